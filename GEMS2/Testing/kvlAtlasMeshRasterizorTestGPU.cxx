@@ -64,6 +64,8 @@ int main( int argc, char* argv[] )
   kvl::AtlasMeshAlphaDrawerCPU::Pointer  referenceAlphaDrawer = kvl::AtlasMeshAlphaDrawerCPU::New();
   referenceAlphaDrawer->SetRegions( image->GetLargestPossibleRegion() );
   referenceAlphaDrawer->SetLabelNumber( 1 );
+  referenceAlphaDrawer->SetSortTetrahedra( false );
+  referenceAlphaDrawer->SetDynamicScheduling( false );
   clock.Reset();
   clock.Start();
   referenceAlphaDrawer->Rasterize( mesh );
@@ -86,6 +88,37 @@ int main( int argc, char* argv[] )
     }  
   std::cout << "Maximum error in alpha drawer: " << maximumAlphaError << std::endl;
   
+  
+  // Incremental rasterization: draw a different label on an unchanged mesh, which should 
+  // reuse the cached voxels and baricentric coordinates of every tetrahedron
+  kvl::AtlasMeshAlphaDrawerCPU::Pointer  incrementalAlphaDrawer = kvl::AtlasMeshAlphaDrawerCPU::New();
+  incrementalAlphaDrawer->SetRegions( image->GetLargestPossibleRegion() );
+  incrementalAlphaDrawer->SetIncremental( true );
+  incrementalAlphaDrawer->SetLabelNumber( 1 );
+  incrementalAlphaDrawer->Rasterize( mesh );
+  incrementalAlphaDrawer->SetLabelNumber( 2 );
+  clock.Reset();
+  clock.Start();
+  incrementalAlphaDrawer->Rasterize( mesh );
+  clock.Stop();
+  std::cout << "Time taken by incremental alpha drawer: " << clock.GetMean() << std::endl;
+  referenceAlphaDrawer->SetLabelNumber( 2 );
+  referenceAlphaDrawer->Rasterize( mesh );
+  itk::ImageRegionConstIteratorWithIndex< kvl::AtlasMeshAlphaDrawerCPU::ImageType >  
+             incrementalAlphaIt( incrementalAlphaDrawer->GetImage(), 
+                                 incrementalAlphaDrawer->GetImage()->GetBufferedRegion() );
+  referenceAlphaIt.GoToBegin();
+  maximumAlphaError = 0.0;
+  for ( ; !incrementalAlphaIt.IsAtEnd(); ++incrementalAlphaIt, ++referenceAlphaIt )
+    {
+    const double  error = std::abs( incrementalAlphaIt.Value() - referenceAlphaIt.Value() );
+    if ( error > maximumAlphaError )
+      {
+      maximumAlphaError = error;
+      }  
+    }  
+  std::cout << "Maximum error in incremental alpha drawer: " << maximumAlphaError << std::endl;
+  
 
   // ===================================================
   //
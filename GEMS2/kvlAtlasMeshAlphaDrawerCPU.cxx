@@ -14,6 +14,9 @@ AtlasMeshAlphaDrawerCPU
 {
   m_LabelNumber = 0;
   m_Image = 0; 
+  
+  // Every voxel is drawn by a single tetrahedron, so the order doesn't matter
+  this->SetDynamicScheduling( true );
 }  
 
 
@@ -69,6 +72,22 @@ AtlasMeshAlphaDrawerCPU
   // Loop over all voxels within the tetrahedron and do The Right Thing  
   TetrahedronInteriorIterator< ImageType::PixelType >  it( m_Image, p0, p1, p2, p3 );
   it.AddExtraLoading( alphaInVertex0, alphaInVertex1, alphaInVertex2, alphaInVertex3 );
+  TetrahedronCache*  cache = this->GetTetrahedronCacheToFill( threadNumber );
+  if ( cache )
+    {
+    // Also remember where we've been for the next time around
+    const ImageType::PixelType*  buffer = m_Image->GetBufferPointer();
+    for ( ; !it.IsAtEnd(); ++it )
+      {
+      it.Value() = it.GetExtraLoadingInterpolatedValue( 0 );
+      cache->m_Offsets.push_back( &( it.Value() ) - buffer );
+      cache->m_Pis.push_back( it.GetPi1() );
+      cache->m_Pis.push_back( it.GetPi2() );
+      cache->m_Pis.push_back( it.GetPi3() );
+      }
+    return true;  
+    }
+  
   for ( ; !it.IsAtEnd(); ++it )
     {
     it.Value() = it.GetExtraLoadingInterpolatedValue( 0 );
@@ -78,5 +97,49 @@ AtlasMeshAlphaDrawerCPU
 }
 
 
+
+//
+//
+//
+bool
+AtlasMeshAlphaDrawerCPU
+::RasterizeCachedTetrahedron( const AtlasMesh* mesh, 
+                              AtlasMesh::CellIdentifier tetrahedronId,
+                              const TetrahedronCache& cache,
+                              int threadNumber )
+{
+  // Only the alphas can have changed
+  AtlasMesh::CellAutoPointer  cell;
+  mesh->GetCell( tetrahedronId, cell );
+
+  AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
+  const AtlasMesh::PointIdentifier  id0 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id1 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id2 = *pit;
+  ++pit;
+  const AtlasMesh::PointIdentifier  id3 = *pit;
+  
+  const float alphaInVertex0 = ( mesh->GetPointData()->ElementAt( id0 ).m_Alphas )[ m_LabelNumber ];
+  const float alphaInVertex1 = ( mesh->GetPointData()->ElementAt( id1 ).m_Alphas )[ m_LabelNumber ];
+  const float alphaInVertex2 = ( mesh->GetPointData()->ElementAt( id2 ).m_Alphas )[ m_LabelNumber ];
+  const float alphaInVertex3 = ( mesh->GetPointData()->ElementAt( id3 ).m_Alphas )[ m_LabelNumber ];
+
+  // alpha = alpha0 * pi0 + alpha1 * pi1 + alpha2 * pi2 + alpha3 * pi3, with pi0 = 1 - pi1 - pi2 - pi3
+  const double  a1 = alphaInVertex1 - alphaInVertex0;
+  const double  a2 = alphaInVertex2 - alphaInVertex0;
+  const double  a3 = alphaInVertex3 - alphaInVertex0;
+  ImageType::PixelType*  buffer = m_Image->GetBufferPointer();
+  for ( size_t voxelNumber = 0; voxelNumber < cache.m_Offsets.size(); voxelNumber++ )
+    {
+    const float*  pis = &( cache.m_Pis[ 3 * voxelNumber ] );
+    buffer[ cache.m_Offsets[ voxelNumber ] ] = alphaInVertex0 + a1 * pis[ 0 ] + a2 * pis[ 1 ] + a3 * pis[ 2 ];
+    }
+    
+  return true;
+}
+
+
   
 } // End namespace kvl
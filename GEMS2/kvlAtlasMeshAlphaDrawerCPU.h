@@ -44,6 +44,7 @@ public :
     m_Image->SetRegions( region );
     m_Image->Allocate();
     m_Image->FillBuffer( 0 );
+    this->ClearTetrahedronCache();
     }
   
   /** */
@@ -60,6 +61,12 @@ protected:
                              AtlasMesh::CellIdentifier tetrahedronId,
                              int threadNumber );
 
+  //
+  bool RasterizeCachedTetrahedron( const AtlasMesh* mesh, 
+                                   AtlasMesh::CellIdentifier tetrahedronId,
+                                   const TetrahedronCache& cache,
+                                   int threadNumber );
+
 private:
   AtlasMeshAlphaDrawerCPU(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
@@ -1,5 +1,8 @@
 #include "kvlAtlasMeshRasterizorCPU.h"
 
+#include <algorithm>
+#include <cmath>
+
 static itk::SimpleFastMutexLock rasterizorMutexCPU;
 
 
@@ -15,6 +18,27 @@ AtlasMeshRasterizorCPU
 ::AtlasMeshRasterizorCPU()
 {
   m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  m_SortTetrahedra = true;
+  m_DynamicScheduling = false;
+  m_Incremental = false;
+  m_IncrementalTolerance = 0.0;
+}
+
+
+
+//
+// Interleave the lower 10 bits of x, y, and z into a 30-bit Morton code
+//
+static unsigned int
+MortonCode( unsigned int x, unsigned int y, unsigned int z )
+{
+  unsigned int  code = 0;
+  for ( int bit = 9; bit >= 0; bit-- )
+    {
+    code = ( code << 3 ) | 
+           ( ( ( x >> bit ) & 1 ) << 2 ) | ( ( ( y >> bit ) & 1 ) << 1 ) | ( ( z >> bit ) & 1 );
+    }
+  return code;
 }
 
 
@@ -31,6 +55,8 @@ AtlasMeshRasterizorCPU
   ThreadStruct  str;
   str.m_Rasterizor = this;
   str.m_Mesh = mesh;
+  str.m_NextTetrahedronNumber = 0;
+  str.m_Abort = false;
   for ( AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
         cellIt != mesh->GetCells()->End(); ++cellIt )
     {
@@ -40,21 +66,179 @@ AtlasMeshRasterizorCPU
       //str.m_TetrahedronIds.insert( cellIt.Index() );
       }
     }
+  const int  numberOfTetrahedra = str.m_TetrahedronIds.size();
+
+  // Estimate how many voxels each tetrahedron is going to cost (the volume of its 
+  // bounding box), and sort the tetrahedra along a Morton curve through their centroids
+  str.m_CumulativeCosts.resize( numberOfTetrahedra + 1 );
+  str.m_CumulativeCosts[ 0 ] = 0.0;
+  if ( m_SortTetrahedra && numberOfTetrahedra > 0 )
+    {
+    std::vector< AtlasMesh::PointType >  centroids( numberOfTetrahedra );
+    std::vector< double >  costs( numberOfTetrahedra );
+    AtlasMesh::PointType  lowerCorner;
+    AtlasMesh::PointType  upperCorner;
+    for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+      {
+      AtlasMesh::CellAutoPointer  cell;
+      mesh->GetCell( str.m_TetrahedronIds[ tetrahedronNumber ], cell );
+      
+      AtlasMesh::PointType  minimum;
+      AtlasMesh::PointType  maximum;
+      AtlasMesh::PointType&  centroid = centroids[ tetrahedronNumber ];
+      centroid.Fill( 0.0 );
+      int  vertexNumber = 0;
+      for ( AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin(); 
+            pit != cell->PointIdsEnd(); ++pit, ++vertexNumber )
+        {
+        AtlasMesh::PointType  p;
+        mesh->GetPoint( *pit, &p );
+        for ( int i = 0; i < 3; i++ )
+          {
+          centroid[ i ] += p[ i ] / 4.0;
+          if ( vertexNumber == 0 || p[ i ] < minimum[ i ] )
+            {
+            minimum[ i ] = p[ i ];
+            }
+          if ( vertexNumber == 0 || p[ i ] > maximum[ i ] )
+            {
+            maximum[ i ] = p[ i ];
+            }
+          }
+        }
+        
+      costs[ tetrahedronNumber ] = 1.0;
+      for ( int i = 0; i < 3; i++ )
+        {
+        costs[ tetrahedronNumber ] *= ( maximum[ i ] - minimum[ i ] + 1.0 );
+        if ( tetrahedronNumber == 0 || centroid[ i ] < lowerCorner[ i ] )
+          {
+          lowerCorner[ i ] = centroid[ i ];
+          }
+        if ( tetrahedronNumber == 0 || centroid[ i ] > upperCorner[ i ] )
+          {
+          upperCorner[ i ] = centroid[ i ];
+          }
+        }
+      }
+      
+    // Sort on ( code, number ) so that the order doesn't depend on the sort implementation
+    std::vector< std::pair< unsigned int, int > >  codes( numberOfTetrahedra );
+    for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+      {
+      unsigned int  quantized[ 3 ];
+      for ( int i = 0; i < 3; i++ )
+        {
+        const double  extent = upperCorner[ i ] - lowerCorner[ i ];
+        quantized[ i ] = ( extent > 0 ) ? 
+           static_cast< unsigned int >( 1023.0 * ( centroids[ tetrahedronNumber ][ i ] - lowerCorner[ i ] ) / extent ) : 0;
+        }
+      codes[ tetrahedronNumber ] = std::make_pair( MortonCode( quantized[ 0 ], quantized[ 1 ], quantized[ 2 ] ),
+                                                   tetrahedronNumber );
+      }
+    std::sort( codes.begin(), codes.end() );
+    
+    const std::vector< AtlasMesh::CellIdentifier >  unsortedTetrahedronIds = str.m_TetrahedronIds;
+    for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+      {
+      const int  oldNumber = codes[ tetrahedronNumber ].second;
+      str.m_TetrahedronIds[ tetrahedronNumber ] = unsortedTetrahedronIds[ oldNumber ];
+      str.m_CumulativeCosts[ tetrahedronNumber + 1 ] = 
+                      str.m_CumulativeCosts[ tetrahedronNumber ] + costs[ oldNumber ];
+      }
+    }
+  else
+    {
+    for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+      {
+      str.m_CumulativeCosts[ tetrahedronNumber + 1 ] = tetrahedronNumber + 1;
+      }
+    }
+    
+  // Look up (or create) the cache entries up front, so that the threads never modify the map
+  if ( m_Incremental )
+    {
+    str.m_Caches.resize( numberOfTetrahedra );
+    for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+      {
+      str.m_Caches[ tetrahedronNumber ] = &( m_TetrahedronCaches[ str.m_TetrahedronIds[ tetrahedronNumber ] ] );
+      }
+    }
 
   // Set up the multithreader
   itk::MultiThreader::Pointer  threader = itk::MultiThreader::New();
   threader->SetNumberOfThreads( this->GetNumberOfThreads() );
   //threader->SetNumberOfThreads( 1 );
   threader->SetSingleMethod( this->ThreaderCallback, &str );
+  if ( m_Incremental )
+    {
+    m_CachesToFill.assign( threader->GetNumberOfThreads(), 0 );
+    }
 
   // Let the beast go
   threader->SingleMethodExecute();
 
+  m_CachesToFill.clear();
   
 }
 
 
 
+//
+//
+//
+bool
+AtlasMeshRasterizorCPU
+::RasterizeTetrahedronNumber( ThreadStruct* str, int tetrahedronNumber, int threadNumber )
+{
+  const AtlasMesh::CellIdentifier  tetrahedronId = str->m_TetrahedronIds[ tetrahedronNumber ];
+  if ( str->m_Caches.empty() )
+    {
+    return this->RasterizeTetrahedron( str->m_Mesh, tetrahedronId, threadNumber );
+    }
+
+  // Incremental mode: check if any vertex has moved too much since we last saw this tetrahedron
+  TetrahedronCache*  cache = str->m_Caches[ tetrahedronNumber ];
+  AtlasMesh::CellAutoPointer  cell;
+  str->m_Mesh->GetCell( tetrahedronId, cell );
+  AtlasMesh::PointType  points[ 4 ];
+  bool  hasMoved = !cache->m_Valid;
+  int  vertexNumber = 0;
+  for ( AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin(); 
+        pit != cell->PointIdsEnd(); ++pit, ++vertexNumber )
+    {
+    str->m_Mesh->GetPoint( *pit, &( points[ vertexNumber ] ) );
+    for ( int i = 0; i < 3; i++ )
+      {
+      if ( std::abs( points[ vertexNumber ][ i ] - cache->m_Points[ vertexNumber ][ i ] ) > m_IncrementalTolerance )
+        {
+        hasMoved = true;
+        }
+      }
+    }
+    
+  if ( !hasMoved )
+    {
+    return this->RasterizeCachedTetrahedron( str->m_Mesh, tetrahedronId, *cache, threadNumber );
+    }
+    
+  // Rasterize from scratch, letting the subclass refill the cache
+  cache->m_Valid = false;
+  cache->m_Offsets.clear();
+  cache->m_Pis.clear();
+  for ( vertexNumber = 0; vertexNumber < 4; vertexNumber++ )
+    {
+    cache->m_Points[ vertexNumber ] = points[ vertexNumber ];
+    }
+  m_CachesToFill[ threadNumber ] = cache;
+  const bool  success = this->RasterizeTetrahedron( str->m_Mesh, tetrahedronId, threadNumber );
+  m_CachesToFill[ threadNumber ] = 0;
+  cache->m_Valid = success;
+  
+  return success;
+}
+
+
 
 //
 //
@@ -68,80 +252,66 @@ AtlasMeshRasterizorCPU
   const int  threadNumber = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->ThreadID;
   const int  numberOfThreads = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->NumberOfThreads;
   ThreadStruct*  str = (ThreadStruct *)(((itk::MultiThreader::ThreadInfoStruct *)(arg))->UserData);
+  const int  numberOfTetrahedra = str->m_TetrahedronIds.size();
 
   
-#if 1  
-  // Compute up-front which tetrahedra this thread should be responsible for. This isn't a 
-  // particularly good way of load-balancing, but it does allow us to get the exact same
-  // round-off errors (by adding many floating-point contributions) every single time we
-  // repeat the same computation on the same computer with the same number of threads.
-  const int  numberOfTetrahedra = str->m_TetrahedronIds.size();
-  const int  numberOfTetrahedraPerThread = 
-          itk::Math::Ceil< int >( static_cast< double >( numberOfTetrahedra ) / numberOfThreads );
-  const int  thisThreadStartNumber =  threadNumber * numberOfTetrahedraPerThread;
-  int  thisThreadEndNumber =  thisThreadStartNumber + numberOfTetrahedraPerThread - 1;
-  if ( thisThreadEndNumber > (numberOfTetrahedra-1) )
-    {
-    thisThreadEndNumber = (numberOfTetrahedra-1);
-    }
-    
-  // Rasterize all tetrahedra assigned to this thread  
-  for ( int tetrahedronNumber = thisThreadStartNumber; 
-        tetrahedronNumber < thisThreadEndNumber; 
-        tetrahedronNumber++ )
+  if ( !str->m_Rasterizor->m_DynamicScheduling )
     {
-    if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, 
-                                                   str->m_TetrahedronIds[ tetrahedronNumber ],
-                                                   threadNumber ) )
+    // Compute up-front which tetrahedra this thread should be responsible for: a contiguous
+    // range with about the same estimated cost as the other threads'. This allows us to get
+    // the exact same round-off errors (by adding many floating-point contributions) every 
+    // single time we repeat the same computation on the same computer with the same number 
+    // of threads.
+    const double  totalCost = str->m_CumulativeCosts.back();
+    const int  thisThreadStartNumber = 
+         std::lower_bound( str->m_CumulativeCosts.begin(), str->m_CumulativeCosts.end() - 1,
+                           totalCost * threadNumber / numberOfThreads ) - str->m_CumulativeCosts.begin();
+    const int  thisThreadEndNumber = ( threadNumber == numberOfThreads - 1 ) ? numberOfTetrahedra :
+         std::lower_bound( str->m_CumulativeCosts.begin(), str->m_CumulativeCosts.end() - 1,
+                           totalCost * ( threadNumber + 1 ) / numberOfThreads ) - str->m_CumulativeCosts.begin();
+
+    // Rasterize all tetrahedra assigned to this thread  
+    for ( int tetrahedronNumber = thisThreadStartNumber; 
+          tetrahedronNumber < thisThreadEndNumber; 
+          tetrahedronNumber++ )
       {
-      // Something wrong with this tetrahedron; abort at least this thread
-      break;
-      }  
+      if ( !str->m_Rasterizor->RasterizeTetrahedronNumber( str, tetrahedronNumber, threadNumber ) )
+        {
+        // Something wrong with this tetrahedron; abort at least this thread
+        break;
+        }  
       
+      }
+      
+    return ITK_THREAD_RETURN_VALUE;
     }
-#else
 
+
+  // Dynamic scheduling: keep grabbing the next chunk of (spatially sorted) tetrahedra
+  const int  chunkSize = 64;
   while ( true )
     { 
     rasterizorMutexCPU.Lock();
+    const int  chunkStartNumber = str->m_NextTetrahedronNumber;
+    str->m_NextTetrahedronNumber += chunkSize;
+    const bool  abort = str->m_Abort;
+    rasterizorMutexCPU.Unlock();
 
     // Check if there is anything left to do
-    if ( str->m_TetrahedronIds.size() == 0 )
+    if ( abort || ( chunkStartNumber >= numberOfTetrahedra ) )
       {
-      rasterizorMutexCPU.Unlock();
       return ITK_THREAD_RETURN_VALUE;
       }
 
-    // Let's define how many tetrahedra this thread is going to take on 
-    const int  numberOfTetrahedra = 100;
-
-    // Pop the first numberOfTetrahedra tetrahedra on the list
-    std::vector< AtlasMesh::CellIdentifier >  thisThreadTetrahedronIds;
-    for ( int i = 0; i < numberOfTetrahedra; i++ )
-      {
-      const AtlasMesh::CellIdentifier  tetrahedronId = *( str->m_TetrahedronIds.begin() );
-      str->m_TetrahedronIds.erase( tetrahedronId );
-      thisThreadTetrahedronIds.push_back( tetrahedronId );
-      if ( str->m_TetrahedronIds.size() == 0 )
-        {
-        break;
-        }
-      }
-
-    rasterizorMutexCPU.Unlock();
-
-
-    
-    for ( std::vector< AtlasMesh::CellIdentifier >::const_iterator  it = thisThreadTetrahedronIds.begin();
-          it != thisThreadTetrahedronIds.end(); ++it )
+    const int  chunkEndNumber = std::min( chunkStartNumber + chunkSize, numberOfTetrahedra );
+    for ( int tetrahedronNumber = chunkStartNumber; tetrahedronNumber < chunkEndNumber; tetrahedronNumber++ )
       {
-      // 
-      if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, *it ) )
+      if ( !str->m_Rasterizor->RasterizeTetrahedronNumber( str, tetrahedronNumber, threadNumber ) )
         {
         // Something wrong with this tetrahedron; abort this thread and 
         // make sure other threads also stop ASAP
         rasterizorMutexCPU.Lock();
-        str->m_TetrahedronIds.clear();
+        str->m_Abort = true;
         rasterizorMutexCPU.Unlock();
           
         return ITK_THREAD_RETURN_VALUE;
@@ -150,8 +320,6 @@ AtlasMeshRasterizorCPU
       }  
 
     } // End infinite loop   
-      
-#endif
     
   
   return ITK_THREAD_RETURN_VALUE;
@@ -162,4 +330,3 @@ AtlasMeshRasterizorCPU
 
 
 } // end namespace kvl
-
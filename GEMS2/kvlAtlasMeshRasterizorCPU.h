@@ -2,6 +2,8 @@
 #define __kvlAtlasMeshRasterizorCPU_h
 
 #include "kvlAtlasMesh.h"
+#include <map>
+#include <vector>
 
 
 
@@ -39,16 +41,119 @@ public:
     return m_NumberOfThreads;
     }
 
+  /** Visit the tetrahedra in Morton order of their centroids, so that consecutive 
+   * tetrahedra touch nearby voxels, and split them over the threads in ranges of
+   * roughly equal estimated voxel count rather than equal tetrahedron count. On 
+   * by default. */
+  void SetSortTetrahedra( bool sortTetrahedra )
+    {
+    m_SortTetrahedra = sortTetrahedra;
+    }
+
+  /** */
+  bool GetSortTetrahedra() const
+    {
+    return m_SortTetrahedra;
+    }
+
+  /** Hand out small chunks of tetrahedra to whichever thread is free, instead of
+   * one fixed range per thread. This balances the load better, but which thread
+   * visits which tetrahedron then changes from run to run, so anything accumulated 
+   * per thread is no longer reproducible down to the round-off errors. Only use it
+   * when each voxel is written by a single tetrahedron. Off by default. */
+  void SetDynamicScheduling( bool dynamicScheduling )
+    {
+    m_DynamicScheduling = dynamicScheduling;
+    }
+
+  /** */
+  bool GetDynamicScheduling() const
+    {
+    return m_DynamicScheduling;
+    }
+
+  /** Remember which voxels each tetrahedron covers, and their baricentric coordinates, 
+   * so that subsequent calls only re-rasterize the tetrahedra that have a vertex that 
+   * moved more than the incremental tolerance (in voxels) since they were last 
+   * rasterized. The others are handled by RasterizeCachedTetrahedron(). With a 
+   * tolerance of zero the result is the same as a full rasterization. Off by default. */
+  void SetIncremental( bool incremental )
+    {
+    m_Incremental = incremental;
+    if ( !incremental )
+      {
+      this->ClearTetrahedronCache();
+      }
+    }
+
+  /** */
+  bool GetIncremental() const
+    {
+    return m_Incremental;
+    }
+
+  /** */
+  void SetIncrementalTolerance( double incrementalTolerance )
+    {
+    m_IncrementalTolerance = incrementalTolerance;
+    }
+
+  /** */
+  double GetIncrementalTolerance() const
+    {
+    return m_IncrementalTolerance;
+    }
+
+  /** Forget all cached tetrahedra, e.g., when the image being rasterized into changes */
+  void ClearTetrahedronCache()
+    {
+    m_TetrahedronCaches.clear();
+    }
+
 protected:
   AtlasMeshRasterizorCPU();
   virtual ~AtlasMeshRasterizorCPU() {};
 
+  /** What is remembered about a tetrahedron in incremental mode */
+  struct TetrahedronCache
+    {
+    TetrahedronCache() : m_Valid( false ) {}
+    
+    bool  m_Valid;
+    AtlasMesh::PointType  m_Points[ 4 ];
+    std::vector< int >  m_Offsets;   // Offsets of the visited voxels in the image buffer
+    std::vector< float >  m_Pis;     // pi1, pi2, and pi3 of each visited voxel
+    };
+
   /** */
   //
   virtual bool RasterizeTetrahedron( const AtlasMesh* mesh, 
                                      AtlasMesh::CellIdentifier tetrahedronId,
                                      int threadNumber=0 ) = 0;
                                      
+  /** Redo whatever RasterizeTetrahedron() does, using the voxels and baricentric
+   * coordinates stored in the cache. Subclasses that fill in the cache in 
+   * RasterizeTetrahedron() (see GetTetrahedronCacheToFill()) should override this; 
+   * the default simply rasterizes again. */
+  virtual bool RasterizeCachedTetrahedron( const AtlasMesh* mesh, 
+                                           AtlasMesh::CellIdentifier tetrahedronId,
+                                           const TetrahedronCache& cache,
+                                           int threadNumber=0 )
+    {
+    return this->RasterizeTetrahedron( mesh, tetrahedronId, threadNumber );
+    }
+
+  /** In incremental mode, the cache entry that RasterizeTetrahedron() should append
+   * the voxels it visits to; 0 otherwise */
+  TetrahedronCache* GetTetrahedronCacheToFill( int threadNumber ) const
+    {
+    if ( m_CachesToFill.empty() )
+      {
+      return 0;
+      }
+    return m_CachesToFill[ threadNumber ];
+    }
+
   /** Static function used as a "callback" by the MultiThreader.  The threading
    * library will call this routine for each thread, which will delegate the
    * control to ThreadedGenerateData(). */
@@ -61,8 +166,14 @@ protected:
     AtlasMesh::ConstPointer  m_Mesh;
     std::vector< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
     //std::set< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
+    std::vector< double >  m_CumulativeCosts;  // Estimated cost of tetrahedra [0...n)
+    std::vector< TetrahedronCache* >  m_Caches;
+    int  m_NextTetrahedronNumber;  // For dynamic scheduling
+    bool  m_Abort;
     };
 
+  /** */
+  bool  RasterizeTetrahedronNumber( ThreadStruct* str, int tetrahedronNumber, int threadNumber );
                                      
 
 private:
@@ -70,6 +181,13 @@ private:
   void operator=(const Self&); //purposely not implemented
   
   int  m_NumberOfThreads;
+  bool  m_SortTetrahedra;
+  bool  m_DynamicScheduling;
+  bool  m_Incremental;
+  double  m_IncrementalTolerance;
+  
+  std::map< AtlasMesh::CellIdentifier, TetrahedronCache >  m_TetrahedronCaches;
+  std::vector< TetrahedronCache* >  m_CachesToFill;
   
 };
 
@@ -37,7 +37,7 @@
 #include <QDebug>
 #include "ProgressCallback.h"
 #include "LayerMRI.h"
-#include "MyUtils.h"
+#include "ThreadSurfaceCorrelation.h"
 
 extern "C"
 {
@@ -62,8 +62,10 @@ SurfaceOverlay::SurfaceOverlay ( LayerSurface* surf ) :
   m_bComputeCorrelation(false),
   m_volumeCorrelationSource(NULL),
   m_fCorrelationSourceData(NULL),
-  m_fCorrelationDataBuffer(NULL)
+  m_nCorrelationSeedKey(-1)
 {
+  m_threadCorrelation = new ThreadSurfaceCorrelation(this);
+  connect(m_threadCorrelation, SIGNAL(CorrelationReady(qint64)), this, SLOT(OnCorrelationReady(qint64)), Qt::QueuedConnection);
   InitializeData();
 
   m_property =  new SurfaceOverlayProperty( this );
@@ -73,6 +75,8 @@ SurfaceOverlay::SurfaceOverlay ( LayerSurface* surf ) :
 
 SurfaceOverlay::~SurfaceOverlay ()
 {
+  m_threadCorrelation->Abort();
+
   if ( m_fDataRaw )
     delete[] m_fDataRaw;
 
@@ -97,9 +101,6 @@ SurfaceOverlay::~SurfaceOverlay ()
 
   if (m_fCorrelationSourceData)
     delete[] m_fCorrelationSourceData;
-
-  if (m_fCorrelationDataBuffer)
-    delete[] m_fCorrelationDataBuffer;
 }
 
 void SurfaceOverlay::InitializeData()
@@ -190,7 +191,8 @@ void SurfaceOverlay::InitializeData(float *data_buffer_in, int nvertices, int nf
     GetProperty()->Reset();
     m_fCorrelationSourceData = new float[nframes];
     memset(m_fCorrelationSourceData, 0, sizeof(float)*nframes);
-    m_fCorrelationDataBuffer = new float[nframes];
+    m_threadCorrelation->SetData(NULL, 0, 0);
+    m_nCorrelationSeedKey = -1;
   }
 }
 
@@ -410,6 +412,7 @@ void SurfaceOverlay::SetActiveFrame(int nFrame)
 void SurfaceOverlay::SetComputeCorrelation(bool flag)
 {
   m_bComputeCorrelation = flag;
+  m_nCorrelationSeedKey = -1;
   if (flag)
   {
     UpdateCorrelationCoefficient();
@@ -424,6 +427,13 @@ void SurfaceOverlay::UpdateCorrelationCoefficient(double* pos_in)
 {
   if (m_bComputeCorrelation)
   {
+    // the time series is z-normalized once, after which a map is one
+    // pass of dot products over it
+    if (!m_threadCorrelation->HasData())
+      m_threadCorrelation->SetData(m_fDataRaw, m_nDataSize, m_nNumOfFrames);
+
+    qint64 nKey = -1;
+    int nVertex = -1;
     if (m_volumeCorrelationSource && m_volumeCorrelationSource->GetNumberOfFrames() == m_nNumOfFrames)
     {
       double pos[3];
@@ -432,34 +442,46 @@ void SurfaceOverlay::UpdateCorrelationCoefficient(double* pos_in)
       m_volumeCorrelationSource->TargetToRAS(pos, pos);
       m_volumeCorrelationSource->RASToOriginalIndex(pos, n);
       m_volumeCorrelationSource->GetVoxelValueByOriginalIndexAllFrames(n[0], n[1], n[2], m_fCorrelationSourceData);
+      // voxel seeds are keyed above all vertex numbers
+      nKey = (Q_INT64_C(1) << 62) | ((qint64)(n[0] & 0xfffff) << 40) |
+             ((qint64)(n[1] & 0xfffff) << 20) | (n[2] & 0xfffff);
     }
     else
     {
-      int nVertex = m_surface->GetCurrentVertex();
+      nVertex = m_surface->GetCurrentVertex();
       if (pos_in)
         nVertex = m_surface->GetVertexIndexAtTarget(pos_in, NULL);
-
-      if (nVertex >= 0)
-      {
-        this->GetDataAtVertex(nVertex, m_fCorrelationSourceData);
-      }
+      if (nVertex < 0)
+        return;
+      nKey = nVertex;
     }
-    for (int i = 0; i < m_nDataSize; i++)
-    {
-      for (int j = 0; j < m_nNumOfFrames; j++)
-      {
-        m_fCorrelationDataBuffer[j] = m_fDataRaw[i+j*m_nDataSize];
-      }
-      m_fData[i] = MyUtils::CalculateCorrelationCoefficient(m_fCorrelationSourceData, m_fCorrelationDataBuffer, m_nNumOfFrames);
-    }
-    memcpy(m_fDataUnsmoothed, m_fData, sizeof(float)*m_nDataSize);
-    if (GetProperty()->GetSmooth())
-      SmoothData();
-    m_surface->UpdateOverlay(true);
-    emit DataUpdated();
+    if (nKey == m_nCorrelationSeedKey)
+      return;
+
+    m_nCorrelationSeedKey = nKey;
+    if (m_threadCorrelation->GetCorrelation(nKey, m_fData))
+      OnCorrelationReady(nKey);
+    else if (nVertex >= 0)
+      m_threadCorrelation->ComputeAtVertex(nVertex);
+    else
+      m_threadCorrelation->Compute(m_fCorrelationSourceData, nKey);
   }
 }
 
+void SurfaceOverlay::OnCorrelationReady(qint64 nSeedKey)
+{
+  // drop maps of seeds the user has already moved away from
+  if (!m_bComputeCorrelation || nSeedKey != m_nCorrelationSeedKey ||
+      !m_threadCorrelation->GetCorrelation(nSeedKey, m_fData))
+    return;
+
+  memcpy(m_fDataUnsmoothed, m_fData, sizeof(float)*m_nDataSize);
+  if (GetProperty()->GetSmooth())
+    SmoothData();
+  m_surface->UpdateOverlay(true);
+  emit DataUpdated();
+}
+
 void SurfaceOverlay::SetCorrelationSourceVolume(LayerMRI *vol)
 {
   if (m_volumeCorrelationSource)
@@ -467,6 +489,8 @@ void SurfaceOverlay::SetCorrelationSourceVolume(LayerMRI *vol)
   m_volumeCorrelationSource = vol;
   if (vol)
     connect(vol, SIGNAL(destroyed(QObject*)), this, SLOT(OnCorrelationSourceDeleted(QObject*)));
+  m_threadCorrelation->ClearCache();
+  m_nCorrelationSeedKey = -1;
   UpdateCorrelationCoefficient();
 }
 
@@ -475,6 +499,7 @@ void SurfaceOverlay::OnCorrelationSourceDeleted(QObject *obj)
   if (m_volumeCorrelationSource == obj)
   {
     m_volumeCorrelationSource = NULL;
+    m_nCorrelationSeedKey = -1;
     UpdateCorrelationCoefficient();
   }
 }
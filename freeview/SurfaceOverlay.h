@@ -42,6 +42,7 @@ class vtkRGBAColorTransferFunction;
 class LayerSurface;
 class LayerMRI;
 class SurfaceOverlayProperty;
+class ThreadSurfaceCorrelation;
 
 class SurfaceOverlay  : public QObject
 {
@@ -156,6 +157,7 @@ public slots:
   void UpdateSmooth(bool trigger_paired = true);
   void UpdateCorrelationCoefficient(double* pos = NULL);
   void OnCorrelationSourceDeleted(QObject* obj);
+  void OnCorrelationReady(qint64 nSeedKey);
   void EmitDataUpdated()
   {
     emit DataUpdated();
@@ -188,7 +190,9 @@ private:
   int       m_nNumOfFrames;
   LayerMRI*  m_volumeCorrelationSource;
   float*    m_fCorrelationSourceData;
-  float*    m_fCorrelationDataBuffer;
+  // computes correlation maps of m_fDataRaw off the GUI thread
+  ThreadSurfaceCorrelation* m_threadCorrelation;
+  qint64    m_nCorrelationSeedKey;
 };
 
 #endif
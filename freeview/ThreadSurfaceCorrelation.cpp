@@ -0,0 +1,261 @@
+/**
+ * @file  ThreadSurfaceCorrelation.cpp
+ * @brief Worker thread computing seed-based correlation maps of a surface time series
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include "ThreadSurfaceCorrelation.h"
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutexLocker>
+#include <math.h>
+#include <string.h>
+
+#define CORRELATION_CACHE_SIZE    16
+#define CORRELATION_BLOCK_SIZE    2048
+
+namespace
+{
+
+// correlation of the vertices in [n0, n1) with a normalized seed. Works
+// on blocks of vertices so that the output block stays in cache while
+// the frames stream by; the inner loop is a contiguous multiply-add the
+// compiler vectorizes.
+class CorrelationTask : public QRunnable
+{
+public:
+  CorrelationTask(const float* zdata, const float* seed, float* output,
+                  int nvertices, int nframes, int n0, int n1) :
+    m_zdata(zdata), m_seed(seed), m_output(output),
+    m_nVertices(nvertices), m_nFrames(nframes), m_n0(n0), m_n1(n1)
+  {}
+
+  void run()
+  {
+    for (int nStart = m_n0; nStart < m_n1; nStart += CORRELATION_BLOCK_SIZE)
+    {
+      int n = qMin(CORRELATION_BLOCK_SIZE, m_n1 - nStart);
+      float* out = m_output + nStart;
+      for (int i = 0; i < n; i++)
+        out[i] = 0;
+      for (int j = 0; j < m_nFrames; j++)
+      {
+        const float* z = m_zdata + (size_t)j*m_nVertices + nStart;
+        const float s = m_seed[j];
+        for (int i = 0; i < n; i++)
+          out[i] += s*z[i];
+      }
+    }
+  }
+
+protected:
+  const float*  m_zdata;
+  const float*  m_seed;
+  float*        m_output;
+  int           m_nVertices;
+  int           m_nFrames;
+  int           m_n0;
+  int           m_n1;
+};
+
+// remove the mean and scale to unit length, so that the correlation of
+// two normalized series is their dot product. Constant series become 0.
+void NormalizeSeries(const float* in, int n, float* out)
+{
+  double mean = 0, ss = 0;
+  for (int i = 0; i < n; i++)
+    mean += in[i];
+  mean /= n;
+  for (int i = 0; i < n; i++)
+    ss += (in[i]-mean)*(in[i]-mean);
+  double scale = (ss > 0 ? 1.0/sqrt(ss) : 0);
+  for (int i = 0; i < n; i++)
+    out[i] = (in[i]-mean)*scale;
+}
+
+}
+
+ThreadSurfaceCorrelation::ThreadSurfaceCorrelation(QObject *parent) :
+  QThread(parent),
+  m_nVertices(0),
+  m_nFrames(0),
+  m_nPendingKey(-1),
+  m_bPending(false),
+  m_bRunning(false),
+  m_bAbort(false)
+{
+  m_cache.setMaxCost(CORRELATION_CACHE_SIZE);
+}
+
+ThreadSurfaceCorrelation::~ThreadSurfaceCorrelation()
+{
+  Abort();
+}
+
+void ThreadSurfaceCorrelation::Abort()
+{
+  m_mutex.lock();
+  m_bAbort = true;
+  m_bPending = false;
+  m_mutex.unlock();
+  wait();
+  m_mutex.lock();
+  m_bAbort = false;
+  m_bRunning = false;
+  m_mutex.unlock();
+}
+
+void ThreadSurfaceCorrelation::SetData(const float *data, int nvertices, int nframes)
+{
+  Abort();
+  ClearCache();
+  m_nVertices = nvertices;
+  m_nFrames = nframes;
+  if (!data || nvertices <= 0 || nframes <= 0)
+  {
+    m_fZData.clear();
+    return;
+  }
+
+  // per-vertex mean and length, accumulated a frame at a time so the
+  // frame-major data is read contiguously
+  QVector<double> mean(nvertices, 0), ss(nvertices, 0);
+  for (int j = 0; j < nframes; j++)
+  {
+    const float* p = data + (size_t)j*nvertices;
+    for (int i = 0; i < nvertices; i++)
+      mean[i] += p[i];
+  }
+  for (int i = 0; i < nvertices; i++)
+    mean[i] /= nframes;
+  for (int j = 0; j < nframes; j++)
+  {
+    const float* p = data + (size_t)j*nvertices;
+    for (int i = 0; i < nvertices; i++)
+      ss[i] += (p[i]-mean[i])*(p[i]-mean[i]);
+  }
+  for (int i = 0; i < nvertices; i++)
+    ss[i] = (ss[i] > 0 ? 1.0/sqrt(ss[i]) : 0);
+
+  m_fZData.resize(nvertices*nframes);
+  float* z = m_fZData.data();
+  for (int j = 0; j < nframes; j++)
+  {
+    const float* p = data + (size_t)j*nvertices;
+    float* zp = z + (size_t)j*nvertices;
+    for (int i = 0; i < nvertices; i++)
+      zp[i] = (p[i]-mean[i])*ss[i];
+  }
+}
+
+void ThreadSurfaceCorrelation::Compute(const float *seed, qint64 nSeedKey)
+{
+  if (m_fZData.isEmpty())
+    return;
+
+  bool bStart = false;
+  m_mutex.lock();
+  m_fPendingSeed.resize(m_nFrames);
+  NormalizeSeries(seed, m_nFrames, m_fPendingSeed.data());
+  m_nPendingKey = nSeedKey;
+  m_bPending = true;
+  if (!m_bRunning)
+  {
+    m_bRunning = true;
+    bStart = true;
+  }
+  m_mutex.unlock();
+
+  if (bStart)
+  {
+    // the previous run may still be returning
+    wait();
+    start();
+  }
+}
+
+void ThreadSurfaceCorrelation::ComputeAtVertex(int nVertex)
+{
+  if (m_fZData.isEmpty() || nVertex < 0 || nVertex >= m_nVertices)
+    return;
+
+  QVector<float> seed(m_nFrames);
+  for (int j = 0; j < m_nFrames; j++)
+    seed[j] = m_fZData[nVertex + j*m_nVertices];
+  Compute(seed.constData(), nVertex);
+}
+
+bool ThreadSurfaceCorrelation::GetCorrelation(qint64 nSeedKey, float *output)
+{
+  QMutexLocker locker(&m_mutex);
+  QVector<float>* r = m_cache.object(nSeedKey);
+  if (!r)
+    return false;
+  memcpy(output, r->constData(), sizeof(float)*r->size());
+  return true;
+}
+
+void ThreadSurfaceCorrelation::ClearCache()
+{
+  QMutexLocker locker(&m_mutex);
+  m_cache.clear();
+}
+
+void ThreadSurfaceCorrelation::ComputeCorrelation(const float *seed, float *output)
+{
+  int nThreads = qMax(1, QThread::idealThreadCount());
+  int nChunk = (m_nVertices + nThreads - 1) / nThreads;
+  QThreadPool pool;
+  pool.setMaxThreadCount(nThreads);
+  for (int n0 = 0; n0 < m_nVertices; n0 += nChunk)
+  {
+    pool.start(new CorrelationTask(m_fZData.constData(), seed, output, m_nVertices, m_nFrames,
+                                   n0, qMin(n0 + nChunk, m_nVertices)));
+  }
+  pool.waitForDone();
+}
+
+void ThreadSurfaceCorrelation::run()
+{
+  QVector<float> seed;
+  qint64 nKey;
+  while (true)
+  {
+    m_mutex.lock();
+    if (!m_bPending || m_bAbort)
+    {
+      m_bRunning = false;
+      m_mutex.unlock();
+      return;
+    }
+    seed = m_fPendingSeed;
+    nKey = m_nPendingKey;
+    m_bPending = false;
+    m_mutex.unlock();
+
+    QVector<float>* result = new QVector<float>(m_nVertices);
+    ComputeCorrelation(seed.constData(), result->data());
+
+    m_mutex.lock();
+    if (m_bAbort)
+    {
+      m_mutex.unlock();
+      delete result;
+      continue;
+    }
+    m_cache.insert(nKey, result);
+    m_mutex.unlock();
+    emit CorrelationReady(nKey);
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * @file  ThreadSurfaceCorrelation.h
+ * @brief Worker thread computing seed-based correlation maps of a surface time series
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#ifndef ThreadSurfaceCorrelation_H
+#define ThreadSurfaceCorrelation_H
+
+#include <QThread>
+#include <QMutex>
+#include <QCache>
+#include <QVector>
+
+// Keeps a z-normalized copy of a frames x vertices time series and
+// computes the correlation of every vertex with a seed time series on
+// demand. Requests that arrive while a map is being computed replace
+// each other, so only the latest seed is computed next. Finished maps
+// are kept in a small LRU cache keyed by seed.
+class ThreadSurfaceCorrelation : public QThread
+{
+  Q_OBJECT
+public:
+  explicit ThreadSurfaceCorrelation(QObject *parent = 0);
+  ~ThreadSurfaceCorrelation();
+
+  // data is frame-major: data[vertex + frame*nvertices]
+  void SetData(const float* data, int nvertices, int nframes);
+
+  bool HasData()
+  {
+    return !m_fZData.isEmpty();
+  }
+
+  // seed key -1 means the seed is not cached
+  void Compute(const float* seed, qint64 nSeedKey);
+
+  void ComputeAtVertex(int nVertex);
+
+  // copies a cached map into output, returns false if it is not cached
+  bool GetCorrelation(qint64 nSeedKey, float* output);
+
+  void ClearCache();
+
+  void Abort();
+
+signals:
+  void CorrelationReady(qint64 nSeedKey);
+
+protected:
+  void run();
+
+  void ComputeCorrelation(const float* seed, float* output);
+
+  QVector<float>  m_fZData;
+  int             m_nVertices;
+  int             m_nFrames;
+
+  QMutex          m_mutex;
+  QVector<float>  m_fPendingSeed;
+  qint64          m_nPendingKey;
+  bool            m_bPending;
+  bool            m_bRunning;
+  bool            m_bAbort;
+  QCache<qint64, QVector<float> > m_cache;
+};
+
+#endif // ThreadSurfaceCorrelation_H
@@ -96,6 +96,7 @@ SOURCES += \
     TermWidget.cpp \
     ThreadBuildContour.cpp \
     ThreadIOWorker.cpp \
+    ThreadSurfaceCorrelation.cpp \
     ToolWindowEdit.cpp \
     ToolWindowMeasure.cpp \
     ToolWindowROIEdit.cpp \
@@ -254,6 +255,7 @@ HEADERS  += \
     TermWidget.h \
     ThreadBuildContour.h \
     ThreadIOWorker.h \
+    ThreadSurfaceCorrelation.h \
     ToolWindowEdit.h \
     ToolWindowMeasure.h \
     ToolWindowROIEdit.h \
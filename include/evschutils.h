@@ -118,6 +118,37 @@ MATRIX *EVSfirXtXIdeal(int nEvTypes, int *nEvReps, float *EvDur,
                        float PSDMin, float PSDMax, float dPSD);
 int EVSrefractory(EVSCH *sch, double alpha, double T, double dtmin);
 
+/* Random numbers for schedule synthesis. Each thread can be given its
+   own generator with EVSsrand48(); unseeded threads use drand48(). */
+void   EVSsrand48(long seed);
+double EVSdrand48(void);
+
+/* Evaluates FIR designs from the event onsets without forming the
+   design matrix. Allocate one per thread. */
+typedef struct
+{
+  int    nEvTypes, Ntp, nPSD, RSR;
+  float  TR, PSDMin, dPSD;
+  int    nTask, nNuis, nAvgs; /* columns of X = [Xfir Xnuis] */
+  int    J;                   /* rows of the contrast */
+  double *C;                  /* J x nAvgs */
+  double *Xnuis;              /* Ntp x nNuis */
+  double *NtN;                /* nNuis x nNuis */
+  double *XtX;                /* nAvgs x nAvgs, set by EVSfirEvalXtX() */
+  double *L;                  /* Cholesky factor of XtX */
+  double *y, *VRF;
+  int    *nhits, *hitcol;     /* non-zero entries in each row of Xfir */
+  double *hitw;
+}
+EVS_FIR_EVAL;
+
+EVS_FIR_EVAL *EVSfirEvalAlloc(int nEvTypes, float TR, int Ntp,
+                              float PSDMin, float PSDMax, float dPSD,
+                              MATRIX *Xnuis, MATRIX *C);
+int EVSfirEvalFree(EVS_FIR_EVAL **ppfe);
+int EVSfirEvalXtX(EVS_FIR_EVAL *fe, EVSCH *EvSch);
+int EVSfirEvalStats(EVS_FIR_EVAL *fe, EVSCH *EvSch);
+
 #endif //#ifndef EVSCHUTILS_H
 
 
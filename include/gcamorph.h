@@ -274,6 +274,24 @@ int       GCAMwrite( const GCA_MORPH *gcam, const char *fname );
 int       GCAMwriteInverse(const char *gcamfname, GCA_MORPH *gcam);
 int       GCAMwriteInverseNonTal(const char *gcamfname, GCA_MORPH *gcam);
 GCA_MORPH *GCAMread(const char *fname) ;
+
+/* node fields that GCAMreadPartial can restrict loading to */
+#define GCAM_FIELD_ORIG      0x01   /* origx, origy, origz */
+#define GCAM_FIELD_POSITION  0x02   /* x, y, z */
+#define GCAM_FIELD_NODE      0x04   /* xn, yn, zn */
+#define GCAM_FIELD_LABEL     0x08
+#define GCAM_FIELD_ALL       0x0f
+GCA_MORPH *GCAMreadPartial(const char *fname, int fields, MRI_REGION *box) ;
+
+/* layout written by GCAMwrite: the legacy interleaved gzip stream
+   (default), or per-field arrays in independently compressed chunks,
+   optionally delta coded. FS_M3Z_FORMAT (legacy|chunked|delta) selects
+   it if GCAMsetM3zFormat has not been called. GCAMread reads all three. */
+#define GCAM_M3Z_LEGACY         0
+#define GCAM_M3Z_CHUNKED        1
+#define GCAM_M3Z_CHUNKED_DELTA  2
+int GCAMsetM3zFormat(int format) ;
+int GCAMgetM3zFormat(void) ;
 GCA_MORPH *GCAMreadAndInvert(const char *gcamfname);
 GCA_MORPH *GCAMreadAndInvertNonTal(const char *gcamfname);
 int       GCAMfree(GCA_MORPH **pgcam) ;
@@ -339,6 +357,12 @@ MRI       *GCAMbuildMostLikelyVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildLabelVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri) ;
 int       GCAMinvert(GCA_MORPH *gcam, MRI *mri) ;
+#define GCAM_INVERT_SPLAT     0  // splat nodes and soap bubble (default)
+#define GCAM_INVERT_SCAN      1  // parallel scan conversion of the lattice
+int       GCAMsetInvertMode(int mode, int niter) ;
+int       GCAMinvertScan(GCA_MORPH *gcam, MRI *mri, int niter) ;
+int       GCAMinvertCached(GCA_MORPH *gcam, MRI *mri, const char *gcamfname) ;
+int       GCAMinverseResidual(GCA_MORPH *gcam, double *pmean, double *pmax, int *pnvox) ;
 GCA_MORPH* GCAMfillInverse(GCA_MORPH* gcam);
 int       GCAMfreeInverse(GCA_MORPH *gcam) ;
 int       GCAMcomputeMaxPriorLabels(GCA_MORPH *gcam) ;
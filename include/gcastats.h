@@ -0,0 +1,114 @@
+/**
+ * @file  gcastats.h
+ * @brief mergeable sufficient statistics for training a GCA
+ *
+ * Accumulates everything GCAtrain and GCAtrainCovariances collect (prior
+ * label counts, per node and label sample counts, intensity sums and sums
+ * of outer products, neighbor label co-occurrence counts) in a single pass
+ * over each subject. Statistics of disjoint sets of subjects can be
+ * written to disk, merged and only then turned into a GCA, so that
+ * training can be spread over several processes or machines.
+ *
+ * Reference:
+ * "Whole Brain Segmentation: Automated Labeling of Neuroanatomical
+ * Structures in the Human Brain", Fischl et al.
+ * (2002) Neuron, 33:341-355.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+
+#ifndef GCASTATS_H
+#define GCASTATS_H
+
+#include "gca.h"
+#include "transform.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* values of the hole field */
+#define GCA_STATS_NO_HOLE        0
+#define GCA_STATS_HOLE           1   // prior hole sample with intensities
+#define GCA_STATS_HOLE_NOINT     2   // prior hole sample from a -noint subject
+
+typedef struct
+{
+  unsigned short label ;
+  int     ntraining ;       // # of samples (not counting the hole sample)
+  int     n_just_priors ;   // # of those without intensity information
+  double  *sums ;           // sum of the intensities of the samples
+  int     ncov ;            // # of samples in the covariance moments
+  double  *cov_sums ;       // sum of the covariance samples
+  double  *cov_prods ;      // sum of their outer products (upper triangle)
+  short   nlabels[GIBBS_NEIGHBORHOOD] ;
+  short   max_labels[GIBBS_NEIGHBORHOOD] ;
+  unsigned short *labels[GIBBS_NEIGHBORHOOD] ;
+  int     *counts[GIBBS_NEIGHBORHOOD] ;   // neighbor label co-occurrences
+
+  /* GCAtrain fills a prior hole by adding a sample for a label only if
+     the node has no classifier for it yet, which depends on the subjects
+     seen before. The sample is kept apart so a merge can drop it when an
+     earlier subject turns out to have the label at this node. */
+  char    hole ;
+  float   *hole_vals ;
+  unsigned short hole_nbrs[GIBBS_NEIGHBORHOOD] ;
+}
+GCA_LABEL_STATS ;
+
+typedef struct
+{
+  int              nlabels ;
+  int              max_labels ;
+  GCA_LABEL_STATS  *ls ;   // in order of first appearance
+}
+GCA_NODE_STATS ;
+
+typedef struct
+{
+  GCA             *gca ;        // geometry, and the prior label counts
+  int             ninputs ;
+  int             ncovars ;
+  int             node_width ;
+  int             node_height ;
+  int             node_depth ;
+  GCA_NODE_STATS  ***nodes ;
+}
+GCA_STATS ;
+
+/* gca supplies the geometry and is owned by the stats from then on */
+GCA_STATS *GCAstatsAlloc(GCA *gca) ;
+int       GCAstatsFree(GCA_STATS **pgs) ;
+
+/* one subject's contribution, equivalent to GCAtrain followed (unless
+   noint) by GCAtrainCovariances */
+int       GCAstatsTrain(GCA_STATS *gs, MRI *mri_inputs, MRI *mri_labels,
+                        TRANSFORM *transform, int noint) ;
+
+/* add the subjects of gs_src, which must come after those already in
+   gs_dst in the training order */
+int       GCAstatsMerge(GCA_STATS *gs_dst, GCA_STATS *gs_src) ;
+
+int       GCAstatsWrite(GCA_STATS *gs, const char *fname) ;
+GCA_STATS *GCAstatsRead(const char *fname) ;
+
+/* completes training and returns the GCA. The stats are left without
+   one and can only be freed afterwards. */
+GCA       *GCAstatsCompleteTraining(GCA_STATS *gs) ;
+
+#if defined(__cplusplus)
+};
+#endif
+
+#endif
@@ -69,6 +69,19 @@ typedef struct
   MATRIX *p;
 } GTM_CONTRAST, GTMCON;
 
+/* Sparse GTM design matrix stored by column. Each column (seg) is only
+   nonzero near the seg, so only the entries inside its bounding box
+   are kept. Rows are mask voxels in the same order as GTMvol2mat(). */
+typedef struct 
+{
+  int nrows, ncols;
+  int *nnz;     // number of stored entries in each column
+  int **row;    // 0-based row of each entry, ascending
+  float **val;  // value of each entry
+  int *rowmin, *rowmax; // first and last stored row of each column
+  MRI_REGION *region;   // voxel bounding box of each column
+} GTM_SPARSE;
+
 typedef struct 
 {
   int nrad;
@@ -121,7 +134,7 @@ typedef struct
   MATRIX *ttpct; // percent of the signal in each seg from each tt
 
   // GLM stuff for GTM
-  MATRIX *X,*X0;
+  GTM_SPARSE *X,*X0; // design matrix with and without PSF
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance, all vox and only GM
   MATRIX *som; // spillover matrix
@@ -215,6 +228,14 @@ int GTMprintReplaceList(FILE *fp, const int nReplace, const int *ReplaceThis, co
 int GTMcheckReplaceList(const int nReplace, const int *ReplaceThis, const int *WithThat);
 int GTMloadReplacmentList(const char *fname, int *nReplace, int *ReplaceThis, int *WithThat);
 int GTMcheckX(MATRIX *X);
+GTM_SPARSE *GTMsparseAlloc(int nrows, int ncols);
+int GTMsparseFree(GTM_SPARSE **pX);
+MATRIX *GTMsparseMtM(GTM_SPARSE *X, MATRIX *XtX);
+MATRIX *GTMsparseMtN(GTM_SPARSE *A, GTM_SPARSE *B, MATRIX *AtB);
+MATRIX *GTMsparseMtY(GTM_SPARSE *X, MATRIX *y, MATRIX *Xty);
+MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *beta, MATRIX *Xbeta);
+MATRIX *GTMsparseToDense(GTM_SPARSE *X, MATRIX *D);
+int *GTMrow2nthseg(GTM *gtm);
 int GTMautoMask(GTM *gtm);
 int GTMrvarGM(GTM *gtm);
 int GTMttest(GTM *gtm);
@@ -237,9 +237,9 @@ typedef struct
   MATRIX *bvals, *bvecs;
   int bvec_space; // 0=unknown, 1=scanner, 2=voxel
 
-  // "Chunking" memory management. "Chunking" is where the entire 4D
-  // volume is allocated one big buffer.
-  int    ischunked; // 1 means alloc is one big chunk
+  // "Chunking" memory management. The entire 4D volume is always
+  // allocated as one big buffer that slices[][] point into.
+  int    ischunked; // 1 means MRIgetVoxVal() etc. address the chunk directly
   void   *chunk; // pointer to the one big chunk of buffer
   size_t    bytes_per_vox; // # bytes per voxels
   size_t    bytes_per_row; // # bytes per row
@@ -315,6 +315,9 @@ inline int    MRIsetVoxVal(MRI *mri, int c, int r, int s, int f, float voxval);
 inline void   MRIdbl2ptr(double v, void *pmric, int mritype);
 inline double MRIptr2dbl(void *pmric, int mritype);
 #endif
+/* whole rows at a time, one type dispatch per row (see MRIgetVoxValRow) */
+int    MRIgetVoxValRow(const MRI *mri, int r, int s, int f, float *vals);
+int    MRIsetVoxValRow(MRI *mri, int r, int s, int f, const float *vals);
 size_t MRIsizeof(int mritype);
 
 char * MRIprecisionString(int PrecisionCode);
@@ -1296,6 +1299,8 @@ MRI *MRIreadEx(const char *fname, int nthframe);
 MRI *MRIreadType(const char *fname, int type);
 MRI *MRIreadInfo(const char *fname);
 MRI *MRIreadHeader(const char *fname, int type);
+MRI *MRIreadRegion(const char *fname, const MRI_REGION *box,
+                   const int *frames, int nframes);
 int GetSPMStartFrame(void);
 int MRIwrite(MRI *mri,const  char *fname);
 int MRIwriteFrame(MRI *mri,const  char *fname, int frame) ;
@@ -1446,6 +1451,18 @@ MRI *MRIconformSliceOrder(MRI *mri);
     Please use MRIextractDistanceMap in fastmarching.h instead */
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist,
                           int label, float max_dist, int mode, MRI *mri_mask);
+
+/* engines for MRIdistanceTransform: fast marching (approximate, geodesic
+   within mri_mask) or the exact separable Euclidean distance transform.
+   The default can also be set with the environment variable
+   FS_DTRANS_ENGINE=edt */
+#define DTRANS_ENGINE_FASTMARCHING 0
+#define DTRANS_ENGINE_EDT          1
+int MRIsetDistanceTransformEngine(int engine) ;
+int MRIgetDistanceTransformEngine(void) ;
+MRI *MRIdistanceTransformEDT(MRI *mri_src, MRI *mri_dist,
+                             int label, float max_dist, int mode,
+                             MRI *mri_mask) ;
 int MRIaddCommandLine(MRI *mri, char *cmdline) ;
 MRI *MRInonMaxSuppress(MRI *mri_src, MRI *mri_sup,
                        float thresh, int thresh_dir) ;
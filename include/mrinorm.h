@@ -130,6 +130,17 @@ MRI *MRI3dGentleNormalize(MRI *mri_src, MRI *mri_bias, float wm_target,
 MRI *MRIbuildVoronoiDiagram(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst);
 MRI *MRIsoapBubble(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst,int niter, float min_change);
 MRI *MRIsoapBubbleExpand(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst,int niter);
+
+/* solver used by MRIsoapBubble: Jacobi sweeps (default) or multigrid
+   preconditioned CG, which converges to the same fixed point. The
+   FS_SOAP_ENGINE environment variable (jacobi|multigrid) selects it if
+   MRIsetSoapBubbleEngine has not been called. */
+#define SOAP_ENGINE_JACOBI     0
+#define SOAP_ENGINE_MULTIGRID  1
+int MRIsetSoapBubbleEngine(int engine) ;
+int MRIgetSoapBubbleEngine(void) ;
+MRI *MRIsoapBubbleMultigrid(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst,
+                            int max_iter, float min_change) ;
 int MRI3dUseFileControlPoints(MRI *mri,const char *fname) ;
 int MRI3dUseLabelControlPoints(MRI *mri, LABEL *area) ;
 int MRI3dWriteControlPoints(char *control_volume_fname) ;
@@ -0,0 +1,82 @@
+/**
+ * @file  mrisbvh.h
+ * @brief bounding volume hierarchy over surface triangles
+ *
+ * Exact closest-point-on-surface queries. The tree is built over the
+ * unripped faces of a surface using one of its vertex coordinate sets
+ * (CURRENT_VERTICES, WHITE_VERTICES, PIAL_VERTICES, ...) and returns the
+ * closest face together with the barycentric coordinates of the closest
+ * point in it. The tree is read-only once built, so queries can be made
+ * from several threads at once.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+
+#ifndef MRISBVH_H
+#define MRISBVH_H
+
+#include "mrisurf.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct
+{
+  float  bmin[3] ;   // bounding box of the triangles below this node
+  float  bmax[3] ;
+  int    first ;     // leaf: first triangle, interior: index of right child
+  int    nfaces ;    // # of triangles in a leaf, 0 for interior nodes
+} MRIS_BVH_NODE ;
+
+typedef struct
+{
+  int            which ;   // vertex coordinates the tree was built from
+  int            nfaces ;  // # of triangles in the tree
+  int            *fno ;    // face # of each triangle, in leaf order
+  float          *tri ;    // 9 coordinates per triangle, in leaf order
+  int            nnodes ;
+  MRIS_BVH_NODE  *nodes ;  // nodes[0] is the root, left child follows parent
+} MRIS_BVH ;
+
+typedef struct
+{
+  int    fno ;      // closest face, -1 if there is none within max_dist
+  float  bary[3] ;  // weights of faces[fno].v[0..2] at the closest point
+  float  x, y, z ;  // the closest point
+  float  dist ;     // its distance from the query point
+} MRIS_CLOSEST_POINT ;
+
+MRIS_BVH *MRISbvhAlloc(MRI_SURFACE *mris, int which) ;
+int      MRISbvhFree(MRIS_BVH **pbvh) ;
+
+/* closest point on the surface to (x,y,z). Only points closer than
+   max_dist are considered (max_dist <= 0 for no limit). Returns the
+   face # or -1, in which case cp->dist is max_dist. */
+int      MRISbvhClosestPoint(MRIS_BVH *bvh, float x, float y, float z,
+                             float max_dist, MRIS_CLOSEST_POINT *cp) ;
+
+/* closest points to every vertex of mris (coordinates taken from which),
+   computed in parallel. cps must have mris->nvertices entries; ripped
+   vertices get fno = -1. Returns the # of vertices with no point within
+   max_dist. */
+int      MRISbvhClosestVertexPoints(MRIS_BVH *bvh, MRI_SURFACE *mris,
+                                    int which, float max_dist,
+                                    MRIS_CLOSEST_POINT *cps) ;
+
+#if defined(__cplusplus)
+};
+#endif
+
+#endif
@@ -705,6 +705,9 @@ int MRISfindClosestWhiteVertex(MRI_SURFACE *mris, float x, float y,
 int MRISfindClosestVertex(MRI_SURFACE *mris,
                           float x, float y, float z,
                           float *dmin);
+MRI *MRISnearestVertexField(MRI_SURFACE *mris, MRI *mri_template,
+                            MATRIX *vox2surf, double band, double exact_band,
+                            MRI **pmri_dist) ;
 double MRIScomputeSSE(MRI_SURFACE *mris, INTEGRATION_PARMS *parms) ;
 double MRIScomputeSSEExternal(MRI_SURFACE *mris, INTEGRATION_PARMS *parms,
                               double *ext_sse) ;
@@ -1186,6 +1189,8 @@ int   MRISmeasureCorticalThickness(MRI_SURFACE *mris, MRI *mri_brain,
 int   MRISmeasureCorticalThickness(MRI_SURFACE *mris, int nbhd_size,
                                    float max_thickness) ;
 #endif
+int   MRISmeasureCorticalThicknessExact(MRI_SURFACE *mris,
+                                        float max_thickness) ;
 
 #include "mrishash.h"
 int  MRISmeasureThicknessFromCorrespondence(MRI_SURFACE *mris, MHT *mht, float max_thick) ;
@@ -1534,6 +1539,13 @@ MRI   *MRISaccentuate(MRI *mri_src,
 MRI *MRISfillInterior(MRI_SURFACE *mris,
                       double resolution,
                       MRI *mri_interior) ;
+MRI *MRISfillInteriorShell(MRI_SURFACE *mris,
+                           double resolution,
+                           MRI *mri_interior) ;
+MRI *MRISfillInteriorScanline(MRI_SURFACE *mris,
+                              MATRIX *sras2vox,
+                              int nsub,
+                              MRI *mri_dst) ;
 int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp);
 MRI   *MRISshell(MRI *mri_src,
                  MRI_SURFACE *mris,
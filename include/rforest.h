@@ -63,6 +63,23 @@ typedef struct
   NODE **leaves ;
 } TREE ;
 
+// flattened copy of the forest used for inference. Nodes of all trees are
+// stored in contiguous arrays; child[n] is the index of the left child of
+// node n (the right child is child[n]+1), or -(leaf+1) if n is a leaf.
+typedef struct
+{
+  int    nnodes ;
+  int    nleaves ;
+  int    nclasses ;
+  int    ntrees ;
+  int    *roots ;          // index of the root node of each tree
+  int    *active ;         // 0 if a single class has all the counts of a tree
+  int    *feature ;        // feature index tested at each node
+  double *thresh ;         // go left if feature < thresh
+  int    *child ;
+  double *leaf_counts ;    // nleaves x nclasses table of leaf class counts
+} RF_COMPILED ;
+
 typedef struct
 {
   int    nfeatures ;
@@ -84,6 +101,7 @@ typedef struct
   char   **feature_names ;   // for diags
   double max_class_ratio ;  // don't let there be way more of one class than another
   double *pvals ;           // classification probabilities
+  RF_COMPILED *compiled ;   // flattened trees for fast inference (may be NULL)
 } RANDOM_FOREST, RF ;
 
 RANDOM_FOREST *RFalloc(int ntrees, int nfeatures, int nclasses, int max_depth,
@@ -100,5 +118,8 @@ int  RFsetNumberOfClasses(RANDOM_FOREST *rf, int nlabels) ;
 int  RFevaluateFeatures(RANDOM_FOREST *rf, FILE *fp) ;
 int  RFfree(RANDOM_FOREST **prf) ;
 int  RFpruneTree(RANDOM_FOREST *rf, int min_training_samples) ;
+int  RFcompile(RANDOM_FOREST *rf) ;
+int  RFfreeCompiled(RANDOM_FOREST *rf) ;
+int  RFclassifyBatch(RANDOM_FOREST *rf, double *features, int nsamples, int *classes, double *pvals) ;
 
 #endif
@@ -90,6 +90,9 @@ SCS *sclustPruneByCWPval(SCS *ClusterList, int nclusters,
 int sclustAnnot(MRIS *surf, int NClusters);
 int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh, 
 		     int shape, int vtxno, int *vtxlist);
+int sclustThresholdSweep(MRI_SURFACE *Surf, int thsign, int nthresh,
+                         const double *thresh, int *nClusters,
+                         double *MaxArea, int *MaxCount, double *MaxWeightVtx);
 const char *sculstSrcVersion(void);
 
 #endif
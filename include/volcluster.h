@@ -119,6 +119,31 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
 int clustMaxClusterCount(VOLCLUSTER **VolClustList, int nClusters);
 int clustDumpSummary(FILE *fp,VOLCLUSTER **VolClustList, int nClusters);
 
+/*----------------------------------------------------------*/
+/* Flat-array union-find for connected components. parent[n] < 0
+   means element n has not been added. When stats are kept, nmembers,
+   size and weight are only valid at the root of each component. */
+typedef struct
+{
+  int n;
+  int *parent;
+  int *nmembers;
+  double *size;   // area (surface) or volume (mm3) of each component
+  double *weight; // sum of the values in each component
+}
+CLUSTER_UF;
+
+CLUSTER_UF *clustUFalloc(int n, int KeepStats);
+int clustUFfree(CLUSTER_UF **puf);
+int clustUFadd(CLUSTER_UF *uf, int a, double size, double weight);
+int clustUFfind(CLUSTER_UF *uf, int a);
+int clustUFunion(CLUSTER_UF *uf, int a, int b);
+int clustLabelComponents(MRI *vol, int frame, float thmin, float thmax,
+                         int thsign, MRI *binmask, int AllowDiag, int *label);
+int clustThresholdSweep(MRI *vol, int frame, int thsign, MRI *binmask,
+                        int AllowDiag, int nthresh, const double *thresh,
+                        int *nClusters, int *MaxCount, double *MaxWeight);
+
 /*----------------------------------------------------------*/
 typedef struct
 {
@@ -118,6 +118,10 @@ static float hashres = 16;
 static int normal_smoothing_iterations = 10 ;
 int crsTest = 0, ctest=0, rtest=0, stest=0;
 int UseHash = 1;
+int UseVtxField = 0;
+static float vtxfield_exact = 5;
+static MRI *lhwhite_vno, *lhpial_vno, *rhwhite_vno, *rhpial_vno;
+static MRI *lhwhite_dvno, *lhpial_dvno, *rhwhite_dvno, *rhpial_dvno;
 
 char *CtxSegFile = NULL;
 MRI *CtxSeg = NULL;
@@ -336,18 +340,21 @@ int main(int argc, char **argv)
   }
 
 
-  printf("\n");
-  printf("Building hash of lh white\n");
-  lhwhite_hash = MHTfillVertexTableRes(lhwhite, NULL,CURRENT_VERTICES,hashres);
-  printf("\n");
-  printf("Building hash of lh pial\n");
-  lhpial_hash = MHTfillVertexTableRes(lhpial, NULL,CURRENT_VERTICES,hashres);
-  printf("\n");
-  printf("Building hash of rh white\n");
-  rhwhite_hash = MHTfillVertexTableRes(rhwhite, NULL,CURRENT_VERTICES,hashres);
-  printf("\n");
-  printf("Building hash of rh pial\n");
-  rhpial_hash = MHTfillVertexTableRes(rhpial, NULL,CURRENT_VERTICES,hashres);
+  if (!UseVtxField || crsTest)
+  {
+    printf("\n");
+    printf("Building hash of lh white\n");
+    lhwhite_hash = MHTfillVertexTableRes(lhwhite, NULL,CURRENT_VERTICES,hashres);
+    printf("\n");
+    printf("Building hash of lh pial\n");
+    lhpial_hash = MHTfillVertexTableRes(lhpial, NULL,CURRENT_VERTICES,hashres);
+    printf("\n");
+    printf("Building hash of rh white\n");
+    rhwhite_hash = MHTfillVertexTableRes(rhwhite, NULL,CURRENT_VERTICES,hashres);
+    printf("\n");
+    printf("Building hash of rh pial\n");
+    rhpial_hash = MHTfillVertexTableRes(rhpial, NULL,CURRENT_VERTICES,hashres);
+  }
 
   /* ------ Load ASeg ------ */
   sprintf(tmpstr,"%s/%s/mri/%s.mgz",SUBJECTS_DIR,subject,asegname);
@@ -426,6 +433,22 @@ int main(int argc, char **argv)
   RAS = MatrixAlloc(4,1,MATRIX_REAL);
   RAS->rptr[4][1] = 1;
 
+  if (UseVtxField)
+  {
+    // Closest vertex of each surface for every voxel within hashres
+    // mm, which is as far as the hash search looks
+    printf("Building nearest-vertex fields (exact within %g mm)\n",
+           vtxfield_exact);
+    lhwhite_vno = MRISnearestVertexField(lhwhite, ASeg, Vox2RAS, hashres,
+                                         vtxfield_exact, &lhwhite_dvno);
+    lhpial_vno = MRISnearestVertexField(lhpial, ASeg, Vox2RAS, hashres,
+                                        vtxfield_exact, &lhpial_dvno);
+    rhwhite_vno = MRISnearestVertexField(rhwhite, ASeg, Vox2RAS, hashres,
+                                         vtxfield_exact, &rhwhite_dvno);
+    rhpial_vno = MRISnearestVertexField(rhpial, ASeg, Vox2RAS, hashres,
+                                        vtxfield_exact, &rhpial_dvno);
+  }
+
   if (crsTest)
   {
     printf("Testing point %d %d %d\n",ctest,rtest,stest);
@@ -643,7 +666,26 @@ int main(int argc, char **argv)
 
         // Get the index of the closest vertex in the
         // lh.white, lh.pial, rh.white, rh.pial
-        if (UseHash)
+        if (UseVtxField)
+        {
+          lhwvtx = MRIgetVoxVal(lhwhite_vno,c,r,s,0);
+          lhpvtx = MRIgetVoxVal(lhpial_vno,c,r,s,0);
+          rhwvtx = MRIgetVoxVal(rhwhite_vno,c,r,s,0);
+          rhpvtx = MRIgetVoxVal(rhpial_vno,c,r,s,0);
+          dlhw = MRIgetVoxVal(lhwhite_dvno,c,r,s,0);
+          dlhp = MRIgetVoxVal(lhpial_dvno,c,r,s,0);
+          drhw = MRIgetVoxVal(rhwhite_dvno,c,r,s,0);
+          drhp = MRIgetVoxVal(rhpial_dvno,c,r,s,0);
+          if (lhwvtx < 0 && lhpvtx < 0 && rhwvtx < 0 && rhpvtx < 0)
+          {
+            lhwvtx = MRISfindClosestVertex(lhwhite,vtx.x,vtx.y,vtx.z,&dlhw);
+            lhpvtx = MRISfindClosestVertex(lhpial,vtx.x,vtx.y,vtx.z,&dlhp);
+            rhwvtx = MRISfindClosestVertex(rhwhite,vtx.x,vtx.y,vtx.z,&drhw);
+            rhpvtx = MRISfindClosestVertex(rhpial,vtx.x,vtx.y,vtx.z,&drhp);
+            nbrute ++;
+          }
+        }
+        else if (UseHash)
         {
           lhwvtx = MHTfindClosestVertexNo(lhwhite_hash,lhwhite,&vtx,&dlhw);
           lhpvtx = MHTfindClosestVertexNo(lhpial_hash, lhpial, &vtx,&dlhp);
@@ -1268,6 +1310,20 @@ static int parse_commandline(int argc, char **argv)
     {
       UseHash = 0;
     }
+    else if (!strcasecmp(option, "--vtxfield"))
+    {
+      UseVtxField = 1;
+    }
+    else if (!strcmp(option, "--vtxfield-exact"))
+    {
+      if (nargc < 1)
+      {
+        argnerr(option,1);
+      }
+      sscanf(pargv[0],"%f",&vtxfield_exact);
+      UseVtxField = 1;
+      nargsused = 1;
+    }
     else if (!strcmp(option, "--sd"))
     {
       if (nargc < 1)
@@ -1510,6 +1566,10 @@ static void dump_options(FILE *fp)
     printf("dmaxctx %f\n",dmaxctx);
   }
   fprintf(fp,"RipUnknown %d\n",RipUnknown);
+  if (UseVtxField)
+  {
+    fprintf(fp,"vtxfield exact within %f\n",vtxfield_exact);
+  }
   if (CtxSegFile)
   {
     fprintf(fp,"CtxSeg %s\n",CtxSegFile);
@@ -251,7 +251,7 @@ int nsmoothsurf=0;
 int main(int argc, char *argv[]) {
   int nargs, c, r, s, nhits, InMask, n, mriType,nvox;
   int fstart, fend, nframes;
-  double val,maskval,mergeval,gmean,gstd,gmax,voxvol;
+  double gmean,gstd,gmax,voxvol;
   FILE *fp;
   MRI *mritmp;
 
@@ -397,65 +397,72 @@ int main(int argc, char *argv[]) {
 
   nhits = 0;
   if(nReplace == 0){
-    // Binarize
-    mergeval = BinValNot;
+    // Binarize. Works a row at a time and on slices in parallel
     InMask = 1;
     for(frame = fstart; frame <= fend; frame++){
-      for (c=0; c < InVol->width; c++) {
-	for (r=0; r < InVol->height; r++) {
-	  for (s=0; s < InVol->depth; s++) {
-	    if(MergeVol) mergeval = MRIgetVoxVal(MergeVol,c,r,s,frame);
-	    
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+:nhits)
+#endif
+      for (s=0; s < InVol->depth; s++) {
+	int rr, cc, nn, match;
+	double v, merge;
+	float *inrow, *outrow, *maskrow=NULL, *mergerow=NULL;
+
+	inrow  = (float *) calloc(InVol->width,sizeof(float));
+	outrow = (float *) calloc(InVol->width,sizeof(float));
+	if(MaskVol)  maskrow  = (float *) calloc(InVol->width,sizeof(float));
+	if(MergeVol) mergerow = (float *) calloc(InVol->width,sizeof(float));
+	for (rr=0; rr < InVol->height; rr++) {
+	  MRIgetVoxValRow(InVol,rr,s,frame,inrow);
+	  if(MaskVol)  MRIgetVoxValRow(MaskVol,rr,s,0,maskrow);
+	  if(MergeVol) MRIgetVoxValRow(MergeVol,rr,s,frame,mergerow);
+	  for (cc=0; cc < InVol->width; cc++) {
+	    merge = MergeVol ? mergerow[cc] : BinValNot;
+	    outrow[cc] = merge;
+
 	    // Skip if on the edge
-	    if( (ZeroColEdges &&   (c == 0 || c == InVol->width-1))  ||
-		(ZeroRowEdges &&   (r == 0 || r == InVol->height-1)) ||
-		(ZeroSliceEdges && (s == 0 || s == InVol->depth-1)) ){
-	      MRIsetVoxVal(OutVol,c,r,s,frame,mergeval);
+	    if( (ZeroColEdges &&   (cc == 0 || cc == InVol->width-1))  ||
+		(ZeroRowEdges &&   (rr == 0 || rr == InVol->height-1)) ||
+		(ZeroSliceEdges && (s == 0 || s == InVol->depth-1)) )
 	      continue;
-	    }
-	    
+
 	    // Skip if not in the mask
-	    if(MaskVol) {
-	      maskval = MRIgetVoxVal(MaskVol,c,r,s,0);
-	      if(maskval < MaskThresh){
-		MRIsetVoxVal(OutVol,c,r,s,frame-fstart,mergeval);
-		continue;
-	      }
-	    }
-	    
+	    if(MaskVol && maskrow[cc] < MaskThresh) continue;
+
 	    // Get the value at this voxel
-	    val = MRIgetVoxVal(InVol,c,r,s,frame);
-	    
+	    v = inrow[cc];
+
 	    if(DoMatch){
 	      // Check for a match
-	      Matched = 0;
-	      for(n=0; n < nMatch; n++){
-		if(fabs(val - MatchValues[n]) < 2*FLT_MIN){
-		  MRIsetVoxVal(OutVol,c,r,s,frame-fstart,BinVal);
-		  Matched = 1;
-		  nhits ++;
+	      match = 0;
+	      for(nn=0; nn < nMatch; nn++){
+		if(fabs(v - MatchValues[nn]) < 2*FLT_MIN){
+		  match = 1;
 		  break;
 		}
 	      }
-	      if(!Matched) MRIsetVoxVal(OutVol,c,r,s,frame-fstart,mergeval);
+	      if(match){
+		outrow[cc] = BinVal;
+		nhits ++;
+	      }
 	    }
 	    else{
 	      // Determine whether it is in range
-	      if((MinThreshSet && (val < MinThresh)) ||
-		 (MaxThreshSet && (val > MaxThresh))){
-		// It is NOT in the Range
-		MRIsetVoxVal(OutVol,c,r,s,frame-fstart,mergeval);
-	      }
-	      else {
+	      if(!((MinThreshSet && (v < MinThresh)) ||
+		   (MaxThreshSet && (v > MaxThresh)))){
 		// It is in the Range
-		MRIsetVoxVal(OutVol,c,r,s,frame-fstart,BinVal);
+		outrow[cc] = BinVal;
 		nhits ++;
 	      }
 	    }
-	    
-	  } // slice
+	  } // col
+	  MRIsetVoxValRow(OutVol,rr,s,frame-fstart,outrow);
 	} // row
-      } // col
+	free(inrow);
+	free(outrow);
+	if(maskrow)  free(maskrow);
+	if(mergerow) free(mergerow);
+      } // slice
     } // frame
   } // if(nReplace == 0)
 
@@ -491,15 +498,17 @@ int main(int argc, char *argv[]) {
   
   printf("Counting number of voxels in first frame\n");
   nhits = 0;
-  for (c=0; c < OutVol->width; c++) {
-    for (r=0; r < OutVol->height; r++) {
-      for (s=0; s < OutVol->depth; s++) {
-	// Get the value at this voxel
-        val = MRIgetVoxVal(OutVol,c,r,s,0);
-	if(fabs(val-BinVal) < .00001) nhits ++;
-      } // slice
-    } // row
-  } // col
+  {
+    float *row = (float *) calloc(OutVol->width,sizeof(float));
+    for (s=0; s < OutVol->depth; s++) {
+      for (r=0; r < OutVol->height; r++) {
+	MRIgetVoxValRow(OutVol,r,s,0,row);
+	for (c=0; c < OutVol->width; c++)
+	  if(fabs(row[c]-BinVal) < .00001) nhits ++;
+      } // row
+    } // slice
+    free(row);
+  }
   printf("Found %d voxels in final mask\n",nhits);
 
   if(DoBinCol){
@@ -43,6 +43,7 @@
 #include "utils.h"
 #include "timer.h"
 #include "gca.h"
+#include "gcastats.h"
 #include "gcamorph.h"
 #include "transform.h"
 #include "cma.h"
@@ -59,6 +60,7 @@ static int replaceLabels(MRI *mri_seg) ;
 static void modify_transform(TRANSFORM *transform, MRI *mri, GCA *gca) ;
 static int lateralize_hypointensities(MRI *mri_seg) ;
 static int check(MRI *mri_seg, char *subjects_dir, char *subject_name) ;
+static GCA_STATS *merge_stats_files(char **fnames, int nfiles) ;
 
 static int conform = 1 ;
 static int flash = 0 ;
@@ -85,6 +87,9 @@ static char *seg_dir = "seg_edited.mgz" ; // default name of manual edit file
 static char T1_name[STRLEN] = "orig" ;
 static char *xform_name = NULL;
 static int prune = 0 ;
+static int onepass = 0 ;       // accumulate GCA_STATS in one pass per subject
+static int stats_out = 0 ;     // write the statistics instead of a GCA
+static int merge_stats = 0 ;   // inputs are statistics files to be merged
 static float smooth = -1 ;
 static int gca_inputs = 0 ;
 static double TRs[MAX_GCA_INPUTS] ;
@@ -123,6 +128,7 @@ main(int argc, char *argv[])
   ordering[MAX_GCA_INPUTS], o ;
   struct timeb start ;
   GCA          *gca, *gca_prune = NULL ;
+  GCA_STATS    *gs = NULL ;
   MRI          *mri_seg, *mri_tmp, *mri_eq = NULL, *mri_inputs ;
   TRANSFORM    *transform ;
   LTA          *lta;
@@ -174,7 +180,11 @@ main(int argc, char *argv[])
          Progname, n_omp_threads);
 #endif
 
-  if (!strlen(subjects_dir)) /* hasn't been set on command line */
+  if (prune && onepass)
+    ErrorExit(ERROR_BADPARM, "%s: -prune can't be used with -onepass, "
+              "-stats or -merge", Progname) ;
+
+  if (!strlen(subjects_dir) && !merge_stats) /* hasn't been set on command line */
   {
     cp = getenv("SUBJECTS_DIR") ;
     if (!cp)
@@ -227,12 +237,23 @@ main(int argc, char *argv[])
   }
 
   //////////////////////////////////////////////////////////////////
-  do
+  // reduce step: statistics of shards of the training set were written
+  // with -stats and are merged in the order given
+  if (merge_stats)
+  {
+    if (argc < 3)
+      usage_exit(1) ;
+    gs = merge_stats_files(argv+1, argc-2) ;
+  }
+  else do
   {
     // set up gca direction cosines, width, height, depth defaults
     gca = GCAalloc(gca_inputs, parms.prior_spacing,
                    parms.node_spacing, DEFAULT_VOLUME_SIZE,
                    DEFAULT_VOLUME_SIZE,DEFAULT_VOLUME_SIZE, gca_flags);
+    // the stats use gca for its geometry and prior counts
+    if (onepass)
+      gs = GCAstatsAlloc(gca) ;
 
     /////////////////////////////////////////////////////////////////////////
     // weird way options and subject name are mixed here
@@ -663,6 +684,15 @@ main(int argc, char *argv[])
       // transform    is for this subject
       // gca_prune    is so far null
       // noint        is whether to use intensity information or not
+      if (gs)
+      {
+        // means and covariances in one pass
+        GCAstatsTrain(gs, mri_inputs, mri_seg, transform, noint) ;
+        MRIfree(&mri_seg) ;
+        MRIfree(&mri_inputs) ;
+        TransformFree(&transform) ;
+        continue ;
+      }
       GCAtrain(gca, mri_inputs, mri_seg, transform, gca_prune, noint) ;
       GCAcheck(gca) ;
       MRIfree(&mri_seg) ;
@@ -674,7 +704,8 @@ main(int argc, char *argv[])
       if (gca_prune)
         gca_prune = GCAcompactify(gca_prune);
     }
-    GCAcompleteMeanTraining(gca) ;
+    if (!gs)
+      GCAcompleteMeanTraining(gca) ;
 
     ///////////////////////////////////////////////////////////////
     if (do_sanity_check && sanity_check_badsubj_count)
@@ -685,6 +716,9 @@ main(int argc, char *argv[])
                 sanity_check_badsubj_count);     
     }
 
+    if (gs)
+      break ;   // covariances are in the stats already, no pruning
+
     ///////////////////////////////////////////////////////////////
     /* now compute covariances */
     ///////////////////////////////////////////////////////////////
@@ -962,6 +996,28 @@ main(int argc, char *argv[])
   while (n++ < prune) ;
   ////////////////  end of do ////////////////////////////////////////////
 
+  if (gs)
+  {
+    if (stats_out)
+    {
+      printf("writing training statistics of %d subjects to %s...\n",
+             gs->gca->total_training, out_fname) ;
+      if (GCAstatsWrite(gs, out_fname) != NO_ERROR)
+        ErrorExit(ERROR_BADFILE, "%s: could not write statistics to %s",
+                  Progname, out_fname) ;
+      GCAstatsFree(&gs) ;
+      msec = TimerStop(&start) ;
+      seconds = nint((float)msec/1000.0f) ;
+      printf("accumulating training statistics took %d minutes"
+             " and %d seconds.\n", seconds/60, seconds%60) ;
+      ErrorWriteDoneFile(DoneFile, 0);
+      printf("mri_ca_train done\n");
+      exit(0) ;
+    }
+    gca = GCAstatsCompleteTraining(gs) ;
+    GCAstatsFree(&gs) ;
+  }
+
   if (smooth > 0)
   {
     printf("regularizing conditional densities with smooth=%2.2f\n", smooth) ;
@@ -1209,6 +1265,21 @@ get_option(int argc, char *argv[])
     printf("inserting non-zero vals from %s as label %d...\n",
            insert_fname,insert_label);
   }
+  else if (!stricmp(option, "ONEPASS"))
+  {
+    onepass = 1 ;
+    printf("accumulating means and covariances in a single pass\n") ;
+  }
+  else if (!stricmp(option, "STATS"))
+  {
+    onepass = stats_out = 1 ;
+    printf("writing training statistics instead of a GCA\n") ;
+  }
+  else if (!stricmp(option, "MERGE"))
+  {
+    onepass = merge_stats = 1 ;
+    printf("merging training statistics files\n") ;
+  }
   else if (!stricmp(option, "PRUNE"))
   {
     prune = atoi(argv[2]) ;
@@ -1349,7 +1420,16 @@ usage_exit(int code)
    "(path relative to $subject/mri).\n"
    "                          can specify multiple inputs.  "
    "If not specified, \"orig\" is used\n"
-   "\t-check          - conduct sanity-check of labels for obvious edit errors"
+   "\t-check          - conduct sanity-check of labels for obvious edit errors\n"
+   "\t-onepass        - read each subject once, accumulating mergeable\n"
+   "                     statistics instead of training means and\n"
+   "                     covariances in separate passes\n"
+   "\t-stats          - (implies -onepass) write the statistics of the\n"
+   "                     subjects to the output file instead of a GCA\n"
+   "\t-merge          - the inputs are statistics files written with\n"
+   "                     -stats, for shards of the subjects in training\n"
+   "                     order. Writes the GCA, or the merged statistics\n"
+   "                     if -stats is also given\n"
    "\t-threads N : specify number of threads to use (also -nthreads)"
    "\t-done DoneFile : create DoneFile when done, (contents: 0=ok, 1=error)"
    "\n"
@@ -1859,3 +1939,33 @@ static int check(MRI *mri_seg, char *subjects_dir, char *subject_name)
   return(errors) ;
 }
 
+
+static GCA_STATS *
+merge_stats_files(char **fnames, int nfiles)
+{
+  GCA_STATS *gs, *gs_shard ;
+  int       i ;
+
+  gs = NULL ;
+  for (i = 0 ; i < nfiles ; i++)
+  {
+    printf("reading training statistics from %s, %d of %d...\n",
+           fnames[i], i+1, nfiles) ;
+    gs_shard = GCAstatsRead(fnames[i]) ;
+    if (!gs_shard)
+      ErrorExit(ERROR_NOFILE, "%s: could not read statistics from %s",
+                Progname, fnames[i]) ;
+    if (gs == NULL)
+    {
+      gs = gs_shard ;
+      continue ;
+    }
+    if (GCAstatsMerge(gs, gs_shard) != NO_ERROR)
+      ErrorExit(ERROR_BADPARM, "%s: could not merge statistics from %s",
+                Progname, fnames[i]) ;
+    GCAstatsFree(&gs_shard) ;
+  }
+  printf("merged training statistics of %d subjects\n",
+         gs->gca->total_training) ;
+  return(gs) ;
+}
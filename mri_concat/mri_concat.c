@@ -59,6 +59,9 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void argnerr(char *option, int n);
 static void dump_options(FILE *fp);
+static MRI *ReadInput(int nthin, int nc, int nr, int ns);
+static int  StreamReduceOK(void);
+static MRI *StreamReduce(int nc, int nr, int ns, int datatype, int *pnframes);
 //static int  singledash(char *flag);
 
 int main(int argc, char *argv[]) ;
@@ -132,6 +135,7 @@ MRI *PruneMask = NULL;
 int DoRMS = 0; // compute root-mean-square on multi-frame input
 int DoCumSum = 0;
 int DoFNorm = 0;
+int DoStream = 1; // reduce while reading when the frames are not needed
 char *rusage_file=NULL;
 
 /*--------------------------------------------------*/
@@ -282,6 +286,11 @@ int main(int argc, char **argv)
     }
   }
 
+  if(DoStream && !StreamReduceOK())
+  {
+    DoStream = 0;
+  }
+
   printf("Allocing output\n");
   fflush(stdout);
   int datatype=MRI_FLOAT;
@@ -289,7 +298,16 @@ int main(int argc, char **argv)
   {
     datatype = inputDatatype;
   }
-  if (DoRMS)
+  if (DoStream)
+  {
+    // single frame output reduced while the inputs are read, so
+    // the concatenation never exists in memory
+    printf("Streaming inputs\n");
+    mriout = StreamReduce(nc,nr,ns,datatype,&nframestot);
+    DoMean = DoSum = DoMeanDivN = DoStd = DoVar = 0;
+    DoMax = DoMaxIndex = DoMin = DoCombine = 0;
+  }
+  else if (DoRMS)
   {
     // RMS always has single frame output
     mriout = MRIallocSequence(nc,nr,ns,datatype,1);
@@ -308,16 +326,10 @@ int main(int argc, char **argv)
   for (nthin = 0; nthin < ninputs; nthin++)
   {
     if (DoRMS) break; // MRIrms reads the input frames
-    if(Gdiag_no > 0 || debug)
-    {
-      printf("Loading %dth input %s\n",
-             nthin+1,fio_basename(inlist[nthin],NULL));
-      fflush(stdout);
-    }
-    mritmp = MRIread(inlist[nthin]);
+    if (DoStream) break; // already reduced
+    mritmp = ReadInput(nthin,nc,nr,ns);
     if(mritmp == NULL)
     {
-      printf("ERROR: loading %s\n",inlist[nthin]);
       exit(1);
     }
     if(nthin == 0)
@@ -325,42 +337,22 @@ int main(int argc, char **argv)
       MRIcopyHeader(mritmp, mriout);
       //mriout->nframes = nframestot;
     }
-    if(DoAbs)
-    {
-      if(Gdiag_no > 0 || debug)
-      {
-        printf("Removing sign from input\n");
-      }
-      MRIabs(mritmp,mritmp);
-    }
-    if(DoPos)
-    {
-      if(Gdiag_no > 0 || debug)
-      {
-        printf("Setting input negatives to 0.\n");
-      }
-      MRIpos(mritmp,mritmp);
-    }
-    if(DoNeg)
-    {
-      if(Gdiag_no > 0 || debug)
-      {
-        printf("Setting input positives to 0.\n");
-      }
-      MRIneg(mritmp,mritmp);
-    }
     for(f=0; f < mritmp->nframes; f++)
     {
-      for(c=0; c < nc; c++)
+      // copy a row at a time, slices in parallel
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+      for(s=0; s < ns; s++)
       {
-        for(r=0; r < nr; r++)
+        int rr;
+        float *row = (float *) calloc(nc,sizeof(float));
+        for(rr=0; rr < nr; rr++)
         {
-          for(s=0; s < ns; s++)
-          {
-            v = MRIgetVoxVal(mritmp,c,r,s,f);
-            MRIsetVoxVal(mriout,c,r,s,fout,v);
-          }
+          MRIgetVoxValRow(mritmp,rr,s,f,row);
+          MRIsetVoxValRow(mriout,rr,s,fout,row);
         }
+        free(row);
       }
       fout++;
     }
@@ -485,12 +477,17 @@ int main(int argc, char **argv)
     mriout = mritmp;
   }
   nframes = mriout->nframes;
+  if(DoStream)
+  {
+    nframes = nframestot;
+  }
   printf("nframes = %d\n",nframes);
 
   if(DoBonfCor)
   {
     DoAdd = 1;
-    AddVal = -log10(mriout->nframes);
+    // use the input frame count, the output may already be reduced
+    AddVal = -log10(nframestot);
   }
 
   if(DoMean)
@@ -940,6 +937,14 @@ static int parse_commandline(int argc, char **argv)
       DoPairedDiffNorm2 = 1;
       DoPaired = 1;
     }
+    else if (!strcasecmp(option, "--stream"))
+    {
+      DoStream = 1;
+    }
+    else if (!strcasecmp(option, "--no-stream"))
+    {
+      DoStream = 0;
+    }
     else if (!strcasecmp(option, "--combine"))
     {
       DoCombine = 1;
@@ -1184,6 +1189,10 @@ static void print_usage(void)
   printf("   --rms : root mean square (eg. combine memprage)\n");
   printf("           (square, sum, div-by-nframes, square root)\n");
   printf("   --no-check : do not check inputs (faster)\n");
+  printf("   --no-stream : always hold the full concatenation in memory\n");
+  printf("                 (by default a single --mean, --sum, --mean-div-n,\n");
+  printf("                 --std, --var, --max, --max-index, --min or --combine\n");
+  printf("                 is computed while the inputs are read)\n");
   printf("   --help      print out information on how to use this program\n");
   printf("   --version   print out version and exit\n");
   printf("\n");
@@ -1322,5 +1331,326 @@ MATRIX *GroupedMeanMatrix(int ngroups, int ntotal)
   return(M);
 }
 
+/*---------------------------------------------------------------
+  ReadInput() - loads the nth input, checks that it matches the
+  first input and applies --abs, --pos or --neg. Returns NULL on
+  error rather than exiting so it can be called from the read-ahead
+  thread in StreamReduce().
+  ---------------------------------------------------------------*/
+static MRI *ReadInput(int nthin, int nc, int nr, int ns)
+{
+  MRI *mri;
+
+  if(Gdiag_no > 0 || debug)
+  {
+    printf("Loading %dth input %s\n",
+           nthin+1,fio_basename(inlist[nthin],NULL));
+    fflush(stdout);
+  }
+  mri = MRIread(inlist[nthin]);
+  if(mri == NULL)
+  {
+    printf("ERROR: loading %s\n",inlist[nthin]);
+    return(NULL);
+  }
+  if(mri->width != nc || mri->height != nr || mri->depth != ns)
+  {
+    printf("ERROR: dimension mismatch between %s and %s\n",
+           inlist[0],inlist[nthin]);
+    MRIfree(&mri);
+    return(NULL);
+  }
+  if(DoAbs)
+  {
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Removing sign from input\n");
+    }
+    MRIabs(mri,mri);
+  }
+  if(DoPos)
+  {
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Setting input negatives to 0.\n");
+    }
+    MRIpos(mri,mri);
+  }
+  if(DoNeg)
+  {
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Setting input positives to 0.\n");
+    }
+    MRIneg(mri,mri);
+  }
+  return(mri);
+}
+
+/*---------------------------------------------------------------
+  StreamReduceOK() - returns 1 if the requested output is a single
+  reduction over frames that can be accumulated one input at a
+  time, ie, nothing else needs the concatenated frames.
+  ---------------------------------------------------------------*/
+static int StreamReduceOK(void)
+{
+  int nreduce;
 
+  nreduce = DoMean + DoSum + DoMeanDivN + (DoStd || DoVar) +
+            DoMax + DoMaxIndex + DoMin + DoCombine;
+  if(nreduce != 1)
+  {
+    return(0);
+  }
+  if(DoRMS || DoPrune || DoNormMean || DoNorm1 || DoASL || M != NULL ||
+      ngroups != 0 || DoPaired || DoMedian || DoFNorm || DoTAR1 ||
+      DoConjunction || DoSort || DoVote || DoCumSum || DoSCM || DoPCA ||
+      NReplications > 0)
+  {
+    return(0);
+  }
+  return(1);
+}
 
+/*---------------------------------------------------------------
+  StreamReduce() - computes the requested reduction over all the
+  frames of all the inputs without concatenating them. Each input
+  is accumulated a row at a time with the slices in parallel while
+  one thread reads the next input, so at most two inputs are in
+  memory. Mean and sum are accumulated in double in frame order as
+  in MRIframeMean() and MRIframeSum(); var/std use Welford's update
+  and match fMRIcovariance() (DOF = nframes-1). The output type
+  follows what the in-memory path produces. The total number of
+  frames is passed back in pnframes.
+  ---------------------------------------------------------------*/
+static MRI *StreamReduce(int nc, int nr, int ns, int datatype, int *pnframes)
+{
+  MRI *cur, *next, *out;
+  double *acc, *acc2=NULL;
+  int *count=NULL, outtype, nthin, nframes, s, readerr;
+  char *nonzero=NULL;
+  size_t nvox;
+
+  nvox = (size_t)nc*nr*ns;
+  acc = (double *) calloc(nvox,sizeof(double));
+  if(DoStd || DoVar)
+  {
+    acc2 = (double *) calloc(nvox,sizeof(double));
+  }
+  if(DoMaxIndex || DoCombine)
+  {
+    count = (int *) calloc(nvox,sizeof(int));
+  }
+  if(DoMaxIndexPrune)
+  {
+    nonzero = (char *) calloc(nvox,sizeof(char));
+  }
+  if(acc == NULL || ((DoStd || DoVar) && acc2 == NULL) ||
+      ((DoMaxIndex || DoCombine) && count == NULL) ||
+      (DoMaxIndexPrune && nonzero == NULL))
+  {
+    printf("ERROR: could not alloc accumulators\n");
+    exit(1);
+  }
+
+  outtype = MRI_FLOAT;
+  if(DoMax || DoMin)
+  {
+    outtype = datatype;
+  }
+  if(DoMaxIndex)
+  {
+    outtype = MRI_INT;
+  }
+
+  cur = ReadInput(0,nc,nr,ns);
+  if(cur == NULL)
+  {
+    exit(1);
+  }
+  out = MRIallocSequence(nc,nr,ns,outtype,1);
+  if(out == NULL)
+  {
+    exit(1);
+  }
+  MRIcopyHeader(cur,out);
+
+  nframes = 0;
+  for(nthin = 0; nthin < ninputs; nthin++)
+  {
+    next = NULL;
+    readerr = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+    {
+      // one thread reads ahead while the rest accumulate; the reader
+      // joins the slice loop when it is done
+#ifdef HAVE_OPENMP
+#pragma omp single nowait
+#endif
+      {
+        if(nthin+1 < ninputs)
+        {
+          next = ReadInput(nthin+1,nc,nr,ns);
+          if(next == NULL)
+          {
+            readerr = 1; // cannot exit inside the parallel region
+          }
+        }
+      }
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+      for(s=0; s < ns; s++)
+      {
+        int rr, c, f, n;
+        size_t k;
+        double v, d;
+        float *row = (float *) calloc(nc,sizeof(float));
+        for(rr=0; rr < nr; rr++)
+        {
+          k = ((size_t)s*nr + rr)*nc;
+          for(f=0; f < cur->nframes; f++)
+          {
+            n = nframes + f + 1; // frames seen so far, including this one
+            MRIgetVoxValRow(cur,rr,s,f,row);
+            for(c=0; c < nc; c++)
+            {
+              v = row[c];
+              if(DoMean || DoSum || DoMeanDivN)
+              {
+                acc[k+c] += v;
+              }
+              else if(DoStd || DoVar)
+              {
+                d = v - acc[k+c];
+                acc[k+c] += d/n;
+                acc2[k+c] += d*(v - acc[k+c]);
+              }
+              else if(DoMax)
+              {
+                if(n == 1 || acc[k+c] < v)
+                {
+                  acc[k+c] = v;
+                }
+              }
+              else if(DoMin)
+              {
+                if(n == 1 || acc[k+c] > v)
+                {
+                  acc[k+c] = v;
+                }
+              }
+              else if(DoMaxIndex)
+              {
+                if(n == 1 || acc[k+c] < v)
+                {
+                  acc[k+c] = v;
+                  count[k+c] = n-1;
+                }
+                if(DoMaxIndexPrune && fabs(v) > 0)
+                {
+                  nonzero[k+c] = 1;
+                }
+              }
+              else if(DoCombine)
+              {
+                if(v > 0)
+                {
+                  acc[k+c] += v;
+                  count[k+c]++;
+                }
+              }
+            }
+          }
+        }
+        free(row);
+      }
+    }
+    if(readerr)
+    {
+      exit(1);
+    }
+    nframes += cur->nframes;
+    MRIfree(&cur);
+    cur = next;
+  }
+  printf("Reduced %d frames from %d inputs\n",nframes,ninputs);
+
+  if((DoStd || DoVar) && nframes < 2)
+  {
+    printf("ERROR: cannot compute std from one frame\n");
+    exit(1);
+  }
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for(s=0; s < ns; s++)
+  {
+    int rr, c;
+    size_t k;
+    double v;
+    float *row = (float *) calloc(nc,sizeof(float));
+    for(rr=0; rr < nr; rr++)
+    {
+      k = ((size_t)s*nr + rr)*nc;
+      for(c=0; c < nc; c++)
+      {
+        v = acc[k+c];
+        if(DoMean)
+        {
+          v = v/nframes;
+        }
+        if(DoMeanDivN)
+        {
+          v = v/((double)nframes*nframes);
+        }
+        if(DoStd || DoVar)
+        {
+          v = acc2[k+c]/(nframes-1);
+          if(DoStd)
+          {
+            v = sqrt(v);
+          }
+        }
+        if(DoMaxIndex)
+        {
+          v = count[k+c] + 1;
+          if(DoMaxIndexPrune && !nonzero[k+c])
+          {
+            v = 0;
+          }
+          if(DoMaxIndexAdd && v != 0)
+          {
+            v += MaxIndexAdd;
+          }
+        }
+        if(DoCombine)
+        {
+          v = (count[k+c] > 0) ? v/count[k+c] : 0;
+        }
+        row[c] = v;
+      }
+      MRIsetVoxValRow(out,rr,s,0,row);
+    }
+    free(row);
+  }
+
+  free(acc);
+  if(acc2)
+  {
+    free(acc2);
+  }
+  if(count)
+  {
+    free(count);
+  }
+  if(nonzero)
+  {
+    free(nonzero);
+  }
+  *pnframes = nframes;
+  return(out);
+}
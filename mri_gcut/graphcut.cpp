@@ -25,38 +25,26 @@
 
 #include "graphcut.h"
 
-#define TERMINAL ( (arc *) 1 )  /* to terminal */
-#define ORPHAN   ( (arc *) 2 )  /* orphan */
+#define NO_PARENT 0  /* free node */
+#define TERMINAL  7  /* to terminal */
+#define ORPHAN    8  /* orphan */
 #define INFINITE_D 1000000000  /* infinite distance to the terminal */
 
-#define NEW_VECTOR(X,N,TYPE,MSG) Test_Pointer(X = new TYPE[N], MSG)
-
-#define max_graph_size 20000000
-
-struct edgeW
-{
-  int edge1;
-  int edge2;
-  int weight;
-  int fsw;
-  int bsw;
-};
-
 //no include
 extern bool matrix_alloc(int ****pointer, int z, int y, int x);
 extern bool matrix_free(int ***pointer, int z, int y, int x);
 
 
 
-inline void Graph::set_active(node *i)
+inline void GridGraph::set_active(int i)
 {
-  if (!i->next)
+  if (!nodes[i].next)
   {
     /* it's not in the list yet */
-    if (queue_last[1]) queue_last[1] -> next = i;
-    else               queue_first[1]        = i;
+    if (queue_last[1]) nodes[queue_last[1]].next = i;
+    else               queue_first[1]            = i;
     queue_last[1] = i;
-    i -> next = i;
+    nodes[i].next = i;
   }
 }
 
@@ -65,9 +53,9 @@ inline void Graph::set_active(node *i)
  If it is connected to the sink, it stays in the list,
  otherwise it is removed from the list
 */
-inline Graph::node * Graph::next_active()
+inline int GridGraph::next_active()
 {
-  node *i;
+  int i;
 
   while ( 1 )
   {
@@ -75,57 +63,59 @@ inline Graph::node * Graph::next_active()
     {
       queue_first[0] = i = queue_first[1];
       queue_last[0]  = queue_last[1];
-      queue_first[1] = NULL;
-      queue_last[1]  = NULL;
-      if (!i) return NULL;
+      queue_first[1] = 0;
+      queue_last[1]  = 0;
+      if (!i) return 0;
     }
 
     /* remove it from the active list */
-    if (i->next == i) queue_first[0] = queue_last[0] = NULL;
-    else              queue_first[0] = i -> next;
-    i -> next = NULL;
+    if (nodes[i].next == i) queue_first[0] = queue_last[0] = 0;
+    else                    queue_first[0] = nodes[i].next;
+    nodes[i].next = 0;
 
     /* a node in the list is active iff it has a parent */
-    if (i->parent) return i;
+    if (nodes[i].parent) return i;
   }
 }
 
 /***********************************************************************/
 
-void Graph::maxflow_init()
+void GridGraph::maxflow_init()
 {
-  node *i;
+  int i;
 
-  queue_first[0] = queue_last[0] = NULL;
-  queue_first[1] = queue_last[1] = NULL;
-  orphan_first = NULL;
+  queue_first[0] = queue_last[0] = 0;
+  queue_first[1] = queue_last[1] = 0;
+  orphans.clear();
 
-  for (i=node_block->ScanFirst(); i; i=node_block->ScanNext())
+  for (i = 0; i < nnodes; i++)
   {
-    i -> next = NULL;
-    i -> mark_count = 0;
-    i -> is_sink = 0;
-    if (i->tr_cap > 0)
+    node *n = &nodes[i];
+
+    n -> next = 0;
+    n -> mark_count = 0;
+    n -> is_sink = 0;
+    if (n->tr_cap > 0)
     {
       /* i is connected to the source */
-      i -> is_sink = 0;
-      i -> parent = TERMINAL;
+      n -> is_sink = 0;
+      n -> parent = TERMINAL;
       set_active(i);
-      i -> mark_count = 1;
-      i -> mark_d = 1;
+      n -> mark_count = 1;
+      n -> mark_d = 1;
     }
-    else if (i->tr_cap < 0)
+    else if (n->tr_cap < 0)
     {
       /* i is connected to the sink */
-      i -> is_sink = 1;
-      i -> parent = TERMINAL;
+      n -> is_sink = 1;
+      n -> parent = TERMINAL;
       set_active(i);
-      i -> mark_count = 1;
-      i -> mark_d = 1;
+      n -> mark_count = 1;
+      n -> mark_d = 1;
     }
     else
     {
-      i -> parent = NULL;
+      n -> parent = NO_PARENT;
     }
   }
   mark_count = 2;
@@ -133,90 +123,77 @@ void Graph::maxflow_init()
 
 /***********************************************************************/
 
-void Graph::augment(arc *middle_arc)
+/* middle arc goes from 'middle' (source tree) in direction 'middle_dir'
+   to a node of the sink tree */
+void GridGraph::augment(int middle, int middle_dir)
 {
-  node *i;
-  arc *a;
+  int i, j, d;
   captype bottleneck;
-  nodeptr *np;
-
 
   /* 1. Finding bottleneck capacity */
   /* 1a - the source tree */
-  bottleneck = middle_arc -> r_cap;
-  for (i=middle_arc->sister->head; ; i=a->head)
+  bottleneck = r_cap[NDIRS*middle+middle_dir];
+  for (i=middle; nodes[i].parent != TERMINAL; i=j)
   {
-    a = i -> parent;
-    if (a == TERMINAL) break;
-    if (bottleneck > a->sister->r_cap) bottleneck = a -> sister -> r_cap;
+    d = nodes[i].parent - 1;
+    j = i + offset[d];
+    if (bottleneck > r_cap[NDIRS*j+(d^1)]) bottleneck = r_cap[NDIRS*j+(d^1)];
   }
-  if (bottleneck > i->tr_cap) bottleneck = i -> tr_cap;
+  if (bottleneck > nodes[i].tr_cap) bottleneck = nodes[i].tr_cap;
   /* 1b - the sink tree */
-  for (i=middle_arc->head; ; i=a->head)
+  for (i=middle+offset[middle_dir]; nodes[i].parent != TERMINAL; i=j)
   {
-    a = i -> parent;
-    if (a == TERMINAL) break;
-    if (bottleneck > a->r_cap) bottleneck = a -> r_cap;
+    d = nodes[i].parent - 1;
+    j = i + offset[d];
+    if (bottleneck > r_cap[NDIRS*i+d]) bottleneck = r_cap[NDIRS*i+d];
   }
-  if (bottleneck > - i->tr_cap) bottleneck = - i -> tr_cap;
+  if (bottleneck > - nodes[i].tr_cap) bottleneck = - nodes[i].tr_cap;
 
 
   /* 2. Augmenting */
   /* 2a - the source tree */
-  middle_arc -> sister -> r_cap += bottleneck;
-  middle_arc -> r_cap -= bottleneck;
-  for (i=middle_arc->sister->head; ; i=a->head)
+  r_cap[NDIRS*(middle+offset[middle_dir])+(middle_dir^1)] += bottleneck;
+  r_cap[NDIRS*middle+middle_dir] -= bottleneck;
+  for (i=middle; nodes[i].parent != TERMINAL; i=j)
   {
-    a = i -> parent;
-    if (a == TERMINAL) break;
-    a -> r_cap += bottleneck;
-    a -> sister -> r_cap -= bottleneck;
-    if (!a->sister->r_cap)
+    d = nodes[i].parent - 1;
+    j = i + offset[d];
+    r_cap[NDIRS*i+d] += bottleneck;
+    r_cap[NDIRS*j+(d^1)] -= bottleneck;
+    if (!r_cap[NDIRS*j+(d^1)])
     {
       /* add i to the adoption list */
-      i -> parent = ORPHAN;
-      np = nodeptr_block -> New();
-      np -> ptr = i;
-      np -> next = orphan_first;
-      orphan_first = np;
+      nodes[i].parent = ORPHAN;
+      orphans.push_front(i);
     }
   }
-  i -> tr_cap -= bottleneck;
-  if (!i->tr_cap)
+  nodes[i].tr_cap -= bottleneck;
+  if (!nodes[i].tr_cap)
   {
     /* add i to the adoption list */
-    i -> parent = ORPHAN;
-    np = nodeptr_block -> New();
-    np -> ptr = i;
-    np -> next = orphan_first;
-    orphan_first = np;
+    nodes[i].parent = ORPHAN;
+    orphans.push_front(i);
   }
   /* 2b - the sink tree */
-  for (i=middle_arc->head; ; i=a->head)
+  for (i=middle+offset[middle_dir]; nodes[i].parent != TERMINAL; i=j)
   {
-    a = i -> parent;
-    if (a == TERMINAL) break;
-    a -> sister -> r_cap += bottleneck;
-    a -> r_cap -= bottleneck;
-    if (!a->r_cap)
+    d = nodes[i].parent - 1;
+    j = i + offset[d];
+    r_cap[NDIRS*j+(d^1)] += bottleneck;
+    r_cap[NDIRS*i+d] -= bottleneck;
+    if (!r_cap[NDIRS*i+d])
     {
       /* add i to the adoption list */
-      i -> parent = ORPHAN;
-      np = nodeptr_block -> New();
-      np -> ptr = i;
-      np -> next = orphan_first;
-      orphan_first = np;
+      nodes[i].parent = ORPHAN;
+      orphans.push_front(i);
     }
   }
-  i -> tr_cap += bottleneck;
-  if (!i->tr_cap)
+  nodes[i].tr_cap += bottleneck;
+  if (!nodes[i].tr_cap)
   {
     /* add i to the adoption list */
-    i -> parent = ORPHAN;
-    np = nodeptr_block -> New();
-    np -> ptr = i;
-    np -> next = orphan_first;
-    orphan_first = np;
+    nodes[i].parent = ORPHAN;
+    orphans.push_front(i);
   }
 
 
@@ -225,176 +202,168 @@ void Graph::augment(arc *middle_arc)
 
 /***********************************************************************/
 
-void Graph::process_source_orphan(node *i)
+void GridGraph::process_source_orphan(int i)
 {
-  node *j;
-  arc *a0, *a0_min = NULL, *a;
-  nodeptr *np;
+  int j, k, d0, d0_min = -1, p;
   int d, d_min = INFINITE_D;
 
   /* trying to find a new parent */
-  for (a0=i->first; a0; a0=a0->next)
-    if (a0->sister->r_cap)
+  for (d0 = 0; d0 < NDIRS; d0++)
+  {
+    j = i + offset[d0];
+    if (r_cap[NDIRS*j+(d0^1)] && !nodes[j].is_sink && nodes[j].parent)
     {
-      j = a0 -> head;
-      if (!j->is_sink && (a=j->parent))
+      /* checking the origin of j */
+      d = 0;
+      k = j;
+      while ( 1 )
       {
-        /* checking the origin of j */
-        d = 0;
-        while ( 1 )
+        if (nodes[k].mark_count == mark_count)
         {
-          if (j->mark_count == mark_count)
-          {
-            d += j -> mark_d;
-            break;
-          }
-          a = j -> parent;
-          d ++;
-          if (a==TERMINAL)
-          {
-            j -> mark_count = mark_count;
-            j -> mark_d = 1;
-            break;
-          }
-          if (a==ORPHAN)
-          {
-            d = INFINITE_D;
-            break;
-          }
-          j = a -> head;
+          d += nodes[k].mark_d;
+          break;
         }
-        if (d<INFINITE_D) /* j originates from the source - done */
+        p = nodes[k].parent;
+        d ++;
+        if (p==TERMINAL)
         {
-          if (d<d_min)
-          {
-            a0_min = a0;
-            d_min = d;
-          }
-          /* set marks along the path */
-          for (j=a0->head; j->mark_count!=mark_count; j=j->parent->head)
-          {
-            j -> mark_count = mark_count;
-            j -> mark_d = d --;
-          }
+          nodes[k].mark_count = mark_count;
+          nodes[k].mark_d = 1;
+          break;
+        }
+        if (p==ORPHAN)
+        {
+          d = INFINITE_D;
+          break;
+        }
+        k += offset[p-1];
+      }
+      if (d<INFINITE_D) /* j originates from the source - done */
+      {
+        if (d<d_min)
+        {
+          d0_min = d0;
+          d_min = d;
+        }
+        /* set marks along the path */
+        for (k=j; nodes[k].mark_count!=mark_count; k+=offset[nodes[k].parent-1])
+        {
+          nodes[k].mark_count = mark_count;
+          nodes[k].mark_d = d --;
         }
       }
     }
+  }
 
-  if ((i->parent = a0_min))
+  if (d0_min >= 0)
   {
-    i -> mark_count = mark_count;
-    i -> mark_d = d_min + 1;
+    nodes[i].parent = d0_min + 1;
+    nodes[i].mark_count = mark_count;
+    nodes[i].mark_d = d_min + 1;
   }
   else
   {
     /* no parent is found */
-    i -> mark_count = 0;
+    nodes[i].parent = NO_PARENT;
+    nodes[i].mark_count = 0;
 
     /* process neighbors */
-    for (a0=i->first; a0; a0=a0->next)
+    for (d0 = 0; d0 < NDIRS; d0++)
     {
-      j = a0 -> head;
-      if (!j->is_sink && (a=j->parent))
+      j = i + offset[d0];
+      p = nodes[j].parent;
+      if (!nodes[j].is_sink && p)
       {
-        if (a0->sister->r_cap) set_active(j);
-        if (a!=TERMINAL && a!=ORPHAN && a->head==i)
+        if (r_cap[NDIRS*j+(d0^1)]) set_active(j);
+        if (p!=TERMINAL && p!=ORPHAN && p-1==(d0^1))
         {
           /* add j to the adoption list */
-          j -> parent = ORPHAN;
-          np = nodeptr_block -> New();
-          np -> ptr = j;
-          if (orphan_last) orphan_last -> next = np;
-          else             orphan_first        = np;
-          orphan_last = np;
-          np -> next = NULL;
+          nodes[j].parent = ORPHAN;
+          orphans.push_back(j);
         }
       }
     }
   }
 }
 
-void Graph::process_sink_orphan(node *i)
+void GridGraph::process_sink_orphan(int i)
 {
-  node *j;
-  arc *a0, *a0_min = NULL, *a;
-  nodeptr *np;
+  int j, k, d0, d0_min = -1, p;
   int d, d_min = INFINITE_D;
 
   /* trying to find a new parent */
-  for (a0=i->first; a0; a0=a0->next)
-    if (a0->r_cap)
+  for (d0 = 0; d0 < NDIRS; d0++)
+  {
+    j = i + offset[d0];
+    if (r_cap[NDIRS*i+d0] && nodes[j].is_sink && nodes[j].parent)
     {
-      j = a0 -> head;
-      if ((j->is_sink) && (a=j->parent))
+      /* checking the origin of j */
+      d = 0;
+      k = j;
+      while ( 1 )
       {
-        /* checking the origin of j */
-        d = 0;
-        while ( 1 )
+        if (nodes[k].mark_count == mark_count)
         {
-          if (j->mark_count == mark_count)
-          {
-            d += j -> mark_d;
-            break;
-          }
-          a = j -> parent;
-          d ++;
-          if (a==TERMINAL)
-          {
-            j -> mark_count = mark_count;
-            j -> mark_d = 1;
-            break;
-          }
-          if (a==ORPHAN)
-          {
-            d = INFINITE_D;
-            break;
-          }
-          j = a -> head;
+          d += nodes[k].mark_d;
+          break;
         }
-        if (d<INFINITE_D) /* j originates from the sink - done */
+        p = nodes[k].parent;
+        d ++;
+        if (p==TERMINAL)
         {
-          if (d<d_min)
-          {
-            a0_min = a0;
-            d_min = d;
-          }
-          /* set marks along the path */
-          for (j=a0->head; j->mark_count!=mark_count; j=j->parent->head)
-          {
-            j -> mark_count = mark_count;
-            j -> mark_d = d --;
-          }
+          nodes[k].mark_count = mark_count;
+          nodes[k].mark_d = 1;
+          break;
+        }
+        if (p==ORPHAN)
+        {
+          d = INFINITE_D;
+          break;
+        }
+        k += offset[p-1];
+      }
+      if (d<INFINITE_D) /* j originates from the sink - done */
+      {
+        if (d<d_min)
+        {
+          d0_min = d0;
+          d_min = d;
+        }
+        /* set marks along the path */
+        for (k=j; nodes[k].mark_count!=mark_count; k+=offset[nodes[k].parent-1])
+        {
+          nodes[k].mark_count = mark_count;
+          nodes[k].mark_d = d --;
         }
       }
     }
+  }
 
-  if ((i->parent = a0_min))
+  if (d0_min >= 0)
   {
-    i -> mark_count = mark_count;
-    i -> mark_d = d_min + 1;
+    nodes[i].parent = d0_min + 1;
+    nodes[i].mark_count = mark_count;
+    nodes[i].mark_d = d_min + 1;
   }
   else
   {
     /* no parent is found */
-    i -> mark_count = 0;
+    nodes[i].parent = NO_PARENT;
+    nodes[i].mark_count = 0;
 
     /* process neighbors */
-    for (a0=i->first; a0; a0=a0->next)
+    for (d0 = 0; d0 < NDIRS; d0++)
     {
-      j = a0 -> head;
-      if (j->is_sink && (a=j->parent))
+      j = i + offset[d0];
+      p = nodes[j].parent;
+      if (nodes[j].is_sink && p)
       {
-        if (a0->r_cap) set_active(j);
-        if (a!=TERMINAL && a!=ORPHAN && a->head==i)
+        if (r_cap[NDIRS*i+d0]) set_active(j);
+        if (p!=TERMINAL && p!=ORPHAN && p-1==(d0^1))
         {
           /* add j to the adoption list */
-          j -> parent = ORPHAN;
-          np = nodeptr_block -> New();
-          np -> ptr = j;
-          if (orphan_last) orphan_last -> next = np;
-          else             orphan_first        = np;
-          orphan_last = np;
-          np -> next = NULL;
+          nodes[j].parent = ORPHAN;
+          orphans.push_back(j);
         }
       }
     }
@@ -403,21 +372,18 @@ void Graph::process_sink_orphan(node *i)
 
 /***********************************************************************/
 
-Graph::flowtype Graph::maxflow()
+GridGraph::flowtype GridGraph::maxflow()
 {
-  node *i = NULL, *j = NULL, *current_node = NULL;
-  arc *a = NULL;
-  nodeptr *np = NULL, *np_next = NULL;
+  int i, j, d, current_node = 0, middle = 0, middle_dir = -1;
 
   maxflow_init();
-  nodeptr_block = new DBlock<nodeptr>(NODEPTR_BLOCK_SIZE, error_function);
 
   while ( 1 )
   {
     if ((i=current_node))
     {
-      i -> next = NULL; /* remove active flag */
-      if (!i->parent) i = NULL;
+      nodes[i].next = 0; /* remove active flag */
+      if (!nodes[i].parent) i = 0;
     }
     if (!i)
     {
@@ -425,193 +391,157 @@ Graph::flowtype Graph::maxflow()
     }
 
     /* growth */
-    if (!i->is_sink)
+    middle_dir = -1;
+    if (!nodes[i].is_sink)
     {
       /* grow source tree */
-      for (a=i->first; a; a=a->next)
-        if (a->r_cap)
+      for (d = 0; d < NDIRS; d++)
+        if (r_cap[NDIRS*i+d])
         {
-          j = a -> head;
-          if (!j->parent)
+          j = i + offset[d];
+          if (!nodes[j].parent)
           {
-            j -> is_sink = 0;
-            j -> parent = a -> sister;
-            j -> mark_count = i -> mark_count;
-            j -> mark_d = i -> mark_d + 1;
+            nodes[j].is_sink = 0;
+            nodes[j].parent = (d^1) + 1;
+            nodes[j].mark_count = nodes[i].mark_count;
+            nodes[j].mark_d = nodes[i].mark_d + 1;
             set_active(j);
           }
-          else if (j->is_sink) break;
-          else if (j->mark_count &&
-                   j->mark_count <= i->mark_count &&
-                   j->mark_d > i->mark_d)
+          else if (nodes[j].is_sink)
+          {
+            middle = i;
+            middle_dir = d;
+            break;
+          }
+          else if (nodes[j].mark_count &&
+                   nodes[j].mark_count <= nodes[i].mark_count &&
+                   nodes[j].mark_d > nodes[i].mark_d)
           {
             /* heuristic - trying to make the distance from 
                j to the source shorter */
-            j -> parent = a -> sister;
-            j -> mark_count = i -> mark_count;
-            j -> mark_d = i -> mark_d + 1;
+            nodes[j].parent = (d^1) + 1;
+            nodes[j].mark_count = nodes[i].mark_count;
+            nodes[j].mark_d = nodes[i].mark_d + 1;
           }
         }
     }
     else
     {
       /* grow sink tree */
-      for (a=i->first; a; a=a->next)
-        if (a->sister->r_cap)
+      for (d = 0; d < NDIRS; d++)
+      {
+        j = i + offset[d];
+        if (r_cap[NDIRS*j+(d^1)])
         {
-          j = a -> head;
-          if (!j->parent)
+          if (!nodes[j].parent)
           {
-            j -> is_sink = 1;
-            j -> parent = a -> sister;
-            j -> mark_count = i -> mark_count;
-            j -> mark_d = i -> mark_d + 1;
+            nodes[j].is_sink = 1;
+            nodes[j].parent = (d^1) + 1;
+            nodes[j].mark_count = nodes[i].mark_count;
+            nodes[j].mark_d = nodes[i].mark_d + 1;
             set_active(j);
           }
-          else if (!j->is_sink)
+          else if (!nodes[j].is_sink)
           {
-            a = a -> sister;
+            middle = j;
+            middle_dir = d^1;
             break;
           }
-          else if (j->mark_count &&
-                   j->mark_count <= i->mark_count &&
-                   j->mark_d > i->mark_d)
+          else if (nodes[j].mark_count &&
+                   nodes[j].mark_count <= nodes[i].mark_count &&
+                   nodes[j].mark_d > nodes[i].mark_d)
           {
             /* heuristic - trying to make the distance 
                from j to the sink shorter */
-            j -> parent = a -> sister;
-            j -> mark_count = i -> mark_count;
-            j -> mark_d = i -> mark_d + 1;
+            nodes[j].parent = (d^1) + 1;
+            nodes[j].mark_count = nodes[i].mark_count;
+            nodes[j].mark_d = nodes[i].mark_d + 1;
           }
         }
+      }
     }
 
-    if (a)
+    if (middle_dir >= 0)
     {
-      i -> next = i; /* set active flag */
+      nodes[i].next = i; /* set active flag */
       current_node = i;
 
       /* augmentation */
-      augment(a);
+      augment(middle, middle_dir);
       /* augmentation end */
 
       /* adoption */
-      while ((np=orphan_first))
+      while (!orphans.empty())
       {
-        np_next = np -> next;
-        np -> next = NULL;
-
-        while ((np=orphan_first))
-        {
-          orphan_first = np -> next;
-          i = np -> ptr;
-          nodeptr_block -> Delete(np);
-          if (!orphan_first) orphan_last = NULL;
-          if (i->is_sink) process_sink_orphan(i);
-          else            process_source_orphan(i);
-        }
-
-        orphan_first = np_next;
+        j = orphans.front();
+        orphans.pop_front();
+        if (nodes[j].is_sink) process_sink_orphan(j);
+        else                  process_source_orphan(j);
       }
       mark_count ++;
       /* adoption end */
     }
-    else current_node = NULL;
+    else current_node = 0;
   }
 
-  delete nodeptr_block;
-
   return flow;
 }
 
 /***********************************************************************/
 
-Graph::termtype Graph::what_segment(node_id i)
+GridGraph::termtype GridGraph::what_segment(int x, int y, int z)
 {
-  if (((node*)i)->parent && !((node*)i)->is_sink) return SOURCE;
+  node *n = &nodes[node_index(x, y, z)];
+
+  if (n->parent && !n->is_sink) return SOURCE;
   return SINK;
 }
 
 
-Graph::Graph(void (*err_function)(char *))
+GridGraph::GridGraph(int xs, int ys, int zs)
 {
-  error_function = err_function;
-  node_block = new Block<node>(NODE_BLOCK_SIZE, error_function);
-  arc_block  = new Block<arc>(NODE_BLOCK_SIZE, error_function);
+  xsize = xs + 2;
+  ysize = ys + 2;
+  zsize = zs + 2;
+  nnodes = xsize * ysize * zsize;
+  offset[0] = -1;
+  offset[1] = 1;
+  offset[2] = -xsize;
+  offset[3] = xsize;
+  offset[4] = -xsize*ysize;
+  offset[5] = xsize*ysize;
+
+  nodes = (node *)calloc(nnodes, sizeof(node));
+  r_cap = (captype *)calloc((size_t)nnodes*NDIRS, sizeof(captype));
+  if (!nodes || !r_cap)
+  {
+    printf("\n\n\a -> Error: insufficient memory for a %d x %d x %d graph.",
+           xs, ys, zs);
+    printf("\n Execution terminated!\n");
+    exit(1);
+  }
   flow = 0;
 }
 
-Graph::~Graph()
+GridGraph::~GridGraph()
 {
-  delete node_block;
-  delete arc_block;
+  free(nodes);
+  free(r_cap);
 }
 
-Graph::node_id Graph::add_node()
+void GridGraph::set_edge(int x, int y, int z, int dir, captype cap)
 {
-  node *i = node_block -> New();
-
-  i -> first = NULL;
-  i -> tr_cap = 0;
+  int i = node_index(x, y, z);
 
-  return (node_id) i;
+  r_cap[NDIRS*i+dir] = cap;
+  r_cap[NDIRS*(i+offset[dir])+(dir^1)] = cap;
 }
 
-void Graph::add_edge(node_id from, node_id to, captype cap, captype rev_cap)
-{
-  arc *a, *a_rev;
-
-  a = arc_block -> New(2);
-  a_rev = a + 1;
-
-  a -> sister = a_rev;
-  a_rev -> sister = a;
-  a -> next = ((node*)from) -> first;
-  ((node*)from) -> first = a;
-  a_rev -> next = ((node*)to) -> first;
-  ((node*)to) -> first = a_rev;
-  a -> head = (node*)to;
-  a_rev -> head = (node*)from;
-  a -> r_cap = cap;
-  a_rev -> r_cap = rev_cap;
-}
-
-void Graph::set_tweights(node_id i, captype cap_source, captype cap_sink)
+void GridGraph::set_tweights(int x, int y, int z,
+                             captype cap_source, captype cap_sink)
 {
   flow += (cap_source < cap_sink) ? cap_source : cap_sink;
-  ((node*)i) -> tr_cap = cap_source - cap_sink;
-}
-
-
-void Test_Pointer(void * p, char * _or)
-{
-  if (p == NULL)
-  {
-    printf("\n\n\a -> Error: insufficient memory.");
-    if (_or != NULL) printf("\nOrigin = %s\n", _or);
-    printf("\n Execution terminated!\n");
-    exit(1);
-  }
-}
-
-void map(int index, int *x, int *y, int *z, int xV, int yV, int zV)
-{
-  *z = index / (yV * xV);
-  *y = (index - (*z) * yV * xV) / xV;
-  *x = index - (*z) * yV * xV - (*y) * xV;
-}
-
-void map(int index, int *x, int *y, int *z, 
-         int xV, int yV, int zV, 
-         int xoff, int yoff, int zoff)
-{
-  *z = index / (yV * xV);
-  *y = (index - (*z) * yV * xV) / xV;
-  *x = index - (*z) * yV * xV - (*y) * xV;
-  //plus offset
-  *z = *z + zoff;
-  *y = *y + yoff;
-  *x = *x + xoff;
+  nodes[node_index(x, y, z)].tr_cap = cap_source - cap_sink;
 }
 
 void do_cityblock(int ***pointer, int zVol, int yVol, int xVol)
@@ -666,185 +596,6 @@ void do_cityblock(int ***pointer, int zVol, int yVol, int xVol)
   }
 }
 
-void mincut(int ***im_gcut, edgeW *hor, edgeW *ver, edgeW *tra, 
-            int length_h, int length_v, int length_t, 
-            int x_start, int y_start, int z_start, 
-            int x_end, int y_end, int z_end)
-{
-  int i, k, x, y, z, m1, m2, m3, n;
-  int *marked;
-
-  x = x_end - x_start + 1;
-  y = y_end - y_start + 1;
-  z = z_end - z_start + 1;
-  m1 = length_h;
-  m2 = length_v;
-  m3 = length_t;
-  n = 5;//number of column in edgewts matrix
-
-  /* if ((m1 >= m2) && (m1 >= m3))
-    m = m1;
-   if ((m2 >= m1) && (m2 >= m3))
-    m = m2;
-   if ((m3 >= m1) && (m3 >= m2))
-    m = m3;
-  */
-  // Flag for the indices in the matrix.
-  int sizeofMarked = x * y * z;
-  marked = new int[sizeofMarked];
-  for (i=0; i<sizeofMarked; i++) marked[i]=0;
-
-  // Graph construction
-  Graph::node_id *nodes = new Graph::node_id[x * y * z + 1];
-  //Graph::node_id nodes[max_graph_size];
-  Graph *g = new Graph();
-
-  // Create the first node
-  k = 0;
-  nodes[k] = g -> add_node();
-  g -> set_tweights(nodes[k], 400, 0); //set_tweights(node, source_weight, sink_weight);
-  marked[0] = 1;
-  k = k + 1;
-
-  //edgewts1 = (float **) calloc(m, sizeof(float *));
-  //for (i = 1; i <= m; i++)
-  // edgewts1[i] = (float *) calloc(n, sizeof(float));
-
-  /* for (i = 1; i <= m1; i++)
-   {
-    for (j = 1; j <= n; j++)
-    {
-     fscanf (fp,"%f",&edgewts1[i][j]);
-    }
-   }
-  */
-
-  // Create nodes and edges (from right to left)
-  for (i = 0; i < m1; i++)
-  {
-    if (marked[hor[i].edge1 - 1] == 0)
-    {
-      marked[hor[i].edge1 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], hor[i].bsw, hor[i].fsw);
-      k = k + 1;
-    }
-
-    if (marked[hor[i].edge2 - 1] == 0)
-    {
-      marked[hor[i].edge2 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], hor[i].bsw, hor[i].fsw);
-      k = k + 1;
-    }
-
-    g -> add_edge(nodes[hor[i].edge2 - 1], 
-                  nodes[hor[i].edge1 - 1], 
-                  hor[i].weight, 
-                  hor[i].weight);
-//  if( i % 10000 == 0 )
-//    printf("doing hor:%d; k=%d\n", i, k);
-  }
-
-
-  /* for (i = 1; i <= m2; i++)
-   {
-    for (j = 1; j <= n; j++)
-    {
-     fscanf (fp,"%f",&edgewts1[i][j]);
-    }
-   }
-  */
-  // Create nodes and edges (from bottom to top)
-  for (i = 0; i < m2; i++)
-  {
-    if (marked[ver[i].edge1 - 1] == 0)
-    {
-      marked[ver[i].edge1 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], ver[i].bsw, ver[i].fsw);
-      k = k + 1;
-    }
-
-    if (marked[ver[i].edge2 - 1] == 0)
-    {
-      marked[ver[i].edge2 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], ver[i].bsw, ver[i].fsw);
-      k = k + 1;
-    }
-
-    g -> add_edge(nodes[ver[i].edge2 - 1], 
-                  nodes[ver[i].edge1 - 1], 
-                  ver[i].weight, 
-                  ver[i].weight);
-//  if( i % 10000 == 0 )
-//    printf("doing ver:%d; k=%d\n", i, k);
-  }
-
-  /* for (i = 1; i <= m3; i++)
-   {
-    for (j = 1; j <= n; j++)
-    {
-     fscanf (fp,"%f",&edgewts1[i][j]);
-    }
-   }
-  */
-  // Create nodes and edges (from back to front)
-  for (i = 0; i < m3; i++)
-  {
-    if (marked[tra[i].edge1 - 1] == 0)
-    {
-      marked[tra[i].edge1 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], tra[i].bsw, tra[i].fsw);
-      k = k + 1;
-    }
-
-    if (marked[tra[i].edge2 - 1] == 0)
-    {
-      marked[tra[i].edge2 - 1] = 1;
-      nodes[k] = g -> add_node();
-      g -> set_tweights(nodes[k], tra[i].bsw, tra[i].fsw);
-      k = k + 1;
-    }
-
-    g -> add_edge(nodes[tra[i].edge2 - 1], 
-                  nodes[tra[i].edge1 - 1], 
-                  tra[i].weight, 
-                  tra[i].weight);
-//  if( i % 10000 == 0 )
-//    printf("doing tra:%d; k=%d\n", i, k);
-  }
-
-
-  //Graph::flowtype flow = g -> maxflow();
-  printf("now doing maxflow, be patient...\n");
-  g -> maxflow();
-
-  // Write the output of mincut to a file
-  //fp = fopen("output.txt","w");
-  //for (i = 0; i < k; i++)
-  // fprintf(fp,"%d \n", g->what_segment(nodes[i]));
-
-  i = 0;
-  for (int z = z_start; z <= z_end; z++)
-  {
-    for (int y = y_start; y <= y_end; y++)
-    {
-      for (int x = x_start; x <= x_end; x++)
-      {
-        im_gcut[z][y][x] = g->what_segment(nodes[i]);
-        i++;
-      }
-    }
-  }
-
-  delete[] marked;
-  delete g;
-  delete[] nodes;
-}
-
 void decide_bound(unsigned char ***image, double threshold, 
                   int xVol, int yVol, int zVol, 
                   int & x_start, int & x_end, 
@@ -961,8 +712,30 @@ void decide_bound(unsigned char ***image, double threshold,
   }
 }
 
+/* weight of the edge between two neighbouring voxels, from their city
+   block distances to the background and their intensities */
+static int edge_weight(int cb1, int cb2, 
+                       unsigned char val1, unsigned char val2, 
+                       double k, double threshold)
+{
+  int weight = cb1 > cb2 ? cb1 : cb2;
+  weight = weight * weight;
+  if (weight > 1 && weight < 6)
+    weight = 6;
+  if (weight != 1 && weight != 6 && weight != 0)
+  {
+    unsigned char value = val1 > val2 ? val2 : val1;
+    weight = (int)fabs(weight * (exp(k * (value - threshold)) - 1));
+  }
+  if (weight > 1 && weight < 6)
+    weight = 6;
+  if (weight == 0)
+    weight = 1000;
+  return weight;
+}
+
 double graphcut(unsigned char ***image, unsigned char ***label, 
-                int ***im_gcut, int ***foreSW, int ***backSW, 
+                int ***im_gcut, 
                 int xVol, int yVol, int zVol, 
                 double kval, double threshold, double whitemean)
 {
@@ -970,21 +743,12 @@ double graphcut(unsigned char ***image, unsigned char ***label,
   int ***cityblock;
   matrix_alloc(&cityblock, zVol, yVol, xVol);
 
-  //fore groud seed & back ground seed
   for (int z = 0; z < zVol; z++)
   {
     for (int y = 0; y < yVol; y++)
     {
       for (int x = 0; x < xVol; x++)
       {
-        if ( label[z][y][x] == 1 )
-        {
-          foreSW[z][y][x] = 4000;
-        }
-        if ( image[z][y][x] <= 0 )
-        {
-          backSW[z][y][x] = 4000;
-        }
         if ( image[z][y][x] > 0 )
         {
           cityblock[z][y][x] = -1;
@@ -1006,143 +770,75 @@ double graphcut(unsigned char ***image, unsigned char ***label,
   //printf("x_new=%d, y_new=%d, z_new=%d", xVol_new, yVol_new, zVol_new);
 
   double k = kval / (whitemean - threshold);
-  //assign memory
-  int length_h = (xVol_new-1)*yVol_new*zVol_new;
-  int length_v = xVol_new*(yVol_new-1)*zVol_new;
-  int length_t = xVol_new*yVol_new*(zVol_new-1);
-  edgeW *hor = new edgeW[length_h];
-  edgeW *ver = new edgeW[length_v];
-  edgeW *tra = new edgeW[length_t];
-  memset(hor,0,sizeof(edgeW[length_h]));
-  memset(ver,0,sizeof(edgeW[length_v]));
-  memset(tra,0,sizeof(edgeW[length_t]));
-
-  int i, j;
+  GridGraph *g = new GridGraph(xVol_new, yVol_new, zVol_new);
+
   int x, y, z;
   printf("calculating weights...\n");
-  //hor
-  for (i = 0, j = 0; i < length_h; j++)
+  for (z = 0; z < zVol_new; z++)
   {
-    map(j, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    if ( x+1 == xVol_new )
-      continue;
-    hor[i].edge1 = j + 1;
-    hor[i].edge2 = j + 1 + 1;
-    //weight
-    //map(hor[i].edge1-1, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    x += x_start;
-    y += y_start;
-    z += z_start;
-    hor[i].weight = cityblock[z][y][x] > cityblock[z][y][x+1] ? 
-      cityblock[z][y][x] : cityblock[z][y][x+1];
-    hor[i].weight = hor[i].weight * hor[i].weight;
-    if (hor[i].weight > 1 && hor[i].weight < 6)
-      hor[i].weight = 6;
-    if (hor[i].weight != 1 && hor[i].weight != 6 && hor[i].weight != 0)
+    for (y = 0; y < yVol_new; y++)
     {
-      unsigned char value = image[z][y][x] > image[z][y][x+1] ? 
-        image[z][y][x+1] : image[z][y][x];
-      hor[i].weight = (int)fabs(hor[i].weight * 
-                                (exp(k * (value - threshold)) - 1));
+      for (x = 0; x < xVol_new; x++)
+      {
+        int xi = x + x_start, yi = y + y_start, zi = z + z_start;
+
+        if (x+1 < xVol_new)
+          g->set_edge(x, y, z, 1, 
+                      edge_weight(cityblock[zi][yi][xi], 
+                                  cityblock[zi][yi][xi+1], 
+                                  image[zi][yi][xi], image[zi][yi][xi+1], 
+                                  k, threshold));
+        if (y+1 < yVol_new)
+          g->set_edge(x, y, z, 3, 
+                      edge_weight(cityblock[zi][yi][xi], 
+                                  cityblock[zi][yi+1][xi], 
+                                  image[zi][yi][xi], image[zi][yi+1][xi], 
+                                  k, threshold));
+        if (z+1 < zVol_new)
+          g->set_edge(x, y, z, 5, 
+                      edge_weight(cityblock[zi][yi][xi], 
+                                  cityblock[zi+1][yi][xi], 
+                                  image[zi][yi][xi], image[zi+1][yi][xi], 
+                                  k, threshold));
+
+        //foreground seed and background seed. The voxels of the first
+        //column take the seeds of their right neighbour, and the very
+        //first voxel is tied to the background, as the edge list based
+        //construction used to do
+        if (x == 0 && y == 0 && z == 0)
+        {
+          g->set_tweights(x, y, z, 400, 0);
+          continue;
+        }
+        if (x == 0 && xVol_new > 1)
+          xi++;
+        int fsw = label[zi][yi][xi] == 1 ? 4000 : 0;
+        int bsw = image[zi][yi][xi] <= 0 ? 4000 : 0;
+        g->set_tweights(x, y, z, bsw, fsw);
+      }
     }
-    if (hor[i].weight > 1 && hor[i].weight < 6)
-      hor[i].weight = 6;
-    if (hor[i].weight > 0 && hor[i].weight < 1)
-      hor[i].weight = 1;
-    if (hor[i].weight == 0)
-      hor[i].weight = 1000;
-    //foreground seed and background seed
-    hor[i].fsw = foreSW[z][y][x+1];
-    hor[i].bsw = backSW[z][y][x+1];
-    i++;
   }
 
-  //ver
-  for (i = 0, j = 0; i < length_v; j++)
-  {
-    map(j, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    if ( y+1 == yVol_new )
-      continue;
-    ver[i].edge1 = j + 1;
-    ver[i].edge2 = j + 1 + xVol_new;
-    //weight
-    //map(ver[i].edge1-1, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    x += x_start;
-    y += y_start;
-    z += z_start;
-    ver[i].weight = cityblock[z][y][x] > cityblock[z][y+1][x] ? 
-      cityblock[z][y][x] : cityblock[z][y+1][x];
-    ver[i].weight = ver[i].weight * ver[i].weight;
-    if (ver[i].weight > 1 && ver[i].weight < 6)
-      ver[i].weight = 6;
-    if (ver[i].weight != 1 && ver[i].weight != 6 && ver[i].weight != 0)
-    {
-      unsigned char value = image[z][y][x] > image[z][y+1][x] ? 
-        image[z][y+1][x] : image[z][y][x];
-      ver[i].weight = (int)fabs(ver[i].weight * 
-                                (exp(k * (value - threshold)) - 1));
-    }
-    if (ver[i].weight > 1 && ver[i].weight < 6)
-      ver[i].weight = 6;
-    if (ver[i].weight > 0 && ver[i].weight < 1)
-      ver[i].weight = 1;
-    if (ver[i].weight == 0)
-      ver[i].weight = 1000;
-    //foreground seed and background seed
-    ver[i].fsw = foreSW[z][y+1][x];
-    ver[i].bsw = backSW[z][y+1][x];
-    i++;
-  }
+  // -- free memory
+  matrix_free(cityblock, zVol, yVol, xVol);
+  //mincut
+  printf("doing mincut...\n");
+  printf("now doing maxflow, be patient...\n");
+  g->maxflow();
 
-  //tra
-  for (i = 0, j = 0; i < length_t; j++)
+  for (z = z_start; z <= z_end; z++)
   {
-    map(j, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    if ( z+1 == zVol_new )
-      continue;
-    tra[i].edge1 = j + 1;
-    tra[i].edge2 = j + 1 + xVol_new * yVol_new;
-    //weight
-    //map(tra[i].edge1-1, &x, &y, &z, xVol_new, yVol_new, zVol_new);
-    x += x_start;
-    y += y_start;
-    z += z_start;
-    tra[i].weight = cityblock[z][y][x] > cityblock[z+1][y][x] ? 
-      cityblock[z][y][x] : cityblock[z+1][y][x];
-    tra[i].weight = tra[i].weight * tra[i].weight;
-    if (tra[i].weight > 1 && tra[i].weight < 6)
-      tra[i].weight = 6;
-    if (tra[i].weight != 1 && tra[i].weight != 6 && tra[i].weight != 0)
+    for (y = y_start; y <= y_end; y++)
     {
-      unsigned char value = image[z][y][x] > image[z+1][y][x] ? 
-        image[z+1][y][x] : image[z][y][x];
-      tra[i].weight = (int)fabs(tra[i].weight * 
-                                (exp(k * (value - threshold)) - 1));
+      for (x = x_start; x <= x_end; x++)
+      {
+        im_gcut[z][y][x] = 
+          g->what_segment(x - x_start, y - y_start, z - z_start);
+      }
     }
-    if (tra[i].weight > 1 && tra[i].weight < 6)
-      tra[i].weight = 6;
-    if (tra[i].weight > 0 && tra[i].weight < 1)
-      tra[i].weight = 1;
-    if (tra[i].weight == 0)
-      tra[i].weight = 1000;
-    //foreground seed and background seed
-    tra[i].fsw = foreSW[z+1][y][x];
-    tra[i].bsw = backSW[z+1][y][x];
-    i++;
   }
 
-  // -- free memory
-  matrix_free(cityblock, zVol, yVol, xVol);
-  matrix_free(backSW, zVol, yVol, xVol);
-  matrix_free(foreSW, zVol, yVol, xVol);
-  //mincut
-  printf("doing mincut...\n");
-  mincut(im_gcut, hor, ver, tra, length_h, length_v, length_t, 
-         x_start, y_start, z_start, x_end, y_end, z_end);
-
-  delete[] hor;
-  delete[] ver;
-  delete[] tra;
+  delete g;
   return 0;
 }
 
@@ -18,225 +18,17 @@
  *
  */
 
-#define NODE_BLOCK_SIZE 512
-#define ARC_BLOCK_SIZE 1024
-#define NODEPTR_BLOCK_SIZE 128
-
-template <class Type> class Block
-{
-public:
-  /* Constructor. Arguments are the block size and
-     (optionally) the pointer to the function which
-     will be called if allocation failed; the message
-     passed to this function is "Not enough memory!" */
-  Block(int size, void (*err_function)(char *) = NULL)
-  {
-    first = last = NULL;
-    block_size = size;
-    error_function = err_function;
-  }
-
-  /* Destructor. Deallocates all items added so far */
-  ~Block()
-  {
-    while (first)
-    {
-      block *next = first -> next;
-      delete[] first;
-      first = next;
-    }
-  }
-
-  /* Allocates 'num' consecutive items; returns pointer
-     to the first item. 'num' cannot be greater than the
-     block size since items must fit in one block */
-  Type *New(int num = 1)
-  {
-    Type *t;
-
-    if (!last || last->current + num > last->last)
-    {
-      if (last && last->next) last = last -> next;
-      else
-      {
-        block *next = 
-          (block *) new char [sizeof(block) + (block_size-1)*sizeof(Type)];
-        if (!next)
-        {
-          if (error_function) 
-            (*error_function)((char*)"Not enough memory!");
-          exit(1);
-        }
-        if (last) last -> next = next;
-        else first = next;
-        last = next;
-        last -> current = & ( last -> data[0] );
-        last -> last = last -> current + block_size;
-        last -> next = NULL;
-      }
-    }
-
-    t = last -> current;
-    last -> current += num;
-    return t;
-  }
-
-  /* Returns the first item (or NULL, if no items were added) */
-  Type *ScanFirst()
-  {
-    scan_current_block = first;
-    if (!scan_current_block) return NULL;
-    scan_current_data = & ( scan_current_block -> data[0] );
-    return scan_current_data ++;
-  }
-
-  /* Returns the next item (or NULL, if all items have been read)
-     Can be called only if previous ScanFirst() or ScanNext()
-     call returned not NULL. */
-  Type *ScanNext()
-  {
-    if (scan_current_data >= scan_current_block -> current)
-    {
-      scan_current_block = scan_current_block -> next;
-      if (!scan_current_block) return NULL;
-      scan_current_data = & ( scan_current_block -> data[0] );
-    }
-    return scan_current_data ++;
-  }
-
-  /* Marks all elements as empty */
-  void Reset()
-  {
-    block *b;
-    if (!first) return;
-    for (b=first; ; b=b->next)
-    {
-      b -> current = & ( b -> data[0] );
-      if (b == last) break;
-    }
-    last = first;
-  }
-
-  /***********************************************************************/
-
-private:
-
-  typedef struct block_st
-  {
-    Type     *current, *last;
-    struct block_st   *next;
-    Type     data[1];
-  }
-  block;
-
-  int  block_size;
-  block *first;
-  block *last;
-
-  block *scan_current_block;
-  Type *scan_current_data;
-
-  void (*error_function)(char *);
-};
-
-/***********************************************************************/
-/***********************************************************************/
-/***********************************************************************/
-
-template <class Type> class DBlock
-{
-public:
-  /* Constructor. Arguments are the block size and
-     (optionally) the pointer to the function which
-     will be called if allocation failed; the message
-     passed to this function is "Not enough memory!" */
-  DBlock(int size, void (*err_function)(char *) = NULL)
-  {
-    first = NULL;
-    first_free = NULL;
-    block_size = size;
-    error_function = err_function;
-  }
-
-  /* Destructor. Deallocates all items added so far */
-  ~DBlock()
-  {
-    while (first)
-    {
-      block *next = first -> next;
-      delete[] first;
-      first = next;
-    }
-  }
-
-  /* Allocates one item */
-  Type *New()
-  {
-    block_item *item;
-
-    if (!first_free)
-    {
-      block *next = first;
-      first = 
-        (block *) new char [sizeof(block) + (block_size-1)*sizeof(block_item)];
-      if (!first)
-      {
-        if (error_function) 
-          (*error_function)((char*)"Not enough memory!");
-        exit(1);
-      }
-      first_free = & (first -> data[0] );
-      for (item=first_free; item<first_free+block_size-1; item++)
-        item -> next_free = item + 1;
-      item -> next_free = NULL;
-      first -> next = next;
-    }
-
-    item = first_free;
-    first_free = item -> next_free;
-    return (Type *) item;
-  }
-
-  /* Deletes an item allocated previously */
-  void Delete(Type *t)
-  {
-    ((block_item *) t) -> next_free = first_free;
-    first_free = (block_item *) t;
-  }
-
-  /***********************************************************************/
-
-private:
-
-  typedef union block_item_st
-  {
-    Type   t;
-    block_item_st *next_free;
-  } block_item;
-
-  typedef struct block_st
-  {
-    struct block_st   *next;
-    block_item    data[1];
-  }
-  block;
-
-  int   block_size;
-  block  *first;
-  block_item *first_free;
-
-  void (*error_function)(char *);
-};
-
-
-
+#include <deque>
 
 /*
- Nodes, arcs and pointers to nodes are
- added in blocks for memory and time efficiency.
- Below are numbers of items in blocks
+ Boykov-Kolmogorov max-flow specialised for a regular 3-D grid with
+ 6-connectivity. Nodes are voxels and are addressed by their position;
+ arcs to the neighbours are implicit, only their residual capacities are
+ stored, six per node next to each other. The grid is padded by one
+ voxel on every side so that every interior node has all six neighbours;
+ the padding nodes have no capacities and never join a tree.
 */
-class Graph
+class GridGraph
 {
 public:
   typedef enum
@@ -245,40 +37,32 @@ public:
     SINK = 1
   } termtype; /* terminals */
 
-  /* Type of edge weights.
-     Can be changed to char, int, float, double, ... */
-  typedef short captype;
+  /* Type of edge weights */
+  typedef int captype;
   /* Type of total flow */
-  typedef int flowtype;
-
-  typedef void * node_id;
+  typedef double flowtype;
 
-  /* interface functions */
+  /* arc directions: -x, +x, -y, +y, -z, +z. The reverse of d is d^1 */
+  enum { NDIRS = 6 };
 
-  /* Constructor. Optional argument is the pointer to the
-     function which will be called if an error occurs;
-     an error message is passed to this function. If this
-     argument is omitted, exit(1) will be called. */
-  Graph(void (*err_function)(char *) = NULL);
+  /* Constructor. Allocates an xsize x ysize x zsize grid without any
+     edges; exits if there is not enough memory. */
+  GridGraph(int xsize, int ysize, int zsize);
 
   /* Destructor */
-  ~Graph();
+  ~GridGraph();
 
-  /* Adds a node to the graph */
-  node_id add_node();
+  /* Sets the weights of the edges between (x,y,z) and its neighbour in
+     direction 'dir' (one of 1, 3 or 5), 'cap' in both directions */
+  void set_edge(int x, int y, int z, int dir, captype cap);
 
-  /* Adds a bidirectional edge between 'from' and 'to'
-     with the weights 'cap' and 'rev_cap' */
-  void add_edge(node_id from, node_id to, captype cap, captype rev_cap);
-
-  /* Sets the weights of the edges 'SOURCE->i' and 'i->SINK'
-     Can be called at most once for each node.
-     If this function is not called for 'i', then these edges are not present */
-  void set_tweights(node_id i, captype cap_source, captype cap_sink);
+  /* Sets the weights of the edges 'SOURCE->(x,y,z)' and '(x,y,z)->SINK'
+     Can be called at most once for each node. */
+  void set_tweights(int x, int y, int z, captype cap_source, captype cap_sink);
 
   /* After the maxflow is computed, this function returns to which
-     segment the node 'i' belongs (Graph::SOURCE or Graph::SINK) */
-  termtype what_segment(node_id i);
+     segment the node (x,y,z) belongs (GridGraph::SOURCE or GridGraph::SINK) */
+  termtype what_segment(int x, int y, int z);
 
   /* Computes the maxflow. Can be called only once. */
   flowtype maxflow();
@@ -288,70 +72,50 @@ public:
   /***********************************************************************/
 
 private:
-  /* internal variables and functions */
-
-  struct arc_st;
-
-  /* node structure */
+  /* node structure. Nodes are referred to by index, 0 is a padding node
+     and doubles as the null index. */
   typedef struct node_st
   {
-    arc_st   *first;  /* first outcoming arc */
-
-    arc_st   *parent; /* node's parent */
-    node_st   *next;  /* pointer to the next active node
-                    (or to itself if it is the last node in the list) */
+    int    next;  /* index of the next active node
+                    (or of itself if it is the last node in the list) */
     int    mark_count; /* d is valid if mark_count == ::mark_count */
     int    mark_d;  /* distance to the terminal */
-    short   is_sink; /* flag showing whether the node is in the source or in the sink tree */
-
     captype   tr_cap;  /* if tr_cap > 0 then tr_cap is residual capacity of the arc SOURCE->node
                     otherwise         -tr_cap is residual capacity of the arc node->SINK */
+    char   parent; /* 1 + direction of the arc to the node's parent,
+                      or NO_PARENT, TERMINAL, ORPHAN */
+    char   is_sink; /* flag showing whether the node is in the source or in the sink tree */
   }
   node;
 
-  /* arc structure */
-  typedef struct arc_st
-  {
-    node_st   *head;  /* node the arc points to */
-    arc_st   *next;  /* next arc with the same originating node */
-    arc_st   *sister; /* reverse arc */
-
-    captype   r_cap;  /* residual capacity */
-  }
-  arc;
-
-  /* 'pointer to node' structure */
-  typedef struct nodeptr_st
-  {
-    node_st   *ptr;
-    nodeptr_st  *next;
-  }
-  nodeptr;
-
-  Block<node>   *node_block;
-  Block<arc>   *arc_block;
-  DBlock<nodeptr>  *nodeptr_block;
+  int    xsize, ysize, zsize; /* size including the padding */
+  int    nnodes;
+  int    offset[NDIRS];  /* index offset of the neighbour in each direction */
 
-  void (*error_function)(char *); /* this function is called if a error occurs,
-                 with a corresponding error message
-                 (or exit(1) is called if it's NULL) */
+  node    *nodes;
+  captype *r_cap;  /* residual capacity of arc (i,d) is r_cap[NDIRS*i+d] */
 
   flowtype   flow;  /* total flow */
 
   /***********************************************************************/
 
-  node    *queue_first[2], *queue_last[2]; /* list of active nodes */
-  nodeptr    *orphan_first, *orphan_last;  /* list of pointers to orphans */
+  int     queue_first[2], queue_last[2]; /* list of active nodes */
+  std::deque<int> orphans;      /* list of orphans */
   int     mark_count;       /* monotonically increasing global counter */
 
   /***********************************************************************/
 
+  int node_index(int x, int y, int z)
+  {
+    return ((z+1)*ysize + y+1)*xsize + x+1;
+  }
+
   /* functions for processing active list */
-  void set_active(node *i);
-  node *next_active();
+  void set_active(int i);
+  int next_active();
 
   void maxflow_init();
-  void augment(arc *middle_arc);
-  void process_source_orphan(node *i);
-  void process_sink_orphan(node *i);
+  void augment(int middle, int middle_dir);
+  void process_source_orphan(int i);
+  void process_sink_orphan(int i);
 };
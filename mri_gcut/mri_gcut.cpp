@@ -396,14 +396,8 @@ int main(int argc, char *argv[])
   }
 
   //new code
-  int ***foregroundseedwt;
-  int ***backgroundseedwt;
-  matrix_alloc(&foregroundseedwt, d, h, w);
-  matrix_alloc(&backgroundseedwt, d, h, w);
-
   double kval = 2.3;
   graphcut(mri->slices, label, im_gcut,
-           foregroundseedwt, backgroundseedwt,
            w, h, d, kval, threshold, whitemean);
   printf("g-cut done!\npost-processing...\n");
   //printf("_test: %f\n", _test);
@@ -728,6 +728,10 @@ float ThreshList[4] = {1.3,  2.0,  2.3,  3.0};
 int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
+// Volume clustering at all thresholds of the loop in one sweep
+int UseThreshSweep = 0;
+double ThreshAdjList[4];
+int SweepNClusters[3][20][4], SweepMaxCount[3][20][4];
 
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
@@ -1671,6 +1675,14 @@ int main(int argc, char **argv) {
       }
     }
 
+    // In the volume, sig only depends on the sign and contrast, so each
+    // is clustered at all thresholds at once. Not for mc-z/mc-t with
+    // more than one contrast: z is resynthesized for each contrast on
+    // the first threshold only, so sig changes between thresholds.
+    UseThreshSweep = (surf == NULL && nThreshList > 1 && Gdiag_no <= 0 &&
+		      (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm") ||
+		       mriglm->glm->ncontrasts == 1));
+
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     TimerStart(&mytimer) ;
     for (nthsim=0; nthsim < nsim; nthsim++) {
@@ -1805,11 +1817,30 @@ int main(int argc, char **argv) {
 	    else {
 	      // volume clustering -------------
 	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
+	      if(UseThreshSweep){
+		if(nthThresh == 0){
+		  for(m=0; m < nThreshList; m++){
+		    if(csd->threshsign == 0) ThreshAdjList[m] = ThreshList[m];
+		    else ThreshAdjList[m] = ThreshList[m] - log10(2.0); // one-sided test
+		  }
+		  if(clustThresholdSweep(sig, 0, csd->threshsign, mriglm->mask, 0,
+					 nThreshList, ThreshAdjList,
+					 SweepNClusters[nthSign][n],
+					 SweepMaxCount[nthSign][n], NULL)){
+		    printf("ERROR: clustering at %d thresholds\n",nThreshList);
+		    exit(1);
+		  }
+		}
+		nClusters = SweepNClusters[nthSign][n][nthThresh];
+		csize = voxelsize*SweepMaxCount[nthSign][n][nthThresh];
+	      }
+	      else {
+		VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
+						mriglm->mask, &nClusters, NULL);
+		csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+		if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+		clustFreeClusterList(&VolClustList,nClusters);
+	      }
 	    }
 	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
 			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
@@ -675,8 +675,8 @@ int main(int argc, char *argv[])
       if(Gdiag_no > 0) PrintMemUsage(stdout);
       PrintMemUsage(logfp);
       TimerStart(&mytimer);
-      MatrixFree(&gtm->X);
-      MatrixFree(&gtm->X0);
+      GTMsparseFree(&gtm->X);
+      GTMsparseFree(&gtm->X0);
       GTMbuildX(gtm);
       if(gtm->X==NULL) exit(1);
       printf(" gtm build time %4.1f sec\n",TimerStop(&mytimer)/1000.0);fflush(stdout);
@@ -694,12 +694,18 @@ int main(int argc, char *argv[])
   //printf("Freeing segpvf\n"); fflush(stdout);
   //MRIfree(&gtm->segpvf);
   if(SaveX0) {
+    MATRIX *X0dense;
     printf("Writing X0 to %s\n",Xfile);
-    MatlabWrite(gtm->X0, X0file,"X0");
+    X0dense = GTMsparseToDense(gtm->X0,NULL);
+    MatlabWrite(X0dense, X0file,"X0");
+    MatrixFree(&X0dense);
   }
   if(SaveX) {
+    MATRIX *Xdense;
     printf("Writing X to %s\n",Xfile);
-    MatlabWrite(gtm->X, Xfile,"X");
+    Xdense = GTMsparseToDense(gtm->X,NULL);
+    MatlabWrite(Xdense, Xfile,"X");
+    MatrixFree(&Xdense);
   }
 
   printf("Solving ...\n");
@@ -715,13 +721,12 @@ int main(int argc, char *argv[])
   PrintMemUsage(logfp);
 
   if(gtm->X0 && DoGTMMat){
-    MATRIX *X0tX0, *X0t,*X0tX,*iX0tX0,*gtmmat;
+    MATRIX *X0tX0, *X0tX,*iX0tX0,*gtmmat;
     printf("Computing actual GTM Matrix\n"); fflush(stdout);
-    X0tX0 = MatrixMtM(gtm->X0,NULL);
+    X0tX0 = GTMsparseMtM(gtm->X0,NULL);
     iX0tX0 = MatrixInverse(X0tX0,NULL);
 
-    X0t = MatrixTranspose(gtm->X0,NULL);
-    X0tX = MatrixMultiplyD(X0t,gtm->X,NULL);
+    X0tX = GTMsparseMtN(gtm->X0,gtm->X,NULL);
     gtmmat = MatrixMultiplyD(iX0tX0,X0tX,NULL);
     sprintf(tmpstr,"%s/gtm.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
@@ -729,7 +734,6 @@ int main(int argc, char *argv[])
     sprintf(tmpstr,"%s/gtm.inv.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
     printf("done computing gtm matrix\n"); fflush(stdout);
-    MatrixFree(&X0t);
     MatrixFree(&X0tX0);
     MatrixFree(&X0tX);
     MatrixFree(&gtmmat);
@@ -820,7 +824,7 @@ int main(int argc, char *argv[])
   MRIfree(&mritmp);
 
   printf("Freeing X\n");
-  MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->X);
 
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
@@ -899,7 +903,7 @@ int main(int argc, char *argv[])
   if(yhat0File) MRIwrite(gtm->ysynth,yhat0File);
   
   printf("Freeing X0\n");
-  MatrixFree(&gtm->X0);
+  GTMsparseFree(&gtm->X0);
 
 
   if(yhatFile|| yhatFullFoVFile){
@@ -2279,30 +2283,23 @@ MRI *GTMsimAnatSeg(GTM *gtm)
  */
 int GTMsom(GTM *gtm)
 {
-  int rthseg, cthseg, k, f, c,r,s,segid;
+  int rthseg, cthseg, n, f, *row2seg;
   double val,cbeta,sum;
 
   gtm->som = MatrixAlloc(gtm->nsegs,gtm->nsegs,MATRIX_REAL);
 
   f = 0; // only one frame with the matrix
+  row2seg = GTMrow2nthseg(gtm); // crs order is important here!
   for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
-    k = 0;
     cbeta = gtm->beta->rptr[cthseg+1][f+1];
-    for(s=0; s < gtm->yvol->depth; s++){ // crs order is important here!
-      for(c=0; c < gtm->yvol->width; c++){
-	for(r=0; r < gtm->yvol->height; r++){
-	  if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	  val = cbeta*gtm->X->rptr[k+1][cthseg+1];
-	  segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
-	  if(segid != 0) {
-	    rthseg = GTMsegid2nthseg(gtm,segid);
-	    gtm->som->rptr[rthseg+1][cthseg+1] += val;
-	  }
-	  k++;
-	}
-      }
+    for(n=0; n < gtm->X->nnz[cthseg]; n++){
+      rthseg = row2seg[gtm->X->row[cthseg][n]];
+      if(rthseg < 0) continue;
+      val = cbeta*gtm->X->val[cthseg][n];
+      gtm->som->rptr[rthseg+1][cthseg+1] += val;
     }
   } // cthseg
+  free(row2seg);
     
   /* Normalize SOM(rNoPVC,cGTM) is the proportion that cGTM
      contributes to rNoPVC, ie, it is the amount of spill-out of
@@ -173,10 +173,11 @@ int main(int argc, char *argv[]) {
   MRI *z, *zabs=NULL, *sig=NULL, *p=NULL;
   int FreeMask = 0;
   int nthSign, nthFWHM, nthThresh;
-  double sigmax, zmax, threshadj, csize, csizeavg, cweightvtx, searchspace,avgvtxarea;
+  double sigmax, zmax, csize, csizeavg, cweightvtx, searchspace,avgvtxarea;
   int csizen;
   int nClusters, cmax,rmax,smax;
-  SURFCLUSTERSUM *SurfClustList;
+  double ThreshAdjList[100], MaxAreaList[100], MaxWeightVtxList[100];
+  int MaxCountList[100], nClustersList[100];
   struct timeb  mytimer;
   LABEL *clabel;
   FILE *fp, *fpLog=NULL;
@@ -462,22 +463,28 @@ int main(int argc, char *argv[]) {
 	ppSig = ppSig0;
 	for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
 
+	// Surface clustering at all thresholds in one sweep
 	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
 	  csd = csdList[nthFWHM][nthThresh][nthSign];
-
-	  // Surface clustering
 	  // Set the threshold
-	  if(csd->threshsign == 0) threshadj = csd->thresh;
-	  else threshadj = csd->thresh - log10(2.0); // one-sided test
-	  // Compute clusters
-	  SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						0,&nClusters,NULL);
+	  if(csd->threshsign == 0) ThreshAdjList[nthThresh] = csd->thresh;
+	  else ThreshAdjList[nthThresh] = csd->thresh - log10(2.0); // one-sided test
+	}
+	if(sclustThresholdSweep(surf, csd->threshsign, nThreshList, ThreshAdjList,
+				nClustersList, MaxAreaList, MaxCountList, MaxWeightVtxList)){
+	  printf("ERROR: clustering at %d thresholds\n",nThreshList);
+	  exit(1);
+	}
+
+	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+	  csd = csdList[nthFWHM][nthThresh][nthSign];
+	  nClusters = nClustersList[nthThresh];
 	  // Actual area of cluster with max area
-	  csize  = sclustMaxClusterArea(SurfClustList, nClusters);
+	  csize  = MaxAreaList[nthThresh];
 	  // Number of vertices of cluster with max number of vertices. 
 	  // Note: this may be a different cluster from above!
-	  csizen = sclustMaxClusterCount(SurfClustList, nClusters);
-	  cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
+	  csizen = MaxCountList[nthThresh];
+	  cweightvtx = MaxWeightVtxList[nthThresh];
 	  // Area of this cluster based on average vertex area. This just scales
 	  // the number of vertices.
 	  csizeavg = csizen * avgvtxarea;
@@ -970,6 +970,11 @@ get_option(int argc, char *argv[])
   {
     usage_exit(0);
   }
+  else if (!stricmp(option, "soap_mg"))
+  {
+    MRIsetSoapBubbleEngine(SOAP_ENGINE_MULTIGRID) ;
+    printf( "using multigrid solver for soap bubble interpolation...\n") ;
+  }
   else if (!stricmp(option, "no1d"))
   {
     no1d = 1 ;
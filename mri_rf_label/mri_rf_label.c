@@ -578,6 +578,93 @@ compute_conditional_density( MATRIX *m_inv_cov,
 }
 
 
+/*
+  voxels are classified in blocks: the feature vectors of RF_BLOCK_SIZE
+  voxels are gathered serially and then labeled in one (parallel) call
+  to RFclassifyBatch.
+*/
+#define RF_BLOCK_SIZE 4096
+
+typedef struct
+{
+  int    nvox ;
+  int    *x, *y, *z ;
+  double *features ;     // RF_BLOCK_SIZE x nfeatures
+  int    *labels ;
+  double *pvals ;
+} RF_VOXEL_BLOCK ;
+
+static RF_VOXEL_BLOCK *
+alloc_voxel_block(int nfeatures)
+{
+  RF_VOXEL_BLOCK *vb ;
+
+  vb = (RF_VOXEL_BLOCK *)calloc(1, sizeof(RF_VOXEL_BLOCK)) ;
+  if (vb)
+  {
+    vb->x = (int *)calloc(RF_BLOCK_SIZE, sizeof(int)) ;
+    vb->y = (int *)calloc(RF_BLOCK_SIZE, sizeof(int)) ;
+    vb->z = (int *)calloc(RF_BLOCK_SIZE, sizeof(int)) ;
+    vb->labels = (int *)calloc(RF_BLOCK_SIZE, sizeof(int)) ;
+    vb->pvals = (double *)calloc(RF_BLOCK_SIZE, sizeof(double)) ;
+    vb->features = (double *)calloc((size_t)RF_BLOCK_SIZE*nfeatures, sizeof(double)) ;
+  }
+  if (vb == NULL || !vb->x || !vb->y || !vb->z || !vb->labels || !vb->pvals || !vb->features)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d x %d feature block",
+	      Progname, RF_BLOCK_SIZE, nfeatures) ;
+  return(vb) ;
+}
+
+static void
+free_voxel_block(RF_VOXEL_BLOCK **pvb)
+{
+  RF_VOXEL_BLOCK *vb = *pvb ;
+
+  *pvb = NULL ;
+  free(vb->x) ; free(vb->y) ; free(vb->z) ;
+  free(vb->labels) ; free(vb->pvals) ; free(vb->features) ;
+  free(vb) ;
+}
+
+// write the labels of a classified block of candidate WMSA voxels
+static int
+set_wmsa_block_labels(RF_VOXEL_BLOCK *vb, MRI *mri_labeled, MRI *mri_pvals)
+{
+  int i ;
+
+  for (i = 0 ; i < vb->nvox ; i++)
+  {
+    if (vb->labels[i] > 0 && vb->pvals[i] > wmsa_thresh)
+      MRIsetVoxVal(mri_labeled, vb->x[i], vb->y[i], vb->z[i], 0, vb->labels[i]) ;
+    MRIsetVoxVal(mri_pvals, vb->x[i], vb->y[i], vb->z[i], 2, vb->pvals[i]) ;
+  }
+  vb->nvox = 0 ;
+  return(NO_ERROR) ;
+}
+
+// write the new labels of a block of voxels next to WMSAs and count the changes
+static int
+set_relabeled_block(RF_VOXEL_BLOCK *vb, MRI *mri_orig_labeled, MRI *mri_labeled,
+		    int *pnon, int *pnoff, int *pnunchanged)
+{
+  int i, label, new_label ;
+
+  for (i = 0 ; i < vb->nvox ; i++)
+  {
+    label = MRIgetVoxVal(mri_orig_labeled, vb->x[i], vb->y[i], vb->z[i], 0) ;
+    new_label = vb->labels[i] ;
+    MRIsetVoxVal(mri_labeled, vb->x[i], vb->y[i], vb->z[i], 0, new_label) ;
+    if (new_label == label)
+      (*pnunchanged)++ ;
+    else if (new_label > 0)
+      (*pnon)++ ;
+    else
+      (*pnoff)++ ;
+  }
+  vb->nvox = 0 ;
+  return(NO_ERROR) ;
+}
+
 static MRI *
 label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
 			 float wm_thresh, MRI *mri_in, MRI *mri_labeled, int wmsa_whalf, MRI *mri_aseg, 
@@ -586,6 +673,7 @@ label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
   int     x, y, z, wsize, label ;
   double  *feature, xatlas, yatlas, zatlas, pval ;
   MRI     *mri_wmsa_possible, *mri_pvals ;
+  RF_VOXEL_BLOCK *vb ;
 
   wsize = nint(pow((rf->nfeatures-3)/mri_in->nframes, 1.0/3)) ;
   if (mri_labeled == NULL)
@@ -604,9 +692,7 @@ label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
   for ( ; wmsa_whalf > 0 ; wmsa_whalf--)
     MRIdilate(mri_wmsa_possible, mri_wmsa_possible) ;
 
-  feature = calloc(rf->nfeatures, sizeof(double)) ;
-  if (feature == NULL)
-    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d-len feature vector", rf->nfeatures) ;
+  vb = alloc_voxel_block(rf->nfeatures) ;
 
   if (Gx >= 0)    // diagnostics
   {
@@ -663,6 +749,7 @@ label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
 	  continue ;
 	}
 	TransformSourceVoxelToAtlas(transform, mri_in, x, y, z, &xatlas, &yatlas, &zatlas) ;
+	feature = vb->features + (size_t)vb->nvox*rf->nfeatures ;
 	extract_feature(mri_in, wsize, x, y, z, feature, xatlas, yatlas, zatlas) ;
 	if (mri_aseg)
 	  feature[rf->nfeatures-4] = MRIcountCSFInNbhd(mri_aseg, 5, x, y, z) ;
@@ -681,16 +768,23 @@ label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
 	  printf("\n") ;
 	  Gdiag |= DIAG_VERBOSE ;
 	  DiagBreak() ;
-	}
-	label = RFclassify(rf, feature, &pval, -1);
-	if (label > 0)
-	  DiagBreak() ;
-	if (label > 0 && pval > wmsa_thresh)
-	  MRIsetVoxVal(mri_labeled, x, y, z, 0, label) ;
-	MRIsetVoxVal(mri_pvals, x, y, z, 2, pval) ;
-	if (x == Gx && y == Gy && z == Gz)
+	  pval = 0 ;
+	  label = RFclassify(rf, feature, &pval, -1);
+	  if (label > 0 && pval > wmsa_thresh)
+	    MRIsetVoxVal(mri_labeled, x, y, z, 0, label) ;
+	  MRIsetVoxVal(mri_pvals, x, y, z, 2, pval) ;
 	  Gdiag &= ~DIAG_VERBOSE ;
+	  continue ;
+	}
+	vb->x[vb->nvox] = x ; vb->y[vb->nvox] = y ; vb->z[vb->nvox] = z ;
+	if (++vb->nvox == RF_BLOCK_SIZE)
+	{
+	  RFclassifyBatch(rf, vb->features, vb->nvox, vb->labels, vb->pvals) ;
+	  set_wmsa_block_labels(vb, mri_labeled, mri_pvals) ;
+	}
       }
+  RFclassifyBatch(rf, vb->features, vb->nvox, vb->labels, vb->pvals) ;
+  set_wmsa_block_labels(vb, mri_labeled, mri_pvals) ;
 
   if (Gx >= 0)
   {
@@ -701,16 +795,17 @@ label_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca,
     *pmri_pvals = mri_pvals ;
   else
     MRIfree(&mri_pvals) ;
-  free(feature) ; MRIfree(&mri_wmsa_possible) ;
+  free_voxel_block(&vb) ; MRIfree(&mri_wmsa_possible) ;
   return(mri_labeled) ;
 }
 static MRI *
 relabel_wmsa_nbrs_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GCA *gca, 
 				     MRI *mri_in, MRI *mri_labeled)
 {
-  int     x, y, z, wsize, label, non, noff, nunchanged = 0, new_label, total ;
+  int     x, y, z, wsize, label, non, noff, nunchanged = 0, total ;
   double  *feature, pval ;
   MRI     *mri_mask, *mri_orig_labeled ;
+  RF_VOXEL_BLOCK *vb ;
 
   wsize = nint(pow((rf->nfeatures-3)/mri_in->nframes, 1.0/3)) ;
   if (mri_labeled == NULL)
@@ -722,9 +817,7 @@ relabel_wmsa_nbrs_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GC
   mri_mask = MRIcopy(mri_labeled, NULL) ;
   MRIdilate(mri_mask, mri_mask) ;  // nbrs
 
-  feature = calloc(rf->nfeatures, sizeof(double)) ;
-  if (feature == NULL)
-    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d-len feature vector", rf->nfeatures) ;
+  vb = alloc_voxel_block(rf->nfeatures) ;
 
   if (Gx >= 0)    // diagnostics
   {
@@ -770,6 +863,7 @@ relabel_wmsa_nbrs_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GC
 	    MRIgetVoxVal(mri_mask, x, y, z, 0) == 0)
 	  continue ;
 	
+	feature = vb->features + (size_t)vb->nvox*rf->nfeatures ;
 	extract_feature(mri_in, wsize, x, y, z, feature, 0, 0, 0) ;
 	feature[rf->nfeatures-3] = 100*gm_prior(gca, mri_in, transform, x, y, z) ;
 	feature[rf->nfeatures-2] = 100*wm_prior(gca, mri_in, transform, x, y, z) ;
@@ -785,28 +879,33 @@ relabel_wmsa_nbrs_with_random_forest(RANDOM_FOREST *rf, TRANSFORM *transform, GC
 	  Gdiag |= DIAG_VERBOSE ;
 	  DiagBreak() ;
 	}
-	new_label = RFclassify(rf, feature, &pval, -1);
-	if (x == Gx && y == Gy && z == Gz)
-	  printf("\nlabel = %d, pval = %2.2f\n", new_label, pval) ;
-	if (new_label > 0)
-	  DiagBreak() ;
-	MRIsetVoxVal(mri_labeled, x, y, z, 0, new_label) ;
-	if (new_label == label)
-	  nunchanged++ ;
-	else if (new_label > 0)
-	  non++ ;
-	else
-	  noff++ ;
+	vb->x[vb->nvox] = x ; vb->y[vb->nvox] = y ; vb->z[vb->nvox] = z ;
 	if (x == Gx && y == Gy && z == Gz)
+	{
+	  // classify the diagnostic voxel by itself so the tree walk is printed
+	  RFclassifyBatch(rf, vb->features, vb->nvox, vb->labels, vb->pvals) ;
+	  pval = 0 ;
+	  vb->labels[vb->nvox] = RFclassify(rf, feature, &pval, -1);
+	  printf("\nlabel = %d, pval = %2.2f\n", vb->labels[vb->nvox], pval) ;
 	  Gdiag &= ~DIAG_VERBOSE ;
+	  vb->nvox++ ;
+	  set_relabeled_block(vb, mri_orig_labeled, mri_labeled, &non, &noff, &nunchanged) ;
+	}
+	else if (++vb->nvox == RF_BLOCK_SIZE)
+	{
+	  RFclassifyBatch(rf, vb->features, vb->nvox, vb->labels, vb->pvals) ;
+	  set_relabeled_block(vb, mri_orig_labeled, mri_labeled, &non, &noff, &nunchanged) ;
+	}
       }
+  RFclassifyBatch(rf, vb->features, vb->nvox, vb->labels, vb->pvals) ;
+  set_relabeled_block(vb, mri_orig_labeled, mri_labeled, &non, &noff, &nunchanged) ;
 
   total = non+noff+nunchanged ;
   printf("%2.0f%% (%d) WMSA added and %2.0f%% (%d) removed, %2.0f%% (%d)\n", 
 	 100.0*(float)non/total, non, 
 	 100.0*(float)noff/total, noff, 
 	 100.0*(float)nunchanged/total, nunchanged) ; 
-  free(feature) ; MRIfree(&mri_mask) ; MRIfree(&mri_orig_labeled) ;
+  free_voxel_block(&vb) ; MRIfree(&mri_mask) ; MRIfree(&mri_orig_labeled) ;
   return(mri_labeled) ;
 }
 
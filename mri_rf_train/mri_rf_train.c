@@ -565,6 +565,7 @@ main(int argc, char *argv[])
       rf = train_rforest_with_wmsa_nbrs(mri_inputs, mri_segs, transforms, nsubjects, gca, &parms) ;
     else
       rf = train_rforest(mri_inputs, mri_segs, transforms, nsubjects, gca, &parms, wm_thresh,wmsa_whalf) ;
+    RFcompile(rf) ;  // store the flattened forest (and exact thresholds) with it
     printf("writing random forest to %s\n", out_fname) ;
     if (RFwrite(rf, out_fname) != NO_ERROR)
       ErrorExit
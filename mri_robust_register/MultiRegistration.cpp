@@ -62,6 +62,14 @@ extern "C"
 
 using namespace std;
 
+// free a Gaussian pyramid that was shared with the registrations
+static void freeGP(vector<MRI*>& p)
+{
+  for (unsigned int i = 0; i < p.size(); i++)
+    MRIfree(&p[i]);
+  p.clear();
+}
+
 void MultiRegistration::clear()
 {
   if (mri_mean)
@@ -375,6 +383,7 @@ void MultiRegistration::initRegistration(RegRobust & R)
   R.setCost(Registration::ROB);
   R.setSaturation(sat);
   R.setDoublePrec(doubleprec);
+  R.setMatrixFree(matrixfree);
   //R.setDebug(debug);
 
   if (subsamplesize > 0)
@@ -575,6 +584,15 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
   // the methods are: maxit 3, maxit 2, maxit 1, subsample 180
   int noxformits[4] =
   { 3, 1, 0, 0 };
+
+  // Gaussian pyramids of the resampled inputs are only needed for the
+  // multiresolution registration or the saturation search. The template
+  // geometry does not change, so they are built once and kept across the
+  // iterations (the keys tell us if a registration resampled differently).
+  bool usegp = satit || !(nomulti || iscaleonly);
+  vector<vector<MRI*> > gpmov(nin);
+  vector<Registration::GPKey> gpmovkeys(nin);
+
   while (itcount < itmax && maxchange > eps)
   {
     itcount++;
@@ -599,6 +617,10 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
 
     // register all inputs to mean
     vector<double> dists(nin, 1000); // should be larger than maxchange!
+    // the template pyramid is built by the first registration and shared
+    // by all others that resample the template the same way
+    vector<MRI*> gpmean;
+    Registration::GPKey gpmeankey;
 #ifdef HAVE_OPENMP
 #pragma omp parallel for schedule(static,1)
 #endif
@@ -616,6 +638,31 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
 //      R.setTarget(mri_mean, fixvoxel, keeptype); // gaussian pyramid will be constructed for
 //                                                 // each Rv[i], could be optimized
       R.setSourceAndTarget(mri_mov[i],mri_mean,keeptype);
+      if (usegp)
+      {
+        Registration::GPKey tkey = R.getTargetGPKey();
+#ifdef HAVE_OPENMP
+#pragma omp critical(gpmean)
+#endif
+        {
+          if (gpmean.empty())
+          {
+            gpmean = R.buildTargetGP(tkey.limits);
+            gpmeankey = tkey;
+          }
+        }
+        if (tkey == gpmeankey)
+          R.setTargetGP(gpmean);
+
+        Registration::GPKey skey = R.getSourceGPKey();
+        if (gpmov[i].empty() || !(skey == gpmovkeys[i]))
+        {
+          freeGP(gpmov[i]);
+          gpmov[i] = R.buildSourceGP(skey.limits);
+          gpmovkeys[i] = skey;
+        }
+        R.setSourceGP(gpmov[i]);
+      }
 
       ostringstream oss;
       oss << outdir << "tp" << i + 1 << "_to_template-it" << itcount;
@@ -655,16 +702,19 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       if (satit)
         R.findSaturation();
 
+      if (nomulti || iscaleonly)
+      {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif 
-      if (nomulti || iscaleonly)
-      {
         cout << " - running high-res registration on TP " << i + 1 << "..." << endl;
         R.computeIterativeRegistration(iterate, epsit); 
       }
       else
       {
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif 
         cout << " - running multi-resolutional registration on TP " << i + 1 << "..." << endl;
         R.computeMultiresRegistration(maxres, iterate, epsit);
       }
@@ -707,12 +757,14 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
             MyMatrix::AffineTransDistSq(lastlta->xforms[0].m_L,
                 ltas[i]->xforms[0].m_L));
         LTAfree(&lastlta);
-        if (dists[i] > maxchange)
-          maxchange = dists[i];
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
+        {
+          if (dists[i] > maxchange)
+            maxchange = dists[i];
+          cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
+        }
       }
 
       // create warps: warp mov to mean
@@ -840,6 +892,7 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       }
 
     } // for loop end (all timepoints)
+    freeGP(gpmean);
 
     // if we did not have initial transforms
     // allow for more iterations on different resolutions
@@ -872,6 +925,9 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
 
   } // end while
 
+  for (int i = 0; i < nin; i++)
+    freeGP(gpmov[i]);
+
   //strncpy(P.mri_mean->fname, P.mean.c_str(),STRLEN);
 
   cout << " DONE : computeTemplate " << endl;
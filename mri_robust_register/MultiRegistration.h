@@ -61,7 +61,7 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
+          keeptype(false), average(1), doubleprec(false), matrixfree(false), backupweights(false),
           sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
   {
   }
@@ -70,7 +70,7 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
+          keeptype(false), average(1), doubleprec(false), matrixfree(false), backupweights(false),
           sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
   {
     loadMovables(mov);
@@ -103,6 +103,7 @@ public:
     std::cout << " KeepType:      " << keeptype << std::endl;
     std::cout << " Average:       " << average << std::endl;
     std::cout << " DoublePrec:    " << doubleprec << std::endl;
+    std::cout << " MatrixFree:    " << matrixfree << std::endl;
     std::cout << " BackupWeights: " << backupweights << std::endl;
     std::cout << " SampleType:    " << sampletype<< std::endl;
     std::cout << " CRASCenter:    " << crascenter<< std::endl;
@@ -243,6 +244,12 @@ public:
     doubleprec = b;
   }
 
+  //! Specify if registration streams voxels instead of constructing A and b
+  void setMatrixFree(bool b)
+  {
+    matrixfree = b;
+  }
+
   //! Specify if weights are keept
   void setBackupWeights(bool b)
   {
@@ -323,6 +330,7 @@ private:
   bool keeptype;
   int average;
   bool doubleprec;
+  bool matrixfree;
   bool backupweights;
   int sampletype;
   bool crascenter;
@@ -44,8 +44,8 @@ class RegRobust: public Registration
   template<class T> friend class RegistrationStep;
 public:
   RegRobust() :
-      Registration(), sat(-1), wlimit(0.16), mri_weights(NULL), mri_hweights(
-          NULL), mri_indexing(NULL)
+      Registration(), sat(-1), wlimit(0.16), matrixfree(false), mri_weights(
+          NULL), mri_hweights(NULL), mri_indexing(NULL)
   {
   }
   
@@ -78,6 +78,12 @@ public:
     wlimit = d;
   }
 
+  //! Stream voxels instead of constructing A and b (memory independent of image size)
+  void setMatrixFree(bool b)
+  {
+    matrixfree = b;
+  }
+
   //! Get Name of Registration class
   virtual std::string getClassName() {return "RegRobust";}
   
@@ -96,6 +102,7 @@ private:
   // PRIVATE DATA
   double sat;
   double wlimit;
+  bool matrixfree;
   MRI * mri_weights;
   MRI * mri_hweights;
   MRI * mri_indexing;
@@ -182,6 +189,8 @@ void RegRobust::iterativeRegistrationHelper(int nmax, double epsit, MRI * mriS,
       if (mriS->width > subsamplesize && mriS->height > subsamplesize
           && (mriS->depth > subsamplesize || mriS->depth == 1))
         std::cout << " (subsample " << subsamplesize << ") " << std::flush;
+    if (verbose == 1 && matrixfree)
+      std::cout << " (matrix-free) " << std::flush;
     if (verbose > 1)
       std::cout << std::endl;
 
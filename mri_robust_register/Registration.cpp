@@ -69,10 +69,8 @@ Registration::~Registration()
 //  if (mri_indexing) MRIfree(&mri_indexing);
 //  if (mri_weights)  MRIfree(&mri_weights);
 //  if (mri_hweights) MRIfree(&mri_hweights);
-  if (gpS.size() > 0)
-    freeGaussianPyramid(gpS);
-  if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+  freeGPS();
+  freeGPT();
   if (trans)
     delete trans;
   //std::cout << " Done " << std::endl;
@@ -3156,6 +3154,62 @@ void Registration::freeGaussianPyramid(std::vector<MRI*>& p)
   p.clear();
 }
 
+/** Uses the same minimum size as computeMultiresRegistration.
+ */
+pair<int, int> Registration::getGPLimits()
+{
+  int MINS = 16;
+  if (minsize > MINS)
+    MINS = minsize; // use minsize, but at least 16
+  return getGPLimits(mri_source, mri_target, MINS, maxsize);
+}
+
+Registration::GPKey Registration::getSourceGPKey()
+{
+  assert(mri_source != NULL);
+  GPKey k;
+  k.R = Rsrc;
+  k.width = mri_source->width;
+  k.height = mri_source->height;
+  k.depth = mri_source->depth;
+  k.type = mri_source->type;
+  k.limits = getGPLimits();
+  return k;
+}
+
+Registration::GPKey Registration::getTargetGPKey()
+{
+  assert(mri_target != NULL);
+  GPKey k;
+  k.R = Rtrg;
+  k.width = mri_target->width;
+  k.height = mri_target->height;
+  k.depth = mri_target->depth;
+  k.type = mri_target->type;
+  k.limits = getGPLimits();
+  return k;
+}
+
+/** The pyramid has to be built from the resampled source of this
+ registration (see getSourceGPKey) and has to outlive it.
+ */
+void Registration::setSourceGP(const std::vector<MRI*> & p)
+{
+  freeGPS();
+  gpS = p;
+  gpSshared = true;
+}
+
+/** The pyramid has to be built from the resampled target of this
+ registration (see getTargetGPKey) and has to outlive it.
+ */
+void Registration::setTargetGP(const std::vector<MRI*> & p)
+{
+  freeGPT();
+  gpT = p;
+  gpTshared = true;
+}
+
 void Registration::saveGaussianPyramid(std::vector<MRI*>& p,
     const std::string & prefix)
 {
@@ -3926,11 +3980,9 @@ void Registration::setSourceAndTarget(MRI * s, MRI * t, bool keeptype)
 //  cout << " S " << mri_source->width << " " << mri_source->height << " " << mri_source->depth << endl;
 //  cout << " T " << mri_target->width << " " << mri_target->height << " " << mri_target->depth << endl;
 
-  if (gpS.size() > 0)
-    freeGaussianPyramid(gpS);
+  freeGPS();
   centroidS.clear();
-  if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+  freeGPT();
   centroidT.clear();
 
   // initialize the correct registration type:
@@ -3962,8 +4014,7 @@ void Registration::setSource(MRI * s, bool conform, bool keeptype)
     MRIwrite(mri_source, n.c_str());
   }
 
-  if (gpS.size() > 0)
-    freeGaussianPyramid(gpS);
+  freeGPS();
   centroidS.clear();
 
   // initialize the correct registration type:
@@ -3994,8 +4045,7 @@ void Registration::setTarget(MRI * t, bool conform, bool keeptype)
     MRIwrite(mri_target, n.c_str());
   }
 
-  if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+  freeGPT();
   centroidT.clear();
   //cout << "mri_target" << mri_target << endl;
 
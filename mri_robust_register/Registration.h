@@ -77,7 +77,8 @@ public:
           debug(0), verbose(1),initorient(false), inittransform(true), initscaling(false),
           highit(-1), mri_source(NULL), mri_target(NULL), iscaleinit(1.0),
           iscalefinal(1.0), doubleprec(false), symmetry(true),
-          sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false)
+          sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false),
+          gpSshared(false), gpTshared(false)
   {
   }
 
@@ -88,18 +89,62 @@ public:
   //! Initialize registration (keep source, target, gauss pyramid and transformation type)
   virtual void clear();
 
-  //! Free Gaussian pyramid for source image
+  //! Free Gaussian pyramid for source image (a shared one is only released)
   void freeGPS()
   {
-    freeGaussianPyramid(gpS);
+    if (gpSshared)
+      gpS.clear();
+    else
+      freeGaussianPyramid(gpS);
+    gpSshared = false;
   }
 
-  //! Free Gaussian pyramid for target image
+  //! Free Gaussian pyramid for target image (a shared one is only released)
   void freeGPT()
   {
-    freeGaussianPyramid(gpT);
+    if (gpTshared)
+      gpT.clear();
+    else
+      freeGaussianPyramid(gpT);
+    gpTshared = false;
   }
 
+  /** \brief Identifies the Gaussian pyramid of a resampled input.
+   Pyramids built from the same input image with equal keys are equal
+   and can be shared between registrations. */
+  struct GPKey
+  {
+    vnl_matrix<double> R; //!< resample matrix (Rsrc or Rtrg)
+    int width, height, depth, type;
+    std::pair<int, int> limits;
+    bool operator==(const GPKey & k) const
+    {
+      return width == k.width && height == k.height && depth == k.depth
+          && type == k.type && limits == k.limits && R == k.R;
+    }
+  };
+
+  //! Limits of the Gaussian pyramids for the current source and target
+  std::pair<int, int> getGPLimits();
+  //! Key of the source pyramid (call after setting source and target)
+  GPKey getSourceGPKey();
+  //! Key of the target pyramid (call after setting source and target)
+  GPKey getTargetGPKey();
+  //! Build the pyramid of the resampled source, it belongs to the caller
+  std::vector<MRI*> buildSourceGP(const std::pair<int, int> & limits)
+  {
+    return buildGPLimits(mri_source, limits);
+  }
+  //! Build the pyramid of the resampled target, it belongs to the caller
+  std::vector<MRI*> buildTargetGP(const std::pair<int, int> & limits)
+  {
+    return buildGPLimits(mri_target, limits);
+  }
+  //! Use a source pyramid built elsewhere (it is only read and not freed)
+  void setSourceGP(const std::vector<MRI*> & p);
+  //! Use a target pyramid built elsewhere (it is only read and not freed)
+  void setTargetGP(const std::vector<MRI*> & p);
+
   //! Allow only translation
   void setTransonly()
   {
@@ -450,6 +495,10 @@ protected:
 
   bool converged;
 
+  // pyramids passed via setSourceGP / setTargetGP are not ours to free
+  bool gpSshared;
+  bool gpTshared;
+
 private:
 
   // construct Ab and R:
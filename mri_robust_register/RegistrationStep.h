@@ -40,12 +40,15 @@ extern "C"
 
 #include <utility>
 #include <vector>
+#include <limits>
+#include <cstring>
 #include <cassert>
 #include <iostream>
 #include <string>
 #include <vnl/vnl_vector.h>
 #include <vnl/vnl_matrix.h>
 #include <vnl/vnl_matrix_fixed.h>
+#include <vnl/algo/vnl_svd.h>
 #include "MyMRI.h"
 #include "MyMatrix.h"
 #include "Regression.h"
@@ -62,8 +65,9 @@ public:
   RegistrationStep(const RegRobust & R) :
       sat(R.sat), iscale(R.iscale), transonly(R.transonly), rigid(R.rigid), isoscale(
           R.isoscale), trans(R.trans), costfun(R.costfun), rtype(1), subsamplesize(
-          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), iscalefinal(
-          R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
+          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), matrixfree(
+          R.matrixfree), ssat(R.sat < 0 ? SATr : R.sat), iscalefinal(R.iscalefinal), mri_weights(
+          NULL), mri_indexing(NULL), sfx(NULL), sfy(NULL), sfz(NULL), sft(NULL), sSmT(NULL)
   {
   }
 
@@ -127,6 +131,42 @@ protected:
 
   vnl_matrix<T> constructR(const vnl_vector<T> & p);
 
+  //! Matrix-free registration step (streams rows of A and b from the images)
+  std::pair<vnl_matrix_fixed<double, 4, 4>, double> computeRegistrationStepStream(
+      MRI * mriS, MRI* mriT);
+  //! Prepare derivative images and sample grid for streaming
+  void streamSetup(MRI *mriS, MRI *mriT);
+  //! Free derivative images used for streaming
+  void streamCleanup();
+  //! Get all valid rows of A and b for a slice of the sample grid
+  int streamSliceRows(int z, std::vector<double> &Ar, std::vector<double> &br,
+      std::vector<int> &pos, MRI *mri_w);
+  //! Exit with an error if no voxels overlap
+  void streamNoOverlap();
+  //! Residual of a single row
+  inline double streamResidual(const double * a, double b,
+      const vnl_vector<double> &p);
+  //! Sqrt of Tukey's biweight of a residual
+  inline double streamSqrtWeight(double r, double sigma);
+  //! Order preserving mapping of floats to unsigned int and back
+  static inline unsigned int streamKey(float v);
+  static inline float streamKeyValue(unsigned int u);
+  //! Histogram of upper or lower 16 bits of residual keys
+  long int streamKeyHistogram(const vnl_vector<double> &p, double shift,
+      bool absval, const unsigned int * buckets, std::vector<long int> &h0,
+      std::vector<long int> &h1);
+  //! Exact median of (absolute shifted) residuals via two histogram passes
+  double streamMedian(const vnl_vector<double> &p, double shift, bool absval);
+  //! Robust sigma (MAD) of the residuals b - A p
+  double streamSigmaMAD(const vnl_vector<double> &p, double d = 1.4826);
+  //! Accumulate A^T W A and A^T W b and solve (weights from residuals b - A pw)
+  vnl_vector<double> streamWeightedLS(const vnl_vector<double> &pw, double sigma);
+  //! Weighted error sum( w r^2) / sum(w) with r = b - A p
+  double streamError(const vnl_vector<double> &p, const vnl_vector<double> &pw,
+      double sigma);
+  //! Write weights image, weight check and weight statistics
+  void streamWeights(const vnl_vector<double> &pw, double sigma);
+
 private:
 // in:
 
@@ -142,6 +182,8 @@ private:
   int debug;
   int verbose;
   bool floatsvd; // should be removed
+  bool matrixfree;
+  double ssat; // saturation used when streaming
   double iscalefinal; // from the last step, used in constructAB
 
 // out:
@@ -157,6 +199,20 @@ private:
   MRI * mri_indexing;
   vnl_vector<T> pvec;
 
+// streaming (matrix-free):
+  MRI * sfx;
+  MRI * sfy;
+  MRI * sfz;
+  MRI * sft;
+  MRI * sSmT;
+  MRI * smriS;
+  MRI * smriT;
+  bool sis2d;
+  bool sdosubsample;
+  int sgw, sgh, sgd; // sample grid size
+  int spnum;         // number of columns of A
+  long int scount;   // number of rows of A
+
 };
 
 /** Computes Registration Single Step
@@ -175,6 +231,10 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
     exit(1);
   }
 
+  // the restricted rigid model (rtype 2) needs the full A
+  if (matrixfree && !(rigid && rtype == 2))
+    return computeRegistrationStepStream(mriS, mriT);
+
   vnl_matrix<T> A;
   vnl_vector<T> b;
 
@@ -1432,4 +1492,771 @@ vnl_matrix<T> RegistrationStep<T>::constructR(const vnl_vector<T> & p)
   return R;
 }
 
+/** Matrix-free version of computeRegistrationStep.
+ Instead of constructing A and b (one row per voxel and frame), the rows
+ are recomputed from the derivative images slice by slice whenever they are
+ needed. The iterative reweighted least squares (Tukey's biweight, same
+ iteration as Regression::getRobustEstWAB) only accumulates the normal
+ equations A^T W A and A^T W b, the robust sigma (MAD) is obtained by exact
+ histogram selection. Memory therefore does not grow with the number of rows.
+ Partial sums are kept per slice and added in order, so the result does not
+ depend on the number of threads.
+ If subsampling is switched on, one random voxel of each 2x2x2 block is used
+ (at full resolution, so the gradients and coordinates match).
+ */
+template<class T>
+std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRegistrationStepStream(
+    MRI * mriS, MRI* mriT)
+{
+  streamSetup(mriS, mriT);
+
+  vnl_vector<double> p(spnum, 0.0);
+  if (costfun == Registration::ROB)
+  {
+    if (verbose > 1)
+      std::cout << "   - compute robust estimate matrix-free ( sat " << sat
+          << " )..." << std::endl;
+
+    // constants (see Regression<T>::getRobustEstWAB)
+    int MAXIT = 20;
+    double EPS = 2e-12;
+    std::vector<double> err(MAXIT + 1);
+    err[0] = std::numeric_limits<double>::infinity();
+    err[1] = 1e20;
+
+    // the weights of an iteration are defined by the residuals
+    // of the previous parameters pw and their sigma
+    vnl_vector<double> pw(p);
+    vnl_vector<double> lastp(p);
+    vnl_vector<double> lastpw(p);
+    double sigma = 0.0;
+    double lastsigma = 0.0;
+    int count = 0;
+    int incr = 0;
+    do
+    {
+      count++; //first = 1
+      if (count > 1)
+      {
+        lastp = p;
+        lastpw = pw;
+        lastsigma = sigma;
+      }
+
+      pw = p;
+      sigma = streamSigmaMAD(pw);
+      if (count == 1 && scount == 0)
+        streamNoOverlap();
+      if (sigma < EPS) // e.g. if images are identical
+        std::cout << "  Sigma too small: " << sigma << " (identical images?)"
+            << std::endl;
+
+      // compute weighted least squares and the new error
+      p = streamWeightedLS(pw, sigma);
+      err[count] = streamError(p, pw, sigma);
+      if (err[count - 1] <= err[count])
+        incr++;
+    } while (incr < 1 && count < MAXIT && err[count] > EPS);
+
+    if (err[count] > err[count - 1])
+    {
+      // take previous values (since actual values made the error to increase)
+      p = lastp;
+      pw = lastpw;
+      sigma = lastsigma;
+      if (verbose > 1)
+        std::cout << "     Step: " << count - 2 << " ERR: " << err[count - 1]
+            << std::endl;
+    }
+    else if (verbose > 1)
+      std::cout << "     Step: " << count - 1 << " ERR: " << err[count]
+          << std::endl;
+
+    streamWeights(pw, sigma);
+
+    if (verbose > 1)
+      std::cout << "  DONE" << std::endl;
+  }
+  else
+  {
+    if (verbose > 1)
+      std::cout << "   - compute least squares estimate matrix-free ..."
+          << std::flush;
+    p = streamWeightedLS(p, -1.0);
+    if (scount == 0)
+      streamNoOverlap();
+    if (verbose > 1)
+      std::cout << "  DONE" << std::endl;
+    // no weights in this case
+    if (mri_weights)
+      MRIfree(&mri_weights);
+    zeroweights = -1;
+  }
+
+  streamCleanup();
+
+  pvec.set_size(p.size());
+  for (unsigned int i = 0; i < p.size(); i++)
+    pvec[i] = (T) p[i];
+
+  Md.second = 0.0;
+  if (iscale)
+    Md.second = pvec[pvec.size() - 1];
+  trans->setParameters(pvec);
+  Md.first = trans->getMatrix();
+
+  return Md;
+}
+
+/** Computes the derivative images (same as constructAb) and the size of the
+ sample grid (half the image size on each axis, if subsampling).
+ */
+template<class T>
+void RegistrationStep<T>::streamSetup(MRI *mriS, MRI *mriT)
+{
+  if (verbose > 1)
+    std::cout << "   - streamSetup: " << std::endl;
+
+  if (mriS->nframes == 0) mriS->nframes = 1;
+  if (mriT->nframes == 0) mriT->nframes = 1;
+
+  assert(mriT != NULL);
+  assert(mriS != NULL);
+  assert(mriS->width == mriT->width);
+  assert(mriS->height== mriT->height);
+  assert(mriS->depth == mriT->depth);
+  assert(mriS->nframes == mriT->nframes);
+  assert(mriS->type == mriT->type);
+
+  sis2d = false;
+  if (mriS->depth == 1 || mriT->depth == 1)
+  {
+    if (mriT->depth != mriS->depth)
+    {
+      cout << "ERROR: both source and target need to be 2D or 3D" << endl;
+      exit(1);
+    }
+    sis2d = true;
+  }
+  smriS = mriS;
+  smriT = mriT;
+
+  sdosubsample = false;
+  if (subsamplesize > 0)
+    sdosubsample = (mriS->width > subsamplesize && mriS->height > subsamplesize
+        && (mriS->depth > subsamplesize || mriS->depth == 1));
+
+  // we will need the derivatives (fx,fy,fz), smoothed image (ft) and difference (SmT)
+  if (verbose > 1)
+    std::cout << "     -- compute derivatives ... " << std::flush;
+  MRI *SpTh = MRIallocSequence(mriS->width, mriS->height, mriS->depth, MRI_FLOAT, mriS->nframes);
+  SpTh = MRIadd(mriS, mriT, SpTh);
+  SpTh = MRIscalarMul(SpTh, SpTh, 0.5);
+  sfx = NULL; sfy = NULL; sfz = NULL; sft = NULL;
+  MyMRI::getPartials(SpTh, sfx, sfy, sfz, sft);
+  MRIfree(&SpTh);
+  sSmT = MRIallocSequence(mriS->width, mriS->height, mriS->depth, MRI_FLOAT, mriS->nframes);
+  sSmT = MRIsubtract(mriS, mriT, sSmT);
+  sSmT = MyMRI::getBlur(sSmT, sSmT);
+  if (verbose > 1)
+    std::cout << " done!" << std::endl;
+
+  sgw = mriS->width;
+  sgh = mriS->height;
+  sgd = mriS->depth;
+  if (sdosubsample)
+  {
+    sgw /= 2;
+    sgh /= 2;
+    if (!sis2d)
+      sgd /= 2;
+  }
+
+  spnum = trans->getDOF();
+  if (iscale)
+    spnum++;
+  scount = 0;
+
+  if (verbose > 1)
+    std::cout << "     -- sample grid " << sgw << " x " << sgh << " x " << sgd
+        << " x " << mriS->nframes << " , " << spnum << " parameters" << std::endl;
+}
+
+template<class T>
+void RegistrationStep<T>::streamCleanup()
+{
+  if (sfx)
+    MRIfree(&sfx);
+  if (sfy)
+    MRIfree(&sfy);
+  if (sfz)
+    MRIfree(&sfz);
+  if (sft)
+    MRIfree(&sft);
+  if (sSmT)
+    MRIfree(&sSmT);
+}
+
+template<class T>
+void RegistrationStep<T>::streamNoOverlap()
+{
+  std::cerr << std::endl;
+  std::cerr
+      << " ERROR: All entries are zero! Images do not overlap (anymore?)."
+      << std::endl;
+  std::cerr
+      << "    Try calling with --noinit (if the original images are well aligned)"
+      << std::endl;
+  std::cerr << "    Maybe use --ixform <init.lta> with an approx. alignment"
+      << std::endl;
+  std::cerr << "    obtained from tkregister or another registration program."
+      << std::endl;
+  std::cerr << std::endl;
+  exit(1);
+}
+
+/** Computes all rows of A and b that belong to slice z of the sample grid
+ (same selection of voxels as constructAb). Ar receives spnum values per row,
+ pos the voxel (x,y,z,frame) of each row.
+ If mri_w is passed, the weights of voxels outside either image are set
+ (0: outside in one image only, 1: outside in both).
+ Returns the number of rows.
+ */
+template<class T>
+int RegistrationStep<T>::streamSliceRows(int z, std::vector<double> &Ar,
+    std::vector<double> &br, std::vector<int> &pos, MRI *mri_w)
+{
+  double eps = 0.00001;
+  double oepss = eps + smriS->outside_val / 255.0;
+  double oepst = eps + smriT->outside_val / 255.0;
+  int step = 3;
+  if (sis2d)
+    step = 2;
+  int x, y, f, xp, yp, zp, randpos, pno;
+  float fzval = eps / 2.0;
+  int fxf = sfx->nframes;
+  int rows = 0;
+
+  Ar.clear();
+  br.clear();
+  pos.clear();
+  for (x = 0; x < sgw; x++)
+    for (y = 0; y < sgh; y++)
+    {
+      if (sdosubsample)
+      {
+        // position in the sequence of random numbers (as if visited in z,x,y order)
+        randpos = (int) (((((long int) z * sgw + x) * sgh + y) * step) % 101);
+        xp = 2 * x + (int) (2.0 * MyMRI::getRand(randpos));
+        randpos++;
+        yp = 2 * y + (int) (2.0 * MyMRI::getRand(randpos));
+        randpos++;
+        if (sis2d)
+          zp = z;
+        else
+          zp = 2 * z + (int) (2.0 * MyMRI::getRand(randpos));
+      }
+      else
+      {
+        xp = x;
+        yp = y;
+        zp = z;
+      }
+
+      // check if position is outside either source or target:
+      bool souts = fabs(MRIgetVoxVal(smriS,xp,yp,zp,0) - smriS->outside_val) <= oepss;
+      bool touts = fabs(MRIgetVoxVal(smriT,xp,yp,zp,0) - smriT->outside_val) <= oepst;
+      if (souts || touts)
+      {
+        if (mri_w)
+        {
+          float wval = 0.0; // background in only one image (label outlier)
+          if (souts && touts)
+            wval = 1.0;
+          for (f = 0; f < fxf; f++)
+            MRIFseq_vox(mri_w, xp, yp, zp, f) = wval;
+        }
+        continue;
+      }
+
+      for (f = 0; f < fxf; f++)
+      {
+        const float & ftval = MRIFseq_vox(sft, xp, yp, zp, f);
+        const float & fxval = MRIFseq_vox(sfx, xp, yp, zp, f);
+        const float & fyval = MRIFseq_vox(sfy, xp, yp, zp, f);
+        if (!sis2d)
+          fzval = MRIFseq_vox(sfz, xp, yp, zp, f);
+
+        // skip nans or zeros
+        if (isnan(fxval) || isnan(fyval) || isnan(fzval) || isnan(ftval))
+          continue;
+        if (fabs(fxval) < eps && fabs(fyval) < eps && fabs(fzval) < eps)
+          continue;
+
+        vnl_vector<double> grad = trans->getGradient(xp, fxval, yp, fyval, zp, fzval);
+        for (pno = 0; pno < (int) grad.size(); pno++)
+          Ar.push_back(grad[pno]);
+        // ISCALE (see constructAb)
+        if (iscale)
+          Ar.push_back(ftval);
+
+        // A p = b = IS - IT
+        br.push_back(MRIFseq_vox(sSmT, xp, yp, zp, f));
+        pos.push_back(xp);
+        pos.push_back(yp);
+        pos.push_back(zp);
+        pos.push_back(f);
+        rows++;
+      }
+    }
+  assert((int)Ar.size() == rows * spnum);
+  return rows;
+}
+
+/** Returns the residual b - a^T p of a single row.
+ */
+template<class T>
+inline double RegistrationStep<T>::streamResidual(const double * a, double b,
+    const vnl_vector<double> &p)
+{
+  double r = b;
+  for (int j = 0; j < spnum; j++)
+    r -= a[j] * p[j];
+  return r;
+}
+
+/** Returns the square root of Tukey's biweight of a residual
+ (see Regression<T>::getSqrtTukeyDiaWeights), 1 if sigma is too small.
+ */
+template<class T>
+inline double RegistrationStep<T>::streamSqrtWeight(double r, double sigma)
+{
+  if (sigma < 2e-12)
+    return 1.0;
+  double t1 = r / sigma;
+  if (fabs(t1) >= ssat)
+    return 0.0;
+  t1 /= ssat;
+  return 1.0 - t1 * t1;
+}
+
+/** Maps a float to an unsigned int with the same ordering.
+ */
+template<class T>
+inline unsigned int RegistrationStep<T>::streamKey(float v)
+{
+  unsigned int u;
+  memcpy(&u, &v, sizeof(u));
+  if (u & 0x80000000u)
+    return ~u;
+  return u | 0x80000000u;
+}
+
+template<class T>
+inline float RegistrationStep<T>::streamKeyValue(unsigned int u)
+{
+  if (u & 0x80000000u)
+    u &= 0x7fffffffu;
+  else
+    u = ~u;
+  float v;
+  memcpy(&v, &u, sizeof(v));
+  return v;
+}
+
+/** Histogram of the keys of the residuals b - A p (or |b - A p - shift|).
+ If buckets is NULL, h0 counts the upper 16 bits, otherwise h0 and h1 count
+ the lower 16 bits of the keys whose upper bits are buckets[0] and buckets[1].
+ Returns the number of rows.
+ */
+template<class T>
+long int RegistrationStep<T>::streamKeyHistogram(const vnl_vector<double> &p,
+    double shift, bool absval, const unsigned int * buckets,
+    std::vector<long int> &h0, std::vector<long int> &h1)
+{
+  const unsigned int nbins = 65536;
+  h0.assign(nbins, 0);
+  h1.assign(nbins, 0);
+  long int n = 0;
+  int z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<long int> l0(nbins, 0);
+    std::vector<long int> l1(nbins, 0);
+    std::vector<double> Ar, br;
+    std::vector<int> pos;
+    long int ln = 0;
+    int rows, i;
+    unsigned int key, b;
+    double r;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for (z = 0; z < sgd; z++)
+    {
+      rows = streamSliceRows(z, Ar, br, pos, NULL);
+      for (i = 0; i < rows; i++)
+      {
+        r = streamResidual(&Ar[i * spnum], br[i], p);
+        if (absval)
+          r = fabs(r - shift);
+        key = streamKey((float) r);
+        if (buckets == NULL)
+          l0[key >> 16]++;
+        else
+        {
+          if ((key >> 16) == buckets[0])
+            l0[key & 0xffff]++;
+          if ((key >> 16) == buckets[1])
+            l1[key & 0xffff]++;
+        }
+      }
+      ln += rows;
+    }
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif
+    {
+      // integer counts, so the order of merging does not matter
+      for (b = 0; b < nbins; b++)
+      {
+        h0[b] += l0[b];
+        h1[b] += l1[b];
+      }
+      n += ln;
+    }
+  }
+  return n;
+}
+
+/** Exact median (in float precision) of the residuals b - A p
+ (or of |b - A p - shift| if absval), without storing the residuals:
+ a radix selection on the upper and lower 16 bits of the float keys.
+ Same definition as RobustGaussian<T>::median (mean of the two middle
+ elements for even size).
+ */
+template<class T>
+double RegistrationStep<T>::streamMedian(const vnl_vector<double> &p,
+    double shift, bool absval)
+{
+  std::vector<long int> h0, h1;
+  long int n = streamKeyHistogram(p, shift, absval, NULL, h0, h1);
+  scount = n;
+  if (n == 0)
+    return 0.0;
+
+  // ranks (starting at 1) of the middle elements
+  long int k[2];
+  if (n % 2 == 1)
+  {
+    k[0] = (n + 1) / 2;
+    k[1] = k[0];
+  }
+  else
+  {
+    k[0] = n / 2;
+    k[1] = n / 2 + 1;
+  }
+
+  // find upper bits
+  unsigned int buckets[2];
+  long int rank[2];
+  int j;
+  for (j = 0; j < 2; j++)
+  {
+    long int cum = 0;
+    unsigned int b = 0;
+    while (cum + h0[b] < k[j])
+    {
+      cum += h0[b];
+      b++;
+    }
+    buckets[j] = b;
+    rank[j] = k[j] - cum;
+  }
+
+  // find lower bits
+  streamKeyHistogram(p, shift, absval, buckets, h0, h1);
+  double m = 0.0;
+  for (j = 0; j < 2; j++)
+  {
+    std::vector<long int> & h = (j == 0) ? h0 : h1;
+    long int cum = 0;
+    unsigned int b = 0;
+    while (cum + h[b] < rank[j])
+    {
+      cum += h[b];
+      b++;
+    }
+    m += 0.5 * streamKeyValue((buckets[j] << 16) | b);
+  }
+  return m;
+}
+
+/** Robust estimate for sigma of the residuals b - A p
+ (median absolute deviation, see RobustGaussian<T>::mad).
+ */
+template<class T>
+double RegistrationStep<T>::streamSigmaMAD(const vnl_vector<double> &p,
+    double d)
+{
+  double medi = streamMedian(p, 0.0, false);
+  return d * streamMedian(p, medi, true);
+}
+
+/** Solves the weighted least squares problem
+ \f$ p = [A^T W A]^{-1} A^T W b\f$ where the weights are Tukey's biweights
+ of the residuals b - A pw scaled by sigma (unit weights if sigma < 0).
+ A^T W A and A^T W b are accumulated per slice and then summed in order.
+ */
+template<class T>
+vnl_vector<double> RegistrationStep<T>::streamWeightedLS(
+    const vnl_vector<double> &pw, double sigma)
+{
+  int nn = spnum * spnum;
+  std::vector<double> sM(sgd * nn, 0.0);
+  std::vector<double> sv(sgd * spnum, 0.0);
+  std::vector<long int> sn(sgd, 0);
+  int z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<double> Ar, br;
+    std::vector<int> pos;
+    int rows, i, j, k;
+    double w, wa;
+    const double * a;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for (z = 0; z < sgd; z++)
+    {
+      double * M = &sM[z * nn];
+      double * v = &sv[z * spnum];
+      rows = streamSliceRows(z, Ar, br, pos, NULL);
+      sn[z] = rows;
+      for (i = 0; i < rows; i++)
+      {
+        a = &Ar[i * spnum];
+        w = 1.0;
+        if (sigma >= 0.0)
+        {
+          w = streamSqrtWeight(streamResidual(a, br[i], pw), sigma);
+          w *= w; // remember w is the sqrt of the weights
+          if (w == 0.0)
+            continue;
+        }
+        for (j = 0; j < spnum; j++)
+        {
+          wa = w * a[j];
+          for (k = j; k < spnum; k++)
+            M[j * spnum + k] += wa * a[k];
+          v[j] += wa * br[i];
+        }
+      }
+    }
+  }
+
+  vnl_matrix<double> AtWA(spnum, spnum, 0.0);
+  vnl_vector<double> AtWb(spnum, 0.0);
+  int j, k;
+  scount = 0;
+  for (z = 0; z < sgd; z++)
+  {
+    for (j = 0; j < spnum; j++)
+    {
+      for (k = j; k < spnum; k++)
+        AtWA[j][k] += sM[z * nn + j * spnum + k];
+      AtWb[j] += sv[z * spnum + j];
+    }
+    scount += sn[z];
+  }
+  for (j = 0; j < spnum; j++)
+    for (k = 0; k < j; k++)
+      AtWA[j][k] = AtWA[k][j];
+
+  if (scount == 0)
+    return vnl_vector<double>(spnum, 0.0);
+  vnl_svd<double> svd(AtWA);
+  return svd.solve(AtWb);
+}
+
+/** Weighted error \f$ \sum_i w_i r_i^2 / \sum_i w_i \f$ with the residuals
+ r = b - A p and the weights (as in streamWeightedLS) from b - A pw.
+ */
+template<class T>
+double RegistrationStep<T>::streamError(const vnl_vector<double> &p,
+    const vnl_vector<double> &pw, double sigma)
+{
+  std::vector<double> sswr(sgd, 0.0);
+  std::vector<double> ssw(sgd, 0.0);
+  int z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<double> Ar, br;
+    std::vector<int> pos;
+    int rows, i;
+    double w, r;
+    const double * a;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for (z = 0; z < sgd; z++)
+    {
+      rows = streamSliceRows(z, Ar, br, pos, NULL);
+      for (i = 0; i < rows; i++)
+      {
+        a = &Ar[i * spnum];
+        w = streamSqrtWeight(streamResidual(a, br[i], pw), sigma);
+        w *= w;
+        r = streamResidual(a, br[i], p);
+        ssw[z] += w;
+        sswr[z] += w * r * r;
+      }
+    }
+  }
+
+  double swr = 0.0;
+  double sw = 0.0;
+  for (z = 0; z < sgd; z++)
+  {
+    swr += sswr[z];
+    sw += ssw[z];
+  }
+  if (sw <= 0.0)
+    return std::numeric_limits<double>::infinity();
+  return swr / sw;
+}
+
+/** Creates the weights image (weights are the squared sqrt-weights, see
+ computeRegistrationStep) and computes the weight check and the average
+ weight on significant voxels.
+ */
+template<class T>
+void RegistrationStep<T>::streamWeights(const vnl_vector<double> &pw,
+    double sigma)
+{
+  if (mri_weights
+      && (mri_weights->width != smriS->width
+          || mri_weights->height != smriS->height
+          || mri_weights->depth != smriS->depth
+          || mri_weights->nframes != smriS->nframes))
+    MRIfree(&mri_weights);
+
+  if (!mri_weights)
+  {
+    mri_weights = MRIallocSequence(smriS->width, smriS->height, smriS->depth, MRI_FLOAT, smriS->nframes);
+    MRIcopyHeader(smriS, mri_weights);
+    mri_weights->type = MRI_FLOAT;
+    MRIsetResolution(mri_weights, smriS->xsize, smriS->ysize, smriS->zsize);
+    mri_weights->outside_val = 1.0;
+  }
+
+  // anything not sampled (or skipped) is set to 1
+  int x, y, z, f;
+  for (f = 0; f < mri_weights->nframes; f++)
+    for (z = 0; z < mri_weights->depth; z++)
+      for (y = 0; y < mri_weights->height; y++)
+        for (x = 0; x < mri_weights->width; x++)
+          MRIFseq_vox(mri_weights, x, y, z, f) = 1.0;
+
+  // sigma = max(widht,height,depth) / 6;
+  double gsigma = smriS->width;
+  if (smriS->height > gsigma)
+    gsigma = smriS->height;
+  if (smriS->depth > gsigma)
+    gsigma = smriS->depth;
+  gsigma = gsigma / 6.0;
+  double sigma22 = 2.0 * gsigma * gsigma;
+  double factor = 1.0 / sqrt(M_PI * sigma22);
+
+  std::vector<double> sdsum(sgd, 0.0);
+  std::vector<double> swcheck(sgd, 0.0);
+  std::vector<double> swchecksqrt(sgd, 0.0);
+  std::vector<double> sdd(sgd, 0.0);
+  std::vector<long int> sddcount(sgd, 0);
+  std::vector<long int> szcount(sgd, 0);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<double> Ar, br;
+    std::vector<int> pos;
+    int rows, i, xp, yp, zp, fp, zz;
+    double w, wtemp, xx, yy, zzz, gauss;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for (zz = 0; zz < sgd; zz++)
+    {
+      // slices of the sample grid map to disjoint voxels
+      rows = streamSliceRows(zz, Ar, br, pos, mri_weights);
+      for (i = 0; i < rows; i++)
+      {
+        xp = pos[4 * i];
+        yp = pos[4 * i + 1];
+        zp = pos[4 * i + 2];
+        fp = pos[4 * i + 3];
+        w = streamSqrtWeight(streamResidual(&Ar[i * spnum], br[i], pw), sigma);
+        wtemp = w * w;
+        MRIFseq_vox(mri_weights, xp, yp, zp, fp) = wtemp;
+
+        // compute distance to center:
+        xx = xp - 0.5 * smriS->width;
+        yy = yp - 0.5 * smriS->height;
+        zzz = zp - 0.5 * smriS->depth;
+        gauss = factor * exp(-(xx * xx + yy * yy + zzz * zzz) / sigma22);
+        sdsum[zz] += gauss;
+        swcheck[zz] += gauss * (1.0 - wtemp);
+        swchecksqrt[zz] += gauss * (1.0 - w); //!!!!! historical, better not use the square root (use wcheck)
+
+        // statistics on weights (see Regression<T>::getRobustEstWAB)
+        if (fabs(br[i]) > 0.00001)
+        {
+          sdd[zz] += w;
+          sddcount[zz]++;
+          if (w < 0.1)
+            szcount[zz]++;
+        }
+      }
+    }
+  }
+
+  double dsum = 0.0;
+  double dd = 0.0;
+  double ddcount = 0.0;
+  double zcount = 0.0;
+  wcheck = 0.0;
+  wchecksqrt = 0.0;
+  for (z = 0; z < sgd; z++)
+  {
+    dsum += sdsum[z];
+    wcheck += swcheck[z];
+    wchecksqrt += swchecksqrt[z];
+    dd += sdd[z];
+    ddcount += sddcount[z];
+    zcount += szcount[z];
+  }
+  wcheck = wcheck / dsum;
+  wchecksqrt = wchecksqrt / dsum;
+  dd /= ddcount;
+  zeroweights = dd;
+  if (verbose > 1)
+  {
+    std::cout << "          weights average: " << dd << "  zero: "
+        << zcount / ddcount << std::endl;
+    std::cout << "   - Weight Check: " << wcheck << "  wsqrt: " << wchecksqrt
+        << std::endl;
+  }
+}
+
 #endif
@@ -135,6 +135,7 @@ struct Parameters
   bool entball;
   bool entcorrection;
   double powelltol;
+  bool matrixfree;
 };
 static struct Parameters P =
 { "", "", "", "", "", "", "", "", "", "", "", false, false, false, false, false, false,
@@ -142,7 +143,7 @@ static struct Parameters P =
     NULL, NULL, false, false, true, false, 1, -1, false, 0.16, true, true, "",
     "", -1, -1, Registration::ROB,
 //  256,
-    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5 };
+    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5, false };
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -1463,6 +1464,7 @@ static void initRegistration(Registration & R, Parameters & P)
   {
     dynamic_cast<RegRobust*>(&R)->setSaturation(P.sat);
     dynamic_cast<RegRobust*>(&R)->setWLimit(P.wlimit);
+    dynamic_cast<RegRobust*>(&R)->setMatrixFree(P.matrixfree);
   }
   if (R.getClassName() == "RegPowell")
   {
@@ -2067,6 +2069,14 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "MATRIXFREE"))
+  {
+    P.matrixfree = true;
+    nargs = 0;
+    cout
+        << "--matrixfree: Will stream voxels instead of constructing the linear system (low mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "DEBUG"))
   {
     P.debug = 1;
@@ -131,6 +131,7 @@ struct Parameters
   bool crascenter;
   int pairiterate;
   double pairepsit;
+  bool matrixfree;
 };
 
 // Initializations:
@@ -138,7 +139,7 @@ static struct Parameters P =
 { vector<string>(0), vector<string>(0), "", vector<string>(0), vector<string>(0), vector<string>(
     0), false, false, false, false, false, false, false, false, false, 5, -1.0, SAT, vector<
     string>(0), 0, 1, -1, false, false, SSAMPLE, false, false, "", false, true,
-    vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01};
+    vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, false};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -229,6 +230,7 @@ int main(int argc, char *argv[])
     MR.setKeepType(!P.floattype);
     MR.setAverage(P.average);
     MR.setDoublePrec(P.doubleprec);
+    MR.setMatrixFree(P.matrixfree);
     MR.setSubsamplesize(P.subsamplesize);
     MR.setHighit(P.highit);
     if (P.nweights.size() > 0)
@@ -671,6 +673,14 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "MATRIXFREE"))
+  {
+    P.matrixfree = true;
+    nargs = 0;
+    cout
+        << "--matrixfree: Will stream voxels instead of constructing the linear system (low mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "WEIGHTS"))
   {
     nargs = 0;
@@ -101,6 +101,11 @@
 
   --tol1d tol1d : tolerance on powell 1d minimizations
 
+  --lbfgs : use L-BFGS with the analytic gradient instead of powell
+     (trilinear interpolation without vsm only)
+  --lbfgs-nmax nmax : max number of L-BFGS iterations (def 200)
+  --lbfgs-tol tol : L-BFGS relative tolerance on cost (def 1e-7)
+
   --1dmin : use brute force 1D minimizations instead of powell
   --n1dmin n1dmin : number of 1d minimization (default = 3)
 
@@ -192,6 +197,28 @@ int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      char *costfile, double *costs, int *niters);
 float compute_powell_cost(float *p) ;
 double RelativeSurfCost(MRI *mov, MATRIX *R0);
+MATRIX *BBRparams2R(MATRIX *R0, double *p, int dof, MATRIX *R);
+
+/* Boundary points and the mov frame packed for the L-BFGS cost/gradient
+   engine. Points are the white/cortex projections of each vertex that
+   passes the same filters as GetSurfCosts(); the volume is frame 0 of mov
+   as float with column fastest. */
+typedef struct {
+  int npoints;
+  float *wxyz;    // 3*npoints, white-side point (tkreg RAS)
+  float *cxyz;    // 3*npoints, cortex-side point (tkreg RAS)
+  float *targcon; // target contrast per point, or NULL
+  int width, height, depth;
+  float *vol;
+  double ras2vox[4][4]; // inv(tkreg vox2ras) of mov
+} BBR_POINTS;
+BBR_POINTS *BBRpointsBuild(MRI *mov);
+int BBRpointsFree(BBR_POINTS **pbp);
+double *BBRcostGrad(BBR_POINTS *bp, MATRIX *R0, double *p, int dof,
+		    double *costs, double *grad);
+int MinLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double ftol,
+	     int nmaxiters, double *costs, int *niters);
+BBR_POINTS *bbrpoints = NULL;
 
 char *costfile_powell = NULL;
 
@@ -262,6 +289,9 @@ int n1dmin = 3;
 int nMaxItersPowell = 36;
 double TolPowell = 1e-8;
 double LinMinTolPowell = 1e-8;
+int UseLBFGS = 0;
+int nMaxItersLBFGS = 200;
+double TolLBFGS = 1e-7;
 
 #define NMAX 100
 int ntx=0, nty=0, ntz=0, nax=0, nay=0, naz=0;
@@ -753,9 +783,19 @@ int main(int argc, char **argv) {
   }
 
   TimerStart(&mytimer) ;
-  printf("Starting Powell Minimization\n");
-  MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
-	    nMaxItersPowell,SegRegCostFile, costs, &nth);
+  if(UseLBFGS && (interpcode != SAMPLE_TRILINEAR || vsm != NULL)){
+    printf("INFO: --lbfgs needs trilinear interpolation and no vsm, using Powell\n");
+    UseLBFGS = 0;
+  }
+  if(UseLBFGS){
+    printf("Starting LBFGS Minimization\n");
+    MinLBFGS(mov, R, p, dof, TolLBFGS, nMaxItersLBFGS, costs, &nth);
+  }
+  else {
+    printf("Starting Powell Minimization\n");
+    MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
+	      nMaxItersPowell,SegRegCostFile, costs, &nth);
+  }
   secCostTime = TimerStop(&mytimer)/1000.0 ;
 
   // Compute relative final cost 
@@ -1228,6 +1268,19 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%lf",&LinMinTolPowell);
       nargsused = 1;
     }
+    else if (!strcasecmp(option, "--lbfgs")) UseLBFGS = 1;
+    else if (istringnmatch(option, "--lbfgs-nmax",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%d",&nMaxItersLBFGS);
+      UseLBFGS = 1;
+      nargsused = 1;
+    }
+    else if (istringnmatch(option, "--lbfgs-tol",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%lf",&TolLBFGS);
+      UseLBFGS = 1;
+      nargsused = 1;
+    }
     else if (istringnmatch(option, "--o",0)) {
       if (nargc < 1) argnerr(option,1);
       outfile = pargv[0];
@@ -1638,6 +1691,11 @@ printf("       This is the fraction of the cost that the difference in \n");
 printf("       successive costs must drop below to stop the optimization.  \n");
 printf("  --tol1d tol1d : tolerance on powell 1d minimizations\n");
 printf("\n");
+printf("  --lbfgs : use L-BFGS with the analytic gradient instead of powell\n");
+printf("     (trilinear interpolation without vsm only)\n");
+printf("  --lbfgs-nmax nmax : max number of L-BFGS iterations (def %d)\n",nMaxItersLBFGS);
+printf("  --lbfgs-tol tol : L-BFGS relative tolerance on cost (def %g)\n",TolLBFGS);
+printf("\n");
 printf("  --1dmin : use brute force 1D minimizations instead of powell\n");
 printf("  --n1dmin n1dmin : number of 1d minimization (default = 3)\n");
 printf("\n");
@@ -1744,6 +1802,11 @@ static void dump_options(FILE *fp)
   fprintf(fp,"frame  %d\n",frame);
   fprintf(fp,"TolPowell %lf\n",TolPowell);
   fprintf(fp,"nMaxItersPowell %d\n",nMaxItersPowell);
+  fprintf(fp,"UseLBFGS %d\n",UseLBFGS);
+  if(UseLBFGS){
+    fprintf(fp,"TolLBFGS %lf\n",TolLBFGS);
+    fprintf(fp,"nMaxItersLBFGS %d\n",nMaxItersLBFGS);
+  }
   fprintf(fp,"n1dmin  %d\n",n1dmin);
   if(interpcode == SAMPLE_SINC) fprintf(fp,"sinc hw  %d\n",sinchw);
   fprintf(fp,"Profile   %d\n",DoProfile);
@@ -1842,7 +1905,12 @@ float compute_powell_cost(float *p)
   if(R==NULL) R = MatrixAlloc(4,4,MATRIX_REAL);
   for(n=0; n < dof; n++) pp[n] = p[n+1];
   
-  GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
+  if(bbrpoints){
+    // L-BFGS is running, use the packed points
+    R = BBRparams2R(R0, pp, dof, R);
+    BBRcostGrad(bbrpoints, R0, pp, dof, costs, NULL);
+  }
+  else GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
 
   // This is for a fast check on convergence
   //costs[7] = 0;
@@ -2112,32 +2180,15 @@ double VertexCost(double vctx, double vwm, double slope,
   return(c);
 }
 
-/*-------------------------------------------------------*/
-double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
-		     double *p, int dof, double *costs)
+/*-------------------------------------------------------
+  BBRparams2R() - computes the registration for the given
+  parameters (trans, rot, scale, shear; up to dof of them):
+  R = Mshear*Mscale*Mtrans*Mrot*R0
+  -------------------------------------------------------*/
+MATRIX *BBRparams2R(MATRIX *R0, double *p, int dof, MATRIX *R)
 {
-  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
-  extern MRI *lhcost, *rhcost;
-  extern MRI *lhcon, *rhcon;
-  extern char *lhcostfile, *rhcostfile;
-  extern char *lhconfile, *rhconfile;
-  extern int UseMask, UseLH, UseRH;
-  extern MRI *lhsegmask, *rhsegmask;
-  extern MRI *lhCortexLabel, *rhCortexLabel;
-  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
-  extern int PenaltySign;
-  extern double PenaltySlope;
-  extern int nsubsamp;
-  extern int interpcode;
-  double angles[3],d,dsum,dsum2,dstd,dmean,vwm,vctx,c,csum,csum2,cstd,cmean,val;
+  double angles[3];
   MATRIX *Mrot=NULL, *Mtrans=NULL, *Mscale=NULL, *Mshear=NULL;
-  int nhits,n;
-  //FILE *fp;
-
-  if(R==NULL){
-    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
-    return(NULL);
-  }
 
   Mtrans = MatrixIdentity(4,NULL);
   if(dof > 0){
@@ -2177,6 +2228,37 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   MatrixFree(&Mscale);
   MatrixFree(&Mshear);
 
+  return(R);
+}
+
+/*-------------------------------------------------------*/
+double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
+		     double *p, int dof, double *costs)
+{
+  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
+  extern MRI *lhcost, *rhcost;
+  extern MRI *lhcon, *rhcon;
+  extern char *lhcostfile, *rhcostfile;
+  extern char *lhconfile, *rhconfile;
+  extern int UseMask, UseLH, UseRH;
+  extern MRI *lhsegmask, *rhsegmask;
+  extern MRI *lhCortexLabel, *rhCortexLabel;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  extern int PenaltySign;
+  extern double PenaltySlope;
+  extern int nsubsamp;
+  extern int interpcode;
+  double d,dsum,dsum2,dstd,dmean,vwm,vctx,c,csum,csum2,cstd,cmean,val;
+  int nhits,n;
+  //FILE *fp;
+
+  if(R==NULL){
+    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
+    return(NULL);
+  }
+
+  R = BBRparams2R(R0, p, dof, R);
+
   //printf("Trans: %g %g %g\n",p[0],p[1],p[2]);
   //printf("Rot:   %g %g %g\n",p[3],p[4],p[5]);
   //printf("Scale: %g %g %g\n",p[6],p[7],p[8]);
@@ -2322,6 +2404,513 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   return(costs);
 }
 
+/*-------------------------------------------------------
+  BBRpointsBuild() - packs the white and cortex sample points of
+  all vertices that pass the GetSurfCosts() filters along with
+  frame 0 of mov so that the cost and its gradient can be computed
+  without going through MRIvol2surfVSM(). Only valid for trilinear
+  interpolation without a vsm.
+  -------------------------------------------------------*/
+BBR_POINTS *BBRpointsBuild(MRI *mov)
+{
+  extern int UseMask, UseLH, UseRH;
+  extern MRI *lhsegmask, *rhsegmask;
+  extern MRI *lhCortexLabel, *rhCortexLabel;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  extern int nsubsamp;
+  BBR_POINTS *bp;
+  MRIS *wm, *ctx;
+  MRI *segmask, *CortexLabel, *label, *TargCon;
+  MATRIX *vox2ras, *ras2vox;
+  int hemi, n, np, nmax, c, r, s, k;
+
+  bp = (BBR_POINTS *) calloc(sizeof(BBR_POINTS),1);
+  nmax = 0;
+  if(UseLH) nmax += lhwm->nvertices;
+  if(UseRH) nmax += rhwm->nvertices;
+  bp->wxyz = (float *) calloc(sizeof(float),3*nmax+1);
+  bp->cxyz = (float *) calloc(sizeof(float),3*nmax+1);
+  if((UseLH && TargConLH) || (UseRH && TargConRH))
+    bp->targcon = (float *) calloc(sizeof(float),nmax+1);
+
+  np = 0;
+  for(hemi = 0; hemi < 2; hemi++){
+    if(hemi == 0 && !UseLH) continue;
+    if(hemi == 1 && !UseRH) continue;
+    if(hemi == 0){
+      wm = lhwm; ctx = lhctx; segmask = lhsegmask; label = lhlabel;
+      CortexLabel = lhCortexLabel; TargCon = TargConLH;
+    }
+    else {
+      wm = rhwm; ctx = rhctx; segmask = rhsegmask; label = rhlabel;
+      CortexLabel = rhCortexLabel; TargCon = TargConRH;
+    }
+    for(n = 0; n < wm->nvertices; n += nsubsamp){
+      if(wm->vertices[n].ripflag != 0) continue;
+      if(ctx->vertices[n].ripflag != 0) continue;
+      if(CortexLabel && MRIgetVoxVal(CortexLabel,n,0,0,0) < 0.5) continue;
+      if(UseMask && MRIgetVoxVal(segmask,n,0,0,0) < 0.5) continue;
+      if(UseLabel && MRIgetVoxVal(label,n,0,0,0) < 0.5) continue;
+      bp->wxyz[3*np+0] = wm->vertices[n].x;
+      bp->wxyz[3*np+1] = wm->vertices[n].y;
+      bp->wxyz[3*np+2] = wm->vertices[n].z;
+      bp->cxyz[3*np+0] = ctx->vertices[n].x;
+      bp->cxyz[3*np+1] = ctx->vertices[n].y;
+      bp->cxyz[3*np+2] = ctx->vertices[n].z;
+      if(TargCon) bp->targcon[np] = MRIgetVoxVal(TargCon,n,0,0,0);
+      np++;
+    }
+  }
+  bp->npoints = np;
+
+  bp->width  = mov->width;
+  bp->height = mov->height;
+  bp->depth  = mov->depth;
+  bp->vol = (float *) calloc(sizeof(float),mov->width*mov->height*mov->depth);
+  k = 0;
+  for(s=0; s < mov->depth; s++){
+    for(r=0; r < mov->height; r++){
+      for(c=0; c < mov->width; c++){
+	bp->vol[k] = MRIgetVoxVal(mov,c,r,s,0);
+	k++;
+      }
+    }
+  }
+
+  vox2ras = MRIxfmCRS2XYZtkreg(mov);
+  ras2vox = MatrixInverse(vox2ras,NULL);
+  for(r=0; r < 4; r++)
+    for(c=0; c < 4; c++) bp->ras2vox[r][c] = ras2vox->rptr[r+1][c+1];
+  MatrixFree(&vox2ras);
+  MatrixFree(&ras2vox);
+
+  return(bp);
+}
+
+/*-------------------------------------------------------*/
+int BBRpointsFree(BBR_POINTS **pbp)
+{
+  BBR_POINTS *bp = *pbp;
+  if(bp == NULL) return(0);
+  free(bp->wxyz);
+  free(bp->cxyz);
+  if(bp->targcon) free(bp->targcon);
+  free(bp->vol);
+  free(bp);
+  *pbp = NULL;
+  return(0);
+}
+
+/* C = A*B for 4x4, C may be A or B */
+static void BBRmul44(double A[4][4], double B[4][4], double C[4][4])
+{
+  double T[4][4];
+  int r,c,k;
+  for(r=0; r < 4; r++){
+    for(c=0; c < 4; c++){
+      T[r][c] = 0;
+      for(k=0; k < 4; k++) T[r][c] += A[r][k]*B[k][c];
+    }
+  }
+  memcpy(C,T,sizeof(T));
+}
+
+/* ras2vox * Mshear*Mscale*Mtrans*Mrot*R0 */
+static void BBRchain(double V[4][4], double Sh[4][4], double S[4][4],
+		     double T[4][4], double Rot[4][4], double R0[4][4],
+		     double M[4][4])
+{
+  BBRmul44(Rot,R0,M);
+  BBRmul44(T,M,M);
+  BBRmul44(S,M,M);
+  BBRmul44(Sh,M,M);
+  BBRmul44(V,M,M);
+}
+
+/*-------------------------------------------------------
+  BBRsample() - trilinear sample of the packed volume, matching
+  MRIsampleSeqVolume() (coordinates clamped to the volume), and
+  its spatial derivative. The derivative along a clamped axis is 0.
+  -------------------------------------------------------*/
+static double BBRsample(const BBR_POINTS *bp, double x, double y, double z,
+			double *g)
+{
+  int xm, xp, ym, yp, zm, zp, gx=1, gy=1, gz=1;
+  long sy = bp->width, sz = (long)bp->width*bp->height;
+  double xmd, ymd, zmd, xpd, ypd, zpd;
+  double v000,v001,v010,v011,v100,v101,v110,v111;
+
+  if(x >= bp->width)  {x = bp->width - 1.0;  gx = 0;}
+  if(y >= bp->height) {y = bp->height - 1.0; gy = 0;}
+  if(z >= bp->depth)  {z = bp->depth - 1.0;  gz = 0;}
+  if(x < 0.0) {x = 0.0; gx = 0;}
+  if(y < 0.0) {y = 0.0; gy = 0;}
+  if(z < 0.0) {z = 0.0; gz = 0;}
+
+  xm = MAX((int)x, 0) ;
+  xp = MIN(bp->width-1, xm+1) ;
+  ym = MAX((int)y, 0) ;
+  yp = MIN(bp->height-1, ym+1) ;
+  zm = MAX((int)z, 0) ;
+  zp = MIN(bp->depth-1, zm+1) ;
+
+  xmd = x - (float)xm ;
+  ymd = y - (float)ym ;
+  zmd = z - (float)zm ;
+  xpd = (1.0f - xmd) ;
+  ypd = (1.0f - ymd) ;
+  zpd = (1.0f - zmd) ;
+
+  // v<x><y><z>, 0=m, 1=p
+  v000 = bp->vol[xm + ym*sy + zm*sz];
+  v001 = bp->vol[xm + ym*sy + zp*sz];
+  v010 = bp->vol[xm + yp*sy + zm*sz];
+  v011 = bp->vol[xm + yp*sy + zp*sz];
+  v100 = bp->vol[xp + ym*sy + zm*sz];
+  v101 = bp->vol[xp + ym*sy + zp*sz];
+  v110 = bp->vol[xp + yp*sy + zm*sz];
+  v111 = bp->vol[xp + yp*sy + zp*sz];
+
+  if(g){
+    g[0] = g[1] = g[2] = 0;
+    if(gx) g[0] = ypd*zpd*(v100-v000) + ypd*zmd*(v101-v001) +
+	          ymd*zpd*(v110-v010) + ymd*zmd*(v111-v011);
+    if(gy) g[1] = xpd*zpd*(v010-v000) + xpd*zmd*(v011-v001) +
+	          xmd*zpd*(v110-v100) + xmd*zmd*(v111-v101);
+    if(gz) g[2] = xpd*ypd*(v001-v000) + xpd*ymd*(v011-v010) +
+	          xmd*ypd*(v101-v100) + xmd*ymd*(v111-v110);
+  }
+
+  return(xpd * ypd * zpd * v000 + xpd * ypd * zmd * v001 +
+	 xpd * ymd * zpd * v010 + xpd * ymd * zmd * v011 +
+	 xmd * ypd * zpd * v100 + xmd * ypd * zmd * v101 +
+	 xmd * ymd * zpd * v110 + xmd * ymd * zmd * v111);
+}
+
+#define BBR_BLOCK 2048
+#define BBR_NACC  21 // nhits, 8 sums, 3x4 gradient accumulator
+
+/*-------------------------------------------------------
+  BBRcostGrad() - computes the same costs[] as GetSurfCosts()
+  from the packed points and, if grad is non-NULL, the analytic
+  gradient of costs[7] wrt the dof parameters. Points are processed
+  in fixed-size blocks whose partial sums are combined in block
+  order, so the result does not depend on the number of threads.
+  -------------------------------------------------------*/
+double *BBRcostGrad(BBR_POINTS *bp, MATRIX *R0, double *p, int dof,
+		    double *costs, double *grad)
+{
+  extern int PenaltySign;
+  extern double PenaltySlope;
+  double T[4][4], Rot[4][4], S[4][4], Sh[4][4], R0d[4][4], M[4][4];
+  double dRot[3][4][4], E[4][4], G[12][4][4], Rx[3][3], Ry[3][3], Rz[3][3];
+  double dRx[3][3], dRy[3][3], dRz[3][3], ca,sa,cb,sb,cg,sg, d2r = M_PI/180;
+  double *acc, a[BBR_NACC], nhits;
+  int nblocks, r, c, k, i, b;
+  static const int shrc[3][2] = {{0,1},{0,2},{1,2}};
+
+  for(r=0; r < 4; r++){
+    for(c=0; c < 4; c++){
+      T[r][c] = S[r][c] = Sh[r][c] = Rot[r][c] = (r==c);
+      R0d[r][c] = R0->rptr[r+1][c+1];
+    }
+  }
+  if(dof > 0) for(r=0; r < 3; r++) T[r][3] = p[r];
+  if(dof > 6) for(r=0; r < 3; r++) S[r][r] = p[6+r];
+  if(dof > 9) for(k=0; k < 3; k++) Sh[shrc[k][0]][shrc[k][1]] = p[9+k];
+
+  memset(dRot,0,sizeof(dRot));
+  if(dof > 3){
+    // Same convention as MRIangles2RotMat(): Rz(p5)*Ry(p4)*Rx(p3)
+    cg = cos(p[3]*d2r); sg = sin(p[3]*d2r);
+    cb = cos(p[4]*d2r); sb = sin(p[4]*d2r);
+    ca = cos(p[5]*d2r); sa = sin(p[5]*d2r);
+    memset(Rx,0,sizeof(Rx)); memset(dRx,0,sizeof(dRx));
+    memset(Ry,0,sizeof(Ry)); memset(dRy,0,sizeof(dRy));
+    memset(Rz,0,sizeof(Rz)); memset(dRz,0,sizeof(dRz));
+    Rx[0][0] = 1;
+    Rx[1][1] = cg;  Rx[1][2] = -sg; Rx[2][1] = sg;  Rx[2][2] = cg;
+    dRx[1][1] = -sg; dRx[1][2] = -cg; dRx[2][1] = cg; dRx[2][2] = -sg;
+    Ry[1][1] = 1;
+    Ry[0][0] = cb;  Ry[0][2] = sb;  Ry[2][0] = -sb; Ry[2][2] = cb;
+    dRy[0][0] = -sb; dRy[0][2] = cb; dRy[2][0] = -cb; dRy[2][2] = -sb;
+    Rz[2][2] = 1;
+    Rz[0][0] = ca;  Rz[0][1] = -sa; Rz[1][0] = sa;  Rz[1][1] = ca;
+    dRz[0][0] = -sa; dRz[0][1] = -ca; dRz[1][0] = ca; dRz[1][1] = -sa;
+    for(r=0; r < 3; r++){
+      for(c=0; c < 3; c++){
+	Rot[r][c] = 0;
+	for(k=0; k < 9; k++){
+	  // k enumerates the (i,j) pairs of Rz[r][i]*Ry[i][j]*Rx[j][c]
+	  i = k/3; b = k%3;
+	  Rot[r][c]     += Rz[r][i]*Ry[i][b]*Rx[b][c];
+	  dRot[0][r][c] += Rz[r][i]*Ry[i][b]*dRx[b][c]*d2r;
+	  dRot[1][r][c] += Rz[r][i]*dRy[i][b]*Rx[b][c]*d2r;
+	  dRot[2][r][c] += dRz[r][i]*Ry[i][b]*Rx[b][c]*d2r;
+	}
+      }
+    }
+  }
+
+  // M = ras2vox*R maps surface RAS to mov crs
+  BBRchain(bp->ras2vox,Sh,S,T,Rot,R0d,M);
+
+  // G[k] = ras2vox * dR/dp[k]
+  if(grad){
+    for(k=0; k < dof; k++){
+      memset(E,0,sizeof(E));
+      if(k < 3){
+	E[k][3] = 1;
+	BBRchain(bp->ras2vox,Sh,S,E,Rot,R0d,G[k]);
+      }
+      else if(k < 6) BBRchain(bp->ras2vox,Sh,S,T,dRot[k-3],R0d,G[k]);
+      else if(k < 9){
+	E[k-6][k-6] = 1;
+	BBRchain(bp->ras2vox,Sh,E,T,Rot,R0d,G[k]);
+      }
+      else {
+	E[shrc[k-9][0]][shrc[k-9][1]] = 1;
+	BBRchain(bp->ras2vox,E,S,T,Rot,R0d,G[k]);
+      }
+    }
+  }
+
+  nblocks = (bp->npoints + BBR_BLOCK - 1)/BBR_BLOCK;
+  acc = (double *) calloc(sizeof(double),BBR_NACC*nblocks+1);
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+#endif
+  for(b=0; b < nblocks; b++){
+    double *ab = &acc[BBR_NACC*b];
+    double crs[3], gw[3], gc[3], vwm=0, vctx=0, d, sum, th, cost, dcdd, cw, cc;
+    const float *w, *x;
+    int n, nlast, m, i, j, ok;
+
+    nlast = MIN(bp->npoints,(b+1)*BBR_BLOCK);
+    for(n = b*BBR_BLOCK; n < nlast; n++){
+      // white then cortex; a point is dropped if either is out of the
+      // volume (nint() test of MRIvol2surfVSM) or samples to 0
+      ok = 1;
+      for(m=0; m < 2 && ok; m++){
+	x = (m==0) ? &bp->wxyz[3*n] : &bp->cxyz[3*n];
+	for(i=0; i < 3; i++)
+	  crs[i] = M[i][0]*x[0] + M[i][1]*x[1] + M[i][2]*x[2] + M[i][3];
+	if(nint(crs[0]) < 0 || nint(crs[0]) >= bp->width  ||
+	   nint(crs[1]) < 0 || nint(crs[1]) >= bp->height ||
+	   nint(crs[2]) < 0 || nint(crs[2]) >= bp->depth) {ok = 0; break;}
+	if(m == 0){
+	  // cast to float as MRIvol2surfVSM() stores in a float volume
+	  vwm = (float)BBRsample(bp,crs[0],crs[1],crs[2],grad ? gw : NULL);
+	  if(vwm == 0.0) ok = 0;
+	}
+	else {
+	  vctx = (float)BBRsample(bp,crs[0],crs[1],crs[2],grad ? gc : NULL);
+	  if(vctx == 0.0) ok = 0;
+	}
+      }
+      if(!ok) continue;
+
+      // cost as in VertexCost() and its derivative wrt contrast
+      sum = vctx+vwm;
+      d = 200.0*(vctx-vwm)/sum;
+      if(bp->targcon){
+	cost = (d-bp->targcon[n])*(d-bp->targcon[n]);
+	dcdd = 2*(d-bp->targcon[n]);
+      }
+      else {
+	th = 0; dcdd = 0;
+	if(PenaltySign ==  0){
+	  th = -fabs(PenaltySlope*(d-PenaltyCenter));
+	  dcdd = (PenaltySlope*(d-PenaltyCenter) > 0) ? -PenaltySlope : PenaltySlope;
+	}
+	if(PenaltySign == -1) {th = -(PenaltySlope*(d-PenaltyCenter)); dcdd = -PenaltySlope;}
+	if(PenaltySign == +1) {th = +(PenaltySlope*(d-PenaltyCenter)); dcdd = +PenaltySlope;}
+	if(PenaltySign == -2 && d >= 0){th = -(PenaltySlope*(d-PenaltyCenter)); dcdd = -PenaltySlope;}
+	th = tanh(th);
+	cost = 1+th;
+	dcdd *= (1-th*th);
+      }
+      ab[0] += 1;
+      ab[1] += vwm;
+      ab[2] += vwm*vwm;
+      ab[3] += vctx;
+      ab[4] += vctx*vctx;
+      ab[5] += d;
+      ab[6] += d*d;
+      ab[7] += cost;
+      ab[8] += cost*cost;
+      if(grad){
+	// dcost/dcrs for each side, outer product with [xyz 1]
+	cw = dcdd * (-400.0*vctx/(sum*sum));
+	cc = dcdd * ( 400.0*vwm/(sum*sum));
+	w = &bp->wxyz[3*n];
+	x = &bp->cxyz[3*n];
+	for(i=0; i < 3; i++){
+	  for(j=0; j < 3; j++)
+	    ab[9+4*i+j] += cw*gw[i]*w[j] + cc*gc[i]*x[j];
+	  ab[9+4*i+3] += cw*gw[i] + cc*gc[i];
+	}
+      }
+    }
+  }
+
+  memset(a,0,sizeof(a));
+  for(b=0; b < nblocks; b++)
+    for(k=0; k < BBR_NACC; k++) a[k] += acc[BBR_NACC*b+k];
+  free(acc);
+
+  nhits = a[0];
+  costs[0] = nhits;
+  costs[1] = a[1]/nhits; // wm mean
+  costs[2] = sum2stddev(a[1],a[2],nhits); // wm std
+  costs[3] = sum2stddev(a[5],a[6],nhits); // std in percent contrast
+  costs[4] = a[3]/nhits; // ctx mean
+  costs[5] = sum2stddev(a[3],a[4],nhits); // ctx std
+  costs[6] = a[5]/nhits; // percent contrast
+  costs[7] = a[7]/nhits;
+  if(nhits == 0) costs[7] = 10.0;
+
+  if(grad){
+    for(k=0; k < dof; k++){
+      grad[k] = 0;
+      if(nhits == 0) continue;
+      for(r=0; r < 3; r++)
+	for(c=0; c < 4; c++) grad[k] += a[9+4*r+c]*G[k][r][c];
+      grad[k] /= nhits;
+    }
+  }
+
+  return(costs);
+}
+
+/*-------------------------------------------------------
+  MinLBFGS() - minimizes the BBR cost with limited-memory BFGS
+  using the analytic gradient from BBRcostGrad(). R is the
+  registration that params are relative to (as with MinPowell());
+  on return R is the optimal registration and costs are from
+  GetSurfCosts() at the optimum.
+  -------------------------------------------------------*/
+#define LBFGS_M 7
+int MinLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double ftol,
+	     int nmaxiters, double *costs, int *niters)
+{
+  MATRIX *R0;
+  float *pp;
+  double x[12], g[12], xn[12], gn[12], dir[12], s[LBFGS_M][12], y[LBFGS_M][12];
+  double rho[LBFGS_M], alpha[LBFGS_M], sn[12], yn[12];
+  double f, fn, gd, step, q, ys, yy, gmax;
+  int n, k, iter, m, nmem, nls, oldest;
+
+  R0 = MatrixCopy(R,NULL);
+  bbrpoints = BBRpointsBuild(mov);
+  printf("LBFGS: %d boundary points, dof = %d\n",bbrpoints->npoints,dof);
+
+  pp = vector(1, dof);
+  for(n=0; n < dof; n++) x[n] = params[n];
+  for(n=0; n < dof; n++) pp[n+1] = x[n];
+  compute_powell_cost(pp); // for logging
+  BBRcostGrad(bbrpoints, R0, x, dof, costs, g);
+  f = costs[7];
+
+  nmem = 0;
+  oldest = 0;
+  for(iter = 1; iter <= nmaxiters; iter++){
+    // two-loop recursion for dir = -H*g
+    for(n=0; n < dof; n++) dir[n] = -g[n];
+    for(m=0; m < nmem; m++){
+      k = (oldest + nmem - 1 - m) % LBFGS_M;
+      q = 0;
+      for(n=0; n < dof; n++) q += s[k][n]*dir[n];
+      alpha[k] = rho[k]*q;
+      for(n=0; n < dof; n++) dir[n] -= alpha[k]*y[k][n];
+    }
+    if(nmem > 0){
+      k = (oldest + nmem - 1) % LBFGS_M;
+      ys = yy = 0;
+      for(n=0; n < dof; n++){ys += y[k][n]*s[k][n]; yy += y[k][n]*y[k][n];}
+      for(n=0; n < dof; n++) dir[n] *= ys/yy;
+    }
+    for(m=nmem-1; m >= 0; m--){
+      k = (oldest + nmem - 1 - m) % LBFGS_M;
+      q = 0;
+      for(n=0; n < dof; n++) q += y[k][n]*dir[n];
+      q = rho[k]*q;
+      for(n=0; n < dof; n++) dir[n] += s[k][n]*(alpha[k]-q);
+    }
+    gd = 0;
+    for(n=0; n < dof; n++) gd += g[n]*dir[n];
+    if(gd >= 0){
+      // not a descent direction, restart from steepest descent
+      for(n=0; n < dof; n++) dir[n] = -g[n];
+      gd = 0;
+      for(n=0; n < dof; n++) gd -= g[n]*g[n];
+      nmem = 0;
+    }
+    if(gd == 0) break;
+
+    // First step is limited to 1 (mm or deg) in any parameter
+    step = 1;
+    if(nmem == 0){
+      gmax = 0;
+      for(n=0; n < dof; n++) if(gmax < fabs(dir[n])) gmax = fabs(dir[n]);
+      if(gmax > 1) step = 1.0/gmax;
+    }
+
+    // Backtracking line search with the Armijo condition
+    for(nls = 0; nls < 30; nls++){
+      for(n=0; n < dof; n++) xn[n] = x[n] + step*dir[n];
+      BBRcostGrad(bbrpoints, R0, xn, dof, costs, gn);
+      fn = costs[7];
+      if(fn <= f + 1e-4*step*gd) break;
+      step *= 0.5;
+    }
+    if(nls == 30) {
+      printf("LBFGS: line search failed at iter %d\n",iter);
+      break;
+    }
+
+    for(n=0; n < dof; n++) pp[n+1] = xn[n];
+    compute_powell_cost(pp); // for logging and curreg
+
+    // Keep the pair only if it has positive curvature
+    ys = 0;
+    for(n=0; n < dof; n++){
+      sn[n] = xn[n]-x[n];
+      yn[n] = gn[n]-g[n];
+      ys += yn[n]*sn[n];
+    }
+    if(ys > 1e-12){
+      if(nmem < LBFGS_M){
+	k = (oldest + nmem) % LBFGS_M;
+	nmem++;
+      }
+      else {
+	k = oldest;
+	oldest = (oldest+1) % LBFGS_M;
+      }
+      for(n=0; n < dof; n++){s[k][n] = sn[n]; y[k][n] = yn[n];}
+      rho[k] = 1.0/ys;
+    }
+
+    q = fabs(f-fn)/(fabs(f)+fabs(fn)+FLT_MIN);
+    for(n=0; n < dof; n++) {x[n] = xn[n]; g[n] = gn[n];}
+    f = fn;
+    if(q < ftol) break;
+  }
+  if(iter > nmaxiters) iter = nmaxiters;
+  *niters = iter;
+  printf("LBFGS done niters = %d\n",*niters);
+
+  for(n=0; n < dof; n++) params[n] = x[n];
+  BBRpointsFree(&bbrpoints);
+  GetSurfCosts(mov, NULL, R0, R, params, dof, costs);
+
+  free_vector(pp, 1, dof);
+  MatrixFree(&R0);
+  return(NO_ERROR) ;
+}
+
 /*---------------------------------------------------------*/
 int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      int dof, double ftol, double linmintol, int nmaxiters,
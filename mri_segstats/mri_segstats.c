@@ -2132,14 +2132,17 @@ static int singledash(char *flag)
 int MRIsegCount(MRI *seg, int id, int frame)
 {
   int nhits, v, c,r,s;
+  float *row;
   nhits = 0;
-  for (c=0; c < seg->width; c++)
+  row = (float *) calloc(seg->width,sizeof(float));
+  for (s=0; s < seg->depth; s++)
   {
     for (r=0; r < seg->height; r++)
     {
-      for (s=0; s < seg->depth; s++)
+      MRIgetVoxValRow(seg,r,s,frame,row);
+      for (c=0; c < seg->width; c++)
       {
-        v = (int) MRIgetVoxVal(seg,c,r,s,frame);
+        v = (int) row[c];
         if (v == id)
         {
           nhits ++;
@@ -2147,6 +2150,7 @@ int MRIsegCount(MRI *seg, int id, int frame)
       }
     }
   }
+  free(row);
   return(nhits);
 }
 /*------------------------------------------------------------*/
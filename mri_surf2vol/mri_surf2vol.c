@@ -119,6 +119,7 @@ MATRIX *Qa2v;
 
 float reshapefactor;
 int mksurfmask = 0;
+int FillInterior = 0, FillInteriorNSub = 0;
 int UseVolRegIdentity = 0;
 FSENV *fsenv;
 int fstalres;
@@ -340,8 +341,13 @@ int main(int argc, char **argv) {
   MRIcopyHeader(TempVol,OutVol);
   OutVol->nframes = SurfVal->nframes;
 
-  printf("INFO: mapping vertices to closest voxel\n");
-  if (fillribbon) {   /* fill entire ribbon */
+  if (FillInterior) {   /* fill inside of the surface */
+    printf("INFO: filling interior of surface (nsub = %d)\n",FillInteriorNSub);
+    if(MRISfillInteriorScanline(SrcSurf, Qa2v, FillInteriorNSub, OutVol) == NULL)
+      exit(1);
+    VtxVol = NULL;
+  } else if (fillribbon) {   /* fill entire ribbon */
+    printf("INFO: mapping vertices to closest voxel\n");
     VtxVol = MRIconst(TempVol->width, TempVol->height, TempVol->depth, 1, -1, NULL);
     printf("VtxVol fixed\n");
     nhits = 0; 
@@ -378,6 +384,7 @@ int main(int argc, char **argv) {
     //projfrac = (ProjFracStart+ProjFracStop)/2;
     //VtxVol = MRImapSurf2VolClosest(SrcSurf, OutVol, Qa2v, projfrac);
   } else {  /* sample from one point */
+    printf("INFO: mapping vertices to closest voxel\n");
     VtxVol = MRImapSurf2VolClosest(SrcSurf, OutVol, Qa2v, projfrac);
     if (VtxVol == NULL) {
       printf("ERROR: could not map vertices to voxels\n");
@@ -421,7 +428,8 @@ int main(int argc, char **argv) {
     for (c=0; c < OutVol->width; c++) {
       for (r=0; r < OutVol->height; r++) {
         for (s=0; s < OutVol->depth; s++) {
-          v = MRIgetVoxVal(VtxVol,c,r,s,0);
+          if (VtxVol) v = MRIgetVoxVal(VtxVol,c,r,s,0);
+          else        v = (MRIgetVoxVal(OutVol,c,r,s,0) == 0) ? -1 : 0;
           if (v == -1) {
             // output is zero, replace with mergevol
             for (f=0; f < OutVol->nframes; f++) {
@@ -440,7 +448,7 @@ int main(int argc, char **argv) {
     MRIwriteType(OutVol,outvolpath,outvolfmtid);
   }
 
-  if (vtxvolpath != NULL) {
+  if (vtxvolpath != NULL && VtxVol != NULL) {
     printf("INFO: writing closest vertex map to %s\n",vtxvolpath);
     MRIwrite(VtxVol,vtxvolpath);
   }
@@ -514,6 +522,15 @@ static int parse_commandline(int argc, char **argv) {
       if (nargc < 1) argnerr(option,1);
       sscanf(pargv[0],"%f",&projfrac);
       nargsused = 1;
+    } else if ( !strcmp(option, "--fill-interior") ) {
+      FillInterior = 1;
+      mksurfmask = 1;
+    } else if ( !strcmp(option, "--fill-interior-pvf") ) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%d",&FillInteriorNSub);
+      FillInterior = 1;
+      mksurfmask = 1;
+      nargsused = 1;
     } else if ( !strcmp(option, "--fillribbon") ) {
       if (nargc < 0) argnerr(option,1);
       nargsused = 0;
@@ -679,6 +696,8 @@ static void print_usage(void) {
   printf("  --projfrac thickness fraction \n");
   printf("  --fillribbon\n");
   printf("  --fill-projfrac start stop delta : implies --fillribbon\n");
+  printf("  --fill-interior : 1 inside the surface, implies --mkmask\n");
+  printf("  --fill-interior-pvf nsub : fraction of each voxel inside the surface\n");
   printf("  --reg volume registration file\n");
   printf("  --identity subjid : use identity (must supply subject name)\n");
   printf("  --subject subject : override subject in reg \n");
@@ -783,6 +802,16 @@ static void print_help(void) {
     "Note that the volume can be filled 'into' the surface by setting stop < 0,\n"
     "eg, --fill-projfrac -1 0 0.05\n"
     "\n"
+    "--fill-interior\n"
+    "\n"
+    "Instead of mapping values, set each voxel whose center is inside the\n"
+    "(closed) surface to 1. Implies --mkmask.\n"
+    "\n"
+    "--fill-interior-pvf nsub\n"
+    "\n"
+    "Like --fill-interior but compute the fraction of each voxel that is\n"
+    "inside the surface, using nsub x nsub sample lines per voxel.\n"
+    "\n"
     "--reg volume registration file\n"
     "\n"
     "Contains the matrix that maps XYZ in the reference anatomical to XYZ\n"
@@ -931,6 +960,14 @@ static void check_options(void) {
       }
     }
   }
+  if (FillInterior && fillribbon) {
+    printf("ERROR: cannot --fill-interior and --fillribbon\n");
+    exit(1);
+  }
+  if (FillInteriorNSub < 0) {
+    printf("ERROR: --fill-interior-pvf nsub cannot be negative\n");
+    exit(1);
+  }
   if (mksurfmask && surfvalpath != NULL) {
     printf("ERROR: cannot make mask and spec surface value file\n");
     exit(1);
@@ -1029,6 +1066,7 @@ static void dump_options(FILE *fp) {
   if (!mksurfmask) fprintf(fp,"surface value path  %s\n",surfvalpath);
   fprintf(fp,"hemi           %s\n",hemi);
   fprintf(fp,"mksurfmask     %d\n",mksurfmask);
+  if (FillInterior) fprintf(fp,"fillinterior   %d\n",FillInteriorNSub);
   fprintf(fp,"projfrac       %g\n",projfrac);
   if (volregfile) fprintf(fp,"volreg file    %s\n",volregfile);
   fprintf(fp,"outvol   path  %s\n",outvolpath);
@@ -995,7 +995,7 @@ int main(int argc, char **argv) {
 	mri_tmp = MRIalloc(gcam->image.width, gcam->image.height, gcam->image.depth, MRI_FLOAT) ;
 	useVolGeomToMRI(&gcam->image, mri_tmp);
 	
-	GCAMinvert(gcam, mri_tmp) ;
+	GCAMinvertCached(gcam, mri_tmp, gcamfile) ;
 	MRIfree(&mri_tmp) ;
       }
       printf("Applying reg to gcam\n");
@@ -1470,7 +1470,8 @@ static int parse_commandline(int argc, char **argv) {
       } else srclta = NULL;
       if(strcmp(pargv[2],"0")!=0){
 	printf("Loading GCAM %s\n",pargv[2]);
-	gcam = GCAMread(pargv[2]);
+	// only the node positions are needed to sample the morph
+	gcam = GCAMreadPartial(pargv[2], GCAM_FIELD_ORIG|GCAM_FIELD_POSITION, NULL);
 	if(gcam == NULL) exit(1);
       } else gcam = NULL;
       printf("Loading destination LTA %s\n",pargv[3]);
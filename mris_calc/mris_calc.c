@@ -1857,6 +1857,7 @@ VOL_fileRead(
   int     I             = 0;
   MRI*      pMRI            = NULL;
   float*      pf_data           = NULL;
+  float*      pf_row            = NULL;
 
   if(G_verbosity)
   {
@@ -1874,14 +1875,22 @@ VOL_fileRead(
   *ap_vectorSize  = pMRI->width*pMRI->height*pMRI->depth*pMRI->nframes;
   pf_data       = (float*) xmalloc(*ap_vectorSize * sizeof(float));
   sprintf(pch_readMessage, "Packing %s", apch_volFileName);
+  // The array is packed with 'z' fastest, but the volume is read a
+  // row ('x') at a time; I only counts voxels for the progress bar.
+  pf_row        = (float*) xmalloc(pMRI->width * sizeof(float));
   for(f=0; f<pMRI->nframes; f++)        // number of frames
-    for(i=0; i<pMRI->width; i++)  // 'x', i.e. columns in slice
-      for(j=0; j<pMRI->height; j++) // 'y', i.e. rows in slice
-        for(k=0; k<pMRI->depth; k++)    // 'z', i.e. # of slices
+    for(k=0; k<pMRI->depth; k++)        // 'z', i.e. # of slices
+      for(j=0; j<pMRI->height; j++)     // 'y', i.e. rows in slice
+      {
+        MRIgetVoxValRow(pMRI, j, k, f, pf_row);
+        for(i=0; i<pMRI->width; i++)    // 'x', i.e. columns in slice
         {
-          CURV_arrayProgress_print(*ap_vectorSize, I, pch_readMessage);
-          pf_data[I++]  = (float) MRIgetVoxVal(pMRI, i, j, k, f);
+          CURV_arrayProgress_print(*ap_vectorSize, I++, pch_readMessage);
+          pf_data[((f*pMRI->width + i)*pMRI->height + j)*pMRI->depth + k]
+            = pf_row[i];
         }
+      }
+  free(pf_row);
   *apf_data = pf_data;
   return(e_OK);
 }
@@ -1916,6 +1925,7 @@ VOL_fileWrite(
   char    pch_readMessage[STRBUF];
   int           ret;
   MRI     *out;
+  float   *pf_row;
 
   if(!Gp_MRI)
   {
@@ -1929,14 +1939,21 @@ VOL_fileWrite(
   sprintf(pch_readMessage, "Packing %s", apch_volFileName);
   out = MRIallocSequence(Gp_MRI->width, Gp_MRI->height, Gp_MRI->depth, MRI_FLOAT, Gp_MRI->nframes);
   MRIcopyHeader(Gp_MRI,out);
+  // Unpacked a row at a time, as in VOL_fileRead()
+  pf_row = (float*) xmalloc(Gp_MRI->width * sizeof(float));
   for(f=0; f<Gp_MRI->nframes; f++)              // number of frames
-    for(i=0; i<Gp_MRI->width; i++)        // 'x', i.e. columns in slice
-      for(j=0; j<Gp_MRI->height; j++)     // 'y', i.e. rows in slice
-        for(k=0; k<Gp_MRI->depth; k++)      // 'z', i.e. # of slices
+    for(k=0; k<Gp_MRI->depth; k++)              // 'z', i.e. # of slices
+      for(j=0; j<Gp_MRI->height; j++)           // 'y', i.e. rows in slice
+      {
+        for(i=0; i<Gp_MRI->width; i++)          // 'x', i.e. columns in slice
         {
-          CURV_arrayProgress_print(a_vectorSize, I, pch_readMessage);
-          MRIsetVoxVal(out, i, j, k, f, (float) apf_data[I++]);
+          CURV_arrayProgress_print(a_vectorSize, I++, pch_readMessage);
+          pf_row[i] = apf_data[((f*Gp_MRI->width + i)*Gp_MRI->height + j)
+                               *Gp_MRI->depth + k];
         }
+        MRIsetVoxValRow(out, j, k, f, pf_row);
+      }
+  free(pf_row);
   sprintf(pch_readMessage, "Saving result to '%s' (type = %s )",
           apch_volFileName, type_to_string (G_FSFILETYPE3));
   cprints(pch_readMessage, "");
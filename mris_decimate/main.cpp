@@ -30,12 +30,8 @@
 ///
 /// \b DESCRIPTION
 ///
-///  This tool reduces the number of triangles in a surface using the
-///  the GNU Triangulated Surface Library documented at:
-///
-///           http://gts.sourceforge.net/reference/book1.html
-///
-///  Please see the GTS documentation for details on the decimation algorithm.
+///  This tool reduces the number of triangles in a surface by quadric
+///  error edge collapses.
 ///  mris_decimate will read in an existing surface and write out a new one
 ///  with less triangles.  The decimation level and other options can be provided
 ///  on the command-line.
@@ -214,6 +210,10 @@ static int get_option(int argc, char *argv[])
       printf("using minimumAngle = %f\n", gDecimationOptions.minimumAngle) ;
       nargs = 1;
       break;
+    case 'P':
+      gDecimationOptions.parallel = true;
+      printf("collapsing independent edges in parallel rounds\n") ;
+      break;
     default:
       fprintf(stderr, "unknown option %s\n", argv[1]) ;
       exit(1) ;
@@ -290,6 +290,7 @@ static void dump_options(FILE *fp)
   {
     fprintf(fp,"minimumAngle               %f\n", 1.0f) ;
   }
+  fprintf(fp,"parallel                   %d\n", gDecimationOptions.parallel);
 
   return;
 }
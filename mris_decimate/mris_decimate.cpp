@@ -33,12 +33,12 @@
 ///
 /// \b DESCRIPTION
 ///
-///  This tool reduces the number of triangles in a surface using the
-///  the GNU Triangulated Surface Library documented at:
+///  This tool reduces the number of triangles in a surface by quadric
+///  error edge collapses:
 ///
-///           http://gts.sourceforge.net/reference/book1.html
+///     M. Garland and P. Heckbert, "Surface Simplification Using Quadric
+///     Error Metrics", SIGGRAPH 1997.
 ///
-///  Please see the GTS documentation for details on the decimation algorithm.
 ///  mris_decimate will read in an existing surface and write out a new one
 ///  with less triangles.  The decimation level and other options can be provided
 ///  on the command-line.
@@ -49,10 +49,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <sys/utsname.h>
-#include <sstream>
-#include <gts.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include "mris_decimate.h"
 
@@ -60,11 +62,9 @@ extern "C"
 {
 #include "macros.h"
 #include "utils.h"
-#include "fio.h"
-#include "version.h"
-#include "cmdargs.h"
 #include "error.h"
 #include "diag.h"
+#include "colortab.h"
 }
 
 
@@ -74,340 +74,995 @@ extern "C"
 //
 //
 
+// per-vertex scalars that are interpolated along collapsed edges
+#define NSCALARS 7
+// per-vertex labels that are taken from the nearer end of a collapsed edge
+#define NLABELS  2
+
+// weight of the planes that keep the border of an open surface in place
+#define BORDER_WEIGHT 1000.0
+
+// in a parallel round only the cheapest quarter of the candidates is used
+#define ROUND_FRACTION 4
 
 ///
-//  Callback function for loading vertex data from GtsSurface in
-//  decimateSurface()
+//  Symmetric 4x4 quadric error matrix, the upper triangle stored row by row
 //
-static void vertexLoad(GtsPoint * p, gpointer * data)
+struct Quadric
 {
-  MRI_SURFACE *mris = (MRI_SURFACE *)data;
-  mris->vertices[mris->nvertices].x = p->x;
-  mris->vertices[mris->nvertices].y = p->y;
-  mris->vertices[mris->nvertices].z = p->z;
-  unsigned int vertexID = mris->nvertices;
-  GTS_OBJECT(p)->reserved = GUINT_TO_POINTER(vertexID);
-  mris->nvertices++;
-}
+  double a[10];
+
+  void clear()
+  {
+    for (int i = 0; i < 10; i++)
+    {
+      a[i] = 0.0;
+    }
+  }
+
+  void add(const Quadric &q)
+  {
+    for (int i = 0; i < 10; i++)
+    {
+      a[i] += q.a[i];
+    }
+  }
+
+  // squared distance to the plane n.x + d = 0, times w
+  void addPlane(const double *n, double d, double w)
+  {
+    a[0] += w*n[0]*n[0];
+    a[1] += w*n[0]*n[1];
+    a[2] += w*n[0]*n[2];
+    a[3] += w*n[0]*d;
+    a[4] += w*n[1]*n[1];
+    a[5] += w*n[1]*n[2];
+    a[6] += w*n[1]*d;
+    a[7] += w*n[2]*n[2];
+    a[8] += w*n[2]*d;
+    a[9] += w*d*d;
+  }
+
+  double eval(const double *p) const
+  {
+    double x = p[0], y = p[1], z = p[2];
+    return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+           + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+           + a[7]*z*z + 2*a[8]*z + a[9];
+  }
+
+  // position of least error, false if the system is (nearly) singular
+  bool optimum(double *p) const
+  {
+    double c0 = a[4]*a[7] - a[5]*a[5];
+    double c1 = a[1]*a[7] - a[5]*a[2];
+    double c2 = a[1]*a[5] - a[4]*a[2];
+    double det = a[0]*c0 - a[1]*c1 + a[2]*c2;
+    double scale = a[0] + a[4] + a[7];
+    if (fabs(det) <= 1e-10*scale*scale*scale)
+    {
+      return false;
+    }
+    double b0 = -a[3], b1 = -a[6], b2 = -a[8];
+    p[0] = (b0*c0 - a[1]*(b1*a[7] - a[5]*b2) + a[2]*(b1*a[5] - a[4]*b2)) / det;
+    p[1] = (a[0]*(b1*a[7] - a[5]*b2) - b0*c1 + a[2]*(a[1]*b2 - b1*a[2])) / det;
+    p[2] = (a[0]*(a[4]*b2 - b1*a[5]) - a[1]*(a[1]*b2 - b1*a[2]) + b0*c2) / det;
+    return true;
+  }
+};
 
 ///
-//  Callbackfunction for loading traingle data from GtsSurface in
-//  decimateSurface()
+//  Collapse of edge (v0, v1) into v0, placed at p.  The stamps tell if
+//  the heap entry is out of date.
 //
-static void faceLoad(GtsTriangle * t, gpointer * data)
+struct Collapse
+{
+  double cost;
+  double p[3];
+  int    v0, v1;
+  int    stamp0, stamp1;
+
+  bool operator>(const Collapse &c) const
+  {
+    if (cost != c.cost)
+    {
+      return cost > c.cost;
+    }
+    if (v0 != c.v0)
+    {
+      return v0 > c.v0;
+    }
+    return v1 > c.v1;
+  }
+};
+
+static void triangleNormal(const double *p0, const double *p1,
+                           const double *p2, double *n)
 {
-  MRI_SURFACE *mris = (MRI_SURFACE *)data;
-  GtsVertex *v1, *v2, *v3;
-  gts_triangle_vertices(t, &v1, &v2, &v3);
-
-  mris->faces[mris->nfaces].v[0] = (guint) (glong) GTS_OBJECT (v1)->reserved;
-  mris->faces[mris->nfaces].v[1] = (guint) (glong) GTS_OBJECT (v2)->reserved;
-  mris->faces[mris->nfaces].v[2] = (guint) (glong) GTS_OBJECT (v3)->reserved;
-  mris->nfaces++;
+  double e1[3], e2[3];
+  for (int i = 0; i < 3; i++)
+  {
+    e1[i] = p1[i] - p0[i];
+    e2[i] = p2[i] - p0[i];
+  }
+  n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+  n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+  n[2] = e1[0]*e2[1] - e1[1]*e2[0];
 }
 
-///
-//  From cleanup.c example in gts, use this callback function in
-//  edgeCleanup to remove duplicate edges
-//
-static void buildList(gpointer data, GSList ** list)
+static double dot3(const double *a, const double *b)
 {
-  *list = g_slist_prepend (*list, data);
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
 }
 
 ///
-//  Cleanup any duplicate edges from GtsSurface.  This is needed because
-//  the GTS library uses a data structure where each face edge needs
-//  to be stored only once (vs. the way Freesurfer stores the edge in
-//  each face).  This function goes through and cleans out any duplicate
-//  edges from the mesh.  This is applied before the surface is
-//  decimated.
+//  Scratch lists of the collapse checks, one per thread
 //
-//  This code was adapted from gts-0.7.6 examples/cleanup.c
+struct Workspace
+{
+  std::vector<int>      n0, n1, changed, corners;
+  std::vector<double>   normals;
+  std::vector<Collapse> cands;
+};
+
+///
+//  Edge collapse decimation on flat vertex and face arrays.  Faces are
+//  never renumbered during decimation, collapsed ones are only marked
+//  dead, and each vertex keeps the list of its live faces.
 //
-static void edgeCleanup(GtsSurface * surface)
+class Decimator
 {
-  GSList * edges = NULL;
-  GSList * i;
+public:
+  Decimator(MRI_SURFACE *mris, double minimumAngle);
 
-  g_return_if_fail (surface != NULL);
+  int liveFaces() const
+  {
+    return nlive;
+  }
 
-  /* build list of edges */
-  gts_surface_foreach_edge (surface, (GtsFunc) buildList, &edges);
+  // one cheapest collapse at a time, from a lazily updated heap
+  void decimateSerial(int targetFaces);
+  // rounds of collapses on edges whose neighborhoods do not overlap
+  void decimateParallel(int targetFaces);
 
-  /* remove degenerate and duplicate edges.
-   Note: we could use gts_edges_merge() to remove the duplicates and then
-   remove the degenerate edges but it is more efficient to do everything
-   at once (and it's more pedagogical too ...) */
+  MRI_SURFACE *buildSurface(MRI_SURFACE *mris_src) const;
 
-  /* We want to control manually the destruction of edges */
-  gts_allow_floating_edges = TRUE;
+private:
+  void evaluate(int v0, int v1, Collapse &c) const;
+  bool canCollapse(const Collapse &c, Workspace &ws) const;
+  int  collapse(const Collapse &c);
+  void neighbors(int vno, std::vector<int> &nbrs) const;
+  bool bestCollapse(int v0, Collapse &c, Workspace &ws) const;
 
-  i = edges;
-  while (i)
+  const double *position(int vno, const Collapse &c) const
   {
-    GtsEdge * e = (GtsEdge*) i->data;
-    GtsEdge * duplicate;
-    if (GTS_SEGMENT (e)->v1 == GTS_SEGMENT (e)->v2) /* edge is degenerate */
-      /* destroy e */
+    return (vno == c.v0 || vno == c.v1) ? c.p : &pos[3*vno];
+  }
+
+  int                            nvertices;
+  int                            nlive;
+  double                         cosFold;
+  std::vector<double>            pos;
+  std::vector<int>               faces;
+  std::vector<char>              faceDead;
+  std::vector<char>              vertexDead;
+  std::vector<char>              border;
+  std::vector<int>               stamp;
+  std::vector< std::vector<int> > vfaces;
+  std::vector<Quadric>           quadrics;
+  std::vector<float>             scalars;
+  std::vector<int>               labels;
+};
+
+Decimator::Decimator(MRI_SURFACE *mris, double minimumAngle)
+{
+  nvertices = mris->nvertices;
+  cosFold = cos(minimumAngle * M_PI / 180.0);
+
+  pos.resize(3*nvertices);
+  scalars.resize(NSCALARS*nvertices);
+  labels.resize(NLABELS*nvertices);
+  for (int vno = 0; vno < nvertices; vno++)
+  {
+    VERTEX *v = &mris->vertices[vno];
+    pos[3*vno]   = v->x;
+    pos[3*vno+1] = v->y;
+    pos[3*vno+2] = v->z;
+    float *s = &scalars[NSCALARS*vno];
+    s[0] = v->curv;
+    s[1] = v->val;
+    s[2] = v->val2;
+    s[3] = v->stat;
+    s[4] = v->origx;
+    s[5] = v->origy;
+    s[6] = v->origz;
+    labels[NLABELS*vno]   = v->annotation;
+    labels[NLABELS*vno+1] = v->marked;
+  }
+
+  // ripped and degenerate faces are left out
+  faces.reserve(3*mris->nfaces);
+  vfaces.resize(nvertices);
+  for (int fno = 0; fno < mris->nfaces; fno++)
+  {
+    FACE *f = &mris->faces[fno];
+    if (f->ripflag || f->v[0] == f->v[1] || f->v[1] == f->v[2] ||
+        f->v[2] == f->v[0])
     {
-      gts_object_destroy (GTS_OBJECT (e));
+      continue;
     }
-    else if ((duplicate = gts_edge_is_duplicate (e)))
+    int fid = faces.size() / 3;
+    for (int n = 0; n < 3; n++)
     {
-      /* replace e with its duplicate */
-      gts_edge_replace (e, duplicate);
-      /* destroy e */
-      gts_object_destroy (GTS_OBJECT (e));
+      faces.push_back(f->v[n]);
+      vfaces[f->v[n]].push_back(fid);
     }
-    i = i->next;
+  }
+  nlive = faces.size() / 3;
+  faceDead.assign(nlive, 0);
+  stamp.assign(nvertices, 0);
+  border.assign(nvertices, 0);
+  vertexDead.resize(nvertices);
+  for (int vno = 0; vno < nvertices; vno++)
+  {
+    vertexDead[vno] = vfaces[vno].empty();
   }
 
-  /* don't forget to reset to default */
-  gts_allow_floating_edges = FALSE;
+  // area weighted plane quadrics of the faces, plus planes through
+  // border edges perpendicular to their face
+  Quadric zero;
+  zero.clear();
+  quadrics.assign(nvertices, zero);
+  for (int fid = 0; fid < nlive; fid++)
+  {
+    const int *fv = &faces[3*fid];
+    double n[3];
+    triangleNormal(&pos[3*fv[0]], &pos[3*fv[1]], &pos[3*fv[2]], n);
+    double len = sqrt(dot3(n, n));
+    if (len <= 0)
+    {
+      continue;
+    }
+    n[0] /= len;
+    n[1] /= len;
+    n[2] /= len;
+    double d = -dot3(n, &pos[3*fv[0]]);
+    for (int k = 0; k < 3; k++)
+    {
+      quadrics[fv[k]].addPlane(n, d, 0.5*len);
+    }
 
-  /* free list of edges */
-  g_slist_free (edges);
+    for (int k = 0; k < 3; k++)
+    {
+      int a = fv[k], b = fv[(k+1)%3], nshared = 0;
+      for (unsigned int i = 0; i < vfaces[a].size(); i++)
+      {
+        const int *g = &faces[3*vfaces[a][i]];
+        if (g[0] == b || g[1] == b || g[2] == b)
+        {
+          nshared++;
+        }
+      }
+      if (nshared != 1)
+      {
+        continue;
+      }
+      border[a] = border[b] = 1;
+      double e[3], m[3];
+      for (int i = 0; i < 3; i++)
+      {
+        e[i] = pos[3*b+i] - pos[3*a+i];
+      }
+      m[0] = e[1]*n[2] - e[2]*n[1];
+      m[1] = e[2]*n[0] - e[0]*n[2];
+      m[2] = e[0]*n[1] - e[1]*n[0];
+      double mlen = sqrt(dot3(m, m));
+      if (mlen <= 0)
+      {
+        continue;
+      }
+      m[0] /= mlen;
+      m[1] /= mlen;
+      m[2] /= mlen;
+      double md = -dot3(m, &pos[3*a]);
+      quadrics[a].addPlane(m, md, BORDER_WEIGHT*dot3(e, e));
+      quadrics[b].addPlane(m, md, BORDER_WEIGHT*dot3(e, e));
+    }
+  }
 }
 
-///////////////////////////////////////////////////////////////////////////////////
-//
-//  Public Functions
-//
-//
-
+void Decimator::neighbors(int vno, std::vector<int> &nbrs) const
+{
+  nbrs.clear();
+  for (unsigned int i = 0; i < vfaces[vno].size(); i++)
+  {
+    const int *f = &faces[3*vfaces[vno][i]];
+    for (int k = 0; k < 3; k++)
+    {
+      if (f[k] != vno &&
+          std::find(nbrs.begin(), nbrs.end(), f[k]) == nbrs.end())
+      {
+        nbrs.push_back(f[k]);
+      }
+    }
+  }
+}
 
 ///
-/// \fn int decimateSurface(MRI_SURFACE *mris, const DECIMATION_OPTIONS &decimationOptions)
-/// \brief This function performs decimation on the input surface and outputs the new surface to a file
-////     using GTS (GNUT Triangulated Surface Library)
-/// \param mris Input loaded MRI_SURFACE to decimate
-/// \param decimationOptions Options controlling the decimation arguments (see DECIMATION_OPTIONS)
-/// \param decimateProgressFn If non-NULL, provides updates on decimation percentage complete and
-///               a status message that can, for example, be displayed in a GUI.
-/// \param userData If decimateProgressFn is non-NULL, argument passed into decimateProgressFn
-/// \return 0 on success, 1 on failure
-///
-int decimateSurface(MRI_SURFACE **pmris,
-                    const DECIMATION_OPTIONS &decimationOptions,
-                    DECIMATE_PROGRESS_FUNC decimateProgressFn,
-                    void *userData)
+//  Position and cost of collapsing (v0, v1).  The optimum of the summed
+//  quadric is used unless it is singular or far off the edge, then the
+//  best of the end points and the midpoint.
+//
+void Decimator::evaluate(int v0, int v1, Collapse &c) const
 {
-  MRI_SURFACE *mris = (*pmris);
+  Quadric q = quadrics[v0];
+  q.add(quadrics[v1]);
+  const double *p0 = &pos[3*v0], *p1 = &pos[3*v1];
 
-  // Special case: if decimation level is 1.0, just make a copy of the
-  // surface and return
-  if (decimationOptions.decimationLevel == 1.0)
+  c.v0 = v0;
+  c.v1 = v1;
+  c.stamp0 = stamp[v0];
+  c.stamp1 = stamp[v1];
+
+  double mid[3], e[3], dm[3];
+  for (int i = 0; i < 3; i++)
   {
-    if (decimateProgressFn != NULL)
+    mid[i] = 0.5*(p0[i] + p1[i]);
+    e[i] = p1[i] - p0[i];
+  }
+  bool ok = q.optimum(c.p);
+  if (ok)
+  {
+    for (int i = 0; i < 3; i++)
     {
-      decimateProgressFn(1.0, "No decimation requested, finished.", userData);
+      dm[i] = c.p[i] - mid[i];
     }
-
-    return 0;
+    ok = dot3(dm, dm) <= dot3(e, e);
   }
-  GtsSurface *gtsSurface = NULL;
-  GtsVertex **gtsVertices = NULL;
-  GtsEdge **gtsEdges = NULL;
-
-  gtsSurface = gts_surface_new( gts_surface_class(),
-                                gts_face_class(),
-                                gts_edge_class(),
-                                gts_vertex_class() );
-  gtsVertices = (GtsVertex**) g_malloc( sizeof(GtsVertex*) * 
-                                        (mris->nvertices) );
+  if (ok)
+  {
+    c.cost = q.eval(c.p);
+  }
+  else
+  {
+    const double *cand[3] = { p0, p1, mid };
+    c.cost = -1;
+    for (int k = 0; k < 3; k++)
+    {
+      double cost = q.eval(cand[k]);
+      if (c.cost < 0 || cost < c.cost)
+      {
+        c.cost = cost;
+        c.p[0] = cand[k][0];
+        c.p[1] = cand[k][1];
+        c.p[2] = cand[k][2];
+      }
+    }
+  }
+  if (c.cost < 0)
+  {
+    c.cost = 0;  // round off
+  }
+}
 
-  if (decimateProgressFn != NULL)
+///
+//  The collapse must keep the surface a manifold (link condition, no
+//  pinching of the border) and must not flip a face or fold two
+//  neighboring faces onto each other closer than the minimum angle.
+//
+bool Decimator::canCollapse(const Collapse &c, Workspace &ws) const
+{
+  int v0 = c.v0, v1 = c.v1;
+  int nshared = 0;
+  for (unsigned int i = 0; i < vfaces[v0].size(); i++)
+  {
+    const int *f = &faces[3*vfaces[v0][i]];
+    if (f[0] == v1 || f[1] == v1 || f[2] == v1)
+    {
+      nshared++;
+    }
+  }
+  if (nshared < 1 || nshared > 2)
   {
-    decimateProgressFn(0.10, "Creating vertices...", userData);
+    return false;
+  }
+  if (nshared == 2 && border[v0] && border[v1])
+  {
+    return false;
   }
 
-  for (int vno = 0; vno < mris->nvertices; vno++)
+  std::vector<int> &n0 = ws.n0, &n1 = ws.n1;
+  neighbors(v0, n0);
+  neighbors(v1, n1);
+  int ncommon = 0;
+  for (unsigned int i = 0; i < n0.size(); i++)
+    if (std::find(n1.begin(), n1.end(), n0[i]) != n1.end())
+    {
+      ncommon++;
+    }
+  if (ncommon != nshared)
   {
-    gtsVertices[vno] = gts_vertex_new ( gtsSurface->vertex_class,
-                                        mris->vertices[vno].x,
-                                        mris->vertices[vno].y,
-                                        mris->vertices[vno].z );
+    return false;
   }
 
-  if (decimateProgressFn != NULL)
+  // faces that move, with their new corners (v1 renamed to v0)
+  std::vector<int>    &changed = ws.changed;
+  std::vector<int>    &corners = ws.corners;
+  std::vector<double> &normals = ws.normals;
+  changed.clear();
+  corners.clear();
+  normals.clear();
+  for (int side = 0; side < 2; side++)
   {
-    decimateProgressFn(0.20, "Creating edges...", userData);
+    const std::vector<int> &vf = vfaces[side ? v1 : v0];
+    for (unsigned int i = 0; i < vf.size(); i++)
+    {
+      const int *f = &faces[3*vf[i]];
+      bool has0 = (f[0] == v0 || f[1] == v0 || f[2] == v0);
+      bool has1 = (f[0] == v1 || f[1] == v1 || f[2] == v1);
+      if (has0 && has1)
+      {
+        continue;  // collapses away
+      }
+      double nold[3], nnew[3];
+      triangleNormal(&pos[3*f[0]], &pos[3*f[1]], &pos[3*f[2]], nold);
+      triangleNormal(position(f[0], c), position(f[1], c),
+                     position(f[2], c), nnew);
+      double len2 = dot3(nnew, nnew), len2old = dot3(nold, nold);
+      if (len2 <= 1e-12*len2old || (len2old > 0 && dot3(nold, nnew) <= 0))
+      {
+        return false;
+      }
+      double len = sqrt(len2);
+      changed.push_back(vf[i]);
+      for (int k = 0; k < 3; k++)
+      {
+        corners.push_back(f[k] == v1 ? v0 : f[k]);
+        normals.push_back(nnew[k] / len);
+      }
+    }
   }
 
-  gtsEdges = (GtsEdge**) g_malloc(sizeof(GtsEdge*) * mris->nfaces * 3);
-  int edge = 0;
-  for (int fno = 0; fno < mris->nfaces; fno++)
+  for (unsigned int i = 0; i < changed.size(); i++)
   {
-    GtsVertex *v1 = gtsVertices[mris->faces[fno].v[0]];
-    GtsVertex *v2 = gtsVertices[mris->faces[fno].v[1]];
-    GtsVertex *v3 = gtsVertices[mris->faces[fno].v[2]];
+    const int *f = &corners[3*i];
+    const double *nf = &normals[3*i];
+    for (int k = 0; k < 3; k++)
+    {
+      int a = f[k], b = f[(k+1)%3];
+      double ng[3];
+      bool found = false;
+      if (a == v0 || b == v0)
+      {
+        for (unsigned int j = 0; j < changed.size() && !found; j++)
+        {
+          const int *g = &corners[3*j];
+          if (j != i && (g[0] == a || g[1] == a || g[2] == a) &&
+              (g[0] == b || g[1] == b || g[2] == b))
+          {
+            found = true;
+            ng[0] = normals[3*j];
+            ng[1] = normals[3*j+1];
+            ng[2] = normals[3*j+2];
+          }
+        }
+      }
+      else
+      {
+        for (unsigned int j = 0; j < vfaces[a].size() && !found; j++)
+        {
+          int gid = vfaces[a][j];
+          const int *g = &faces[3*gid];
+          if (gid != changed[i] && (g[0] == b || g[1] == b || g[2] == b))
+          {
+            found = true;
+            triangleNormal(position(g[0], c), position(g[1], c),
+                           position(g[2], c), ng);
+            double len = sqrt(dot3(ng, ng));
+            if (len <= 0)
+            {
+              found = false;
+              break;
+            }
+            ng[0] /= len;
+            ng[1] /= len;
+            ng[2] /= len;
+          }
+        }
+      }
+      if (found && dot3(nf, ng) < -cosFold)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
-    gtsEdges[edge++] = gts_edge_new( gtsSurface->edge_class, v1, v2 );
-    gtsEdges[edge++] = gts_edge_new( gtsSurface->edge_class, v2, v3 );
-    gtsEdges[edge++] = gts_edge_new( gtsSurface->edge_class, v3, v1 );
+///
+//  Merges v1 into v0 and returns the number of faces removed.  Only the
+//  closed neighborhoods of v0 and v1 are touched.
+//
+int Decimator::collapse(const Collapse &c)
+{
+  int v0 = c.v0, v1 = c.v1, nremoved = 0;
 
+  for (unsigned int i = 0; i < vfaces[v1].size(); i++)
+  {
+    int fid = vfaces[v1][i];
+    int *f = &faces[3*fid];
+    if (f[0] == v0 || f[1] == v0 || f[2] == v0)
+    {
+      faceDead[fid] = 1;
+      nremoved++;
+      for (int k = 0; k < 3; k++)
+      {
+        if (f[k] == v1)
+        {
+          continue;
+        }
+        std::vector<int> &vf = vfaces[f[k]];
+        vf.erase(std::find(vf.begin(), vf.end(), fid));
+      }
+    }
+    else
+    {
+      for (int k = 0; k < 3; k++)
+        if (f[k] == v1)
+        {
+          f[k] = v0;
+        }
+      vfaces[v0].push_back(fid);
+    }
   }
+  std::vector<int>().swap(vfaces[v1]);
 
-  if (decimateProgressFn != NULL)
+  // where the new vertex lies along the old edge
+  double e[3], d[3];
+  for (int i = 0; i < 3; i++)
   {
-    decimateProgressFn(0.30, "Adding faces...", userData);
+    e[i] = pos[3*v1+i] - pos[3*v0+i];
+    d[i] = c.p[i] - pos[3*v0+i];
   }
-
-  edge = 0;
-  for (int fno = 0; fno < mris->nfaces; fno++)
+  double t = dot3(e, e) > 0 ? dot3(d, e) / dot3(e, e) : 0.0;
+  if (t < 0)
+  {
+    t = 0;
+  }
+  if (t > 1)
   {
-    gts_surface_add_face( gtsSurface,
-                          gts_face_new(gtsSurface->face_class,
-                                       gtsEdges[edge],
-                                       gtsEdges[edge + 1],
-                                       gtsEdges[edge + 2]) );
-    edge += 3;
+    t = 1;
   }
+  for (int i = 0; i < NSCALARS; i++)
+  {
+    scalars[NSCALARS*v0+i] = (1-t)*scalars[NSCALARS*v0+i] +
+                             t*scalars[NSCALARS*v1+i];
+  }
+  if (t > 0.5)
+    for (int i = 0; i < NLABELS; i++)
+    {
+      labels[NLABELS*v0+i] = labels[NLABELS*v1+i];
+    }
 
-  // The GTS data structure requires the edges to be merged.  Since
-  // we did not cull duplicate edges from the Freesurfer data structure,
-  // use this GTS function to merge the edges of the surface before
-  // decimation.
-  edgeCleanup(gtsSurface);
-  int numDistinctEdges = gts_surface_edge_number(gtsSurface);
+  pos[3*v0]   = c.p[0];
+  pos[3*v0+1] = c.p[1];
+  pos[3*v0+2] = c.p[2];
+  quadrics[v0].add(quadrics[v1]);
+  border[v0] = border[v0] || border[v1];
+  vertexDead[v1] = 1;
+  stamp[v0]++;
+  stamp[v1]++;
 
-  if (decimateProgressFn != NULL)
+  return nremoved;
+}
+
+void Decimator::decimateSerial(int targetFaces)
+{
+  std::priority_queue<Collapse, std::vector<Collapse>,
+      std::greater<Collapse> > heap;
+  std::vector<int> nbrs;
+  Workspace ws;
+  Collapse c;
+
+  for (int v0 = 0; v0 < nvertices; v0++)
   {
-    decimateProgressFn(0.40, "Decimating surface...", userData);
+    if (vertexDead[v0])
+    {
+      continue;
+    }
+    neighbors(v0, nbrs);
+    for (unsigned int i = 0; i < nbrs.size(); i++)
+      if (nbrs[i] > v0)
+      {
+        evaluate(v0, nbrs[i], c);
+        heap.push(c);
+      }
   }
 
-  float minimumAngle = 1.0;
-  if (decimationOptions.setMinimumAngle)
+  while (nlive > targetFaces && !heap.empty())
   {
-    minimumAngle = decimationOptions.minimumAngle;
+    c = heap.top();
+    heap.pop();
+    if (vertexDead[c.v0] || vertexDead[c.v1] ||
+        c.stamp0 != stamp[c.v0] || c.stamp1 != stamp[c.v1])
+    {
+      continue;  // out of date
+    }
+    if (!canCollapse(c, ws))
+    {
+      continue;
+    }
+    nlive -= collapse(c);
+
+    int v0 = c.v0;
+    neighbors(v0, nbrs);
+    for (unsigned int i = 0; i < nbrs.size(); i++)
+    {
+      int vn = nbrs[i];
+      evaluate(std::min(v0, vn), std::max(v0, vn), c);
+      heap.push(c);
+    }
   }
+}
 
-  GtsVolumeOptimizedParams params = { 0.5, 0.5, 0. };
-  gdouble fold = minimumAngle * PI/180.;
-  int stop = (int)((float)numDistinctEdges * 
-                   decimationOptions.decimationLevel);
-  gts_surface_coarsen (gtsSurface,
-                       (GtsKeyFunc) gts_volume_optimized_cost,
-                       &params,
-                       (GtsCoarsenFunc) gts_volume_optimized_vertex,
-                       &params,
-                       (GtsStopFunc) gts_coarsen_stop_number,
-                       &stop,
-                       fold);
+///
+//  Cheapest valid collapse of v0 with one of its higher numbered neighbors
+//
+bool Decimator::bestCollapse(int v0, Collapse &best, Workspace &ws) const
+{
+  std::vector<Collapse> &cands = ws.cands;
+  Collapse c;
 
-  // Free the vertex and face buffers
-  for (int vno = 0 ; vno < mris->nvertices ; vno++)
+  neighbors(v0, ws.n0);
+  cands.clear();
+  for (unsigned int i = 0; i < ws.n0.size(); i++)
+    if (ws.n0[i] > v0)
+    {
+      evaluate(v0, ws.n0[i], c);
+      cands.push_back(c);
+    }
+  std::sort(cands.begin(), cands.end(), std::greater<Collapse>());
+  while (!cands.empty())
   {
-    if (mris->vertices[vno].f)
+    if (canCollapse(cands.back(), ws))
     {
-      free(mris->vertices[vno].f) ;
-      mris->vertices[vno].f = NULL ;
+      best = cands.back();
+      return true;
     }
-    if (mris->vertices[vno].n)
+    cands.pop_back();
+  }
+  return false;
+}
+
+static bool lessCost(const Collapse &c1, const Collapse &c2)
+{
+  return c2 > c1;
+}
+
+///
+//  Each round updates the best collapse of the vertices around the
+//  previous round's collapses in parallel, then greedily picks the
+//  cheapest ones whose closed neighborhoods do not overlap and applies
+//  them in parallel.  Cached collapses further away keep their cost but
+//  may have become invalid, so the candidates are checked again before
+//  picking.  The picks do not depend on the number of threads.
+//
+void Decimator::decimateParallel(int targetFaces)
+{
+  std::vector<Collapse> best(nvertices);
+  std::vector<char>     hasBest(nvertices, 0);
+  std::vector<char>     dirty(nvertices, 1);
+  std::vector<int>      updated(nvertices, 0);
+  std::vector<int>      locked(nvertices, 0);
+  std::vector<int>      todo, ring, n1;
+  int                   round = 0;
+
+  while (nlive > targetFaces)
+  {
+    round++;
+    todo.clear();
+    for (int vno = 0; vno < nvertices; vno++)
+      if (dirty[vno])
+      {
+        todo.push_back(vno);
+        dirty[vno] = 0;
+      }
+    int i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
     {
-      free(mris->vertices[vno].n) ;
-      mris->vertices[vno].n = NULL ;
+      Workspace ws;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+      for (i = 0; i < (int)todo.size(); i++)
+      {
+        int v0 = todo[i];
+        hasBest[v0] = !vertexDead[v0] && bestCollapse(v0, best[v0], ws);
+        updated[v0] = round;
+      }
     }
-    if (mris->vertices[vno].dist)
+
+    std::vector<Collapse> cands;
+    for (int vno = 0; vno < nvertices; vno++)
+      if (hasBest[vno])
+      {
+        cands.push_back(best[vno]);
+      }
+    if (cands.empty())
     {
-      free(mris->vertices[vno].dist) ;
-      mris->vertices[vno].dist = NULL ;
+      break;
     }
-    if (mris->vertices[vno].dist_orig)
+    int nconsider = cands.size() / ROUND_FRACTION + 1;
+    std::nth_element(cands.begin(), cands.begin() + nconsider - 1,
+                     cands.end(), lessCost);
+    std::sort(cands.begin(), cands.begin() + nconsider, lessCost);
+
+    std::vector<char> valid(nconsider);
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
     {
-      free(mris->vertices[vno].dist_orig) ;
-      mris->vertices[vno].dist_orig = NULL ;
+      Workspace ws;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+      for (i = 0; i < nconsider; i++)
+      {
+        valid[i] = updated[cands[i].v0] == round || canCollapse(cands[i], ws);
+      }
     }
-    if (mris->vertices[vno].v)
+
+    std::vector<Collapse> picks;
+    int nremove = 0;
+    for (i = 0; i < nconsider && nlive - nremove > targetFaces; i++)
     {
-      free(mris->vertices[vno].v) ;
-      mris->vertices[vno].v = NULL ;
+      const Collapse &c = cands[i];
+      if (!valid[i])
+      {
+        dirty[c.v0] = 1;
+        continue;
+      }
+      neighbors(c.v0, ring);
+      neighbors(c.v1, n1);
+      ring.insert(ring.end(), n1.begin(), n1.end());
+      bool isfree = true;
+      for (unsigned int k = 0; k < ring.size() && isfree; k++)
+        if (locked[ring[k]] == round)
+        {
+          isfree = false;
+        }
+      if (!isfree)
+      {
+        continue;
+      }
+      for (unsigned int k = 0; k < ring.size(); k++)
+      {
+        locked[ring[k]] = round;
+      }
+      picks.push_back(c);
+      nremove += border[c.v0] && border[c.v1] ? 1 : 2;
     }
-  }
-  free(mris->vertices);
-  free(mris->faces);
 
-  GtsSurfaceStats stats;
-  gts_surface_stats( gtsSurface, &stats);
+    int nremoved = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+:nremoved)
+#endif
+    for (i = 0; i < (int)picks.size(); i++)
+    {
+      nremoved += collapse(picks[i]);
+    }
+    nlive -= nremoved;
 
-  printf("Decimated Surface Number of vertices: %d\n", 
-         stats.edges_per_vertex.n);
-  printf("Decimated Surface Number of faces: %d\n",
-         stats.n_faces);
+    // edge costs changed only around the merged vertices
+    for (i = 0; i < (int)picks.size(); i++)
+    {
+      hasBest[picks[i].v1] = 0;
+      dirty[picks[i].v0] = 1;
+      neighbors(picks[i].v0, n1);
+      for (unsigned int k = 0; k < n1.size(); k++)
+      {
+        dirty[n1[k]] = 1;
+      }
+    }
+  }
+}
 
-  mris->nvertices = stats.edges_per_vertex.n;
-  mris->nfaces = stats.n_faces;
+///
+//  New surface from the live faces and the vertices they use (in their
+//  original order), with the interpolated per-vertex data
+//
+MRI_SURFACE *Decimator::buildSurface(MRI_SURFACE *mris_src) const
+{
+  std::vector<int> vmap(nvertices, -1);
+  int nfaces = faces.size() / 3, nv = 0, nf = 0;
+  for (int fid = 0; fid < nfaces; fid++)
+    if (!faceDead[fid])
+    {
+      nf++;
+      for (int k = 0; k < 3; k++)
+      {
+        vmap[faces[3*fid+k]] = 0;
+      }
+    }
+  for (int vno = 0; vno < nvertices; vno++)
+    if (vmap[vno] == 0)
+    {
+      vmap[vno] = nv++;
+    }
 
-  // Allocate at the new size
-  mris->vertices = (VERTEX *)calloc(stats.edges_per_vertex.n, sizeof(VERTEX)) ;
-  if (!mris->vertices)
+  MRI_SURFACE *mris = MRISoverAlloc(nv, nf, nv, nf);
+  mris->type = mris_src->type;
+  mris->hemisphere = mris_src->hemisphere;
+  mris->status = mris_src->status;
+  mris->useRealRAS = mris_src->useRealRAS;
+  copyVolGeom(&mris_src->vg, &mris->vg);
+  strcpy(mris->fname, mris_src->fname);
+  strcpy(mris->subject_name, mris_src->subject_name);
+  if (mris_src->ct)
   {
-    ErrorExit(ERROR_NO_MEMORY,
-              "decimateSurface(%d, %d): could not allocate vertices",
-              mris->nvertices, sizeof(VERTEX));
+    mris->ct = CTABdeepCopy(mris_src->ct);
   }
-  mris->faces = (FACE *)calloc(stats.n_faces, sizeof(FACE)) ;
-  if (!mris->faces)
+
+  for (int vno = 0; vno < nvertices; vno++)
   {
-    ErrorExit(ERROR_NO_MEMORY,
-              "decimateSurface(%d, %d): could not allocate faces",
-              mris->nfaces, sizeof(FACE));
+    if (vmap[vno] < 0)
+    {
+      continue;
+    }
+    VERTEX *v = &mris->vertices[vmap[vno]];
+    const float *s = &scalars[NSCALARS*vno];
+    v->x = pos[3*vno];
+    v->y = pos[3*vno+1];
+    v->z = pos[3*vno+2];
+    v->curv = s[0];
+    v->val = s[1];
+    v->val2 = s[2];
+    v->stat = s[3];
+    v->origx = s[4];
+    v->origy = s[5];
+    v->origz = s[6];
+    v->annotation = labels[NLABELS*vno];
+    v->marked = labels[NLABELS*vno+1];
   }
 
-  if (decimateProgressFn != NULL)
+  nf = 0;
+  for (int fid = 0; fid < nfaces; fid++)
+    if (!faceDead[fid])
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        mris->faces[nf].v[k] = vmap[faces[3*fid+k]];
+        mris->vertices[mris->faces[nf].v[k]].num++;
+      }
+      nf++;
+    }
+  for (int vno = 0; vno < nv; vno++)
   {
-    decimateProgressFn(0.70, "Copying vertices to mris...", userData);
+    VERTEX *v = &mris->vertices[vno];
+    v->f = (int *)calloc(v->num, sizeof(int));
+    v->n = (uchar *)calloc(v->num, sizeof(uchar));
+    if (!v->f || !v->n)
+      ErrorExit(ERROR_NO_MEMORY,
+                "decimateSurface: could not allocate %d faces at vertex %d",
+                v->num, vno);
+    v->num = 0;
   }
+  for (int fno = 0; fno < nf; fno++)
+    for (int k = 0; k < 3; k++)
+    {
+      VERTEX *v = &mris->vertices[mris->faces[fno].v[k]];
+      v->n[v->num] = k;
+      v->f[v->num++] = fno;
+    }
 
-  gpointer data;
-  mris->nvertices = 0;
-  data = (gpointer)mris;
-  gts_surface_foreach_vertex( gtsSurface, (GtsFunc) vertexLoad, data);
+  float xlo = 1e10, ylo = 1e10, zlo = 1e10;
+  float xhi = -1e10, yhi = -1e10, zhi = -1e10;
+  for (int vno = 0; vno < nv; vno++)
+  {
+    VERTEX *v = &mris->vertices[vno];
+    xlo = MIN(xlo, v->x);
+    ylo = MIN(ylo, v->y);
+    zlo = MIN(zlo, v->z);
+    xhi = MAX(xhi, v->x);
+    yhi = MAX(yhi, v->y);
+    zhi = MAX(zhi, v->z);
+  }
+  mris->xlo = xlo;
+  mris->ylo = ylo;
+  mris->zlo = zlo;
+  mris->xhi = xhi;
+  mris->yhi = yhi;
+  mris->zhi = zhi;
+  mris->xctr = (xhi+xlo)/2;
+  mris->yctr = (yhi+ylo)/2;
+  mris->zctr = (zhi+zlo)/2;
+
+  // neighbors, distances and metric properties
+  UpdateMRIS(mris, NULL);
 
+  return mris;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+//  Public Functions
+//
+//
+
+
+///
+/// \fn int decimateSurface(MRI_SURFACE *mris, const DECIMATION_OPTIONS &decimationOptions)
+/// \brief This function performs decimation on the input surface by quadric
+///        error edge collapses and replaces it with the decimated surface
+/// \param mris Input loaded MRI_SURFACE to decimate
+/// \param decimationOptions Options controlling the decimation arguments (see DECIMATION_OPTIONS)
+/// \param decimateProgressFn If non-NULL, provides updates on decimation percentage complete and
+///               a status message that can, for example, be displayed in a GUI.
+/// \param userData If decimateProgressFn is non-NULL, argument passed into decimateProgressFn
+/// \return 0 on success, 1 on failure
+///
+int decimateSurface(MRI_SURFACE **pmris,
+                    const DECIMATION_OPTIONS &decimationOptions,
+                    DECIMATE_PROGRESS_FUNC decimateProgressFn,
+                    void *userData)
+{
+  MRI_SURFACE *mris = (*pmris);
+
+  // Special case: if decimation level is 1.0, just make a copy of the
+  // surface and return
+  if (decimationOptions.decimationLevel == 1.0)
+  {
+    if (decimateProgressFn != NULL)
+    {
+      decimateProgressFn(1.0, "No decimation requested, finished.", userData);
+    }
+
+    return 0;
+  }
 
   if (decimateProgressFn != NULL)
   {
-    decimateProgressFn(0.80, "Copying faces to mris...", userData);
+    decimateProgressFn(0.10, "Computing quadrics...", userData);
   }
 
-  mris->nfaces = 0;
-  data = (gpointer)mris;
-  gts_surface_foreach_face( gtsSurface, (GtsFunc) faceLoad, data);
+  float minimumAngle = 1.0;
+  if (decimationOptions.setMinimumAngle)
+  {
+    minimumAngle = decimationOptions.minimumAngle;
+  }
 
+  Decimator decimator(mris, minimumAngle);
+  int stop = (int)((float)decimator.liveFaces() *
+                   decimationOptions.decimationLevel);
 
   if (decimateProgressFn != NULL)
   {
-    decimateProgressFn(0.90, "Creating new mris...", userData);
+    decimateProgressFn(0.40, "Decimating surface...", userData);
   }
 
-  // Create a temporary file to write the output and then read it back in
-  // to get the decimated surface. The reason I do this is because there
-  // was no clear API call in mrisurf.c that would allow me to muck with
-  // the vertex/face array and properly calculate everything else in the
-  // structure.  I felt this was the safest way to make sure everything
-  // in the surface got recalculated properly.
-  char *tmpName = strdup("/tmp/mris_decimateXXXXXX");
-  int fd = mkstemp(tmpName);
-  char tmp_fpath[STRLEN];
+  if (decimationOptions.parallel)
+  {
+    decimator.decimateParallel(stop);
+  }
+  else
+  {
+    decimator.decimateSerial(stop);
+  }
 
-  if (fd == -1)
+  if (decimateProgressFn != NULL)
   {
-    std::cerr << "Error creating temporary file: " 
-              << std::string(tmpName) << std::endl;
-    return -1;
+    decimateProgressFn(0.80, "Creating new mris...", userData);
   }
 
-  FileNameAbsolute(tmpName, tmp_fpath);
+  MRI_SURFACE *mris_dec = decimator.buildSurface(mris);
 
-  MRISwrite(mris, tmp_fpath);
-  MRISfree(pmris);
-  *pmris = MRISread(tmp_fpath);
-  remove(tmp_fpath);
+  printf("Decimated Surface Number of vertices: %d\n", mris_dec->nvertices);
+  printf("Decimated Surface Number of faces: %d\n", mris_dec->nfaces);
 
-  g_free(gtsVertices);
-  g_free(gtsEdges);
-  g_free(gtsSurface);
+  MRISfree(pmris);
+  *pmris = mris_dec;
 
   if (decimateProgressFn != NULL)
   {
@@ -416,7 +1071,3 @@ int decimateSurface(MRI_SURFACE **pmris,
 
   return 0;
 }
-
-
-
-
@@ -43,6 +43,9 @@
 #include "version.h"
 #include "icosahedron.h"
 #include "label.h"
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 static char vcid[] = "$Id: mris_thickness.c,v 1.28 2012/11/27 17:41:26 fischl Exp $";
 
@@ -68,6 +71,7 @@ static char *sphere_name = "sphere" ;
 static int signed_dist = 0 ;
 static char sdir[STRLEN] = "" ;
 static int fmin_thick = 0 ;
+static int exact_thick = 0 ;
 static float laplace_res = 0.5 ;
 static int laplace_thick = 0 ;
 static INTEGRATION_PARMS parms ;
@@ -630,6 +634,8 @@ main(int argc, char *argv[]) {
   }
   else if (write_vertices) {
     MRISfindClosestOrigVertices(mris, nbhd_size) ;
+  } else if (exact_thick) {
+    MRISmeasureCorticalThicknessExact(mris, max_thick) ;
   } else {
     MRISmeasureCorticalThickness(mris, nbhd_size, max_thick) ;
   }
@@ -763,6 +769,16 @@ get_option(int argc, char *argv[]) {
   } else if (!stricmp(option, "new") || !stricmp(option, "fmin") || !stricmp(option, "variational")) {
     fmin_thick = 1 ;
     fprintf(stderr,  "using variational thickness measurement\n") ;
+  } else if (!stricmp(option, "exact")) {
+    exact_thick = 1 ;
+    fprintf(stderr,  "using exact closest point thickness measurement\n") ;
+  } else if (!stricmp(option, "threads") || !stricmp(option, "nthreads")) {
+#ifdef HAVE_OPENMP
+    int nthreads = atoi(argv[2]) ;
+    omp_set_num_threads(nthreads) ;
+    fprintf(stderr,  "using %d threads\n", nthreads) ;
+#endif
+    nargs = 1 ;
   } else if (!stricmp(option, "laplace") || !stricmp(option, "laplacian")) {
     laplace_thick = 1 ;
     laplace_res = atof(argv[2]) ;
@@ -835,6 +851,9 @@ print_help(void) {
           "<thickness file>.\n") ;
   fprintf(stderr, "\nvalid options are:\n\n") ;
   fprintf(stderr, "-max <max>\t use <max> to threshold thickness (default=5mm)\n") ;
+  fprintf(stderr, "-exact\t\t use the exact closest point on the other surface instead of\n"
+          "\t\t the closest vertex within -N <nbhd size> rings\n") ;
+  fprintf(stderr, "-threads <n>\t use <n> OpenMP threads\n") ;
   fprintf(stderr, "-fill_holes <cortex label> <fsaverage cortex label> fill in thickness in holes in the cortex label\n");
   exit(1) ;
 }
@@ -42,6 +42,7 @@
 #include "mri.h"
 #include "macros.h"
 #include "mrishash.h"
+#include "mrisbvh.h"
 #include "mri_identify.h"
 #include "annotation.h"
 #include "icosahedron.h"
@@ -719,7 +720,8 @@ static void print_help(void)
   (
     "mris_thickness_diff computes the difference of two surface data\n"
     "sets defined on the two surface mesh. Result = data2 - data1\n"
-    "(in the sense of closest vertex).\n\n"
+    "(in the sense of closest point: data2 is linearly interpolated\n"
+    "within the face of surface2 closest to each vertex of surface1).\n\n"
 
     "mris_thickness_diff uses closest Euclidean distance to \n"
     "define correspondence across the two surfaces. It does \n"
@@ -1142,19 +1144,28 @@ MRI *ComputeDifferenceNew(MRI_SURFACE *Mesh1,
                           MRI *mri_res)
 {
   /* This one will do a more accurate interpolation */
-  int index, k, facenumber, closestface, nnindex;
-  VERTEX *vertex;
-  double sumcurv, sumweight, weight;
-  VERTEX *V1, *V2, *V3;
+  int index, k;
+  double sumcurv;
   FACE *face;
-  double value, distance, tmps, tmpt;
+  double value, distance;
   double total_distance, tmp_distance;
   double max_distance, std_dist;
-  float dmin;
-  MHT *SrcHash;
+  MRIS_BVH *bvh;
+  MRIS_CLOSEST_POINT *cps, *cp;
 	MRI *mri_resampled = MRIclone(mri_data1, NULL);
 
-  SrcHash = MHTfillVertexTableRes(Mesh2, NULL,CURRENT_VERTICES,16);
+  /* closest point on Mesh2 to every vertex of Mesh1, with the face it
+     lies in and its barycentric coordinates there */
+  cps = (MRIS_CLOSEST_POINT *)calloc(Mesh1->nvertices, sizeof(MRIS_CLOSEST_POINT));
+  if (cps == NULL)
+  {
+    printf("\nERROR: ComputeDifferenceNew: could not allocate %d points\n",
+           Mesh1->nvertices);
+    exit(1);
+  }
+  bvh = MRISbvhAlloc(Mesh2, CURRENT_VERTICES);
+  MRISbvhClosestVertexPoints(bvh, Mesh1, CURRENT_VERTICES, 0, cps);
+  MRISbvhFree(&bvh);
 
   max_distance = 0;
 
@@ -1169,91 +1180,31 @@ MRI *ComputeDifferenceNew(MRI_SURFACE *Mesh1,
   {
     if (Mesh1->vertices[index].border == 1) continue;
     if (Mesh1->vertices[index].marked != 1) continue;
-    vertex = &Mesh1->vertices[index];
-    nnindex = MHTfindClosestVertexNo(SrcHash,Mesh2,vertex,&dmin);
-
-    /* nnIndex gives the closest vertex on
-       mris_template to the vertex #index of mris 
-       sanity-check it: */
-    if (nnindex >= Mesh2->nvertices)
-    {
-      printf("\nERROR: ComputeDifferenceNew: MHTfindClosestVertexNo "
-             "vidx %d returned nnindex=%d, which is >= nvertices=%d\n", 
-             index,nnindex, Mesh2->nvertices);
-      exit(1);
-    }
-    if (nnindex < 0)
-    {
-      printf("\nERROR: ComputeDifferenceNew: MHTfindClosestVertexNo "
-             "vidx %d returned nnindex=%d, which is invalid\n", index, nnindex);
-      exit(1);
-    }
+    cp = &cps[index];
 
-    /* Now need to find the closest face in order
-       to perform linear interpolation,
-       but first, a sanity-check: */
-    if (Mesh2->vertices[nnindex].num <= 0) 
+    /* sanity-check it: */
+    if (cp->fno < 0 || cp->fno >= Mesh2->nfaces)
     {
-      printf("\nERROR: ComputeDifferenceNew: \n"
-             "(Mesh2->vertices[nnindex].num=%d <= 0)\n", 
-             Mesh2->vertices[nnindex].num);
+      printf("\nERROR: ComputeDifferenceNew: no closest face on Mesh2 "
+             "for vidx %d\n", index);
       exit(1);
     }
-    distance = 1e30;
-    closestface = 0;
-    for (k=0; k < Mesh2->vertices[nnindex].num; k++)
-    {
-
-      facenumber =  Mesh2->vertices[nnindex].f[k]; /* index of the k-th face */
-      if (facenumber < 0 || facenumber >= Mesh2->nfaces) continue;
-      value = v_to_f_distance(vertex, Mesh2, facenumber, 0, &tmps, &tmpt);
-      /* Here it would be better to compute the correct distance together
-			   with the closest point and then use barycentric coordinates below (mr) */
-
-      if (distance > value)
-      {
-        distance = value;
-        closestface = facenumber;
-      }
-    }
 
     if (compute_distance)
     {
-      tmp_distance =  sqrt(distance);
+      tmp_distance = cp->dist;
+      distance = tmp_distance*tmp_distance;
       if (max_distance < tmp_distance) max_distance = tmp_distance;
       total_distance += (tmp_distance);
       std_dist += distance;
     }
 
-    face = &Mesh2->faces[closestface];
-    V1 = &Mesh2->vertices[face->v[0]];
-    V2 = &Mesh2->vertices[face->v[1]];
-    V3 = &Mesh2->vertices[face->v[2]];
+    /* linear interpolation within the closest face */
+    face = &Mesh2->faces[cp->fno];
     sumcurv = 0.0;
-    sumweight = 0.0;
-    weight = 1.0/(1e-20 +
-                  (V1->x - vertex->x)*(V1->x - vertex->x) +
-                  (V1->y - vertex->y)*(V1->y - vertex->y) +
-                  (V1->z - vertex->z)*(V1->z - vertex->z));
-    sumcurv += weight*MRIgetVoxVal(mri_data2,face->v[0],0,0,0);
-    sumweight += weight;
-
-    weight = 1.0/(1e-20 +
-                  (V2->x - vertex->x)*(V2->x - vertex->x) +
-                  (V2->y - vertex->y)*(V2->y - vertex->y) +
-                  (V2->z - vertex->z)*(V2->z - vertex->z));
-    sumcurv += weight*MRIgetVoxVal(mri_data2,face->v[1],0,0,0);
-    sumweight += weight;
-
-    weight = 1.0/(1e-20 +
-                  (V3->x - vertex->x)*(V3->x - vertex->x) +
-                  (V3->y - vertex->y)*(V3->y - vertex->y) +
-                  (V3->z - vertex->z)*(V3->z - vertex->z));
-    sumcurv += weight*MRIgetVoxVal(mri_data2,face->v[2],0,0,0);
-    sumweight += weight;
-
-    sumcurv /= (sumweight + 1e-30);
-		
+    for (k = 0; k < VERTICES_PER_FACE; k++)
+      sumcurv += cp->bary[k]*MRIgetVoxVal(mri_data2,face->v[k],0,0,0);
+
     MRIsetVoxVal(mri_resampled,index, 0, 0, 0, sumcurv);
 		
 		
@@ -1267,6 +1218,7 @@ MRI *ComputeDifferenceNew(MRI_SURFACE *Mesh1,
 
     MRIsetVoxVal(mri_res,index, 0, 0, 0, value);
   }
+  free(cps);
 
   if (compute_distance)
   {
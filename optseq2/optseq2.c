@@ -30,6 +30,9 @@
 #include<stdlib.h>
 #include<math.h>
 #include <sys/time.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 #include "error.h"
 #include "diag.h"
@@ -96,6 +99,11 @@ static int CheckIntMult(float val, float res, float tol);
 static MATRIX * ContrastMatrix(float *EVContrast,
                                int nEVs, int nPer, int nNuis, int SumDelays);
 static MATRIX * AR1WhitenMatrix(double rho, int N);
+static int EvaluateSchedule(EVSCH *EvSch, EVS_FIR_EVAL *fe, MATRIX *Xpoly,
+                            MATRIX *W, MATRIX *XtXIdeal);
+static EVSCH *SynthSchedule(EVS_FIR_EVAL *fe, MATRIX *Xpoly, MATRIX *W,
+                            MATRIX *XtXIdeal, int *Singular);
+static long ScheduleSeed(long seed, long nth);
 int debug = 0;
 
 int   Ntp = -1;
@@ -133,6 +141,8 @@ float tSearched;
 float PctUpdate = 10;
 int Update = 1;
 long seed = -1;
+int nthreads = 0;   /* 0 = all cores */
+#define SEARCH_BATCH 32 /* schedules per thread between merges */
 int nKeep = -1;
 int nCB1Opt = 0;
 float tNullMin = 0.0;
@@ -165,10 +175,10 @@ double penalpha = 0, penT = 0, pendtmin = 0;
 
 /*-------------------------------------------------------------*/
 int main(int argc, char **argv) {
-  EVSCH *EvSch;
-  MATRIX *Xfir=NULL, *Xpoly=NULL, *X=NULL, *Xt=NULL,
-                                     *XtX=NULL, *XtXIdeal=NULL, *W=NULL;
-  int m,n, nthhit=0;
+  EVSCH *EvSch, **Batch=NULL;
+  EVS_FIR_EVAL **FirEval=NULL;
+  MATRIX *Xfir=NULL, *Xpoly=NULL, *X=NULL, *XtXIdeal=NULL, *W=NULL;
+  int m,n, nthhit=0, b, nBatch, *BatchSingular=NULL;
   //float eff, cb1err, vrfavg, vrfstd, vrfmin, vrfmax, vrfrange;
   char fname[2000];
   FILE *fpsum, *fplog;
@@ -274,15 +284,21 @@ int main(int argc, char **argv) {
     if(CMtxFile != NULL)  MatrixWriteTxt(CMtxFile,C);
   }
 
+  /* One design evaluator per search thread */
+  FirEval = (EVS_FIR_EVAL **) calloc(sizeof(EVS_FIR_EVAL*),nthreads);
+  for (n=0; n < nthreads; n++) {
+    FirEval[n] = EVSfirEvalAlloc(nEvTypes, TR, Ntp, PSDMin, PSDMax, dPSD,
+                                 Xpoly, C);
+    if (FirEval[n] == NULL) exit(1);
+  }
+
   /* Alloc the event list and load inputs */
   EvSchList = (EVSCH **) calloc(sizeof(EVSCH*),nKeep);
   if (nInFiles > 0) {
     for (n=0;n<nInFiles;n++) {
       //printf("INFO: reading %s\n",infilelist[n]);
       EvSchList[n] = EVSreadPar(infilelist[n]);
-      Xfir = EVSfirMtxAll(EvSchList[n], 0, TR, Ntp, PSDMin, PSDMax, dPSD);
-      Singular = EVSdesignMtxStats(Xfir, Xpoly, EvSchList[n],C,W);
-      MatrixFree(&Xfir);
+      Singular = EvaluateSchedule(EvSchList[n], FirEval[0], Xpoly, W, NULL);
       if (Singular) continue;
       EVScb1Error(EvSchList[n]);
       EVScost(EvSchList[n], CostId, &VRFAvgStd_Cost_Ratio);
@@ -353,6 +369,14 @@ int main(int argc, char **argv) {
   fprintf(fplog,"Pct nSrch MinSrch Cost Eff Cb1Err VRFAvg VRFStd VRFMin VRFMax VRFRange nSince\n");
   fprintf(fplog,"\nBeginUpdateLog\n");
 
+  /* Each thread synthesizes and evaluates its share of a batch of
+     schedules; the batch is then merged into the kept list in order,
+     so the result does not depend on thread timing. Each schedule is
+     synthesized from its own seed (see ScheduleSeed()), so a given
+     seed gives the same search for any number of threads. */
+  Batch = (EVSCH **) calloc(sizeof(EVSCH*),nthreads*SEARCH_BATCH);
+  BatchSingular = (int *) calloc(sizeof(int),nthreads*SEARCH_BATCH);
+
   /* ------------->>>>>>>----- Search -----<<<<<<<<<---------------------*/
   while (1) {
 
@@ -362,117 +386,105 @@ int main(int argc, char **argv) {
     tSearched = (tNow-tStart)/3600.0;
     if ( (tSearch > 0)  && (tSearched >= tSearch) )break;
     if ( (nSearch > 0)  && (nSearched >= nSearch) ) break;
-    nSearched++;
-
-    /* Randomly select Number of Event Repetitions */
-    if (PctVarEvReps > 0.0) {
-      if (!VarEvRepsPerCond) ftmp = 1.0+2*(drand48()-0.5)*PctVarEvReps/100;
-      for (m=0; m < nEvTypes; m++) {
-        if (VarEvRepsPerCond) ftmp = 1.0+2*(drand48()-0.5)*PctVarEvReps/100;
-        EvReps[m] = (int)nint(ftmp*EvRepsNom[m]);
-      }
-      MatrixFree(&XtXIdeal);
-      XtXIdeal = EVSfirXtXIdeal(nEvTypes, EvReps, EvDuration,
-                                TR, Ntp, PSDMin, PSDMax, dPSD);
-    }
 
-    /* Synthesize a Sequence and Schedule */
-    EvSch = EVSsynth(nEvTypes, EvReps, EvDuration, dPSD,
-                     TR*Ntp, TPreScan, nCB1Opt, tNullMin, tNullMax);
-    if (EvSch==NULL) {
-      printf("ERROR: syntheszing schedule\n");
-      exit(1);
+    nBatch = nthreads*SEARCH_BATCH;
+    if (nSearch > 0 && nBatch > nSearch-nSearched) nBatch = nSearch-nSearched;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (b=0; b < nBatch; b++) {
+      int tid = 0;
+#ifdef HAVE_OPENMP
+      tid = omp_get_thread_num();
+#endif
+      EVSsrand48(ScheduleSeed(seed, nSearched+b));
+      Batch[b] = SynthSchedule(FirEval[tid], Xpoly, W, XtXIdeal,
+                               &BatchSingular[b]);
     }
-    EvSch->nthsearched = nSearched;
-    if (penalize) EVSrefractory(EvSch, penalpha, penT, pendtmin);
-
-    /* Construct the FIR Design Matrix */
-    Xfir = EVSfirMtxAll(EvSch, 0, TR, Ntp, PSDMin, PSDMax, dPSD);
-
-    /* Compute XtXIdeal Error */
-    Xt = MatrixTranspose(Xfir,Xt);
-    XtX = MatrixMultiply(Xt,Xfir,XtX);
 
-    EvSch->idealxtxerr = 0;
-    for (m=1; m <= Xfir->cols; m++) {
-      for (n=1; n <= Xfir->cols; n++) {
-        EvSch->idealxtxerr += fabs(XtX->rptr[m][n]-XtXIdeal->rptr[m][n]);
+    /* Merge the batch in order */
+    for (b=0; b < nBatch; b++) {
+      nSearched++;
+      EvSch = Batch[b];
+      if (EvSch==NULL) {
+        printf("ERROR: syntheszing schedule\n");
+        exit(1);
       }
-    }
-    MatrixFree(&Xt);
-    MatrixFree(&XtX);
+      EvSch->nthsearched = nSearched;
+      Singular = BatchSingular[b];
 
-    Singular = EVSdesignMtxStats(Xfir, Xpoly, EvSch, C, W);
-    MatrixFree(&Xfir);
-
-    if (Singular) continue;
+      if (Singular) {
+        EVSfree(&EvSch);
+        continue;
+      }
 
-    /* Compute the Cost (to be maximized) */
-    EVScost(EvSch, CostId, &VRFAvgStd_Cost_Ratio);
+      /* Compute the Cost (to be maximized) */
+      EVScost(EvSch, CostId, &VRFAvgStd_Cost_Ratio);
 //  CostSum += EvSch->cost;
-    { // Kahan summation algorithm for correction of sum error accumulation:
-      // http://en.wikipedia.org/wiki/Kahan_summation_algorithm
-      float y = EvSch->cost - SumCorrect;
-      float t = CostSum + y;
-      SumCorrect = (t - CostSum) - y;
-      CostSum = t;
-    }
+      { // Kahan summation algorithm for correction of sum error accumulation:
+        // http://en.wikipedia.org/wiki/Kahan_summation_algorithm
+        float y = EvSch->cost - SumCorrect;
+        float t = CostSum + y;
+        SumCorrect = (t - CostSum) - y;
+        CostSum = t;
+      }
 //  CostSum2 += (EvSch->cost * EvSch->cost);
-    { // Kahan summation algorithm for correction of sum error accumulation:
-      float y = (EvSch->cost * EvSch->cost) - Sum2Correct;
-      float t = CostSum2 + y;
-      Sum2Correct = (t - CostSum2) - y;
-      CostSum2 = t;
-    }
-    if (EffMax < EvSch->eff)       EffMax    = EvSch->eff;
-    if (VRFAvgMax < EvSch->vrfavg) VRFAvgMax = EvSch->vrfavg;
-
-    /* Save data on each iteration to a file */
-    if (SvAllFile != NULL) {
-      fprintf(fpSvAll,"%g  %g  %g  %g  %g  %g  %g %g",
-              EvSch->cost,EvSch->eff,EvSch->cb1err,EvSch->vrfavg,
-              EvSch->vrfstd,EvSch->vrfmin,EvSch->vrfmax,EvSch->idealxtxerr);
-      if (PctVarEvReps > 0.0)
-        for (m=0; m < nEvTypes; m++) fprintf(fpSvAll,"%d ",EvReps[m]);
-      fprintf(fpSvAll,"\n");
-    }
+      { // Kahan summation algorithm for correction of sum error accumulation:
+        float y = (EvSch->cost * EvSch->cost) - Sum2Correct;
+        float t = CostSum2 + y;
+        Sum2Correct = (t - CostSum2) - y;
+        CostSum2 = t;
+      }
+      if (EffMax < EvSch->eff)       EffMax    = EvSch->eff;
+      if (VRFAvgMax < EvSch->vrfavg) VRFAvgMax = EvSch->vrfavg;
+
+      /* Save data on each iteration to a file */
+      if (SvAllFile != NULL) {
+        fprintf(fpSvAll,"%g  %g  %g  %g  %g  %g  %g %g",
+                EvSch->cost,EvSch->eff,EvSch->cb1err,EvSch->vrfavg,
+                EvSch->vrfstd,EvSch->vrfmin,EvSch->vrfmax,EvSch->idealxtxerr);
+        if (PctVarEvReps > 0.0)
+          for (m=0; m < nEvTypes; m++) fprintf(fpSvAll,"%d ",EvSch->nEvReps[m]);
+        fprintf(fpSvAll,"\n");
+      }
 
-    if (nthhit < nKeep && nInFiles == 0) {
-      EvSchList[nthhit] = EvSch;
-      if (nthhit == nKeep-1) EVSsort(EvSchList,nKeep);
-    } else {
-      if (EvSch->cost > EvSchList[nKeep-1]->cost) {
-        /* Print update before and after the list changes */
-        PrintUpdate(fplog,0);
-        PrintUpdate(stdout,0);
+      if (nthhit < nKeep && nInFiles == 0) {
+        EvSchList[nthhit] = EvSch;
+        if (nthhit == nKeep-1) EVSsort(EvSchList,nKeep);
+      } else {
+        if (EvSch->cost > EvSchList[nKeep-1]->cost) {
+          /* Print update before and after the list changes */
+          PrintUpdate(fplog,0);
+          PrintUpdate(stdout,0);
+
+          EVSfree(&EvSchList[nKeep-1]);
+          EvSchList[nKeep-1] = EvSch;
+          EVSsort(EvSchList,nKeep);
+          nSince = 0;
+
+          PrintUpdate(fplog,0);
+          PrintUpdate(stdout,0);
+        } else {
+          EVSfree(&EvSch);
+          nSince++;
+        }
+      }
 
-        EVSfree(&EvSchList[nKeep-1]);
-        EvSchList[nKeep-1] = EvSch;
-        EVSsort(EvSchList,nKeep);
-        nSince = 0;
+      /* Print an update to the terminal */
+      if (nSearch > 0) PctDone = 100*nSearched/nSearch;
+      else            PctDone = 100*tSearched/tSearch;
+      PctDoneSince = PctDone - PctDoneLast;
 
+      if (Update && (PctDoneSince > PctUpdate || UpdateNow ) ) {
         PrintUpdate(fplog,0);
         PrintUpdate(stdout,0);
-      } else {
-        EVSfree(&EvSch);
-        nSince++;
+        PctDoneLast = PctDone;
+        UpdateNow = 0;
       }
-    }
 
-    /* Print an update to the terminal */
-    if (nSearch > 0) PctDone = 100*nSearched/nSearch;
-    else            PctDone = 100*tSearched/tSearch;
-    PctDoneSince = PctDone - PctDoneLast;
-
-    if (Update && (PctDoneSince > PctUpdate || UpdateNow ) ) {
-      PrintUpdate(fplog,0);
-      PrintUpdate(stdout,0);
-      PctDoneLast = PctDone;
-      UpdateNow = 0;
+      nthhit ++;
     }
 
-    nthhit ++;
-
   }/*----------- Done Search Loop ----------------------------*/
   /*-----------------------------------------------------------*/
 
@@ -486,6 +498,8 @@ int main(int argc, char **argv) {
 
   /*---------------- Clean-up after loop ------------------------*/
   if (SvAllFile != NULL) fclose(fpSvAll);
+  free(Batch);
+  free(BatchSingular);
 
   printf("INFO: searched %d iterations for %f hours\n",
          nSearched,tSearched);
@@ -641,6 +655,15 @@ static int parse_commandline(int argc, char **argv) {
     else if (!strcasecmp(option, "--noupdate"))  Update = 0;
     else if (!strcasecmp(option, "--nosearch"))  NoSearch = 1;
     else if (!strcasecmp(option, "--sumdelays")) ContrastSumDelays = 1;
+    else if (!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads")) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%d",&nthreads);
+      if (nthreads < 1) {
+        printf("ERROR: --nthreads must be at least 1\n");
+        exit(1);
+      }
+      nargsused = 1;
+    }
 
     else if (stringmatch(option, "--nsearch")) {
       if (nargc < 1) argnerr(option,1);
@@ -879,6 +902,7 @@ static void print_usage(void) {
   printf("\n");
   printf("  --sumdelays : sum delays when forming contrast matrix\n");
   printf("  --seed seedval : initialize random number generator to seedval\n");
+  printf("  --nthreads n : search with n threads (default is all cores)\n");
 
   printf("\n");
   printf("Output Options\n");
@@ -1089,6 +1113,14 @@ static void print_help(void) {
          "specified, then one will be picked based on the time of day. optseq2 \n"
          "uses drand48(). \n"
          " \n"
+         "--nthreads n \n"
+         " \n"
+         "Search with n threads. By default, all the cores are used. Each \n"
+         "schedule is synthesized from its own seed, derived from seedval and \n"
+         "its position in the search, so a search is reproducible for a given \n"
+         "seedval whatever the number of threads. The schedules differ from \n"
+         "those of versions before the threaded search for the same seedval. \n"
+         " \n"
          "--pctupdate pct \n"
          " \n"
          "Print an update line to stdout and the log file after completing each \n"
@@ -1420,6 +1452,13 @@ static void check_options(void) {
     } else srand48(seed);
   }
 
+#ifdef HAVE_OPENMP
+  if (nthreads == 0) nthreads = omp_get_max_threads();
+  else               omp_set_num_threads(nthreads);
+#else
+  nthreads = 1;
+#endif
+
   if (nInFiles > 0 && nKeep > 0) {
     printf("ERROR: cannot spec input file and nkeep\n");
     exit(1);
@@ -1526,6 +1565,7 @@ static void dump_options(FILE *fp) {
   fprintf(fp,"PctUpdate  = %f\n",PctUpdate);
   fprintf(fp,"nCB1Opt  = %d\n",nCB1Opt);
   fprintf(fp,"seed     = %ld\n",seed);
+  fprintf(fp,"nthreads = %d\n",nthreads);
   fprintf(fp,"Ntp  = %d\n",Ntp);
   fprintf(fp,"TR   = %g\n",TR);
   fprintf(fp,"TPreScan   = %g\n",TPreScan);
@@ -1696,3 +1736,103 @@ static MATRIX * AR1WhitenMatrix(double rho, int N) {
 
   return(W);
 }
+/*------------------------------------------------------------
+  EvaluateSchedule() - computes the design statistics of the
+  schedule (and the ideal XtX error if XtXIdeal is not NULL).
+  Returns 1 if the design is singular. X'X is computed from the
+  event onsets unless whitening, which mixes the rows of X.
+  ------------------------------------------------------------*/
+static int EvaluateSchedule(EVSCH *EvSch, EVS_FIR_EVAL *fe, MATRIX *Xpoly,
+                            MATRIX *W, MATRIX *XtXIdeal) {
+  MATRIX *Xfir, *Xt=NULL, *XtX=NULL;
+  int m, n, Singular;
+
+  if (W == NULL && EvSch->nEvTypes == fe->nEvTypes) {
+    EVSfirEvalXtX(fe, EvSch);
+    if (XtXIdeal != NULL) {
+      EvSch->idealxtxerr = 0;
+      for (m=0; m < fe->nTask; m++)
+        for (n=0; n < fe->nTask; n++)
+          EvSch->idealxtxerr += fabs(fe->XtX[m*fe->nAvgs+n] -
+                                     XtXIdeal->rptr[m+1][n+1]);
+    }
+    return(EVSfirEvalStats(fe, EvSch));
+  }
+
+  Xfir = EVSfirMtxAll(EvSch, 0, TR, Ntp, PSDMin, PSDMax, dPSD);
+  if (XtXIdeal != NULL) {
+    Xt = MatrixTranspose(Xfir,Xt);
+    XtX = MatrixMultiply(Xt,Xfir,XtX);
+    EvSch->idealxtxerr = 0;
+    for (m=1; m <= Xfir->cols; m++) {
+      for (n=1; n <= Xfir->cols; n++) {
+        EvSch->idealxtxerr += fabs(XtX->rptr[m][n]-XtXIdeal->rptr[m][n]);
+      }
+    }
+    MatrixFree(&Xt);
+    MatrixFree(&XtX);
+  }
+  Singular = EVSdesignMtxStats(Xfir, Xpoly, EvSch, C, W);
+  MatrixFree(&Xfir);
+  return(Singular);
+}
+/*------------------------------------------------------------
+  SynthSchedule() - synthesizes a random schedule and computes
+  its design statistics. Called from the search threads, so it
+  only uses the thread's random number generator and evaluator.
+  XtXIdeal is for the nominal number of repetitions; it is
+  recomputed here if the repetitions vary. Returns NULL if a
+  schedule could not be synthesized.
+  ------------------------------------------------------------*/
+static EVSCH *SynthSchedule(EVS_FIR_EVAL *fe, MATRIX *Xpoly, MATRIX *W,
+                            MATRIX *XtXIdeal, int *Singular) {
+  EVSCH *EvSch;
+  MATRIX *XtXIdealReps=NULL;
+  int m, *Reps;
+  float ftmp=0;
+
+  Reps = (int *) calloc(sizeof(int),nEvTypes);
+  for (m=0; m < nEvTypes; m++) Reps[m] = EvRepsNom[m];
+
+  /* Randomly select Number of Event Repetitions */
+  if (PctVarEvReps > 0.0) {
+    if (!VarEvRepsPerCond) ftmp = 1.0+2*(EVSdrand48()-0.5)*PctVarEvReps/100;
+    for (m=0; m < nEvTypes; m++) {
+      if (VarEvRepsPerCond) ftmp = 1.0+2*(EVSdrand48()-0.5)*PctVarEvReps/100;
+      Reps[m] = (int)nint(ftmp*EvRepsNom[m]);
+    }
+    XtXIdealReps = EVSfirXtXIdeal(nEvTypes, Reps, EvDuration,
+                                  TR, Ntp, PSDMin, PSDMax, dPSD);
+    XtXIdeal = XtXIdealReps;
+  }
+
+  /* Synthesize a Sequence and Schedule */
+  EvSch = EVSsynth(nEvTypes, Reps, EvDuration, dPSD,
+                   TR*Ntp, TPreScan, nCB1Opt, tNullMin, tNullMax);
+  free(Reps);
+  if (EvSch == NULL) {
+    if (XtXIdealReps) MatrixFree(&XtXIdealReps);
+    return(NULL);
+  }
+  if (penalize) EVSrefractory(EvSch, penalpha, penT, pendtmin);
+
+  *Singular = EvaluateSchedule(EvSch, fe, Xpoly, W, XtXIdeal);
+
+  if (XtXIdealReps) MatrixFree(&XtXIdealReps);
+  return(EvSch);
+}
+/*------------------------------------------------------------
+  ScheduleSeed() - seed for the nth schedule of the search. The
+  global seed and nth are hashed (splitmix64 finalizer) so that
+  neighboring schedules, and the same schedule under neighboring
+  seeds, get unrelated drand48 streams.
+  ------------------------------------------------------------*/
+static long ScheduleSeed(long seed, long nth) {
+  unsigned long long z;
+
+  z = (unsigned long long)seed*0x9E3779B97F4A7C15ULL + (unsigned long long)nth;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= (z >> 31);
+  return((long)(z & 0xFFFFFFFFULL));
+}
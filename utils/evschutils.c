@@ -27,6 +27,7 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<math.h>
+#include<string.h>
 
 #include "error.h"
 #include "diag.h"
@@ -42,6 +43,12 @@
 #endif
 static int EVScompare(const void *evsch1, const void *evsch2);
 
+static unsigned short EVSrandState[3];
+static int EVSrandSeeded = 0;
+#ifdef HAVE_OPENMP
+#pragma omp threadprivate(EVSrandState, EVSrandSeeded)
+#endif
+
 /*-------------------------------------------------------------*/
 EVENT_SCHEDULE *EVSAlloc(int nevents, int allocweight)
 {
@@ -536,7 +543,7 @@ int *RandPerm(int N, int *v)
 
   for (n=0;n < N;n++)
   {
-    n2 = (int)floor(drand48()*N);
+    n2 = (int)floor(EVSdrand48()*N);
     tmp = v[n];
     v[n] = v[n2];
     v[n2] = tmp;
@@ -1033,6 +1040,273 @@ int EVSrefractory(EVSCH *sch, double alpha, double T, double dtmin)
   return(0);
 }
 
+/*-------------------------------------------------------------
+  EVSsrand48() - seeds the calling thread's generator used by
+  EVSdrand48(). The sequence is the one drand48() gives after
+  srand48(seed), so seeding a single search thread with the
+  global seed reproduces the unthreaded search.
+  -------------------------------------------------------------*/
+void EVSsrand48(long seed)
+{
+  EVSrandState[0] = 0x330E;
+  EVSrandState[1] = (unsigned short)(seed & 0xFFFF);
+  EVSrandState[2] = (unsigned short)((seed >> 16) & 0xFFFF);
+  EVSrandSeeded = 1;
+}
+/*-------------------------------------------------------------
+  EVSdrand48() - uniform random number in [0,1) from the calling
+  thread's generator, or from drand48() if it was not seeded.
+  -------------------------------------------------------------*/
+double EVSdrand48(void)
+{
+  if (!EVSrandSeeded) return(drand48());
+  return(erand48(EVSrandState));
+}
+/*-------------------------------------------------------------
+  EVSfirEvalAlloc() - sets up the evaluation of FIR designs for
+  the given event types and timing. A row of the FIR matrix only
+  has an entry for each event whose window covers that TR, so X'X
+  is accumulated from the products of those few entries rather
+  than from the dense matrix. Xnuis (can be NULL) is fixed for the
+  search, so its cross-product is computed here. C (can be NULL)
+  is as in EVSdesignMtxStats(); when NULL, all the task regressors
+  are used. Not thread-safe; allocate one for each thread.
+  -------------------------------------------------------------*/
+EVS_FIR_EVAL *EVSfirEvalAlloc(int nEvTypes, float TR, int Ntp,
+                              float PSDMin, float PSDMax, float dPSD,
+                              MATRIX *Xnuis, MATRIX *C)
+{
+  EVS_FIR_EVAL *fe;
+  int m, n, r;
+
+  fe = (EVS_FIR_EVAL *) calloc(sizeof(EVS_FIR_EVAL),1);
+  fe->nEvTypes = nEvTypes;
+  fe->Ntp      = Ntp;
+  fe->TR       = TR;
+  fe->PSDMin   = PSDMin;
+  fe->dPSD     = dPSD;
+  fe->nPSD     = rint((PSDMax-PSDMin)/dPSD);
+  fe->RSR      = rint(TR/dPSD);
+  fe->nTask    = nEvTypes*fe->nPSD;
+  if (Xnuis != NULL) fe->nNuis = Xnuis->cols;
+  else              fe->nNuis = 0;
+  fe->nAvgs    = fe->nTask + fe->nNuis;
+
+  if (C != NULL && C->cols != fe->nAvgs)
+  {
+    printf("ERROR: EVSfirEvalAlloc: C has %d cols, X has %d\n",
+           C->cols,fe->nAvgs);
+    free(fe);
+    return(NULL);
+  }
+  if (C != NULL) fe->J = C->rows;
+  else          fe->J = fe->nTask;
+  fe->C = (double *) calloc(sizeof(double),fe->J*fe->nAvgs);
+  for (m=0; m < fe->J; m++)
+  {
+    if (C == NULL) fe->C[m*fe->nAvgs + m] = 1;
+    else
+      for (n=0; n < fe->nAvgs; n++)
+        fe->C[m*fe->nAvgs + n] = C->rptr[m+1][n+1];
+  }
+
+  if (fe->nNuis > 0)
+  {
+    fe->Xnuis = (double *) calloc(sizeof(double),Ntp*fe->nNuis);
+    fe->NtN   = (double *) calloc(sizeof(double),fe->nNuis*fe->nNuis);
+    for (r=0; r < Ntp; r++)
+      for (m=0; m < fe->nNuis; m++)
+        fe->Xnuis[r*fe->nNuis + m] = Xnuis->rptr[r+1][m+1];
+    for (m=0; m < fe->nNuis; m++)
+      for (n=0; n < fe->nNuis; n++)
+        for (r=0; r < Ntp; r++)
+          fe->NtN[m*fe->nNuis + n] +=
+            fe->Xnuis[r*fe->nNuis + m]*fe->Xnuis[r*fe->nNuis + n];
+  }
+
+  fe->XtX    = (double *) calloc(sizeof(double),fe->nAvgs*fe->nAvgs);
+  fe->L      = (double *) calloc(sizeof(double),fe->nAvgs*fe->nAvgs);
+  fe->y      = (double *) calloc(sizeof(double),fe->nAvgs);
+  fe->VRF    = (double *) calloc(sizeof(double),fe->J);
+  fe->nhits  = (int *)    calloc(sizeof(int),Ntp);
+  fe->hitcol = (int *)    calloc(sizeof(int),Ntp*fe->nTask);
+  fe->hitw   = (double *) calloc(sizeof(double),Ntp*fe->nTask);
+
+  return(fe);
+}
+/*-------------------------------------------------------------*/
+int EVSfirEvalFree(EVS_FIR_EVAL **ppfe)
+{
+  EVS_FIR_EVAL *fe = *ppfe;
+
+  free(fe->C);
+  if (fe->Xnuis != NULL) free(fe->Xnuis);
+  if (fe->NtN   != NULL) free(fe->NtN);
+  free(fe->XtX);
+  free(fe->L);
+  free(fe->y);
+  free(fe->VRF);
+  free(fe->nhits);
+  free(fe->hitcol);
+  free(fe->hitw);
+  free(fe);
+  *ppfe = NULL;
+  return(0);
+}
+/*-------------------------------------------------------------
+  EVSfirEvalXtX() - computes X'X, X = [Xfir Xnuis], for the given
+  schedule into fe->XtX. The entries of Xfir are found the same
+  way as in EVS2FIRmtx(), so the result is the same as forming
+  EVSfirMtxAll() and multiplying. The task block at row (i,m),
+  col (j,n) counts how often event type i lands on the same TR
+  m-n dPSDs after event type j (weighted, if there are weights).
+  -------------------------------------------------------------*/
+int EVSfirEvalXtX(EVS_FIR_EVAL *fe, EVSCH *EvSch)
+{
+  int ev, nthPSD, n, rA, rB, col, k, a, b, m, r, na;
+  float tMax, PSD, tPSD;
+  double w, *xtx;
+
+  if (EvSch->nEvTypes != fe->nEvTypes)
+  {
+    printf("ERROR: EVSfirEvalXtX: schedule has %d event types, expected %d\n",
+           EvSch->nEvTypes,fe->nEvTypes);
+    return(1);
+  }
+
+  tMax = fe->TR*(fe->Ntp-1);
+  memset(fe->nhits,0,sizeof(int)*fe->Ntp);
+
+  /* Collect the non-zero entries of Xfir by row */
+  for (ev=1; ev <= fe->nEvTypes; ev++)
+  {
+    for (nthPSD = 0; nthPSD < fe->nPSD; nthPSD++)
+    {
+      col = (ev-1)*fe->nPSD + nthPSD;
+      PSD = nthPSD*fe->dPSD + fe->PSDMin;
+      for (n = 0; n < EvSch->nevents; n++)
+      {
+        if (EvSch->eventid[n] != ev) continue;
+        tPSD = EvSch->tevent[n] + PSD;
+        if (tPSD < 0.0)  continue;
+        if (tPSD > tMax) break;
+        rA = (int)rint(tPSD/fe->dPSD);
+        if ( (rA % fe->RSR) != 0) continue;
+        rB = rA/fe->RSR;
+        if (rB >= fe->Ntp) continue;
+        if (EvSch->weight != NULL) w = EvSch->weight[n];
+        else                      w = 1;
+        /* EVS2FIRmtx() sets rather than adds */
+        for (k=0; k < fe->nhits[rB]; k++)
+          if (fe->hitcol[rB*fe->nTask + k] == col) break;
+        if (k == fe->nhits[rB]) fe->nhits[rB]++;
+        fe->hitcol[rB*fe->nTask + k] = col;
+        fe->hitw[rB*fe->nTask + k]   = w;
+      }
+    }
+  }
+
+  /* Sum the outer products of the rows */
+  na = fe->nAvgs;
+  xtx = fe->XtX;
+  memset(xtx,0,sizeof(double)*na*na);
+  for (r=0; r < fe->Ntp; r++)
+  {
+    for (a=0; a < fe->nhits[r]; a++)
+    {
+      k = r*fe->nTask + a;
+      col = fe->hitcol[k];
+      w = fe->hitw[k];
+      for (b=0; b < fe->nhits[r]; b++)
+        xtx[col*na + fe->hitcol[r*fe->nTask + b]] +=
+          w*fe->hitw[r*fe->nTask + b];
+      for (m=0; m < fe->nNuis; m++)
+        xtx[col*na + fe->nTask + m] += w*fe->Xnuis[r*fe->nNuis + m];
+    }
+  }
+  for (m=0; m < fe->nNuis; m++)
+  {
+    for (col=0; col < fe->nTask; col++)
+      xtx[(fe->nTask + m)*na + col] = xtx[col*na + fe->nTask + m];
+    for (n=0; n < fe->nNuis; n++)
+      xtx[(fe->nTask + m)*na + fe->nTask + n] = fe->NtN[m*fe->nNuis + n];
+  }
+
+  return(0);
+}
+/*-------------------------------------------------------------
+  EVSfirEvalStats() - computes the same statistics as
+  EVSdesignMtxStats() from the X'X left by EVSfirEvalXtX(). The
+  diagonal of C*inv(X'X)*C' is computed as the squared norms of
+  inv(L)*C', where X'X = L*L', so the inverse is never formed.
+  Returns 1 if X'X is singular (to within a relative tolerance),
+  0 otherwise.
+  -------------------------------------------------------------*/
+int EVSfirEvalStats(EVS_FIR_EVAL *fe, EVSCH *EvSch)
+{
+  int i, j, k, m, na, f0;
+  double d, diagsum, vmin, vmax, vsum, vsum2, *L, *c;
+
+  na = fe->nAvgs;
+  L = fe->L;
+  memcpy(L,fe->XtX,sizeof(double)*na*na);
+
+  /* Cholesky, lower triangle in place */
+  for (j=0; j < na; j++)
+  {
+    d = L[j*na + j];
+    for (k=0; k < j; k++) d -= L[j*na + k]*L[j*na + k];
+    if (d <= 1e-10*fe->XtX[j*na + j] || d <= 0) return(1);
+    d = sqrt(d);
+    L[j*na + j] = d;
+    for (i=j+1; i < na; i++)
+    {
+      double v = L[i*na + j];
+      for (k=0; k < j; k++) v -= L[i*na + k]*L[j*na + k];
+      L[i*na + j] = v/d;
+    }
+  }
+
+  /* Solve L*y = c for each row of C */
+  diagsum = 0;
+  for (m=0; m < fe->J; m++)
+  {
+    c = &(fe->C[m*na]);
+    for (f0=0; f0 < na && c[f0] == 0; f0++) fe->y[f0] = 0;
+    d = 0;
+    for (i=f0; i < na; i++)
+    {
+      double v = c[i];
+      for (k=f0; k < i; k++) v -= L[i*na + k]*fe->y[k];
+      fe->y[i] = v/L[i*na + i];
+      d += fe->y[i]*fe->y[i];
+    }
+    diagsum += d;
+    fe->VRF[m] = 1.0/d;
+  }
+
+  vmin = vmax = fe->VRF[0];
+  vsum = 0;
+  for (m=0; m < fe->J; m++)
+  {
+    vsum += fe->VRF[m];
+    if (vmin > fe->VRF[m]) vmin = fe->VRF[m];
+    if (vmax < fe->VRF[m]) vmax = fe->VRF[m];
+  }
+  vsum2 = 0;
+  for (m=0; m < fe->J; m++)
+    vsum2 += (fe->VRF[m] - vsum/fe->J)*(fe->VRF[m] - vsum/fe->J);
+
+  EvSch->eff = 1.0/diagsum;
+  EvSch->vrfavg = vsum/fe->J;
+  if (fe->J > 1) EvSch->vrfstd = sqrt(vsum2/(fe->J-1));
+  else          EvSch->vrfstd = 0.0;
+  EvSch->vrfmin = vmin;
+  EvSch->vrfmax = vmax;
+  EvSch->vrfrange = vmax-vmin;
+
+  return(0);
+}
 
 #if 0
 /*-----------------------------------------------------------*/
@@ -17392,6 +17392,7 @@ copy_gcs(int nlabels, GC1D *gcs_src, GC1D *gcs_dst, int ninputs)
       }
     }
     gcs_dst[i].ntraining = gcs_src[i].ntraining ;
+    gcs_dst[i].n_just_priors = gcs_src[i].n_just_priors ;
     if (gcs_dst[i].nlabels == NULL)   /* NO_MRF flag must be set */
     {
       continue ;
@@ -75,6 +75,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <errno.h>
+#include <sys/stat.h>
 #ifdef HAVE_OPENMP
 #include <omp.h>
 #endif
@@ -99,6 +100,7 @@
 #include "mri_circulars.h"
 
 #include "chronometer.h"
+#include "zlib.h"
 
 #ifdef FS_CUDA
 #include "gcamfots_cuda.h"
@@ -452,6 +454,498 @@ void GCAMreadGeom(GCA_MORPH *gcam, znzFile file)
 }
 
 
+/*
+  Chunked (version 2) m3z layout. The legacy layout interleaves every
+  node field and pushes them one value at a time through a single gzip
+  stream. Here each field is stored as a contiguous array that is cut
+  into slabs of GCAM_CHUNK_SLICES x-planes, and every slab is compressed
+  on its own, so the chunks can be (de)compressed in parallel and a
+  reader can load only the fields and slabs it needs:
+
+    float     version (GCAM_VERSION_CHUNKED)
+    int       width, height, depth, spacing
+    float     exp_k
+    int       type
+    geometry  (GCAMwriteGeom)
+    int       1 if the affine follows (znzWriteMatrix), 0 otherwise
+    int       nfields, nchunks, chunk_slices
+    nfields * { int field, int coding, nchunks * { long long offset,
+                                                   int compressed size } }
+    chunk data (offsets are relative to its start)
+
+  A chunk holds the 32 bit pattern of each value (x-y-z order, z
+  fastest) as four big-endian byte planes. With GCAM_CODING_DELTA each
+  value is first replaced by its difference from the previous value in
+  the chunk, which is lossless and makes smooth warps compress better.
+  The file itself is not gzipped; gzread passes it through untouched,
+  so GCAMread still opens both layouts with the same call.
+*/
+#define GCAM_VERSION_CHUNKED  2.0
+#define GCAM_CHUNK_SLICES     8
+
+#define GCAM_CODING_PLANES    0
+#define GCAM_CODING_DELTA     1
+
+#define M3Z_NFIELDS           10
+#define M3Z_ORIGX             0
+#define M3Z_ORIGY             1
+#define M3Z_ORIGZ             2
+#define M3Z_X                 3
+#define M3Z_Y                 4
+#define M3Z_Z                 5
+#define M3Z_XN                6
+#define M3Z_YN                7
+#define M3Z_ZN                8
+#define M3Z_LABEL             9
+
+typedef struct
+{
+  int           field ;
+  int           chunk ;
+  long long     offset ;
+  int           size ;          /* compressed bytes */
+  unsigned char *buf ;
+} GCAM_CHUNK ;
+
+static int m3z_format = -1 ;
+
+int
+GCAMsetM3zFormat(int format)
+{
+  int old_format = GCAMgetM3zFormat() ;
+
+  if (format != GCAM_M3Z_LEGACY && format != GCAM_M3Z_CHUNKED &&
+      format != GCAM_M3Z_CHUNKED_DELTA)
+    ErrorReturn(old_format,
+                (ERROR_BADPARM, "GCAMsetM3zFormat: unknown format %d", format)) ;
+  m3z_format = format ;
+  return(old_format) ;
+}
+
+int
+GCAMgetM3zFormat(void)
+{
+  char *cp ;
+
+  if (m3z_format < 0)
+  {
+    m3z_format = GCAM_M3Z_LEGACY ;
+    cp = getenv("FS_M3Z_FORMAT") ;
+    if (cp != NULL)
+    {
+      if (!stricmp(cp, "chunked") || !strcmp(cp, "2"))
+        m3z_format = GCAM_M3Z_CHUNKED ;
+      else if (!stricmp(cp, "delta"))
+        m3z_format = GCAM_M3Z_CHUNKED_DELTA ;
+    }
+  }
+  return(m3z_format) ;
+}
+
+static int
+gcamFieldMask(int field)
+{
+  switch (field)
+  {
+  case M3Z_ORIGX:
+  case M3Z_ORIGY:
+  case M3Z_ORIGZ:
+    return(GCAM_FIELD_ORIG) ;
+  case M3Z_X:
+  case M3Z_Y:
+  case M3Z_Z:
+    return(GCAM_FIELD_POSITION) ;
+  case M3Z_XN:
+  case M3Z_YN:
+  case M3Z_ZN:
+    return(GCAM_FIELD_NODE) ;
+  case M3Z_LABEL:
+    return(GCAM_FIELD_LABEL) ;
+  }
+  return(0) ;
+}
+
+static unsigned int
+gcamFloatBits(float f)
+{
+  unsigned int u ;
+
+  memcpy(&u, &f, sizeof(u)) ;
+  return(u) ;
+}
+
+static float
+gcamBitsFloat(unsigned int u)
+{
+  float f ;
+
+  memcpy(&f, &u, sizeof(f)) ;
+  return(f) ;
+}
+
+static unsigned int
+gcamGetNodeField(const GCA_MORPH_NODE *gcamn, int field)
+{
+  switch (field)
+  {
+  case M3Z_ORIGX:   return(gcamFloatBits(gcamn->origx)) ;
+  case M3Z_ORIGY:   return(gcamFloatBits(gcamn->origy)) ;
+  case M3Z_ORIGZ:   return(gcamFloatBits(gcamn->origz)) ;
+  case M3Z_X:       return(gcamFloatBits(gcamn->x)) ;
+  case M3Z_Y:       return(gcamFloatBits(gcamn->y)) ;
+  case M3Z_Z:       return(gcamFloatBits(gcamn->z)) ;
+  case M3Z_XN:      return((unsigned int)gcamn->xn) ;
+  case M3Z_YN:      return((unsigned int)gcamn->yn) ;
+  case M3Z_ZN:      return((unsigned int)gcamn->zn) ;
+  case M3Z_LABEL:   return((unsigned int)gcamn->label) ;
+  }
+  return(0) ;
+}
+
+static void
+gcamSetNodeField(GCA_MORPH_NODE *gcamn, int field, unsigned int u)
+{
+  switch (field)
+  {
+  case M3Z_ORIGX:   gcamn->origx = gcamBitsFloat(u) ; break ;
+  case M3Z_ORIGY:   gcamn->origy = gcamBitsFloat(u) ; break ;
+  case M3Z_ORIGZ:   gcamn->origz = gcamBitsFloat(u) ; break ;
+  case M3Z_X:       gcamn->x = gcamBitsFloat(u) ; break ;
+  case M3Z_Y:       gcamn->y = gcamBitsFloat(u) ; break ;
+  case M3Z_Z:       gcamn->z = gcamBitsFloat(u) ; break ;
+  case M3Z_XN:      gcamn->xn = (int)u ; break ;
+  case M3Z_YN:      gcamn->yn = (int)u ; break ;
+  case M3Z_ZN:      gcamn->zn = (int)u ; break ;
+  case M3Z_LABEL:   gcamn->label = (int)u ; break ;
+  }
+}
+
+/* planes must hold 4*(x1-x0)*height*depth bytes */
+static void
+gcamEncodeChunk(const GCA_MORPH *gcam, int field, int coding,
+                int x0, int x1, unsigned char *planes)
+{
+  int           x, y, z ;
+  size_t        i, n ;
+  unsigned int  u, prev ;
+
+  n = (size_t)(x1-x0)*gcam->height*gcam->depth ;
+  prev = 0 ;
+  i = 0 ;
+  for (x = x0 ; x < x1 ; x++)
+    for (y = 0 ; y < gcam->height ; y++)
+      for (z = 0 ; z < gcam->depth ; z++, i++)
+      {
+        u = gcamGetNodeField(&gcam->nodes[x][y][z], field) ;
+        if (coding == GCAM_CODING_DELTA)
+        {
+          u -= prev ;
+          prev += u ;
+        }
+        planes[i]     = (unsigned char)(u >> 24) ;
+        planes[n+i]   = (unsigned char)(u >> 16) ;
+        planes[2*n+i] = (unsigned char)(u >> 8) ;
+        planes[3*n+i] = (unsigned char)u ;
+      }
+}
+
+/* only the nodes inside box (or all of them if box is NULL) are set */
+static void
+gcamDecodeChunk(GCA_MORPH *gcam, int field, int coding, int x0, int x1,
+                const unsigned char *planes, MRI_REGION *box)
+{
+  int           x, y, z, inside ;
+  size_t        i, n ;
+  unsigned int  u, prev ;
+
+  n = (size_t)(x1-x0)*gcam->height*gcam->depth ;
+  prev = 0 ;
+  i = 0 ;
+  for (x = x0 ; x < x1 ; x++)
+    for (y = 0 ; y < gcam->height ; y++)
+      for (z = 0 ; z < gcam->depth ; z++, i++)
+      {
+        u = ((unsigned int)planes[i] << 24) |
+            ((unsigned int)planes[n+i] << 16) |
+            ((unsigned int)planes[2*n+i] << 8) |
+            (unsigned int)planes[3*n+i] ;
+        if (coding == GCAM_CODING_DELTA)
+        {
+          u += prev ;
+          prev = u ;
+        }
+        inside = (box == NULL ||
+                  (x >= box->x && x < box->x+box->dx &&
+                   y >= box->y && y < box->y+box->dy &&
+                   z >= box->z && z < box->z+box->dz)) ;
+        if (inside)
+          gcamSetNodeField(&gcam->nodes[x][y][z], field, u) ;
+      }
+}
+
+static int
+gcamWriteChunked(const GCA_MORPH *gcam, const char *fname, int coding)
+{
+  znzFile     file ;
+  GCAM_CHUNK  *chunks ;
+  int         nchunks, njobs, i, failed ;
+  long long   offset ;
+
+  nchunks = (gcam->width + GCAM_CHUNK_SLICES - 1) / GCAM_CHUNK_SLICES ;
+  njobs = M3Z_NFIELDS * nchunks ;
+  chunks = (GCAM_CHUNK *)calloc(njobs, sizeof(GCAM_CHUNK)) ;
+  if (chunks == NULL)
+    ErrorReturn(ERROR_NOMEMORY,
+                (ERROR_NOMEMORY, "GCAMwrite(%s): could not allocate chunk table", fname)) ;
+
+  failed = 0 ;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:failed)
+#endif
+  for (i = 0 ; i < njobs ; i++)
+  {
+    GCAM_CHUNK    *chunk = &chunks[i] ;
+    int           x0, x1 ;
+    uLong         raw_size ;
+    uLongf        size ;
+    unsigned char *planes ;
+
+    chunk->field = i / nchunks ;
+    chunk->chunk = i % nchunks ;
+    x0 = chunk->chunk * GCAM_CHUNK_SLICES ;
+    x1 = MIN(x0 + GCAM_CHUNK_SLICES, gcam->width) ;
+    raw_size = 4 * (uLong)(x1-x0) * gcam->height * gcam->depth ;
+    planes = (unsigned char *)malloc(raw_size) ;
+    size = compressBound(raw_size) ;
+    chunk->buf = (unsigned char *)malloc(size) ;
+    if (planes == NULL || chunk->buf == NULL)
+    {
+      free(planes) ;
+      failed++ ;
+      continue ;
+    }
+    gcamEncodeChunk(gcam, chunk->field, coding, x0, x1, planes) ;
+    if (compress2(chunk->buf, &size, planes, raw_size, Z_DEFAULT_COMPRESSION) != Z_OK)
+      failed++ ;
+    chunk->size = (int)size ;
+    free(planes) ;
+  }
+
+  file = failed ? NULL : znzopen(fname, "wb", 0) ;
+  if (znz_isnull(file))
+  {
+    for (i = 0 ; i < njobs ; i++)
+      free(chunks[i].buf) ;
+    free(chunks) ;
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "GCAMwrite(%s): could not %s", fname,
+                 failed ? "compress warp" : "open file")) ;
+  }
+
+  znzwriteFloat(GCAM_VERSION_CHUNKED, file) ;
+  znzwriteInt(gcam->width, file) ;
+  znzwriteInt(gcam->height, file) ;
+  znzwriteInt(gcam->depth, file) ;
+  znzwriteInt(gcam->spacing, file) ;
+  znzwriteFloat(gcam->exp_k, file) ;
+  znzwriteInt(gcam->type, file) ;
+  GCAMwriteGeom(gcam, file) ;
+  znzwriteInt(gcam->m_affine != NULL, file) ;
+  if (gcam->m_affine)
+    znzWriteMatrix(file, gcam->m_affine) ;
+
+  znzwriteInt(M3Z_NFIELDS, file) ;
+  znzwriteInt(nchunks, file) ;
+  znzwriteInt(GCAM_CHUNK_SLICES, file) ;
+  offset = 0 ;
+  for (i = 0 ; i < njobs ; i++)
+  {
+    if (chunks[i].chunk == 0)
+    {
+      znzwriteInt(chunks[i].field, file) ;
+      znzwriteInt(coding, file) ;
+    }
+    chunks[i].offset = offset ;
+    znzwriteLong(offset, file) ;
+    znzwriteInt(chunks[i].size, file) ;
+    offset += chunks[i].size ;
+  }
+  for (i = 0 ; i < njobs ; i++)
+  {
+    if (znzwrite(chunks[i].buf, 1, chunks[i].size, file) != (size_t)chunks[i].size)
+      failed++ ;
+    free(chunks[i].buf) ;
+  }
+  free(chunks) ;
+  znzclose(file) ;
+
+  if (failed)
+    ErrorReturn(ERROR_BADFILE,
+                (ERROR_BADFILE, "GCAMwrite(%s): write failed", fname)) ;
+  return(NO_ERROR) ;
+}
+
+/*
+  read the nodes of a chunked m3z. Only the fields in the fields mask
+  and the slabs that overlap box are read; the other nodes keep the
+  identity positions of GCAMalloc, and nodes outside of box are marked
+  GCAM_POSITION_INVALID.
+*/
+static GCA_MORPH *
+gcamReadChunked(const char *fname, int fields, MRI_REGION *box)
+{
+  znzFile     file ;
+  GCA_MORPH   *gcam ;
+  GCAM_CHUNK  *chunks ;
+  int         width, height, depth, nfields, nchunks, chunk_slices, i, j,
+              field, code, coding[M3Z_NFIELDS], failed, x, y, z ;
+  long        data_start ;
+
+  file = znzopen(fname, "rb", 0) ;
+  if (znz_isnull(file))
+    ErrorReturn(NULL,
+                (ERROR_BADPARM, "GCAMread(%s): could not open file", fname)) ;
+
+  znzreadFloat(file) ;  // version
+  width  = znzreadInt(file) ;
+  height = znzreadInt(file) ;
+  depth  = znzreadInt(file) ;
+  gcam   = GCAMalloc(width, height, depth) ;
+  gcam->spacing = znzreadInt(file) ;
+  gcam->exp_k   = znzreadFloat(file) ;
+  gcam->type    = znzreadInt(file) ;
+  GCAMreadGeom(gcam, file) ;
+  gcam->det = 1 ;
+  if (znzreadInt(file))
+  {
+    gcam->m_affine = znzReadMatrix(file) ;
+    gcam->det = MatrixDeterminant(gcam->m_affine) ;
+  }
+
+  nfields = znzreadInt(file) ;
+  nchunks = znzreadInt(file) ;
+  chunk_slices = znzreadInt(file) ;
+  if (nfields <= 0 || nfields > M3Z_NFIELDS || nchunks <= 0 || chunk_slices <= 0 ||
+      nchunks != (width + chunk_slices - 1) / chunk_slices)
+  {
+    znzclose(file) ;
+    GCAMfree(&gcam) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE, "GCAMread(%s): corrupt chunk table", fname)) ;
+  }
+
+  chunks = (GCAM_CHUNK *)calloc(nfields*nchunks, sizeof(GCAM_CHUNK)) ;
+  if (chunks == NULL)
+  {
+    znzclose(file) ;
+    GCAMfree(&gcam) ;
+    ErrorReturn(NULL,
+                (ERROR_NOMEMORY, "GCAMread(%s): could not allocate chunk table", fname)) ;
+  }
+  for (i = 0 ; i < nfields ; i++)
+  {
+    field = znzreadInt(file) ;
+    code  = znzreadInt(file) ;
+    if (field < 0 || field >= M3Z_NFIELDS)
+      field = -1 ;   // unknown field from a newer writer, skip it
+    else
+      coding[field] = code ;
+    for (j = 0 ; j < nchunks ; j++)
+    {
+      chunks[i*nchunks+j].field = field ;
+      chunks[i*nchunks+j].chunk = j ;
+      chunks[i*nchunks+j].offset = znzreadLong(file) ;
+      chunks[i*nchunks+j].size = znzreadInt(file) ;
+    }
+  }
+  data_start = znztell(file) ;
+
+  // read the compressed chunks that are needed, then inflate them in parallel
+  for (failed = i = 0 ; i < nfields*nchunks ; i++)
+  {
+    GCAM_CHUNK *chunk = &chunks[i] ;
+    int        x0, x1 ;
+
+    x0 = chunk->chunk * chunk_slices ;
+    x1 = MIN(x0 + chunk_slices, width) ;
+    if (chunk->field < 0 || !(gcamFieldMask(chunk->field) & fields) ||
+        (box && (x1 <= box->x || x0 >= box->x+box->dx)))
+      continue ;
+    chunk->buf = chunk->size > 0 ? (unsigned char *)malloc(chunk->size) : NULL ;
+    if (chunk->buf == NULL ||
+        znzseek(file, data_start + chunk->offset, SEEK_SET) < 0 ||
+        znzread(chunk->buf, 1, chunk->size, file) != (size_t)chunk->size)
+    {
+      failed++ ;
+      break ;
+    }
+  }
+  znzclose(file) ;
+
+  if (!failed)
+  {
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic,1) reduction(+:failed)
+#endif
+    for (i = 0 ; i < nfields*nchunks ; i++)
+    {
+      GCAM_CHUNK    *chunk = &chunks[i] ;
+      int           x0, x1 ;
+      uLongf        raw_size ;
+      unsigned char *planes ;
+
+      if (chunk->buf == NULL)
+        continue ;
+      x0 = chunk->chunk * chunk_slices ;
+      x1 = MIN(x0 + chunk_slices, width) ;
+      raw_size = 4 * (uLongf)(x1-x0) * height * depth ;
+      planes = (unsigned char *)malloc(raw_size) ;
+      if (planes == NULL ||
+          uncompress(planes, &raw_size, chunk->buf, chunk->size) != Z_OK ||
+          raw_size != 4 * (uLongf)(x1-x0) * height * depth)
+        failed++ ;
+      else
+        gcamDecodeChunk(gcam, chunk->field, coding[chunk->field], x0, x1,
+                        planes, box) ;
+      free(planes) ;
+    }
+  }
+  for (i = 0 ; i < nfields*nchunks ; i++)
+    free(chunks[i].buf) ;
+  free(chunks) ;
+  if (failed)
+  {
+    GCAMfree(&gcam) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE, "GCAMread(%s): could not read node data", fname)) ;
+  }
+
+  if (fields & GCAM_FIELD_LABEL)
+    gcam->status = GCAM_LABELED ;
+  for (x = 0 ; x < width ; x++)
+    for (y = 0 ; y < height ; y++)
+      for (z = 0 ; z < depth ; z++)
+      {
+        GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z] ;
+
+        if ((box && (x < box->x || x >= box->x+box->dx ||
+                     y < box->y || y >= box->y+box->dy ||
+                     z < box->z || z >= box->z+box->dz)) ||
+            (FZERO(gcamn->origx) && FZERO(gcamn->origy) && FZERO(gcamn->origz)
+             && FZERO(gcamn->x) && FZERO(gcamn->y) && FZERO(gcamn->z)))
+          gcamn->invalid = GCAM_POSITION_INVALID ;
+        else if (x == 0 || x == width-1 ||
+                 y == 0 || y == height-1 ||
+                 z == 0 || z == depth-1)
+          gcamn->invalid = GCAM_AREA_INVALID ;
+        else
+          gcamn->invalid = GCAM_VALID ;
+      }
+  return(gcam) ;
+}
+
+
 int
 GCAMwrite( const GCA_MORPH *gcam, const char *fname )
 {
@@ -463,6 +957,11 @@ GCAMwrite( const GCA_MORPH *gcam, const char *fname )
 
   printf("GCAMwrite\n");
 
+  if (GCAMgetM3zFormat() != GCAM_M3Z_LEGACY)
+    return(gcamWriteChunked(gcam, fname,
+                            GCAMgetM3zFormat() == GCAM_M3Z_CHUNKED_DELTA ?
+                            GCAM_CODING_DELTA : GCAM_CODING_PLANES)) ;
+
   if (strstr(fname, ".m3z"))
   {
     //    printf("GCAMwrite:: m3z loop\n");
@@ -1374,8 +1873,21 @@ GCAMregister(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   return(NO_ERROR) ;
 }
 
+static GCA_MORPH *gcamFinishRead(GCA_MORPH *gcam) ;
+
 GCA_MORPH *
 GCAMread(const char *fname)
+{
+  return(GCAMreadPartial(fname, GCAM_FIELD_ALL, NULL)) ;
+}
+
+/*
+  read the fields in the fields mask (GCAM_FIELD_*) of the nodes inside
+  box (all of them if box is NULL). Only chunked m3z files can skip
+  data; legacy files are always read whole.
+*/
+GCA_MORPH *
+GCAMreadPartial(const char *fname, int fields, MRI_REGION *box)
 {
   GCA_MORPH       *gcam ;
   znzFile file;
@@ -1406,6 +1918,14 @@ GCAMread(const char *fname)
   }
 
   version = znzreadFloat(file) ;
+  if (version == GCAM_VERSION_CHUNKED)
+  {
+    znzclose(file);
+    gcam = gcamReadChunked(fname, fields, box) ;
+    if (gcam == NULL)
+      return(NULL) ;
+    return(gcamFinishRead(gcam)) ;
+  }
   if (version != GCAM_VERSION)
   {
     znzclose(file);
@@ -1526,6 +2046,12 @@ GCAMread(const char *fname)
 
   znzclose(file);
 
+  return(gcamFinishRead(gcam)) ;
+}
+
+static GCA_MORPH *
+gcamFinishRead(GCA_MORPH *gcam)
+{
   if (gcam->det > 0)  // reset gcamn->orig_area fields to be those of linear transform
   {
     int    x, y, z ;
@@ -8624,6 +9150,524 @@ GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri)
   return(mri) ;
 }
 
+/*-----------------------------------------------------------------------
+  Parallel inversion of the morph. Each cell of the node lattice is
+  split into 6 tetrahedra along its main diagonal (so neighboring cells
+  share faces), and every tetrahedron is scan-converted in the image
+  volume: the inverse at a voxel inside it is the barycentric
+  combination of the node coordinates of its corners, i.e. the exact
+  inverse of the piecewise-linear morph. Where tetrahedra overlap (folds)
+  the one the voxel is deepest inside of wins, so the result doesn't
+  depend on the order the cells are visited in.
+
+  Cells are bucketed into slabs of image slices thicker than any cell,
+  so a cell only writes into its own slab and the next one. Even slabs
+  are done in parallel, then odd ones, without any locking. Voxels not
+  covered by the lattice are filled as in GCAMinvert(). The inverse can
+  then be refined with Newton iterations against the trilinear forward
+  map used by GCAMsampleMorph().
+  ----------------------------------------------------------------------*/
+static int gcam_invert_mode = GCAM_INVERT_SPLAT ;
+static int gcam_invert_niter = 0 ;
+
+int
+GCAMsetInvertMode(int mode, int niter)
+{
+  gcam_invert_mode = mode ;
+  gcam_invert_niter = niter ;
+  return(NO_ERROR) ;
+}
+
+#define GCAM_SCAN_MAX_SLAB  16
+
+// corner offsets (bits x,y,z) of the 6 tetrahedra of a cell, all containing corners 0 and 7
+static int gcam_cell_tets[6][4] =
+{
+  { 0, 1, 3, 7 },
+  { 0, 1, 5, 7 },
+  { 0, 2, 3, 7 },
+  { 0, 2, 6, 7 },
+  { 0, 4, 5, 7 },
+  { 0, 4, 6, 7 }
+} ;
+
+static int
+gcamScanTetrahedron(GCA_MORPH *gcam, double P[4][3], double G[4][3], float *qual, 
+                    int width, int height, int depth)
+{
+  double T[3][3], Ti[3][3], det, l[4], d[3], q ;
+  int    xmin, xmax, ymin, ymax, zmin, zmax, x, y, z, i, j ;
+  long   index ;
+
+  for (i = 0 ; i < 3 ; i++)
+    for (j = 0 ; j < 3 ; j++)
+      T[i][j] = P[j+1][i] - P[0][i] ;
+  det = T[0][0]*(T[1][1]*T[2][2]-T[1][2]*T[2][1]) -
+        T[0][1]*(T[1][0]*T[2][2]-T[1][2]*T[2][0]) +
+        T[0][2]*(T[1][0]*T[2][1]-T[1][1]*T[2][0]) ;
+  if (fabs(det) < 1e-10)
+    return(0) ;   // degenerate
+  Ti[0][0] = (T[1][1]*T[2][2]-T[1][2]*T[2][1])/det ;
+  Ti[0][1] = (T[0][2]*T[2][1]-T[0][1]*T[2][2])/det ;
+  Ti[0][2] = (T[0][1]*T[1][2]-T[0][2]*T[1][1])/det ;
+  Ti[1][0] = (T[1][2]*T[2][0]-T[1][0]*T[2][2])/det ;
+  Ti[1][1] = (T[0][0]*T[2][2]-T[0][2]*T[2][0])/det ;
+  Ti[1][2] = (T[0][2]*T[1][0]-T[0][0]*T[1][2])/det ;
+  Ti[2][0] = (T[1][0]*T[2][1]-T[1][1]*T[2][0])/det ;
+  Ti[2][1] = (T[0][1]*T[2][0]-T[0][0]*T[2][1])/det ;
+  Ti[2][2] = (T[0][0]*T[1][1]-T[0][1]*T[1][0])/det ;
+
+  xmin = width ; ymin = height ; zmin = depth ; xmax = ymax = zmax = -1 ;
+  for (i = 0 ; i < 4 ; i++)
+  {
+    xmin = MIN(xmin, (int)ceil(P[i][0])) ;  xmax = MAX(xmax, (int)floor(P[i][0])) ;
+    ymin = MIN(ymin, (int)ceil(P[i][1])) ;  ymax = MAX(ymax, (int)floor(P[i][1])) ;
+    zmin = MIN(zmin, (int)ceil(P[i][2])) ;  zmax = MAX(zmax, (int)floor(P[i][2])) ;
+  }
+  xmin = MAX(xmin, 0) ; ymin = MAX(ymin, 0) ; zmin = MAX(zmin, 0) ;
+  xmax = MIN(xmax, width-1) ; ymax = MIN(ymax, height-1) ; zmax = MIN(zmax, depth-1) ;
+
+  for (z = zmin ; z <= zmax ; z++)
+    for (y = ymin ; y <= ymax ; y++)
+      for (x = xmin ; x <= xmax ; x++)
+      {
+        d[0] = x - P[0][0] ; d[1] = y - P[0][1] ; d[2] = z - P[0][2] ;
+        for (i = 0 ; i < 3 ; i++)
+          l[i+1] = Ti[i][0]*d[0] + Ti[i][1]*d[1] + Ti[i][2]*d[2] ;
+        l[0] = 1.0 - l[1] - l[2] - l[3] ;
+        q = MIN(MIN(l[0], l[1]), MIN(l[2], l[3])) ;
+        index = ((long)z*height + y)*width + x ;
+        if (q < -1e-6 || q <= qual[index])
+          continue ;
+        qual[index] = q ;
+        MRIFvox(gcam->mri_xind, x, y, z) = l[0]*G[0][0] + l[1]*G[1][0] + l[2]*G[2][0] + l[3]*G[3][0] ;
+        MRIFvox(gcam->mri_yind, x, y, z) = l[0]*G[0][1] + l[1]*G[1][1] + l[2]*G[2][1] + l[3]*G[3][1] ;
+        MRIFvox(gcam->mri_zind, x, y, z) = l[0]*G[0][2] + l[1]*G[1][2] + l[2]*G[2][2] + l[3]*G[3][2] ;
+      }
+  return(1) ;
+}
+
+static int
+gcamScanCell(GCA_MORPH *gcam, int xn, int yn, int zn, float *qual, 
+             int width, int height, int depth)
+{
+  double P[4][3], G[4][3] ;
+  int    t, i, c ;
+  GMN    *gcamn ;
+
+  for (t = 0 ; t < 6 ; t++)
+  {
+    for (i = 0 ; i < 4 ; i++)
+    {
+      c = gcam_cell_tets[t][i] ;
+      G[i][0] = xn + (c & 1) ; G[i][1] = yn + ((c >> 1) & 1) ; G[i][2] = zn + ((c >> 2) & 1) ;
+      gcamn = &gcam->nodes[(int)G[i][0]][(int)G[i][1]][(int)G[i][2]] ;
+      P[i][0] = gcamn->x ; P[i][1] = gcamn->y ; P[i][2] = gcamn->z ;
+    }
+    gcamScanTetrahedron(gcam, P, G, qual, width, height, depth) ;
+  }
+  return(NO_ERROR) ;
+}
+
+/* trilinear forward map at node coords (xn,yn,zn) and its Jacobian, as in GCAMsampleMorph */
+static int
+gcamSampleMorphJacobian(const GCA_MORPH *gcam, double xn, double yn, double zn, 
+                        double F[3], double J[3][3])
+{
+  int    xm, ym, zm, i, j, k, c ;
+  double w[3][2], dw[3][2], wt, p[3] ;
+  const GMN *gcamn ;
+
+  if (xn < 0 || yn < 0 || zn < 0 || 
+      xn > gcam->width-1 || yn > gcam->height-1 || zn > gcam->depth-1)
+    return(ERROR_BADPARM) ;
+  xm = MIN((int)xn, gcam->width-2) ;
+  ym = MIN((int)yn, gcam->height-2) ;
+  zm = MIN((int)zn, gcam->depth-2) ;
+  w[0][1] = xn - xm ; w[0][0] = 1 - w[0][1] ;
+  w[1][1] = yn - ym ; w[1][0] = 1 - w[1][1] ;
+  w[2][1] = zn - zm ; w[2][0] = 1 - w[2][1] ;
+  dw[0][0] = dw[1][0] = dw[2][0] = -1 ; dw[0][1] = dw[1][1] = dw[2][1] = 1 ;
+
+  memset(F, 0, 3*sizeof(double)) ; memset(J, 0, 9*sizeof(double)) ;
+  for (i = 0 ; i < 2 ; i++)
+    for (j = 0 ; j < 2 ; j++)
+      for (k = 0 ; k < 2 ; k++)
+      {
+        gcamn = &gcam->nodes[xm+i][ym+j][zm+k] ;
+        if (gcamn->invalid == GCAM_POSITION_INVALID)
+          return(ERROR_BADPARM) ;
+        p[0] = gcamn->x ; p[1] = gcamn->y ; p[2] = gcamn->z ;
+        wt = w[0][i]*w[1][j]*w[2][k] ;
+        for (c = 0 ; c < 3 ; c++)
+        {
+          F[c] += wt * p[c] ;
+          J[c][0] += dw[0][i]*w[1][j]*w[2][k] * p[c] ;
+          J[c][1] += w[0][i]*dw[1][j]*w[2][k] * p[c] ;
+          J[c][2] += w[0][i]*w[1][j]*dw[2][k] * p[c] ;
+        }
+      }
+  return(NO_ERROR) ;
+}
+
+static double
+gcamInverseVoxelResidual(const GCA_MORPH *gcam, int x, int y, int z, double xn, double yn, double zn)
+{
+  double F[3], J[3][3] ;
+
+  if (gcamSampleMorphJacobian(gcam, xn, yn, zn, F, J) != NO_ERROR)
+    return(-1) ;
+  return(sqrt(SQR(F[0]-x) + SQR(F[1]-y) + SQR(F[2]-z))) ;
+}
+
+// Newton iterations on forward(p) = (x,y,z), starting from the current inverse
+static int
+gcamRefineInverse(GCA_MORPH *gcam, MRI *mri_ctrl, int niter)
+{
+  int z ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for shared(gcam, mri_ctrl) schedule(dynamic,1)
+#endif
+  for (z = 0 ; z < mri_ctrl->depth ; z++)
+  {
+    int    x, y, n ;
+    double p[3], pnew[3], F[3], J[3][3], r[3], det, res, new_res ;
+
+    for (y = 0 ; y < mri_ctrl->height ; y++)
+      for (x = 0 ; x < mri_ctrl->width ; x++)
+      {
+        if (MRIvox(mri_ctrl, x, y, z) != CONTROL_MARKED)
+          continue ;
+        p[0] = MRIFvox(gcam->mri_xind, x, y, z) ;
+        p[1] = MRIFvox(gcam->mri_yind, x, y, z) ;
+        p[2] = MRIFvox(gcam->mri_zind, x, y, z) ;
+        for (n = 0 ; n < niter ; n++)
+        {
+          if (gcamSampleMorphJacobian(gcam, p[0], p[1], p[2], F, J) != NO_ERROR)
+            break ;
+          r[0] = F[0] - x ; r[1] = F[1] - y ; r[2] = F[2] - z ;
+          res = sqrt(SQR(r[0]) + SQR(r[1]) + SQR(r[2])) ;
+          if (res < 1e-4)
+            break ;
+          det = J[0][0]*(J[1][1]*J[2][2]-J[1][2]*J[2][1]) -
+                J[0][1]*(J[1][0]*J[2][2]-J[1][2]*J[2][0]) +
+                J[0][2]*(J[1][0]*J[2][1]-J[1][1]*J[2][0]) ;
+          if (fabs(det) < 1e-10)
+            break ;
+          // p - J^-1 r by Cramer's rule
+          pnew[0] = p[0] - (r[0]*(J[1][1]*J[2][2]-J[1][2]*J[2][1]) -
+                            J[0][1]*(r[1]*J[2][2]-J[1][2]*r[2]) +
+                            J[0][2]*(r[1]*J[2][1]-J[1][1]*r[2])) / det ;
+          pnew[1] = p[1] - (J[0][0]*(r[1]*J[2][2]-J[1][2]*r[2]) -
+                            r[0]*(J[1][0]*J[2][2]-J[1][2]*J[2][0]) +
+                            J[0][2]*(J[1][0]*r[2]-r[1]*J[2][0])) / det ;
+          pnew[2] = p[2] - (J[0][0]*(J[1][1]*r[2]-r[1]*J[2][1]) -
+                            J[0][1]*(J[1][0]*r[2]-r[1]*J[2][0]) +
+                            r[0]*(J[1][0]*J[2][1]-J[1][1]*J[2][0])) / det ;
+          new_res = gcamInverseVoxelResidual(gcam, x, y, z, pnew[0], pnew[1], pnew[2]) ;
+          if (new_res < 0 || new_res >= res)
+            break ;   // left the lattice or didn't improve
+          memmove(p, pnew, sizeof(p)) ;
+        }
+        MRIFvox(gcam->mri_xind, x, y, z) = p[0] ;
+        MRIFvox(gcam->mri_yind, x, y, z) = p[1] ;
+        MRIFvox(gcam->mri_zind, x, y, z) = p[2] ;
+      }
+  }
+  return(NO_ERROR) ;
+}
+
+/*
+  residual |forward(inverse(v)) - v| in image voxels over all voxels
+  whose inverse falls inside the valid part of the lattice.
+*/
+int
+GCAMinverseResidual(GCA_MORPH *gcam, double *pmean, double *pmax, int *pnvox)
+{
+  int    z, depth, nvox ;
+  double *slice_sum, *slice_max, sum, max ;
+  int    *slice_n ;
+
+  if (gcam->mri_xind == NULL)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMinverseResidual: gcam not inverted")) ;
+  depth = gcam->mri_xind->depth ;
+  slice_sum = (double *)calloc(depth, sizeof(double)) ;
+  slice_max = (double *)calloc(depth, sizeof(double)) ;
+  slice_n = (int *)calloc(depth, sizeof(int)) ;
+  if (!slice_sum || !slice_max || !slice_n)
+    ErrorExit(ERROR_NOMEMORY, "GCAMinverseResidual: could not allocate %d slices", depth) ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for shared(gcam, slice_sum, slice_max, slice_n) schedule(dynamic,1)
+#endif
+  for (z = 0 ; z < depth ; z++)
+  {
+    int    x, y ;
+    double res ;
+
+    for (y = 0 ; y < gcam->mri_xind->height ; y++)
+      for (x = 0 ; x < gcam->mri_xind->width ; x++)
+      {
+        res = gcamInverseVoxelResidual(gcam, x, y, z,
+                                       MRIFvox(gcam->mri_xind, x, y, z),
+                                       MRIFvox(gcam->mri_yind, x, y, z),
+                                       MRIFvox(gcam->mri_zind, x, y, z)) ;
+        if (res < 0)
+          continue ;
+        slice_sum[z] += res ;
+        slice_n[z]++ ;
+        if (res > slice_max[z])
+          slice_max[z] = res ;
+      }
+  }
+  for (sum = max = 0.0, nvox = z = 0 ; z < depth ; z++)
+  {
+    sum += slice_sum[z] ; nvox += slice_n[z] ;
+    max = MAX(max, slice_max[z]) ;
+  }
+  free(slice_sum) ; free(slice_max) ; free(slice_n) ;
+  if (pmean)
+    *pmean = nvox > 0 ? sum / nvox : 0 ;
+  if (pmax)
+    *pmax = max ;
+  if (pnvox)
+    *pnvox = nvox ;
+  return(NO_ERROR) ;
+}
+
+int
+GCAMinvertScan(GCA_MORPH *gcam, MRI *mri, int niter)
+{
+  int    width, height, depth, ncells, nslabs, slab_size, max_ext, parity, holes ;
+  int    xn, yn, zn, i, k, c, nbig, *cell_zmin, *slab_start, *slab_cells, *big_cells ;
+  long   nvox, v ;
+  float  *qual ;
+  double zlo, zhi, mean_res, max_res ;
+  MRI    *mri_ctrl ;
+  GMN    *gcamn ;
+
+  if (gcam->mri_xind)   /* already inverted */
+    return(NO_ERROR) ;
+
+  if (mri->width != gcam->image.width
+      || mri->height != gcam->image.height
+      || mri->depth != gcam->image.depth)
+    ErrorExit(ERROR_BADPARM, 
+              "mri passed volume size ( %d %d %d ) is different from "
+              "the one used to create M3D data ( %d %d %d )\n",
+              mri->width, mri->height,mri->depth,gcam->image.width,
+              gcam->image.height,gcam->image.depth);
+
+  width = mri->width ; height = mri->height ; depth = mri->depth ;
+  gcam->mri_xind = MRIalloc(width, height, depth, MRI_FLOAT) ;
+  gcam->mri_yind = MRIalloc(width, height, depth, MRI_FLOAT) ;
+  gcam->mri_zind = MRIalloc(width, height, depth, MRI_FLOAT) ;
+  mri_ctrl = MRIalloc(width, height, depth, MRI_UCHAR) ;
+  nvox = (long)width*height*depth ;
+  qual = (float *)malloc(nvox*sizeof(float)) ;
+  if (!gcam->mri_xind || !gcam->mri_yind || !gcam->mri_zind || !mri_ctrl || !qual)
+    ErrorExit(ERROR_NOMEMORY,
+              "GCAMinvertScan: could not allocated %dx%dx%d index volumes",
+              width, height, depth) ;
+  MRIcopyHeader(mri, gcam->mri_xind);
+  MRIcopyHeader(mri, gcam->mri_yind);
+  MRIcopyHeader(mri, gcam->mri_zind);
+  MRIcopyHeader(mri, mri_ctrl);
+  for (v = 0 ; v < nvox ; v++)
+    qual[v] = -1 ;
+
+  // first image slice touched by each cell, or -1 if it can't be scanned
+  ncells = (gcam->width-1)*(gcam->height-1)*(gcam->depth-1) ;
+  if (ncells <= 0)
+    ErrorExit(ERROR_BADPARM, "GCAMinvertScan: morph lattice is too small") ;
+  cell_zmin = (int *)calloc(ncells, sizeof(int)) ;
+  big_cells = (int *)calloc(ncells, sizeof(int)) ;
+  if (!cell_zmin || !big_cells)
+    ErrorExit(ERROR_NOMEMORY, "GCAMinvertScan: could not allocate %d cells", ncells) ;
+  max_ext = 0 ;
+  for (i = zn = 0 ; zn < gcam->depth-1 ; zn++)
+    for (yn = 0 ; yn < gcam->height-1 ; yn++)
+      for (xn = 0 ; xn < gcam->width-1 ; xn++, i++)
+      {
+        zlo = 1e10 ; zhi = -1e10 ;
+        for (c = 0 ; c < 8 ; c++)
+        {
+          gcamn = &gcam->nodes[xn+(c&1)][yn+((c>>1)&1)][zn+((c>>2)&1)] ;
+          if (gcamn->invalid == GCAM_POSITION_INVALID)
+            break ;
+          zlo = MIN(zlo, gcamn->z) ; zhi = MAX(zhi, gcamn->z) ;
+        }
+        if (c < 8 || zhi < 0 || zlo > depth-1)
+        {
+          cell_zmin[i] = -1 ;
+          continue ;
+        }
+        cell_zmin[i] = MAX(0, (int)ceil(zlo)) ;
+        k = MIN(depth-1, (int)floor(zhi)) - cell_zmin[i] ;
+        if (k < GCAM_SCAN_MAX_SLAB)
+          max_ext = MAX(max_ext, k) ;
+      }
+
+  // bucket the cells by slab; cells thicker than a slab are done serially at the end
+  slab_size = MAX(4, max_ext+1) ;
+  nslabs = (depth + slab_size - 1) / slab_size ;
+  slab_start = (int *)calloc(nslabs+1, sizeof(int)) ;
+  slab_cells = (int *)calloc(ncells, sizeof(int)) ;
+  if (!slab_start || !slab_cells)
+    ErrorExit(ERROR_NOMEMORY, "GCAMinvertScan: could not allocate %d slabs", nslabs) ;
+  for (nbig = i = 0 ; i < ncells ; i++)
+  {
+    if (cell_zmin[i] < 0)
+      continue ;
+    slab_start[cell_zmin[i]/slab_size + 1]++ ;
+  }
+  for (k = 0 ; k < nslabs ; k++)
+    slab_start[k+1] += slab_start[k] ;
+  {
+    int *slab_fill = (int *)calloc(nslabs, sizeof(int)) ;
+    if (!slab_fill)
+      ErrorExit(ERROR_NOMEMORY, "GCAMinvertScan: could not allocate %d slabs", nslabs) ;
+    for (i = 0 ; i < ncells ; i++)
+      if (cell_zmin[i] >= 0)
+      {
+        k = cell_zmin[i]/slab_size ;
+        slab_cells[slab_start[k] + slab_fill[k]++] = i ;
+      }
+    free(slab_fill) ;
+  }
+
+  for (parity = 0 ; parity < 2 ; parity++)
+  {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for shared(gcam, qual, slab_start, slab_cells, big_cells) reduction(+:nbig) schedule(dynamic,1)
+#endif
+    for (k = parity ; k < nslabs ; k += 2)
+    {
+      int j, cell, cxn, cyn, czn, ext ;
+      double zmax ;
+
+      for (j = slab_start[k] ; j < slab_start[k+1] ; j++)
+      {
+        cell = slab_cells[j] ;
+        cxn = cell % (gcam->width-1) ;
+        cyn = (cell / (gcam->width-1)) % (gcam->height-1) ;
+        czn = cell / ((gcam->width-1)*(gcam->height-1)) ;
+        for (zmax = -1e10, ext = 0 ; ext < 8 ; ext++)
+          zmax = MAX(zmax, gcam->nodes[cxn+(ext&1)][cyn+((ext>>1)&1)][czn+((ext>>2)&1)].z) ;
+        ext = MIN(depth-1, (int)floor(zmax)) - cell_zmin[cell] ;
+        if (ext >= slab_size)
+        {
+          big_cells[cell] = 1 ;   // would reach past the next slab
+          nbig++ ;
+          continue ;
+        }
+        gcamScanCell(gcam, cxn, cyn, czn, qual, width, height, depth) ;
+      }
+    }
+  }
+  if (nbig > 0)
+  {
+    if (Gdiag & DIAG_SHOW)
+      printf("GCAMinvertScan: %d folded/stretched cells scanned serially\n", nbig) ;
+    for (i = 0 ; i < ncells ; i++)
+      if (big_cells[i])
+        gcamScanCell(gcam, i % (gcam->width-1), (i / (gcam->width-1)) % (gcam->height-1),
+                     i / ((gcam->width-1)*(gcam->height-1)), qual, width, height, depth) ;
+  }
+  free(cell_zmin) ; free(big_cells) ; free(slab_start) ; free(slab_cells) ;
+
+  for (holes = 0, v = 0, zn = 0 ; zn < depth ; zn++)
+    for (yn = 0 ; yn < height ; yn++)
+      for (xn = 0 ; xn < width ; xn++, v++)
+      {
+        if (qual[v] >= -1e-6)
+          MRIvox(mri_ctrl, xn, yn, zn) = CONTROL_MARKED ;
+        else
+          holes++ ;
+      }
+  free(qual) ;
+
+  if (niter > 0)
+    gcamRefineInverse(gcam, mri_ctrl, niter) ;
+
+  // fill the voxels outside the deformed lattice the same way GCAMinvert does
+  if (holes > 0)
+  {
+    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+      printf("filling %d voxels outside the morph...\n", holes) ;
+    MRIbuildVoronoiDiagram(gcam->mri_xind, mri_ctrl, gcam->mri_xind) ;
+    MRIsoapBubble(gcam->mri_xind, mri_ctrl, gcam->mri_xind, 50, 1) ;
+    MRIbuildVoronoiDiagram(gcam->mri_yind, mri_ctrl, gcam->mri_yind) ;
+    MRIsoapBubble(gcam->mri_yind, mri_ctrl, gcam->mri_yind, 50, 1) ;
+    MRIbuildVoronoiDiagram(gcam->mri_zind, mri_ctrl, gcam->mri_zind) ;
+    MRIsoapBubble(gcam->mri_zind, mri_ctrl, gcam->mri_zind, 50, 1) ;
+  }
+  MRIfree(&mri_ctrl) ;
+
+  GCAMinverseResidual(gcam, &mean_res, &max_res, &k) ;
+  printf("GCAMinvertScan: %2.1f%% of voxels inside the morph, "
+         "inverse residual mean %2.4f, max %2.4f voxels\n",
+         100.0*(nvox-holes)/nvox, mean_res, max_res) ;
+  return(NO_ERROR) ;
+}
+
+/*-----------------------------------------------------------------------
+  GCAMinvertCached() - like GCAMinvert(), but reuses the inverse stored
+  next to the morph in gcamfname.inv.{x,y,z}.mgz if it is there and is
+  newer than the morph. If the environment variable GCAM_INVERSE_CACHE
+  is set a newly computed inverse is written there for the next tool.
+  ----------------------------------------------------------------------*/
+int
+GCAMinvertCached(GCA_MORPH *gcam, MRI *mri, const char *gcamfname)
+{
+  char        fname[STRLEN] ;
+  const char  *ext[3] = { "x", "y", "z" } ;
+  MRI         *mri_ind[3] ;
+  struct stat m3z_stat, inv_stat ;
+  int         i, valid ;
+
+  if (gcam->mri_xind)   /* already inverted */
+    return(NO_ERROR) ;
+
+  valid = (gcamfname != NULL && stat(gcamfname, &m3z_stat) == 0) ;
+  for (i = 0 ; valid && i < 3 ; i++)
+  {
+    sprintf(fname, "%s.inv.%s.mgz", gcamfname, ext[i]) ;
+    if (stat(fname, &inv_stat) != 0 || inv_stat.st_mtime < m3z_stat.st_mtime)
+      valid = 0 ;
+  }
+  if (valid)
+  {
+    memset(mri_ind, 0, sizeof(mri_ind)) ;
+    for (i = 0 ; valid && i < 3 ; i++)
+    {
+      sprintf(fname, "%s.inv.%s.mgz", gcamfname, ext[i]) ;
+      mri_ind[i] = MRIread(fname) ;
+      if (mri_ind[i] == NULL || mri_ind[i]->type != MRI_FLOAT ||
+          mri_ind[i]->width != mri->width || mri_ind[i]->height != mri->height ||
+          mri_ind[i]->depth != mri->depth)
+        valid = 0 ;
+    }
+    if (valid)
+    {
+      printf("using cached morph inverse %s.inv.{x,y,z}.mgz\n", gcamfname) ;
+      gcam->mri_xind = mri_ind[0] ;
+      gcam->mri_yind = mri_ind[1] ;
+      gcam->mri_zind = mri_ind[2] ;
+      return(NO_ERROR) ;
+    }
+    for (i = 0 ; i < 3 ; i++)
+      if (mri_ind[i])
+        MRIfree(&mri_ind[i]) ;
+  }
+
+  GCAMinvert(gcam, mri) ;
+  if (gcamfname && getenv("GCAM_INVERSE_CACHE"))
+    GCAMwriteInverseNonTal(gcamfname, gcam) ;
+  return(NO_ERROR) ;
+}
+
 int
 GCAMinvert(GCA_MORPH *gcam, MRI *mri)
 {
@@ -8638,6 +9682,14 @@ GCAMinvert(GCA_MORPH *gcam, MRI *mri)
   {
     return(NO_ERROR) ;
   }
+  if (getenv("GCAM_INVERT_SCAN"))  // value is the # of Newton refinement iterations
+  {
+    return(GCAMinvertScan(gcam, mri, atoi(getenv("GCAM_INVERT_SCAN")))) ;
+  }
+  if (gcam_invert_mode == GCAM_INVERT_SCAN)
+  {
+    return(GCAMinvertScan(gcam, mri, gcam_invert_niter)) ;
+  }
 #else
   if (gcam->mri_xind)
   {
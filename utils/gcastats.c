@@ -0,0 +1,972 @@
+/**
+ * @file  gcastats.c
+ * @brief mergeable sufficient statistics for training a GCA
+ *
+ * GCAtrain and GCAtrainCovariances need two passes over the training set
+ * because the covariances are accumulated around the final means. Here
+ * the raw moments are kept instead (in double precision), so that every
+ * subject is read once and the statistics of any number of subjects can
+ * be added together before the means and covariances are formed.
+ *
+ * Reference:
+ * "Whole Brain Segmentation: Automated Labeling of Neuroanatomical
+ * Structures in the Human Brain", Fischl et al.
+ * (2002) Neuron, 33:341-355.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcastats.h"
+#include "error.h"
+#include "diag.h"
+#include "macros.h"
+#include "cma.h"
+#include "fio.h"
+#include "znzlib.h"
+
+#define GCA_STATS_MAGIC    0x47434153   // "GCAS"
+#define GCA_STATS_VERSION  1
+
+static int xnbr_offset[] = { 1, -1, 0, 0,  0,  0} ;
+static int ynbr_offset[] = { 0, 0,  1, -1, 0,  0} ;
+static int znbr_offset[] = { 0, 0,  0, 0,  1, -1} ;
+
+static GCA_LABEL_STATS *gcasFindLabel(GCA_NODE_STATS *gns, int label) ;
+static GCA_LABEL_STATS *gcasAddLabel(GCA_STATS *gs, GCA_NODE_STATS *gns,
+                                     int label) ;
+static int gcasFreeLabel(GCA_LABEL_STATS *ls) ;
+static int gcasAddNbrLabel(GCA_LABEL_STATS *ls, int i, int nbr_label,
+                           int count) ;
+static int gcasUpdatePrior(GCA *gca, int xp, int yp, int zp, int label,
+                           float count) ;
+static int gcasUpdateCovariance(GCA_STATS *gs, GCA_LABEL_STATS *ls,
+                                float *vals) ;
+
+/* true if the label would have a classifier at this node in a GCA
+   trained on the subjects seen so far */
+#define LS_HAS_GC(ls)  ((ls) && ((ls)->ntraining > 0 || (ls)->hole))
+
+GCA_STATS *
+GCAstatsAlloc(GCA *gca)
+{
+  GCA_STATS *gs ;
+  int       x, y ;
+
+  gs = (GCA_STATS *)calloc(1, sizeof(GCA_STATS)) ;
+  if (!gs)
+    ErrorExit(ERROR_NOMEMORY, "GCAstatsAlloc: could not allocate struct") ;
+  gs->gca = gca ;
+  gs->ninputs = gca->ninputs ;
+  gs->ncovars = (gca->ninputs*(gca->ninputs+1))/2 ;
+  gs->node_width = gca->node_width ;
+  gs->node_height = gca->node_height ;
+  gs->node_depth = gca->node_depth ;
+  gs->nodes =
+    (GCA_NODE_STATS ***)calloc(gs->node_width, sizeof(GCA_NODE_STATS **)) ;
+  if (!gs->nodes)
+    ErrorExit(ERROR_NOMEMORY, "GCAstatsAlloc: could not allocate nodes") ;
+  for (x = 0 ; x < gs->node_width ; x++)
+  {
+    gs->nodes[x] =
+      (GCA_NODE_STATS **)calloc(gs->node_height, sizeof(GCA_NODE_STATS *)) ;
+    if (!gs->nodes[x])
+      ErrorExit(ERROR_NOMEMORY,
+                "GCAstatsAlloc: could not allocate %dth **", x) ;
+    for (y = 0 ; y < gs->node_height ; y++)
+    {
+      gs->nodes[x][y] =
+        (GCA_NODE_STATS *)calloc(gs->node_depth, sizeof(GCA_NODE_STATS)) ;
+      if (!gs->nodes[x][y])
+        ErrorExit(ERROR_NOMEMORY,
+                  "GCAstatsAlloc: could not allocate %d,%dth *", x, y) ;
+    }
+  }
+  return(gs) ;
+}
+
+int
+GCAstatsFree(GCA_STATS **pgs)
+{
+  GCA_STATS      *gs ;
+  GCA_NODE_STATS *gns ;
+  int            x, y, z, n ;
+
+  gs = *pgs ;
+  *pgs = NULL ;
+  for (x = 0 ; x < gs->node_width ; x++)
+  {
+    for (y = 0 ; y < gs->node_height ; y++)
+    {
+      for (z = 0 ; z < gs->node_depth ; z++)
+      {
+        gns = &gs->nodes[x][y][z] ;
+        for (n = 0 ; n < gns->nlabels ; n++)
+          gcasFreeLabel(&gns->ls[n]) ;
+        if (gns->ls)
+          free(gns->ls) ;
+      }
+      free(gs->nodes[x][y]) ;
+    }
+    free(gs->nodes[x]) ;
+  }
+  free(gs->nodes) ;
+  if (gs->gca)
+    GCAfree(&gs->gca) ;
+  free(gs) ;
+  return(NO_ERROR) ;
+}
+
+static int
+gcasFreeLabel(GCA_LABEL_STATS *ls)
+{
+  int i ;
+
+  free(ls->sums) ;   // cov_sums and cov_prods share the block
+  if (ls->hole_vals)
+    free(ls->hole_vals) ;
+  for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+  {
+    if (ls->labels[i])
+      free(ls->labels[i]) ;
+    if (ls->counts[i])
+      free(ls->counts[i]) ;
+  }
+  return(NO_ERROR) ;
+}
+
+static GCA_LABEL_STATS *
+gcasFindLabel(GCA_NODE_STATS *gns, int label)
+{
+  int n ;
+
+  for (n = 0 ; n < gns->nlabels ; n++)
+    if (gns->ls[n].label == label)
+      return(&gns->ls[n]) ;
+  return(NULL) ;
+}
+
+static GCA_LABEL_STATS *
+gcasAddLabel(GCA_STATS *gs, GCA_NODE_STATS *gns, int label)
+{
+  GCA_LABEL_STATS *ls ;
+
+  if (gns->nlabels >= gns->max_labels)
+  {
+    gns->max_labels += 2 ;
+    gns->ls = (GCA_LABEL_STATS *)realloc(gns->ls, gns->max_labels*
+                                         sizeof(GCA_LABEL_STATS)) ;
+    if (!gns->ls)
+      ErrorExit(ERROR_NOMEMORY,
+                "gcasAddLabel: could not expand labels to %d",
+                gns->max_labels) ;
+  }
+  ls = &gns->ls[gns->nlabels++] ;
+  memset(ls, 0, sizeof(*ls)) ;
+  ls->label = label ;
+  ls->sums = (double *)calloc(2*gs->ninputs+gs->ncovars, sizeof(double)) ;
+  if (!ls->sums)
+    ErrorExit(ERROR_NOMEMORY, "gcasAddLabel: could not allocate moments") ;
+  ls->cov_sums = ls->sums + gs->ninputs ;
+  ls->cov_prods = ls->cov_sums + gs->ninputs ;
+  return(ls) ;
+}
+
+static int
+gcasAddNbrLabel(GCA_LABEL_STATS *ls, int i, int nbr_label, int count)
+{
+  int n ;
+
+  for (n = 0 ; n < ls->nlabels[i] ; n++)
+    if (ls->labels[i][n] == nbr_label)
+      break ;
+  if (n >= ls->nlabels[i])
+  {
+    if (n >= ls->max_labels[i])
+    {
+      ls->max_labels[i] += 2 ;
+      ls->labels[i] =
+        (unsigned short *)realloc(ls->labels[i],
+                                  ls->max_labels[i]*sizeof(unsigned short)) ;
+      ls->counts[i] =
+        (int *)realloc(ls->counts[i], ls->max_labels[i]*sizeof(int)) ;
+      if (!ls->labels[i] || !ls->counts[i])
+        ErrorExit(ERROR_NOMEMORY,
+                  "gcasAddNbrLabel: could not expand nbr labels to %d",
+                  ls->max_labels[i]) ;
+    }
+    ls->labels[i][n] = nbr_label ;
+    ls->counts[i][n] = 0 ;
+    ls->nlabels[i]++ ;
+  }
+  ls->counts[i][n] += count ;
+  return(NO_ERROR) ;
+}
+
+/* same as GCAupdatePrior, but adds count samples and leaves
+   total_training to the caller */
+static int
+gcasUpdatePrior(GCA *gca, int xp, int yp, int zp, int label, float count)
+{
+  GCA_PRIOR *gcap ;
+  int       n ;
+
+  gcap = &gca->priors[xp][yp][zp] ;
+  for (n = 0 ; n < gcap->nlabels ; n++)
+    if (gcap->labels[n] == label)
+      break ;
+  if (n >= gcap->nlabels)
+  {
+    if (n >= gcap->max_labels)
+    {
+      gcap->max_labels += 2 ;
+      gcap->labels =
+        (unsigned short *)realloc(gcap->labels,
+                                  gcap->max_labels*sizeof(unsigned short)) ;
+      gcap->priors =
+        (float *)realloc(gcap->priors, gcap->max_labels*sizeof(float)) ;
+      if (!gcap->labels || !gcap->priors)
+        ErrorExit(ERROR_NOMEMORY,
+                  "gcasUpdatePrior: couldn't expand priors to %d",
+                  gcap->max_labels) ;
+    }
+    gcap->labels[n] = label ;
+    gcap->priors[n] = 0 ;
+    gcap->nlabels++ ;
+  }
+  gcap->priors[n] += count ;
+  return(NO_ERROR) ;
+}
+
+static int
+gcasUpdateCovariance(GCA_STATS *gs, GCA_LABEL_STATS *ls, float *vals)
+{
+  int r, c, v ;
+
+  for (v = r = 0 ; r < gs->ninputs ; r++)
+  {
+    ls->cov_sums[r] += vals[r] ;
+    for (c = r ; c < gs->ninputs ; c++, v++)
+      ls->cov_prods[v] += (double)vals[r]*vals[c] ;
+  }
+  ls->ncov++ ;
+  return(NO_ERROR) ;
+}
+
+/*
+  One subject's worth of GCAtrain and GCAtrainCovariances. The mapping of
+  each slice into the atlas is computed in parallel, the statistics are
+  then accumulated in the same voxel order as GCAtrain uses.
+*/
+int
+GCAstatsTrain(GCA_STATS *gs, MRI *mri_inputs, MRI *mri_labels,
+              TRANSFORM *transform, int noint)
+{
+  GCA             *gca ;
+  GCA_NODE_STATS  *gns ;
+  GCA_LABEL_STATS *ls ;
+  MRI             *mri_prior_mapped, *mri_node_mapped ;
+  int             x, y, z, xp, yp, zp, xn, yn, zn, i, r, label,
+                  width, height, depth, *xyzp, prior_holes, node_holes ;
+  float           vals[MAX_GCA_INPUTS] ;
+
+  gca = gs->gca ;
+  gca->total_training++ ;
+  width = mri_labels->width ;
+  height = mri_labels->height ;
+  depth = mri_labels->depth ;
+  mri_prior_mapped = MRIalloc(gca->prior_width, gca->prior_height,
+                              gca->prior_depth, MRI_UCHAR) ;
+  mri_node_mapped = MRIalloc(gca->node_width, gca->node_height,
+                             gca->node_depth, MRI_UCHAR) ;
+  xyzp = (int *)calloc(3*height*depth, sizeof(int)) ;
+  if (!xyzp)
+    ErrorExit(ERROR_NOMEMORY, "GCAstatsTrain: could not allocate slice map") ;
+
+  for (x = 0 ; x < width ; x++)
+  {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+    for (y = 0 ; y < height ; y++)
+    {
+      int zv, *p ;
+
+      for (zv = 0, p = xyzp+3*y*depth ; zv < depth ; zv++, p += 3)
+        if (GCAsourceVoxelToPrior(gca, mri_inputs, transform, x, y, zv,
+                                  &p[0], &p[1], &p[2]) != NO_ERROR)
+          p[0] = -1 ;
+    }
+
+    for (y = 0 ; y < height ; y++)
+    {
+      for (z = 0 ; z < depth ; z++)
+      {
+        int *p = xyzp+3*(y*depth+z) ;
+
+        label = nint(MRIgetVoxVal(mri_labels, x, y, z, 0)) ;
+        if (label > gca->max_label)
+          gca->max_label = label ;
+        if (p[0] < 0)
+          continue ;
+        if (label >= MAX_CMA_LABEL)
+        {
+          ErrorPrintf(ERROR_BADPARM,
+                      "GCAstatsTrain(%d, %d, %d): label %d out of range",
+                      x, y, z, label) ;
+          continue ;
+        }
+        xp = p[0] ; yp = p[1] ; zp = p[2] ;
+        GCApriorToNode(gca, xp, yp, zp, &xn, &yn, &zn) ;
+        MRIsetVoxVal(mri_prior_mapped, xp, yp, zp, 0, 1) ;
+        MRIsetVoxVal(mri_node_mapped, xn, yn, zn, 0, 1) ;
+        gcasUpdatePrior(gca, xp, yp, zp, label, 1.0f) ;
+        gca->priors[xp][yp][zp].total_training++ ;
+
+        gns = &gs->nodes[xn][yn][zn] ;
+        ls = gcasFindLabel(gns, label) ;
+        if (ls == NULL)
+          ls = gcasAddLabel(gs, gns, label) ;
+        ls->ntraining++ ;
+        if (noint)
+          ls->n_just_priors++ ;
+        else
+        {
+          load_vals(mri_inputs, x, y, z, vals, gs->ninputs) ;
+          for (r = 0 ; r < gs->ninputs ; r++)
+            ls->sums[r] += vals[r] ;
+          gcasUpdateCovariance(gs, ls, vals) ;
+        }
+        if (gca->flags & GCA_NO_MRF)
+          continue ;
+        for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          gcasAddNbrLabel(ls, i, nint(MRIgetVoxVal(mri_labels,
+                                                   mri_labels->xi[x+xnbr_offset[i]],
+                                                   mri_labels->yi[y+ynbr_offset[i]],
+                                                   mri_labels->zi[z+znbr_offset[i]],
+                                                   0)), 1) ;
+      }
+    }
+  }
+  free(xyzp) ;
+
+  /* prior holes: the source voxel closest to an unmapped prior counts
+     toward the prior, and toward the node if it has no classifier for
+     the label yet (see GCAtrain) */
+  for (prior_holes = xp = 0 ; xp < gca->prior_width ; xp++)
+  {
+    for (yp = 0 ; yp < gca->prior_height ; yp++)
+    {
+      for (zp = 0 ; zp < gca->prior_depth ; zp++)
+      {
+        if (MRIgetVoxVal(mri_prior_mapped, xp, yp, zp, 0) > 0)
+          continue ;
+        if (GCApriorToSourceVoxel(gca, mri_inputs, transform,
+                                  xp, yp, zp, &x, &y, &z) != NO_ERROR)
+          continue ;
+        prior_holes++ ;
+        label = nint(MRIgetVoxVal(mri_labels, x, y, z, 0)) ;
+        if (label >= MAX_CMA_LABEL)
+          continue ;
+        gcasUpdatePrior(gca, xp, yp, zp, label, 1.0f) ;
+        gca->priors[xp][yp][zp].total_training++ ;
+        GCApriorToNode(gca, xp, yp, zp, &xn, &yn, &zn) ;
+        gns = &gs->nodes[xn][yn][zn] ;
+        ls = gcasFindLabel(gns, label) ;
+        if (LS_HAS_GC(ls))
+          continue ;
+        if (ls == NULL)
+          ls = gcasAddLabel(gs, gns, label) ;
+        ls->hole = noint ? GCA_STATS_HOLE_NOINT : GCA_STATS_HOLE ;
+        ls->hole_vals = (float *)calloc(gs->ninputs, sizeof(float)) ;
+        if (!ls->hole_vals)
+          ErrorExit(ERROR_NOMEMORY, "GCAstatsTrain: could not allocate hole") ;
+        if (!noint)
+          load_vals(mri_inputs, x, y, z, ls->hole_vals, gs->ninputs) ;
+        if (gca->flags & GCA_NO_MRF)
+          continue ;
+        for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          ls->hole_nbrs[i] =
+            nint(MRIgetVoxVal(mri_labels,
+                              mri_labels->xi[x+xnbr_offset[i]],
+                              mri_labels->yi[y+ynbr_offset[i]],
+                              mri_labels->zi[z+znbr_offset[i]], 0)) ;
+      }
+    }
+  }
+
+  /* node holes contribute to the covariance of the label at the source
+     voxel if the finished GCA has a classifier for it (see
+     GCAtrainCovariances), which is decided in GCAstatsCompleteTraining */
+  node_holes = 0 ;
+  if (!noint)
+  {
+    for (xn = 0 ; xn < gca->node_width ; xn++)
+    {
+      for (yn = 0 ; yn < gca->node_height ; yn++)
+      {
+        for (zn = 0 ; zn < gca->node_depth ; zn++)
+        {
+          if (MRIgetVoxVal(mri_node_mapped, xn, yn, zn, 0) > 0)
+            continue ;
+          if (GCAnodeToSourceVoxel(gca, mri_inputs, transform,
+                                   xn, yn, zn, &x, &y, &z) != NO_ERROR)
+            continue ;
+          node_holes++ ;
+          label = nint(MRIgetVoxVal(mri_labels, x, y, z, 0)) ;
+          if (label >= MAX_CMA_LABEL)
+            continue ;
+          gns = &gs->nodes[xn][yn][zn] ;
+          ls = gcasFindLabel(gns, label) ;
+          if (ls == NULL)
+            ls = gcasAddLabel(gs, gns, label) ;
+          load_vals(mri_inputs, x, y, z, vals, gs->ninputs) ;
+          gcasUpdateCovariance(gs, ls, vals) ;
+        }
+      }
+    }
+  }
+
+  if (prior_holes > 0 || node_holes > 0)
+    printf("%d prior and %d node holes filled\n", prior_holes, node_holes) ;
+  MRIfree(&mri_prior_mapped) ;
+  MRIfree(&mri_node_mapped) ;
+  return(NO_ERROR) ;
+}
+
+int
+GCAstatsMerge(GCA_STATS *gs_dst, GCA_STATS *gs_src)
+{
+  GCA             *gca_dst, *gca_src ;
+  GCA_PRIOR       *gcap ;
+  GCA_NODE_STATS  *gns_dst, *gns_src ;
+  GCA_LABEL_STATS *ls_dst, *ls_src ;
+  int             x, y, z, n, i, j, r, had_gc ;
+
+  gca_dst = gs_dst->gca ;
+  gca_src = gs_src->gca ;
+  if (gca_dst->ninputs != gca_src->ninputs ||
+      gca_dst->flags != gca_src->flags ||
+      gca_dst->node_width != gca_src->node_width ||
+      gca_dst->node_height != gca_src->node_height ||
+      gca_dst->node_depth != gca_src->node_depth ||
+      gca_dst->prior_width != gca_src->prior_width ||
+      gca_dst->prior_height != gca_src->prior_height ||
+      gca_dst->prior_depth != gca_src->prior_depth)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "GCAstatsMerge: statistics were trained with different "
+                 "inputs, flags or spacing")) ;
+
+  if (gca_dst->total_training == 0)
+  {
+    gca_dst->x_r = gca_src->x_r ;
+    gca_dst->x_a = gca_src->x_a ;
+    gca_dst->x_s = gca_src->x_s ;
+    gca_dst->y_r = gca_src->y_r ;
+    gca_dst->y_a = gca_src->y_a ;
+    gca_dst->y_s = gca_src->y_s ;
+    gca_dst->z_r = gca_src->z_r ;
+    gca_dst->z_a = gca_src->z_a ;
+    gca_dst->z_s = gca_src->z_s ;
+    gca_dst->c_r = gca_src->c_r ;
+    gca_dst->c_a = gca_src->c_a ;
+    gca_dst->c_s = gca_src->c_s ;
+    gca_dst->width = gca_src->width ;
+    gca_dst->height = gca_src->height ;
+    gca_dst->depth = gca_src->depth ;
+    gca_dst->xsize = gca_src->xsize ;
+    gca_dst->ysize = gca_src->ysize ;
+    gca_dst->zsize = gca_src->zsize ;
+    GCAsetup(gca_dst) ;
+    gca_dst->type = gca_src->type ;
+    memmove(gca_dst->TRs, gca_src->TRs, sizeof(gca_src->TRs)) ;
+    memmove(gca_dst->FAs, gca_src->FAs, sizeof(gca_src->FAs)) ;
+    memmove(gca_dst->TEs, gca_src->TEs, sizeof(gca_src->TEs)) ;
+  }
+  gca_dst->total_training += gca_src->total_training ;
+  if (gca_src->max_label > gca_dst->max_label)
+    gca_dst->max_label = gca_src->max_label ;
+
+  for (x = 0 ; x < gca_src->prior_width ; x++)
+  {
+    for (y = 0 ; y < gca_src->prior_height ; y++)
+    {
+      for (z = 0 ; z < gca_src->prior_depth ; z++)
+      {
+        gcap = &gca_src->priors[x][y][z] ;
+        for (n = 0 ; n < gcap->nlabels ; n++)
+          gcasUpdatePrior(gca_dst, x, y, z, gcap->labels[n],
+                          gcap->priors[n]) ;
+        gca_dst->priors[x][y][z].total_training += gcap->total_training ;
+      }
+    }
+  }
+
+  for (x = 0 ; x < gs_src->node_width ; x++)
+  {
+    for (y = 0 ; y < gs_src->node_height ; y++)
+    {
+      for (z = 0 ; z < gs_src->node_depth ; z++)
+      {
+        gns_src = &gs_src->nodes[x][y][z] ;
+        gns_dst = &gs_dst->nodes[x][y][z] ;
+        for (n = 0 ; n < gns_src->nlabels ; n++)
+        {
+          ls_src = &gns_src->ls[n] ;
+          ls_dst = gcasFindLabel(gns_dst, ls_src->label) ;
+          had_gc = LS_HAS_GC(ls_dst) ;
+          if (ls_dst == NULL)
+            ls_dst = gcasAddLabel(gs_dst, gns_dst, ls_src->label) ;
+          ls_dst->ntraining += ls_src->ntraining ;
+          ls_dst->n_just_priors += ls_src->n_just_priors ;
+          ls_dst->ncov += ls_src->ncov ;
+          for (r = 0 ; r < 2*gs_src->ninputs+gs_src->ncovars ; r++)
+            ls_dst->sums[r] += ls_src->sums[r] ;
+          for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+            for (j = 0 ; j < ls_src->nlabels[i] ; j++)
+              gcasAddNbrLabel(ls_dst, i, ls_src->labels[i][j],
+                              ls_src->counts[i][j]) ;
+
+          /* src filled the hole because none of its subjects had the
+             label here yet. If one of the dst subjects (which come
+             first) had it, the hole would never have been filled. */
+          if (ls_src->hole && !had_gc)
+          {
+            ls_dst->hole = ls_src->hole ;
+            ls_dst->hole_vals = (float *)calloc(gs_src->ninputs,
+                                                sizeof(float)) ;
+            if (!ls_dst->hole_vals)
+              ErrorExit(ERROR_NOMEMORY,
+                        "GCAstatsMerge: could not allocate hole") ;
+            memmove(ls_dst->hole_vals, ls_src->hole_vals,
+                    gs_src->ninputs*sizeof(float)) ;
+            memmove(ls_dst->hole_nbrs, ls_src->hole_nbrs,
+                    sizeof(ls_src->hole_nbrs)) ;
+          }
+        }
+      }
+    }
+  }
+  return(NO_ERROR) ;
+}
+
+GCA *
+GCAstatsCompleteTraining(GCA_STATS *gs)
+{
+  GCA             *gca ;
+  GCA_NODE        *gcan ;
+  GCA_NODE_STATS  *gns ;
+  GCA_LABEL_STATS *ls ;
+  GC1D            *gc ;
+  int             x, y, z, n, i, j, k, r, c, v, nlabels ;
+  double          *mean ;
+
+  gca = gs->gca ;
+  gs->gca = NULL ;
+  mean = (double *)calloc(gs->ninputs, sizeof(double)) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+  {
+    for (y = 0 ; y < gca->node_height ; y++)
+    {
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        gns = &gs->nodes[x][y][z] ;
+        for (nlabels = n = 0 ; n < gns->nlabels ; n++)
+          if (LS_HAS_GC(&gns->ls[n]))
+            nlabels++ ;
+        if (nlabels == 0)   // keep the empty classifiers from GCAalloc
+          continue ;
+        if (gcan->gcs)
+          free_gcs(gcan->gcs, gcan->max_labels, gca->ninputs) ;
+        if (gcan->labels)
+          free(gcan->labels) ;
+        gcan->nlabels = gcan->max_labels = nlabels ;
+        gcan->total_training = 0 ;
+        gcan->gcs = alloc_gcs(nlabels, gca->flags, gca->ninputs) ;
+        gcan->labels = (unsigned short *)calloc(nlabels,
+                                                sizeof(unsigned short)) ;
+        if (!gcan->labels)
+          ErrorExit(ERROR_NOMEMORY,
+                    "GCAstatsCompleteTraining: could not allocate labels") ;
+
+        for (k = n = 0 ; n < gns->nlabels ; n++)
+        {
+          ls = &gns->ls[n] ;
+          if (!LS_HAS_GC(ls))
+            continue ;
+          gc = &gcan->gcs[k] ;
+          gcan->labels[k++] = ls->label ;
+          gc->ntraining = ls->ntraining ;
+          gc->n_just_priors = ls->n_just_priors ;
+          for (r = 0 ; r < gca->ninputs ; r++)
+            gc->means[r] = ls->sums[r] ;
+          if (ls->hole)
+          {
+            gc->ntraining++ ;
+            if (ls->hole == GCA_STATS_HOLE_NOINT)
+              gc->n_just_priors++ ;
+            else for (r = 0 ; r < gca->ninputs ; r++)
+                gc->means[r] += ls->hole_vals[r] ;
+          }
+          gcan->total_training += gc->ntraining ;
+          if (gca->flags & GCA_NO_MRF)
+            continue ;
+          if (ls->hole)
+            for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+              gcasAddNbrLabel(ls, i, ls->hole_nbrs[i], 1) ;
+          for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          {
+            gc->nlabels[i] = ls->nlabels[i] ;
+            gc->labels[i] =
+              (unsigned short *)calloc(ls->nlabels[i],
+                                       sizeof(unsigned short)) ;
+            gc->label_priors[i] = (float *)calloc(ls->nlabels[i],
+                                                  sizeof(float)) ;
+            if (!gc->labels[i] || !gc->label_priors[i])
+              ErrorExit(ERROR_NOMEMORY, "GCAstatsCompleteTraining: "
+                        "could not allocate gibbs priors") ;
+            for (j = 0 ; j < ls->nlabels[i] ; j++)
+            {
+              gc->labels[i][j] = ls->labels[i][j] ;
+              gc->label_priors[i][j] = ls->counts[i][j] ;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  GCAcompleteMeanTraining(gca) ;
+
+  /* centered sums of products around the final means, which is what
+     GCAtrainCovariances accumulates */
+  for (x = 0 ; x < gca->node_width ; x++)
+  {
+    for (y = 0 ; y < gca->node_height ; y++)
+    {
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        gns = &gs->nodes[x][y][z] ;
+        for (k = n = 0 ; n < gns->nlabels ; n++)
+        {
+          ls = &gns->ls[n] ;
+          if (!LS_HAS_GC(ls))
+            continue ;
+          gc = &gcan->gcs[k++] ;
+          for (r = 0 ; r < gca->ninputs ; r++)
+            mean[r] = gc->means[r] ;
+          for (v = r = 0 ; r < gca->ninputs ; r++)
+            for (c = r ; c < gca->ninputs ; c++, v++)
+              gc->covars[v] = ls->cov_prods[v]
+                              - mean[r]*ls->cov_sums[c]
+                              - ls->cov_sums[r]*mean[c]
+                              + ls->ncov*mean[r]*mean[c] ;
+        }
+      }
+    }
+  }
+  free(mean) ;
+
+  GCAcompleteCovarianceTraining(gca) ;
+  return(gca) ;
+}
+
+int
+GCAstatsWrite(GCA_STATS *gs, const char *fname)
+{
+  znzFile         file ;
+  GCA             *gca ;
+  GCA_PRIOR       *gcap ;
+  GCA_NODE_STATS  *gns ;
+  GCA_LABEL_STATS *ls ;
+  int             x, y, z, n, i, j, r ;
+
+  gca = gs->gca ;
+  file = znzopen(fname, "wb", strstr(fname, ".gz") != NULL) ;
+  if (znz_isnull(file))
+    ErrorReturn(ERROR_BADFILE,
+                (ERROR_BADFILE, "GCAstatsWrite(%s): could not open file",
+                 fname)) ;
+
+  znzwriteInt(GCA_STATS_MAGIC, file) ;
+  znzwriteInt(GCA_STATS_VERSION, file) ;
+  znzwriteInt(gca->ninputs, file) ;
+  znzwriteInt(gca->flags, file) ;
+  znzwriteFloat(gca->prior_spacing, file) ;
+  znzwriteFloat(gca->node_spacing, file) ;
+  znzwriteInt(gca->prior_width, file) ;
+  znzwriteInt(gca->prior_height, file) ;
+  znzwriteInt(gca->prior_depth, file) ;
+  znzwriteInt(gca->node_width, file) ;
+  znzwriteInt(gca->node_height, file) ;
+  znzwriteInt(gca->node_depth, file) ;
+  znzwriteInt(gca->type, file) ;
+  znzwriteInt(gca->total_training, file) ;
+  znzwriteInt(gca->max_label, file) ;
+  for (r = 0 ; r < gca->ninputs ; r++)
+  {
+    znzwriteDouble(gca->TRs[r], file) ;
+    znzwriteDouble(gca->FAs[r], file) ;
+    znzwriteDouble(gca->TEs[r], file) ;
+  }
+  znzwriteFloat(gca->x_r, file) ;
+  znzwriteFloat(gca->x_a, file) ;
+  znzwriteFloat(gca->x_s, file) ;
+  znzwriteFloat(gca->y_r, file) ;
+  znzwriteFloat(gca->y_a, file) ;
+  znzwriteFloat(gca->y_s, file) ;
+  znzwriteFloat(gca->z_r, file) ;
+  znzwriteFloat(gca->z_a, file) ;
+  znzwriteFloat(gca->z_s, file) ;
+  znzwriteFloat(gca->c_r, file) ;
+  znzwriteFloat(gca->c_a, file) ;
+  znzwriteFloat(gca->c_s, file) ;
+  znzwriteInt(gca->width, file) ;
+  znzwriteInt(gca->height, file) ;
+  znzwriteInt(gca->depth, file) ;
+  znzwriteFloat(gca->xsize, file) ;
+  znzwriteFloat(gca->ysize, file) ;
+  znzwriteFloat(gca->zsize, file) ;
+
+  for (x = 0 ; x < gca->prior_width ; x++)
+  {
+    for (y = 0 ; y < gca->prior_height ; y++)
+    {
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        znzwriteInt(gcap->nlabels, file) ;
+        znzwriteInt(gcap->total_training, file) ;
+        for (n = 0 ; n < gcap->nlabels ; n++)
+        {
+          znzwriteInt(gcap->labels[n], file) ;
+          znzwriteFloat(gcap->priors[n], file) ;
+        }
+      }
+    }
+  }
+
+  for (x = 0 ; x < gs->node_width ; x++)
+  {
+    for (y = 0 ; y < gs->node_height ; y++)
+    {
+      for (z = 0 ; z < gs->node_depth ; z++)
+      {
+        gns = &gs->nodes[x][y][z] ;
+        znzwriteInt(gns->nlabels, file) ;
+        for (n = 0 ; n < gns->nlabels ; n++)
+        {
+          ls = &gns->ls[n] ;
+          znzwriteInt(ls->label, file) ;
+          znzwriteInt(ls->ntraining, file) ;
+          znzwriteInt(ls->n_just_priors, file) ;
+          znzwriteInt(ls->ncov, file) ;
+          for (r = 0 ; r < 2*gs->ninputs+gs->ncovars ; r++)
+            znzwriteDouble(ls->sums[r], file) ;
+          znzwriteInt(ls->hole, file) ;
+          if (ls->hole)
+          {
+            for (r = 0 ; r < gs->ninputs ; r++)
+              znzwriteFloat(ls->hole_vals[r], file) ;
+            for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+              znzwriteInt(ls->hole_nbrs[i], file) ;
+          }
+          if (gca->flags & GCA_NO_MRF)
+            continue ;
+          for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          {
+            znzwriteInt(ls->nlabels[i], file) ;
+            for (j = 0 ; j < ls->nlabels[i] ; j++)
+            {
+              znzwriteInt(ls->labels[i][j], file) ;
+              znzwriteInt(ls->counts[i][j], file) ;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  znzclose(file) ;
+  return(NO_ERROR) ;
+}
+
+GCA_STATS *
+GCAstatsRead(const char *fname)
+{
+  znzFile         file ;
+  GCA             *gca ;
+  GCA_STATS       *gs ;
+  GCA_PRIOR       *gcap ;
+  GCA_NODE_STATS  *gns ;
+  GCA_LABEL_STATS *ls ;
+  int             x, y, z, n, i, j, r, magic, version, ninputs, flags,
+                  prior_width, prior_height, prior_depth,
+                  node_width, node_height, node_depth, nlabels, nnbrs,
+                  label, count ;
+  float           prior_spacing, node_spacing, prior ;
+
+  file = znzopen(fname, "rb", strstr(fname, ".gz") != NULL) ;
+  if (znz_isnull(file))
+    ErrorReturn(NULL,
+                (ERROR_NOFILE, "GCAstatsRead(%s): could not open file",
+                 fname)) ;
+  if (!znzreadIntEx(&magic, file) || magic != GCA_STATS_MAGIC)
+  {
+    znzclose(file) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAstatsRead(%s): not a GCA statistics file", fname)) ;
+  }
+  version = znzreadInt(file) ;
+  if (version != GCA_STATS_VERSION)
+  {
+    znzclose(file) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAstatsRead(%s): version %d found, %d expected",
+                 fname, version, GCA_STATS_VERSION)) ;
+  }
+  ninputs = znzreadInt(file) ;
+  flags = znzreadInt(file) ;
+  prior_spacing = znzreadFloat(file) ;
+  node_spacing = znzreadFloat(file) ;
+  prior_width = znzreadInt(file) ;
+  prior_height = znzreadInt(file) ;
+  prior_depth = znzreadInt(file) ;
+  node_width = znzreadInt(file) ;
+  node_height = znzreadInt(file) ;
+  node_depth = znzreadInt(file) ;
+  gca = GCAalloc(ninputs, prior_spacing, node_spacing,
+                 node_spacing*node_width, node_spacing*node_height,
+                 node_spacing*node_depth, flags) ;
+  if (gca->prior_width != prior_width || gca->prior_height != prior_height ||
+      gca->prior_depth != prior_depth)
+  {
+    znzclose(file) ;
+    GCAfree(&gca) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAstatsRead(%s): inconsistent prior dimensions", fname)) ;
+  }
+  gca->type = znzreadInt(file) ;
+  gca->total_training = znzreadInt(file) ;
+  gca->max_label = znzreadInt(file) ;
+  for (r = 0 ; r < ninputs ; r++)
+  {
+    gca->TRs[r] = znzreadDouble(file) ;
+    gca->FAs[r] = znzreadDouble(file) ;
+    gca->TEs[r] = znzreadDouble(file) ;
+  }
+  gca->x_r = znzreadFloat(file) ;
+  gca->x_a = znzreadFloat(file) ;
+  gca->x_s = znzreadFloat(file) ;
+  gca->y_r = znzreadFloat(file) ;
+  gca->y_a = znzreadFloat(file) ;
+  gca->y_s = znzreadFloat(file) ;
+  gca->z_r = znzreadFloat(file) ;
+  gca->z_a = znzreadFloat(file) ;
+  gca->z_s = znzreadFloat(file) ;
+  gca->c_r = znzreadFloat(file) ;
+  gca->c_a = znzreadFloat(file) ;
+  gca->c_s = znzreadFloat(file) ;
+  gca->width = znzreadInt(file) ;
+  gca->height = znzreadInt(file) ;
+  gca->depth = znzreadInt(file) ;
+  gca->xsize = znzreadFloat(file) ;
+  gca->ysize = znzreadFloat(file) ;
+  gca->zsize = znzreadFloat(file) ;
+  GCAsetup(gca) ;
+
+  for (x = 0 ; x < gca->prior_width ; x++)
+  {
+    for (y = 0 ; y < gca->prior_height ; y++)
+    {
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        nlabels = znzreadInt(file) ;
+        gcap->total_training = znzreadInt(file) ;
+        for (n = 0 ; n < nlabels ; n++)
+        {
+          label = znzreadInt(file) ;
+          prior = znzreadFloat(file) ;
+          gcasUpdatePrior(gca, x, y, z, label, prior) ;
+        }
+      }
+    }
+  }
+
+  gs = GCAstatsAlloc(gca) ;
+  for (x = 0 ; x < gs->node_width ; x++)
+  {
+    for (y = 0 ; y < gs->node_height ; y++)
+    {
+      for (z = 0 ; z < gs->node_depth ; z++)
+      {
+        gns = &gs->nodes[x][y][z] ;
+        nlabels = znzreadInt(file) ;
+        for (n = 0 ; n < nlabels ; n++)
+        {
+          ls = gcasAddLabel(gs, gns, znzreadInt(file)) ;
+          ls->ntraining = znzreadInt(file) ;
+          ls->n_just_priors = znzreadInt(file) ;
+          ls->ncov = znzreadInt(file) ;
+          for (r = 0 ; r < 2*gs->ninputs+gs->ncovars ; r++)
+            ls->sums[r] = znzreadDouble(file) ;
+          ls->hole = znzreadInt(file) ;
+          if (ls->hole)
+          {
+            ls->hole_vals = (float *)calloc(gs->ninputs, sizeof(float)) ;
+            if (!ls->hole_vals)
+              ErrorExit(ERROR_NOMEMORY,
+                        "GCAstatsRead: could not allocate hole") ;
+            for (r = 0 ; r < gs->ninputs ; r++)
+              ls->hole_vals[r] = znzreadFloat(file) ;
+            for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+              ls->hole_nbrs[i] = znzreadInt(file) ;
+          }
+          if (flags & GCA_NO_MRF)
+            continue ;
+          for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          {
+            nnbrs = znzreadInt(file) ;
+            for (j = 0 ; j < nnbrs ; j++)
+            {
+              label = znzreadInt(file) ;
+              count = znzreadInt(file) ;
+              gcasAddNbrLabel(ls, i, label, count) ;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (znzeof(file))
+  {
+    znzclose(file) ;
+    GCAstatsFree(&gs) ;
+    ErrorReturn(NULL,
+                (ERROR_BADFILE, "GCAstatsRead(%s): file is truncated",
+                 fname)) ;
+  }
+  znzclose(file) ;
+  return(gs) ;
+}
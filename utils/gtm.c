@@ -643,7 +643,8 @@ int GTMfree(GTM **pGTM)
   MRIfree(&gtm->yvol);
   //MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
-  MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->X);
+  GTMsparseFree(&gtm->X0);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -769,7 +770,7 @@ int GTMsolve(GTM *gtm)
 
   if(! gtm->Optimizing) printf("Computing  XtX ... ");fflush(stdout);
   TimerStart(&timer);
-  gtm->XtX = MatrixMtM(gtm->X,gtm->XtX);
+  gtm->XtX = GTMsparseMtM(gtm->X,gtm->XtX);
   if(! gtm->Optimizing) printf(" %4.1f sec\n",TimerStop(&timer)/1000.0);fflush(stdout);
 
   gtm->iXtX = MatrixInverse(gtm->XtX,gtm->iXtX);
@@ -779,15 +780,15 @@ int GTMsolve(GTM *gtm)
     printf("ERROR: matrix cannot be inverted, cond=%g\n",gtm->XtXcond);
     return(1);
   }
-  gtm->Xty  = MatrixAtB(gtm->X,gtm->y,gtm->Xty);
+  gtm->Xty  = GTMsparseMtY(gtm->X,gtm->y,gtm->Xty);
   gtm->beta = MatrixMultiplyD(gtm->iXtX,gtm->Xty,gtm->beta);
   if(gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if(gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X,gtm->beta,gtm->yhat);
+  gtm->yhat = GTMsparseMultiply(gtm->X,gtm->beta,gtm->yhat);
   gtm->res  = MatrixSubtract(gtm->y,gtm->yhat,gtm->res);
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->X->nrows - gtm->X->ncols;
   if(gtm->rvar==NULL) gtm->rvar = MatrixAlloc(1,gtm->res->cols,MATRIX_REAL);
   if(gtm->rvarUnscaled==NULL) gtm->rvarUnscaled = MatrixAlloc(1,gtm->res->cols,MATRIX_REAL);
   for(f=0; f < gtm->res->cols; f++){
@@ -1284,9 +1285,9 @@ int GTMrbv0(GTM *gtm)
  */
 int GTMmgxpvc(GTM *gtm, int Target)
 {
-  int nthseg,segid,r,tt,f;
+  int nthseg,segid,r,tt,f,n;
   MATRIX *betaNotTarg, *yNotTarg, *ydiff;
-  double sum;
+  double sum, *ttsum;
 
   // Set beta values to 0 if they are not in the target tissue type(s)
   betaNotTarg = MatrixAlloc(gtm->beta->rows,gtm->beta->cols,MATRIX_REAL);
@@ -1301,21 +1302,26 @@ int GTMmgxpvc(GTM *gtm, int Target)
   }
 
   // Compute the estimate of the image without the target
-  yNotTarg = MatrixMultiplyD(gtm->X,betaNotTarg,NULL);
+  yNotTarg = GTMsparseMultiply(gtm->X,betaNotTarg,NULL);
   // Subtract to resdiualize the PET wrt the non-target tissue
   ydiff = MatrixSubtract(gtm->y,yNotTarg,NULL);
 
+  // Fraction of target tissue type in each voxel (row sum of X over
+  // the target columns)
+  ttsum = (double *) calloc(gtm->X->nrows,sizeof(double));
+  for(nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    segid = gtm->segidlist[nthseg];
+    tt = gtm->ctGTMSeg->entries[segid]->TissueType;
+    if(Target == 1 && tt != 1) continue;
+    if(Target == 2 && tt != 2) continue;
+    if(Target == 3 && tt != 1 && tt != 2) continue;
+    for(n=0; n < gtm->X->nnz[nthseg]; n++) 
+      ttsum[gtm->X->row[nthseg][n]] += gtm->X->val[nthseg][n];
+  }
+
   // Scale by the fraction of target tissue type in voxel
-  for(r=0; r < gtm->X->rows; r++){
-    sum = 0;
-    for(nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      segid = gtm->segidlist[nthseg];
-      tt = gtm->ctGTMSeg->entries[segid]->TissueType;
-      if(Target == 1 && tt != 1) continue;
-      if(Target == 2 && tt != 2) continue;
-      if(Target == 3 && tt != 1 && tt != 2) continue;
-      sum += gtm->X->rptr[r+1][nthseg+1];
-    }
+  for(r=0; r < gtm->X->nrows; r++){
+    sum = ttsum[r];
     if(sum < gtm->mgx_gmthresh)
       for(f=0; f < gtm->nframes; f++) ydiff->rptr[r+1][f+1] = 0;
     else
@@ -1326,6 +1332,7 @@ int GTMmgxpvc(GTM *gtm, int Target)
   if(Target == 2) gtm->mgx_subctx = GTMmat2vol(gtm, ydiff, NULL);
   if(Target == 3) gtm->mgx_gm     = GTMmat2vol(gtm, ydiff, NULL);
 
+  free(ttsum);
   MatrixFree(&betaNotTarg);
   MatrixFree(&yNotTarg);
   MatrixFree(&ydiff);
@@ -1549,7 +1556,7 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
     MRIcopyHeader(gtm->yvol,gtm->ysynth);
     MRIcopyPulseParameters(gtm->yvol,gtm->ysynth);
   }
-  yhat = MatrixMultiply(gtm->X0,gtm->beta,NULL);
+  yhat = GTMsparseMultiply(gtm->X0,gtm->beta,NULL);
   GTMmat2vol(gtm, yhat, gtm->ysynth);
   MatrixFree(&yhat);
 
@@ -1625,42 +1632,321 @@ int GTMcheckX(MATRIX *X)
 }
 /*------------------------------------------------------------------------------*/
 /*
-  \fn int GTMbuildX(GTM *gtm)
-  \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If 
-  gtm->DoVoxFracCor=1 then corrects for volume fraction effect.
+  \fn GTM_SPARSE *GTMsparseAlloc(int nrows, int ncols)
+  \brief Allocates an empty column-sparse GTM design matrix. The entries
+  of each column are allocated when the column is filled.
 */
-int GTMbuildX(GTM *gtm)
+GTM_SPARSE *GTMsparseAlloc(int nrows, int ncols)
 {
-  int nthseg,err;
-  struct timeb timer;
+  GTM_SPARSE *X;
+  int c;
+
+  X = (GTM_SPARSE *) calloc(sizeof(GTM_SPARSE),1);
+  X->nrows = nrows;
+  X->ncols = ncols;
+  X->nnz    = (int *)   calloc(ncols,sizeof(int));
+  X->row    = (int **)  calloc(ncols,sizeof(int *));
+  X->val    = (float **)calloc(ncols,sizeof(float *));
+  X->rowmin = (int *)   calloc(ncols,sizeof(int));
+  X->rowmax = (int *)   calloc(ncols,sizeof(int));
+  X->region = (MRI_REGION *) calloc(ncols,sizeof(MRI_REGION));
+  for(c=0; c < ncols; c++){
+    X->rowmin[c] = nrows;
+    X->rowmax[c] = -1;
+  }
+  return(X);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMsparseFree(GTM_SPARSE **pX)
+  \brief Frees a column-sparse GTM design matrix.
+*/
+int GTMsparseFree(GTM_SPARSE **pX)
+{
+  GTM_SPARSE *X = *pX;
+  int c;
+
+  if(X == NULL) return(0);
+  for(c=0; c < X->ncols; c++){
+    if(X->row[c]) free(X->row[c]);
+    if(X->val[c]) free(X->val[c]);
+  }
+  free(X->nnz);
+  free(X->row);
+  free(X->val);
+  free(X->rowmin);
+  free(X->rowmax);
+  free(X->region);
+  free(X);
+  *pX = NULL;
+  return(0);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn static int GTMsparseOverlap(GTM_SPARSE *A, int a, GTM_SPARSE *B, int b)
+  \brief Returns 1 if column a of A and column b of B can share a nonzero
+  row. Checks the row range first, then the voxel bounding boxes.
+*/
+static int GTMsparseOverlap(GTM_SPARSE *A, int a, GTM_SPARSE *B, int b)
+{
+  MRI_REGION *ra, *rb;
+
+  if(A->nnz[a] == 0 || B->nnz[b] == 0) return(0);
+  if(A->rowmax[a] < B->rowmin[b] || B->rowmax[b] < A->rowmin[a]) return(0);
+  ra = &A->region[a];
+  rb = &B->region[b];
+  if(ra->x + ra->dx <= rb->x || rb->x + rb->dx <= ra->x) return(0);
+  if(ra->y + ra->dy <= rb->y || rb->y + rb->dy <= ra->y) return(0);
+  if(ra->z + ra->dz <= rb->z || rb->z + rb->dz <= ra->z) return(0);
+  return(1);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn static double GTMsparseColDot(GTM_SPARSE *A, int a, GTM_SPARSE *B, int b)
+  \brief Dot product of column a of A with column b of B by merging their
+  sorted row lists.
+*/
+static double GTMsparseColDot(GTM_SPARSE *A, int a, GTM_SPARSE *B, int b)
+{
+  int i, j, na, nb, *rowa, *rowb;
+  float *vala, *valb;
+  double sum;
 
-  if(gtm->X==NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs){
-    // Alloc or realloc X
-    if(gtm->X) MatrixFree(&gtm->X);
-    gtm->X = MatrixAlloc(gtm->nmask,gtm->nsegs,MATRIX_REAL);
-    if(gtm->X == NULL){
-      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n",gtm->nmask,gtm->nsegs);
-      return(1);
+  na = A->nnz[a]; rowa = A->row[a]; vala = A->val[a];
+  nb = B->nnz[b]; rowb = B->row[b]; valb = B->val[b];
+  sum = 0;
+  i = 0; 
+  j = 0;
+  while(i < na && j < nb){
+    if(rowa[i] < rowb[j])      i++;
+    else if(rowa[i] > rowb[j]) j++;
+    else {
+      sum += ((double)vala[i]*valb[j]);
+      i++;
+      j++;
     }
   }
-  if(gtm->X0==NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs){
-    if(gtm->X0) MatrixFree(&gtm->X0);
-    gtm->X0 = MatrixAlloc(gtm->nmask,gtm->nsegs,MATRIX_REAL);
-    if(gtm->X0 == NULL){
-      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n",gtm->nmask,gtm->nsegs);
-      return(1);
+  return(sum);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMtN(GTM_SPARSE *A, GTM_SPARSE *B, MATRIX *AtB)
+  \brief Computes AtB = A'*B directly from the columns of A and B. Only
+  pairs of columns whose bounding boxes overlap are multiplied. If A==B, 
+  only the upper triangle is computed and then copied to the lower.
+*/
+MATRIX *GTMsparseMtN(GTM_SPARSE *A, GTM_SPARSE *B, MATRIX *AtB)
+{
+  int a;
+
+  if(A->nrows != B->nrows){
+    printf("ERROR: GTMsparseMtN(): row mismatch %d %d\n",A->nrows,B->nrows);
+    return(NULL);
+  }
+  if(AtB == NULL) AtB = MatrixAlloc(A->ncols,B->ncols,MATRIX_REAL);
+  if(AtB->rows != A->ncols || AtB->cols != B->ncols){
+    printf("ERROR: GTMsparseMtN(): output dimension mismatch\n");
+    return(NULL);
+  }
+
+  // Each a writes row a (and, when symmetric, column a below the
+  // diagonal) so the threads never write the same element
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(a=0; a < A->ncols; a++){
+    int b, b0;
+    double v;
+    b0 = 0;
+    if(A == B) b0 = a;
+    for(b=b0; b < B->ncols; b++){
+      if(GTMsparseOverlap(A,a,B,b)) v = GTMsparseColDot(A,a,B,b);
+      else                          v = 0;
+      AtB->rptr[a+1][b+1] = v;
+      if(A == B) AtB->rptr[b+1][a+1] = v;
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  return(AtB);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMtM(GTM_SPARSE *X, MATRIX *XtX)
+  \brief Computes XtX = X'*X for a column-sparse X. See GTMsparseMtN().
+*/
+MATRIX *GTMsparseMtM(GTM_SPARSE *X, MATRIX *XtX)
+{
+  return(GTMsparseMtN(X,X,XtX));
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMtY(GTM_SPARSE *X, MATRIX *y, MATRIX *Xty)
+  \brief Computes Xty = X'*y for a column-sparse X and a dense y
+  (nrows-by-nframes). Each column only touches the rows it stores.
+*/
+MATRIX *GTMsparseMtY(GTM_SPARSE *X, MATRIX *y, MATRIX *Xty)
+{
+  int c;
+
+  if(X->nrows != y->rows){
+    printf("ERROR: GTMsparseMtY(): row mismatch %d %d\n",X->nrows,y->rows);
+    return(NULL);
+  }
+  if(Xty == NULL) Xty = MatrixAlloc(X->ncols,y->cols,MATRIX_REAL);
+  if(Xty->rows != X->ncols || Xty->cols != y->cols){
+    printf("ERROR: GTMsparseMtY(): output dimension mismatch\n");
+    return(NULL);
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(c=0; c < X->ncols; c++){
+    int n, f;
+    double *sum;
+    float *yrow;
+    sum = (double *) calloc(y->cols,sizeof(double));
+    for(n=0; n < X->nnz[c]; n++){
+      yrow = y->rptr[X->row[c][n]+1];
+      for(f=0; f < y->cols; f++) sum[f] += ((double)X->val[c][n]*yrow[f+1]);
+    }
+    for(f=0; f < y->cols; f++) Xty->rptr[c+1][f+1] = sum[f];
+    free(sum);
+  }
+  return(Xty);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *beta, MATRIX *Xbeta)
+  \brief Computes Xbeta = X*beta for a column-sparse X and a dense beta
+  (ncols-by-nframes). Columns are accumulated in order within each frame,
+  so the result does not depend on the number of threads.
+*/
+MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *beta, MATRIX *Xbeta)
+{
+  int f;
+
+  if(X->ncols != beta->rows){
+    printf("ERROR: GTMsparseMultiply(): dimension mismatch %d %d\n",X->ncols,beta->rows);
+    return(NULL);
+  }
+  if(Xbeta == NULL) Xbeta = MatrixAlloc(X->nrows,beta->cols,MATRIX_REAL);
+  if(Xbeta->rows != X->nrows || Xbeta->cols != beta->cols){
+    printf("ERROR: GTMsparseMultiply(): output dimension mismatch\n");
+    return(NULL);
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for
+  #endif
+  for(f=0; f < beta->cols; f++){
+    int c, n;
+    double b, *sum;
+    sum = (double *) calloc(X->nrows,sizeof(double));
+    for(c=0; c < X->ncols; c++){
+      b = beta->rptr[c+1][f+1];
+      if(b == 0) continue;
+      for(n=0; n < X->nnz[c]; n++) sum[X->row[c][n]] += (b*X->val[c][n]);
+    }
+    for(n=0; n < X->nrows; n++) Xbeta->rptr[n+1][f+1] = sum[n];
+    free(sum);
+  }
+  return(Xbeta);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseToDense(GTM_SPARSE *X, MATRIX *D)
+  \brief Expands a column-sparse design matrix into a dense MATRIX. This
+  is only for saving X or for diagnostics; it can be very large.
+*/
+MATRIX *GTMsparseToDense(GTM_SPARSE *X, MATRIX *D)
+{
+  int c, n;
+
+  if(D == NULL) D = MatrixAlloc(X->nrows,X->ncols,MATRIX_REAL);
+  else          MatrixClear(D);
+  if(D == NULL){
+    printf("ERROR: GTMsparseToDense(): could not alloc %d %d\n",X->nrows,X->ncols);
+    return(NULL);
+  }
+  for(c=0; c < X->ncols; c++)
+    for(n=0; n < X->nnz[c]; n++) D->rptr[X->row[c][n]+1][c+1] = X->val[c][n];
+  return(D);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int *GTMrow2nthseg(GTM *gtm)
+  \brief Returns an array with the nthseg of each row of X (ie, each voxel
+  in the mask, in the same order as GTMbuildX()). Rows in segid=0 or in
+  a seg not in the list are set to -1.
+*/
+int *GTMrow2nthseg(GTM *gtm)
+{
+  int *row2seg, k, c, r, s, segid;
+
+  row2seg = (int *) calloc(gtm->nmask,sizeof(int));
+  k = 0;
+  for(s=0; s < gtm->yvol->depth; s++){
+    for(c=0; c < gtm->yvol->width; c++){
+      for(r=0; r < gtm->yvol->height; r++){
+	if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
+	segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
+	if(segid == 0) row2seg[k] = -1;
+	else           row2seg[k] = GTMsegid2nthseg(gtm,segid);
+	k++;
+      }
+    }
+  }
+  return(row2seg);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMbuildX(GTM *gtm)
+  \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If 
+  gtm->DoVoxFracCor=1 then corrects for volume fraction effect. X and X0 are
+  stored sparsely by column (see GTM_SPARSE); each column only keeps the
+  voxels inside the padded bounding box of its seg. Returns non-zero and
+  sets X=NULL on error.
+*/
+int GTMbuildX(GTM *gtm)
+{
+  int nthseg,err,k,c,r,s,nvox;
+  int *maskrow;
+  struct timeb timer;
+
+  GTMsparseFree(&gtm->X);
+  GTMsparseFree(&gtm->X0);
+  gtm->X = GTMsparseAlloc(gtm->nmask,gtm->nsegs);
+  if(! gtm->Optimizing) gtm->X0 = GTMsparseAlloc(gtm->nmask,gtm->nsegs);
+  gtm->dof = gtm->X->nrows - gtm->X->ncols;
 
   TimerStart(&timer);
 
+  // Map each voxel to its row in X, creating X in this order makes it
+  // consistent with matlab. Note: y must be ordered in the same way. See
+  // GTMvol2mat(). Voxels outside the mask get -1.
+  nvox = gtm->yvol->width*gtm->yvol->height*gtm->yvol->depth;
+  maskrow = (int *) calloc(nvox,sizeof(int));
+  k = 0;
+  for(s=0; s < gtm->yvol->depth; s++){
+    for(c=0; c < gtm->yvol->width; c++){
+      for(r=0; r < gtm->yvol->height; r++){
+	if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) {
+	  maskrow[r + c*gtm->yvol->height + s*gtm->yvol->height*gtm->yvol->width] = -1;
+	  continue;
+	}
+	maskrow[r + c*gtm->yvol->height + s*gtm->yvol->height*gtm->yvol->width] = k;
+	k++;
+      }
+    }
+  }
+
   err = 0;
   #ifdef _OPENMP
-  #pragma omp parallel for reduction(+:err)
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:err)
   #endif
   for(nthseg = 0; nthseg < gtm->nsegs; nthseg++){
-    int segid,k,c,r,s;
+    int segid,k,c,r,s,n,n0,nmax;
+    float v;
     MRI *nthsegpvf=NULL,*nthsegpvfbb=NULL,*nthsegpvfbbsm=NULL,*nthsegpvfbbsmmb=NULL;
     MRI_REGION *region;
     MB2D *mb;
@@ -1712,34 +1998,76 @@ int GTMbuildX(GTM *gtm)
       nthsegpvfbbsm = nthsegpvfbbsmmb;
       MB2Dfree(&mb);
     }
-    // Fill X, creating X in this order makes it consistent with matlab
-    // Note: y must be ordered in the same way. See GTMvol2mat()
-    k = 0;
-    for(s=0; s < gtm->yvol->depth; s++){
-      for(c=0; c < gtm->yvol->width; c++){
-	for(r=0; r < gtm->yvol->height; r++){
-	  if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	  k ++; // have to incr here in case continue below
-	  if(c < region->x || c >= region->x+region->dx)  continue;
-	  if(r < region->y || r >= region->y+region->dy)  continue;
-	  if(s < region->z || s >= region->z+region->dz)  continue;
-	  // do not use k+1 here because it has already been incr above
-	  if(! gtm->Optimizing)
-	    gtm->X0->rptr[k][nthseg+1] = 
-	      MRIgetVoxVal(nthsegpvfbb,c-region->x,r-region->y,s-region->z,0);
-
-	  gtm->X->rptr[k][nthseg+1] = 
-	    MRIgetVoxVal(nthsegpvfbbsm,c-region->x,r-region->y,s-region->z,0);
-
+    // Fill the column with the nonzero voxels in the bounding box. The box
+    // is scanned in the same s,c,r order as the rows so that the rows of
+    // the column come out sorted.
+    nmax = region->dx*region->dy*region->dz;
+    gtm->X->row[nthseg] = (int *)   calloc(nmax,sizeof(int));
+    gtm->X->val[nthseg] = (float *) calloc(nmax,sizeof(float));
+    if(gtm->X0){
+      gtm->X0->row[nthseg] = (int *)   calloc(nmax,sizeof(int));
+      gtm->X0->val[nthseg] = (float *) calloc(nmax,sizeof(float));
+    }
+    n = 0;
+    n0 = 0;
+    for(s=region->z; s < region->z+region->dz; s++){
+      for(c=region->x; c < region->x+region->dx; c++){
+	for(r=region->y; r < region->y+region->dy; r++){
+	  k = maskrow[r + c*gtm->yvol->height + s*gtm->yvol->height*gtm->yvol->width];
+	  if(k < 0) continue;
+	  if(gtm->X0){
+	    v = MRIgetVoxVal(nthsegpvfbb,c-region->x,r-region->y,s-region->z,0);
+	    if(v != 0){
+	      gtm->X0->row[nthseg][n0] = k;
+	      gtm->X0->val[nthseg][n0] = v;
+	      n0++;
+	    }
+	  }
+	  v = MRIgetVoxVal(nthsegpvfbbsm,c-region->x,r-region->y,s-region->z,0);
+	  if(v == 0) continue;
+	  gtm->X->row[nthseg][n] = k;
+	  gtm->X->val[nthseg][n] = v;
+	  n++;
 	}
       }
     }
+    gtm->X->nnz[nthseg] = n;
+    gtm->X->region[nthseg] = *region;
+    if(n > 0){
+      gtm->X->row[nthseg] = (int *)   realloc(gtm->X->row[nthseg],n*sizeof(int));
+      gtm->X->val[nthseg] = (float *) realloc(gtm->X->val[nthseg],n*sizeof(float));
+      gtm->X->rowmin[nthseg] = gtm->X->row[nthseg][0];
+      gtm->X->rowmax[nthseg] = gtm->X->row[nthseg][n-1];
+    }
+    if(gtm->X0){
+      gtm->X0->nnz[nthseg] = n0;
+      gtm->X0->region[nthseg] = *region;
+      if(n0 > 0){
+	gtm->X0->row[nthseg] = (int *)   realloc(gtm->X0->row[nthseg],n0*sizeof(int));
+	gtm->X0->val[nthseg] = (float *) realloc(gtm->X0->val[nthseg],n0*sizeof(float));
+	gtm->X0->rowmin[nthseg] = gtm->X0->row[nthseg][0];
+	gtm->X0->rowmax[nthseg] = gtm->X0->row[nthseg][n0-1];
+      }
+    }
+    free(region);
     MRIfree(&nthsegpvf);
     MRIfree(&nthsegpvfbb);
     MRIfree(&nthsegpvfbbsm);
   }
-  if(! gtm->Optimizing) printf(" Build time %6.4f, err = %d\n",TimerStop(&timer)/1000.0,err);fflush(stdout);
-  if(err) gtm->X = NULL;
+  free(maskrow);
+  if(! gtm->Optimizing) {
+    long nnz = 0;
+    for(nthseg = 0; nthseg < gtm->nsegs; nthseg++) nnz += gtm->X->nnz[nthseg];
+    printf(" Build time %6.4f, err = %d, nnz = %ld (%4.1f%% of dense)\n",
+	   TimerStop(&timer)/1000.0,err,nnz,
+	   100.0*nnz/((double)gtm->X->nrows*gtm->X->ncols+1));
+    fflush(stdout);
+  }
+  if(err) {
+    GTMsparseFree(&gtm->X);
+    GTMsparseFree(&gtm->X0);
+    return(1);
+  }
 
   return(0);
 
@@ -2549,36 +2877,27 @@ MRI **GTMlocal(GTM *gtm, MRI **pvc)
 */
 int GTMttPercent(GTM *gtm)
 {
-  int nTT,k,s,c,r,segid,nthseg,mthseg,mthsegid,tt;
+  int nTT,n,nthseg,mthseg,mthsegid,tt,*row2seg;
   double sum;
 
   nTT = gtm->ttpvf->nframes;
   if(gtm->ttpct != NULL) MatrixFree(&gtm->ttpct);
   gtm->ttpct = MatrixAlloc(gtm->nsegs,nTT,MATRIX_REAL);
 
-  // Must be done in same order as GTMbuildX()
-  k = 0;
-  for(s=0; s < gtm->yvol->depth; s++){
-    for(c=0; c < gtm->yvol->width; c++){
-      for(r=0; r < gtm->yvol->height; r++){
-	if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
-	k++; //have to do this here
-	if(segid == 0) continue;
-	for(nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-	  if(segid == gtm->segidlist[nthseg]) break;
-	for(mthseg = 0; mthseg < gtm->nsegs; mthseg++){
-	  mthsegid = gtm->segidlist[mthseg];
-	  tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
-	  //printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
-	  // k,segid,nthseg,mthsegid,mthseg,tt);
-	  fflush(stdout);
-	  gtm->ttpct->rptr[nthseg+1][tt] += //not tt+1
-	    (gtm->X->rptr[k][mthseg+1] * gtm->beta->rptr[mthseg+1][1]);
-	}
-      }
+  // Walk the stored entries of each column of X; the seg of each row
+  // must be in the same order as GTMbuildX()
+  row2seg = GTMrow2nthseg(gtm);
+  for(mthseg = 0; mthseg < gtm->nsegs; mthseg++){
+    mthsegid = gtm->segidlist[mthseg];
+    tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
+    for(n=0; n < gtm->X->nnz[mthseg]; n++){
+      nthseg = row2seg[gtm->X->row[mthseg][n]];
+      if(nthseg < 0) continue;
+      gtm->ttpct->rptr[nthseg+1][tt] += //not tt+1
+	(gtm->X->val[mthseg][n] * gtm->beta->rptr[mthseg+1][1]);
     }
   }
+  free(row2seg);
   
   for(nthseg = 0; nthseg < gtm->nsegs; nthseg++){
     sum = 0;
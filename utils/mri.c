@@ -29,7 +29,6 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 /*-----------------------------------------------------
   INCLUDE FILES
   -------------------------------------------------------*/
-#define USE_ELECTRIC_FENCE  1
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -1348,6 +1347,109 @@ inline int MRIsetVoxVal(MRI *mri, int c, int r, int s, int f, float voxval)
   }
   return(0);
 }
+/*-------------------------------------------------------------------*/
+/*!
+  \fn int MRIgetVoxValRow(const MRI *mri, int r, int s, int f, float *vals)
+  \brief Copies the mri->width voxels of row r, slice s, frame f into
+  vals as floats, with the same conversion as MRIgetVoxVal.
+  \return int - 0 if ok, 1 if mri->type is unrecognized.
+  The type is dispatched once per row instead of once per voxel, and
+  the row is read contiguously, so full-volume loops written as
+  slice/row loops around this are much faster than column/row/slice
+  loops around MRIgetVoxVal. Works on chunked volumes as well.
+*/
+int MRIgetVoxValRow(const MRI *mri, int r, int s, int f, float *vals)
+{
+  int  c, width ;
+  void *p ;
+
+  width = mri->width ;
+  p = mri->slices[s + f*mri->depth][r] ;
+  switch (mri->type)
+  {
+  case MRI_UCHAR:
+    for (c = 0 ; c < width ; c++)
+      vals[c] = (float)((unsigned char *)p)[c] ;
+    break;
+  case MRI_SHORT:
+    for (c = 0 ; c < width ; c++)
+      vals[c] = (float)((short *)p)[c] ;
+    break;
+  case MRI_INT:
+    for (c = 0 ; c < width ; c++)
+      vals[c] = (float)((int *)p)[c] ;
+    break;
+  case MRI_LONG:
+    // accessed as long32 or long depending on ischunked, so leave it
+    // to MRIgetVoxVal
+    for (c = 0 ; c < width ; c++)
+      vals[c] = MRIgetVoxVal(mri, c, r, s, f) ;
+    break;
+  case MRI_FLOAT:
+    memmove(vals, p, width*sizeof(float)) ;
+    break;
+  default:
+    return(1);
+  }
+  return(0);
+}
+/*-------------------------------------------------------------------*/
+/*!
+  \fn int MRIsetVoxValRow(MRI *mri, int r, int s, int f, const float *vals)
+  \brief Sets the mri->width voxels of row r, slice s, frame f from
+  vals, clipping and rounding like MRIsetVoxVal.
+  \return int - 0 if ok, 1 if mri->type is unrecognized.
+  See MRIgetVoxValRow().
+*/
+int MRIsetVoxValRow(MRI *mri, int r, int s, int f, const float *vals)
+{
+  int   c, width ;
+  void  *p ;
+  float v ;
+
+  width = mri->width ;
+  p = mri->slices[s + f*mri->depth][r] ;
+  switch (mri->type)
+  {
+  case MRI_UCHAR:
+    for (c = 0 ; c < width ; c++)
+    {
+      v = vals[c] ;
+      if (v < UCHAR_MIN) v = UCHAR_MIN;
+      if (v > UCHAR_MAX) v = UCHAR_MAX;
+      ((unsigned char *)p)[c] = nint(v) ;
+    }
+    break;
+  case MRI_SHORT:
+    for (c = 0 ; c < width ; c++)
+    {
+      v = vals[c] ;
+      if (v < SHORT_MIN) v = SHORT_MIN;
+      if (v > SHORT_MAX) v = SHORT_MAX;
+      ((short *)p)[c] = nint(v) ;
+    }
+    break;
+  case MRI_INT:
+    for (c = 0 ; c < width ; c++)
+    {
+      v = vals[c] ;
+      if (v < INT_MIN) v = INT_MIN;
+      if (v > INT_MAX) v = INT_MAX;
+      ((int *)p)[c] = nint(v) ;
+    }
+    break;
+  case MRI_LONG:
+    for (c = 0 ; c < width ; c++)
+      MRIsetVoxVal(mri, c, r, s, f, vals[c]) ;
+    break;
+  case MRI_FLOAT:
+    memmove(p, vals, width*sizeof(float)) ;
+    break;
+  default:
+    return(1);
+  }
+  return(0);
+}
 
 /*------------------------------------------------------------------
   MRIinterpCode() - returns the numeric interpolation code given the
@@ -5888,19 +5990,14 @@ MRIcloneRoi(MRI *mri_src, MRI *mri_dst)
   \fn int MRIchunk(MRI **pmri)
   \brief Change input MRI memory allocation to be "chunked".
   \return 0 on success, 1 if error
-  Has no effect if input is already chuncked
+  Has no effect if input is already chuncked. The voxels are always
+  allocated in one block, so this only marks the volume as chunked.
 */
 int MRIchunk(MRI **pmri)
 {
-  MRI *mritmp;
   if ((*pmri)->ischunked) return(0);
-  //printf("Chunking\n");
-  mritmp = MRIallocChunk((*pmri)->width, (*pmri)->height, (*pmri)->depth,
-                         (*pmri)->type, (*pmri)->nframes);
-  if (mritmp == NULL) return(1);
-  MRIcopy(*pmri, mritmp);
-  MRIfree(pmri);
-  *pmri = mritmp;
+  if ((*pmri)->chunk == NULL) return(1);
+  (*pmri)->ischunked = 1;
   return(0);
 }
 
@@ -6199,73 +6296,209 @@ MRIallocIndices(MRI *mri)
 
   return(NO_ERROR) ;
 }
-/*-----------------------------------------------------*/
-/*!
-\fn MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
-\brief Alloc pixel data in MRI struct as one big buffer.
-*/
-MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+/*-----------------------------------------------------
+  Voxel storage. All the voxels of an MRI live in one aligned block,
+  frame after frame, slice after slice and row after row, and
+  mri->chunk points to it; mri->slices[][] point into the block.
+
+  Freed blocks are kept in a small pool and handed out again to the
+  next volume that needs a block of the same size (and so of the same
+  dimensions and type, give or take a permutation), which saves the
+  allocation and the page faults of the many same-sized temporary
+  volumes of the registration and normalization code. The pool holds
+  at most FS_MRI_POOL_MB megabytes; it is off unless that is set.
+
+  Blocks are zeroed by all threads, each zeroing a contiguous range,
+  so that on NUMA machines the pages of a new block are spread over
+  the nodes of the threads that will work on them.
+  ------------------------------------------------------*/
+#define MRI_BLOCK_ALIGN      64
+#define MRI_POOL_SLOTS       16
+#define MRI_POOL_DEFAULT_MB  0
+#define MRI_ZERO_CHUNK       (256*1024)
+
+typedef struct
 {
-  MRI *mri ;
-  int  slice, row;
-  void *p;
+  void   *base ;   // as returned by malloc
+  size_t size ;    // usable size of the block
+} MRI_BLOCK_HEADER ;   // stored right before the block
+
+static void   *mri_pool[MRI_POOL_SLOTS] ;
+static int    mri_pool_n = 0 ;
+static size_t mri_pool_bytes = 0 ;
+static double mri_pool_max_bytes = -1 ;   // < 0 until FS_MRI_POOL_MB is read
 
-  if( sizeof(mri->bytes_total) != sizeof(size_t) ) {
-    fprintf( stderr, "%s: WARNING\nbytes_total is not a size_t\n",
-             __FUNCTION__ );
+static size_t
+mriBlockSize(void *block)
+{
+  return(((MRI_BLOCK_HEADER *)block)[-1].size) ;
+}
+
+static void
+mriZeroBlock(void *block, size_t size)
+{
+  long   i, nchunks ;
+
+  nchunks = (long)((size + MRI_ZERO_CHUNK - 1) / MRI_ZERO_CHUNK) ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (nchunks > 4) schedule(static)
+#endif
+  for (i = 0 ; i < nchunks ; i++)
+  {
+    size_t start = (size_t)i * MRI_ZERO_CHUNK ;
+    size_t len = size - start < MRI_ZERO_CHUNK ? size - start : MRI_ZERO_CHUNK ;
+    memset((char *)block + start, 0, len) ;
   }
+}
 
-  mris_alloced++ ;
+/* returns a zeroed block of size bytes, NULL if out of memory */
+static void *
+mriAllocBlock(size_t size)
+{
+  void             *block = NULL, *base ;
+  MRI_BLOCK_HEADER *hdr ;
+  int              i ;
 
-  if ((width <= 0) || (height <= 0) || (depth <= 0))
-    ErrorReturn(NULL,
-                (ERROR_BADPARM, "MRIallocChunk(%d, %d, %d): bad parm",
-                 width, height, depth)) ;
-  mri = MRIallocHeader(width, height, depth, type, nframes) ;
-  mri->nframes = nframes ;
-  MRIinitHeader(mri) ;
+#ifdef HAVE_OPENMP
+#pragma omp critical(mri_pool)
+#endif
+  {
+    for (i = mri_pool_n-1 ; i >= 0 ; i--)
+      if (mriBlockSize(mri_pool[i]) == size)
+      {
+        block = mri_pool[i] ;
+        mri_pool[i] = mri_pool[--mri_pool_n] ;
+        mri_pool_bytes -= size ;
+        break ;
+      }
+  }
 
-  // Allocate a big chunk of memory
-  mri->ischunked = 1;
-  mri->bytes_per_row   = mri->bytes_per_vox   * mri->width;
+  if (block == NULL)
+  {
+    base = malloc(size + sizeof(MRI_BLOCK_HEADER) + MRI_BLOCK_ALIGN) ;
+    if (base == NULL)
+      return(NULL) ;
+    block = (void *)(((size_t)base + sizeof(MRI_BLOCK_HEADER) +
+                      MRI_BLOCK_ALIGN - 1) & ~(size_t)(MRI_BLOCK_ALIGN - 1)) ;
+    hdr = (MRI_BLOCK_HEADER *)block - 1 ;
+    hdr->base = base ;
+    hdr->size = size ;
+  }
+
+  mriZeroBlock(block, size) ;
+  return(block) ;
+}
+
+static void
+mriFreeBlock(void *block)
+{
+  size_t size = mriBlockSize(block) ;
+  int    pooled = 0 ;
+  char   *cp ;
+
+#ifdef HAVE_OPENMP
+#pragma omp critical(mri_pool)
+#endif
+  {
+    if (mri_pool_max_bytes < 0)
+    {
+      cp = getenv("FS_MRI_POOL_MB") ;
+      mri_pool_max_bytes =
+        (cp ? atof(cp) : MRI_POOL_DEFAULT_MB) * 1024.0 * 1024.0 ;
+    }
+    if (mri_pool_n < MRI_POOL_SLOTS &&
+        mri_pool_bytes + size <= mri_pool_max_bytes)
+    {
+      mri_pool[mri_pool_n++] = block ;
+      mri_pool_bytes += size ;
+      pooled = 1 ;
+    }
+  }
+
+  if (!pooled)
+    free(((MRI_BLOCK_HEADER *)block)[-1].base) ;
+}
+
+/* allocates the voxels of mri and the slice and row pointers into them */
+static int
+mriAllocVoxels(MRI *mri)
+{
+  size_t  bytes_per_row ;
+  int     slice, row, nslices ;
+  BUFTYPE *p, **rows ;
+
+  switch (mri->type)
+  {
+  case MRI_BITMAP:
+    bytes_per_row = mri->width/8 ;
+    break ;
+  case MRI_UCHAR:
+    bytes_per_row = mri->width*sizeof(BUFTYPE) ;
+    break ;
+  case MRI_TENSOR:
+  case MRI_FLOAT:
+    bytes_per_row = mri->width*sizeof(float) ;
+    break ;
+  case MRI_INT:
+    bytes_per_row = mri->width*sizeof(int) ;
+    break ;
+  case MRI_SHORT:
+    bytes_per_row = mri->width*sizeof(short) ;
+    break ;
+  case MRI_LONG:
+    bytes_per_row = mri->width*sizeof(long) ;
+    break ;
+  default:
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MRIalloc(%d, %d, %d, type=%d): unknown type",
+                 mri->width, mri->height, mri->depth, mri->type)) ;
+    break ;
+  }
+
+  nslices = mri->depth*mri->nframes ;
+  mri->bytes_per_row   = bytes_per_row ;
   mri->bytes_per_slice = mri->bytes_per_row   * mri->height;
   mri->bytes_per_vol   = mri->bytes_per_slice * mri->depth;
   mri->bytes_total     = mri->bytes_per_vol   * mri->nframes;
-  mri->chunk = calloc(mri->bytes_total,1);
+  mri->chunk = mriAllocBlock(mri->bytes_total) ;
   if (mri->chunk == NULL)
-  {
-    printf("ERROR: MRIallocChunk(): could not alloc %lu\n",
-	   (unsigned long)mri->bytes_total);
-    return(NULL);
-  }
-  //printf("Allocing MRI with Chunk\n");
+    ErrorExit(ERROR_NO_MEMORY,
+              "MRIalloc(%d, %d, %d, %d): could not allocate %lu bytes\n",
+              mri->width, mri->height, mri->depth, mri->nframes,
+              (unsigned long)mri->bytes_total) ;
 
-  MRIallocIndices(mri) ;  // not sure what this does
-  mri->outside_val = 0 ;
-  mri->slices = (BUFTYPE ***)calloc(depth*nframes, sizeof(BUFTYPE **)) ;
-  if (!mri->slices)
+  mri->slices = (BUFTYPE ***)calloc(nslices, sizeof(BUFTYPE **)) ;
+  rows = (BUFTYPE **)calloc((size_t)nslices*mri->height, sizeof(BUFTYPE *)) ;
+  if (!mri->slices || !rows)
     ErrorExit(ERROR_NO_MEMORY,
-              "MRIalloc: could not allocate %d slices\n", mri->depth) ;
-
-  p = mri->chunk;
-  for (slice = 0 ; slice < depth*nframes ; slice++)
-  {
-    /* allocate pointer to array of rows */
-    mri->slices[slice] = (BUFTYPE **)calloc(mri->height, sizeof(BUFTYPE *)) ;
-    if (!mri->slices[slice])
-      ErrorExit
-      (ERROR_NO_MEMORY,
-       "MRIallocChunk(%d, %d, %d): could not allocate "
-       "%d bytes for %dth slice\n",
-       height, width, depth, mri->height*sizeof(BUFTYPE *), slice) ;
-    /* Instead of allocating each row, just point to the
-       correct location in the chunk. */
+              "MRIalloc: could not allocate %d slices\n", nslices) ;
+
+  p = (BUFTYPE *)mri->chunk ;
+  for (slice = 0 ; slice < nslices ; slice++)
+  {
+    mri->slices[slice] = rows + (size_t)slice*mri->height ;
     for (row = 0 ; row < mri->height ; row++)
     {
-      mri->slices[slice][row] = p;
-      p += mri->bytes_per_row;
+      mri->slices[slice][row] = p ;
+      p += bytes_per_row ;
     }
   }
+  return(NO_ERROR) ;
+}
+/*-----------------------------------------------------*/
+/*!
+\fn MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+\brief Alloc pixel data in MRI struct as one big buffer, and mark it as
+  chunked so that MRIgetVoxVal() and MRIsetVoxVal() address it directly.
+*/
+MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+{
+  MRI *mri ;
+
+  mri = MRIallocSequence(width, height, depth, type, nframes) ;
+  if (mri)
+    mri->ischunked = 1;
   return(mri) ;
 }
 /*-------------------------------------------------------------*/
@@ -6278,8 +6511,6 @@ MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
 MRI *MRIallocSequence(int width, int height, int depth, int type, int nframes)
 {
   MRI     *mri ;
-  int     slice, row, bpp;
-  BUFTYPE *buf ;
 
   mris_alloced++ ;
 
@@ -6292,115 +6523,14 @@ MRI *MRIallocSequence(int width, int height, int depth, int type, int nframes)
   mri->nframes = nframes ;
   MRIallocIndices(mri) ;
   mri->outside_val = 0 ;
-  mri->slices = (BUFTYPE ***)calloc(depth*nframes, sizeof(BUFTYPE **)) ;
-  if (!mri->slices)
-    ErrorExit(ERROR_NO_MEMORY,
-              "MRIallocSequence: could not allocate %d slices\n", mri->depth) ;
-
-  for (slice = 0 ; slice < depth*nframes ; slice++)
+  if (mriAllocVoxels(mri) != NO_ERROR)
   {
-    /* allocate pointer to array of rows */
-    mri->slices[slice] = (BUFTYPE **)calloc(mri->height, sizeof(BUFTYPE *)) ;
-    if (!mri->slices[slice])
-      ErrorExit
-      (ERROR_NO_MEMORY,
-       "MRIallocSequence(%d, %d, %d,%d): could not allocate "
-       "%d bytes for %dth slice\n",
-       height, width, depth, nframes, mri->height*sizeof(BUFTYPE *), slice) ;
-
-#if USE_ELECTRIC_FENCE
-    switch (mri->type)
-    {
-    case MRI_BITMAP:
-      bpp = 1 ;
-      break ;
-    case MRI_UCHAR:
-      bpp = 8 ;
-      break ;
-    case MRI_TENSOR:
-    case MRI_FLOAT:
-      bpp = sizeof(float) * 8 ;
-      break ;
-    case MRI_INT:
-      bpp = sizeof(int) * 8 ;
-      break ;
-    case MRI_SHORT:
-      bpp = sizeof(short) * 8 ;
-      break ;
-    case MRI_LONG:
-      bpp = sizeof(long) * 8 ;
-      break ;
-    default:
-      ErrorReturn(NULL,
-                  (ERROR_BADPARM,
-                   "MRIallocSequence(%d, %d, %d, type=%d): unknown type",
-                   width, height, depth, mri->type)) ;
-      break ;
-    }
-    bpp /= 8 ;
-    buf = (BUFTYPE *)calloc((mri->width*mri->height*bpp), 1) ;
-    if (buf == NULL)
-      ErrorExit
-      (ERROR_NO_MEMORY,
-       "MRIallocSequence(%d, %d, %d,%d): could not allocate "
-       "%d bytes for %dth slice\n",
-       height, width, depth, nframes, (mri->width*mri->height*bpp), slice) ;
-    for (row = 0 ; row < mri->height ; row++)
-    {
-      mri->slices[slice][row] = buf+(row*mri->width*bpp) ;
-    }
-#else
-    /* allocate each row */
-    for (row = 0 ; row < mri->height ; row++)
-    {
-      switch (mri->type)
-      {
-      case MRI_BITMAP:
-        mri->slices[slice][row] =
-          (BUFTYPE*)calloc(mri->width/8,sizeof(BUFTYPE));
-        break ;
-      case MRI_UCHAR:
-        mri->slices[slice][row] =
-          (BUFTYPE*)calloc(mri->width,sizeof(BUFTYPE));
-        break ;
-      case MRI_TENSOR:
-      case MRI_FLOAT:
-        mri->slices[slice][row] =
-          (BUFTYPE *)calloc(mri->width, sizeof(float));
-        break ;
-      case MRI_INT:
-        mri->slices[slice][row] =
-          (BUFTYPE *)calloc(mri->width, sizeof(int)) ;
-        break ;
-      case MRI_SHORT:
-        mri->slices[slice][row] =
-          (BUFTYPE *)calloc(mri->width, sizeof(short));
-        break ;
-      case MRI_LONG:
-        mri->slices[slice][row] =
-          (BUFTYPE *)calloc(mri->width, sizeof(long)) ;
-        break ;
-      default:
-        ErrorReturn(NULL,
-                    (ERROR_BADPARM,
-                     "MRIalloc(%d, %d, %d, type=%d): unknown type",
-                     width, height, depth, mri->type)) ;
-        break ;
-      }
-
-      if (!mri->slices[slice][row])
-        ErrorExit
-        (ERROR_NO_MEMORY,
-         "MRIallocSequence(%d,%d,%d,%d): could not allocate "
-         "%dth row in %dth slice\n",
-         width,height,depth, nframes, slice, row) ;
-    }
-#endif
+    MRIfree(&mri) ;
+    return(NULL) ;
   }
 
-  // Create chunked volume here. Not super efficient because
-  // must create a new volume, copy the old volume, the dealloc
-  // the old. But it assure that all the above is done.
+  // The voxels are always in one chunk, this only decides whether
+  // MRIgetVoxVal() and MRIsetVoxVal() address the chunk directly.
   // To activate chunking setenv FS_USE_MRI_CHUNK 1
   // to deactivate: unsetenv FS_USE_MRI_CHUNK or setenv FS_USE_MRI_CHUNK 0 
   // Set it to anything other than 1
@@ -6496,7 +6626,7 @@ MRI *MRIallocHeader(int width, int height, int depth, int type, int nframes)
 
   // These things are explicitly set to 0 here because we
   // do not yet know the true number of frames, and they
-  // are set in MRIallocChunk().
+  // are set when the voxels are allocated.
   mri->bytes_per_row   = 0;
   mri->bytes_per_slice = 0;
   mri->bytes_per_vol   = 0;
@@ -6528,10 +6658,7 @@ int
 MRIfree(MRI **pmri)
 {
   MRI *mri ;
-  int slice, i ;
-#if !USE_ELECTRIC_FENCE
-  int  row ;
-#endif
+  int i ;
 
   mris_alloced-- ;
   mri = *pmri ;
@@ -6550,34 +6677,15 @@ MRIfree(MRI **pmri)
   if (mri->yi)    free(mri->yi-MAX_INDEX) ;
   if (mri->zi)    free(mri->zi-MAX_INDEX) ;
 
-  if (!mri->ischunked)
+  if (mri->slices)
   {
-    if (mri->slices)
-    {
-      for (slice = 0 ; slice < mri->depth*mri->nframes ; slice++)
-      {
-        if (mri->slices[slice])
-        {
-#if USE_ELECTRIC_FENCE
-          free(mri->slices[slice][0]) ;
-#else
-          for (row = 0 ; row < mri->height ; row++)
-            free(mri->slices[slice][row]) ;
-#endif
-          free(mri->slices[slice]) ;
-        }
-      }
-      free(mri->slices) ;
-    }
+    free(mri->slices[0]) ;   // the row pointers of all slices
+    free(mri->slices) ;
   }
-  else
+  if (mri->chunk)
   {
-    //printf("Freeing MRI Chunk\n");
-    free(mri->chunk);
+    mriFreeBlock(mri->chunk) ;
     mri->chunk = NULL;
-    for(slice = 0 ; slice < mri->depth*mri->nframes ; slice++)
-        if(mri->slices[slice]) free(mri->slices[slice]) ;
-    free(mri->slices) ;
   }
 
   if (mri->free_transform)
@@ -6611,38 +6719,19 @@ MRIfree(MRI **pmri)
 /*!
   \fn MRIfreeFrames(MRI *mri, int start_frame)
   \brief Frees frames of the mri struct starting at start_frame.
-  Cannot be run on mri struct with chunked mem management.
+  The frames share one block with the others, which is released by
+  MRIfree(), so they are only dropped from the volume.
 */
 int MRIfreeFrames(MRI *mri, int start_frame)
 {
-  int slice, row, end_frame ;
+  int end_frame ;
 
-  if (mri->ischunked)
-  {
-    printf("WARNING: MRIfreeFrames(): cannot free frames "
-           "from chunked memory\n");
-    return(1);
-  }
-
-  end_frame = mri->nframes-1 ;
   if (!mri)
     ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRIfreeFrames: null pointer\n")) ;
-
-  if (mri->slices)
-  {
-    for (slice = start_frame*mri->depth ;
-         slice < mri->depth*end_frame ; slice++)
-    {
-      if (mri->slices[slice])
-      {
-        for (row = 0 ; row < mri->height ; row++)
-          free(mri->slices[slice][row]) ;
-        free(mri->slices[slice]) ;
-      }
-    }
-  }
+  end_frame = mri->nframes-1 ;
 
   mri->nframes -= (end_frame-start_frame+1) ;
+  mri->bytes_total = mri->bytes_per_vol * mri->nframes ;
   return(NO_ERROR) ;
 }
 /*-----------------------------------------------------*/
@@ -12381,23 +12470,231 @@ MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA)
   mri_dst = MRIlinearTransformInterp(mri_src, mri_dst, mA, SAMPLE_TRILINEAR);
   return(mri_dst);
 }
+/*-------------------------------------------------------------------
+  Resampling engine used by MRIlinearTransformInterp(). The source
+  coordinates of a row of output voxels are an affine function of
+  the column, so each row is computed from its start point and the
+  per-column step, and all frames of a location are sampled together.
+  The nearest and trilinear kernels below are expanded once per voxel
+  type by the macros so there is no type switch in the inner loop;
+  they reproduce MRIsampleVolumeFrameType() and MRIsampleVolumeFrame().
+  ------------------------------------------------------------------*/
+#define MRI_RESAMPLE_NEAREST_ROW(fname, TYPE)                              \
+static void                                                              \
+fname(const MRI *mri, const double *p0, const double *dp, int width,     \
+      int nframes, double *vals)                                         \
+{                                                                        \
+  int    i, f, xv, yv, zv ;                                              \
+  double x, y, z ;                                                       \
+                                                                         \
+  for (i = 0 ; i < width ; i++, vals += nframes)                         \
+  {                                                                      \
+    x = p0[0] + i*dp[0] ; y = p0[1] + i*dp[1] ; z = p0[2] + i*dp[2] ;    \
+    if (MRIindexNotInVolume(mri, x, y, z) == 1)                          \
+    {                                                                    \
+      for (f = 0 ; f < nframes ; f++)                                    \
+        vals[f] = mri->outside_val ;                                     \
+      continue ;                                                         \
+    }                                                                    \
+    xv = nint(x) ; yv = nint(y) ; zv = nint(z) ;                         \
+    xv = MAX(0, MIN(mri->width-1, xv)) ;                                 \
+    yv = MAX(0, MIN(mri->height-1, yv)) ;                                \
+    zv = MAX(0, MIN(mri->depth-1, zv)) ;                                 \
+    for (f = 0 ; f < nframes ; f++)                                      \
+      vals[f] = (double)((TYPE *)mri->slices[zv+f*mri->depth][yv])[xv] ; \
+  }                                                                      \
+}
+
+#define MRI_RESAMPLE_TRILINEAR_ROW(fname, TYPE)                            \
+static void                                                              \
+fname(const MRI *mri, const double *p0, const double *dp, int width,     \
+      int nframes, double *vals)                                         \
+{                                                                        \
+  int    i, f, xm, xp, ym, yp, zm, zp ;                                  \
+  double x, y, z, xmd, ymd, zmd, xpd, ypd, zpd ;                         \
+  TYPE   *pmm, *pmp, *ppm, *ppp ;                                        \
+                                                                         \
+  for (i = 0 ; i < width ; i++, vals += nframes)                         \
+  {                                                                      \
+    x = p0[0] + i*dp[0] ; y = p0[1] + i*dp[1] ; z = p0[2] + i*dp[2] ;    \
+    if (MRIindexNotInVolume(mri, x, y, z) == 1)                          \
+    {                                                                    \
+      for (f = 0 ; f < nframes ; f++)                                    \
+        vals[f] = mri->outside_val ;                                     \
+      continue ;                                                         \
+    }                                                                    \
+    if (FEQUAL((int)x,x) && FEQUAL((int)y,y) && FEQUAL((int)z, z))       \
+    {                                                                    \
+      xm = MAX(0, MIN(mri->width-1, nint(x))) ;                          \
+      ym = MAX(0, MIN(mri->height-1, nint(y))) ;                         \
+      zm = MAX(0, MIN(mri->depth-1, nint(z))) ;                          \
+      for (f = 0 ; f < nframes ; f++)                                    \
+        vals[f] = (double)((TYPE *)mri->slices[zm+f*mri->depth][ym])[xm];\
+      continue ;                                                         \
+    }                                                                    \
+    if (x >= mri->width)  x = mri->width - 1.0 ;                         \
+    if (y >= mri->height) y = mri->height - 1.0 ;                        \
+    if (z >= mri->depth)  z = mri->depth - 1.0 ;                         \
+    if (x < 0.0) x = 0.0 ;                                               \
+    if (y < 0.0) y = 0.0 ;                                               \
+    if (z < 0.0) z = 0.0 ;                                               \
+    xm = MAX((int)x, 0) ; xp = MIN(mri->width-1, xm+1) ;                 \
+    ym = MAX((int)y, 0) ; yp = MIN(mri->height-1, ym+1) ;                \
+    zm = MAX((int)z, 0) ; zp = MIN(mri->depth-1, zm+1) ;                 \
+    xmd = x - (float)xm ; ymd = y - (float)ym ; zmd = z - (float)zm ;    \
+    xpd = (1.0f - xmd) ; ypd = (1.0f - ymd) ; zpd = (1.0f - zmd) ;       \
+    for (f = 0 ; f < nframes ; f++)                                      \
+    {                                                                    \
+      pmm = (TYPE *)mri->slices[zm+f*mri->depth][ym] ;                   \
+      pmp = (TYPE *)mri->slices[zp+f*mri->depth][ym] ;                   \
+      ppm = (TYPE *)mri->slices[zm+f*mri->depth][yp] ;                   \
+      ppp = (TYPE *)mri->slices[zp+f*mri->depth][yp] ;                   \
+      vals[f] =                                                          \
+        xpd * ypd * zpd * (double)pmm[xm] +                              \
+        xpd * ypd * zmd * (double)pmp[xm] +                              \
+        xpd * ymd * zpd * (double)ppm[xm] +                              \
+        xpd * ymd * zmd * (double)ppp[xm] +                              \
+        xmd * ypd * zpd * (double)pmm[xp] +                              \
+        xmd * ypd * zmd * (double)pmp[xp] +                              \
+        xmd * ymd * zpd * (double)ppm[xp] +                              \
+        xmd * ymd * zmd * (double)ppp[xp] ;                              \
+    }                                                                    \
+  }                                                                      \
+}
+
+MRI_RESAMPLE_NEAREST_ROW(mriResampleRowNearestUCHAR, BUFTYPE)
+MRI_RESAMPLE_NEAREST_ROW(mriResampleRowNearestSHORT, short)
+MRI_RESAMPLE_NEAREST_ROW(mriResampleRowNearestINT, int)
+MRI_RESAMPLE_NEAREST_ROW(mriResampleRowNearestLONG, long32)
+MRI_RESAMPLE_NEAREST_ROW(mriResampleRowNearestFLOAT, float)
+MRI_RESAMPLE_TRILINEAR_ROW(mriResampleRowTrilinearUCHAR, BUFTYPE)
+MRI_RESAMPLE_TRILINEAR_ROW(mriResampleRowTrilinearSHORT, short)
+MRI_RESAMPLE_TRILINEAR_ROW(mriResampleRowTrilinearINT, int)
+MRI_RESAMPLE_TRILINEAR_ROW(mriResampleRowTrilinearLONG, long32)
+MRI_RESAMPLE_TRILINEAR_ROW(mriResampleRowTrilinearFLOAT, float)
+
+typedef void (*MRI_RESAMPLE_ROW_FUNC)(const MRI *mri, const double *p0, const double *dp,
+                                      int width, int nframes, double *vals) ;
+
+static MRI_RESAMPLE_ROW_FUNC
+mriResampleRowFunc(int type, int InterpMethod)
+{
+  if (InterpMethod == SAMPLE_NEAREST) switch (type)
+  {
+  case MRI_UCHAR: return(mriResampleRowNearestUCHAR) ;
+  case MRI_SHORT: return(mriResampleRowNearestSHORT) ;
+  case MRI_INT:   return(mriResampleRowNearestINT) ;
+  case MRI_LONG:  return(mriResampleRowNearestLONG) ;
+  case MRI_FLOAT: return(mriResampleRowNearestFLOAT) ;
+  }
+  else if (InterpMethod == SAMPLE_TRILINEAR) switch (type)
+  {
+  case MRI_UCHAR: return(mriResampleRowTrilinearUCHAR) ;
+  case MRI_SHORT: return(mriResampleRowTrilinearSHORT) ;
+  case MRI_INT:   return(mriResampleRowTrilinearINT) ;
+  case MRI_LONG:  return(mriResampleRowTrilinearLONG) ;
+  case MRI_FLOAT: return(mriResampleRowTrilinearFLOAT) ;
+  }
+  return(NULL) ;
+}
+
+/* cubic B-spline and sinc sample point by point, but still share the
+   row stepping and the per-location frame loop */
+static void
+mriResampleRowGeneric(MRI *mri, MRI_BSPLINE *bspline, int InterpMethod,
+                      const double *p0, const double *dp, int width,
+                      int nframes, double *vals)
+{
+  int    i, f ;
+  double x, y, z, val ;
+
+  for (i = 0 ; i < width ; i++, vals += nframes)
+  {
+    x = p0[0] + i*dp[0] ; y = p0[1] + i*dp[1] ; z = p0[2] + i*dp[2] ;
+    for (f = 0 ; f < nframes ; f++)
+    {
+      val = 0 ;
+      if (bspline)
+        MRIsampleBSpline(bspline, x, y, z, f, &val);
+      else if (InterpMethod == SAMPLE_SINC)
+      {
+        if (MRIindexNotInVolume(mri, x, y, z) == 1)
+          val = mri->outside_val ;
+        else
+          MRIsincSampleVolumeFrame(mri, x, y, z, f, 5, &val) ;
+      }
+      else
+        MRIsampleVolumeFrameType(mri, x, y, z, f, InterpMethod, &val);
+      vals[f] = val ;
+    }
+  }
+}
+
+/* store a row of samples with the same rounding and clipping as MRIsetVoxVal() */
+static void
+mriResampleStoreRow(MRI *mri, int y, int z, int width, int nframes, const double *vals)
+{
+  int   x, f ;
+  float val ;
+
+  for (f = 0 ; f < nframes ; f++)
+  {
+    switch (mri->type)
+    {
+    case MRI_UCHAR:
+    {
+      BUFTYPE *pdst = &MRIseq_vox(mri, 0, y, z, f) ;
+      for (x = 0 ; x < width ; x++)
+      {
+        val = vals[x*nframes+f] ;
+        pdst[x] = nint(MAX(UCHAR_MIN, MIN(UCHAR_MAX, val))) ;
+      }
+      break ;
+    }
+    case MRI_SHORT:
+    {
+      short *pdst = &MRISseq_vox(mri, 0, y, z, f) ;
+      for (x = 0 ; x < width ; x++)
+      {
+        val = vals[x*nframes+f] ;
+        pdst[x] = nint(MAX(SHORT_MIN, MIN(SHORT_MAX, val))) ;
+      }
+      break ;
+    }
+    case MRI_FLOAT:
+    {
+      float *pdst = &MRIFseq_vox(mri, 0, y, z, f) ;
+      for (x = 0 ; x < width ; x++)
+        pdst[x] = vals[x*nframes+f] ;
+      break ;
+    }
+    default:
+      for (x = 0 ; x < width ; x++)
+        MRIsetVoxVal(mri, x, y, z, f, vals[x*nframes+f]) ;
+      break ;
+    }
+  }
+}
+
 /*-------------------------------------------------------------------
   MRIlinearTransformInterp() Perform linear coordinate transformation
   x' = Ax on the MRI image mri_src into mri_dst using the specified
-  interpolation method. A is a voxel-to-voxel transform.
+  interpolation method. A is a voxel-to-voxel transform. Slices of the
+  output are resampled in parallel.
   ------------------------------------------------------------------*/
 MRI *
 MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
                          int InterpMethod)
 {
-  int    y1, y2, y3, width, height, depth,frame ;
-  VECTOR *v_X, *v_Y ;   /* original and transformed coordinate systems */
+  int    y3, width, height, depth, nframes, r, c ;
   MATRIX *mAinv ;     /* inverse of mA */
-  double   val, x1, x2, x3 ;
+  double A[3][4] ;    /* dst voxel -> src voxel */
+  MRI_RESAMPLE_ROW_FUNC row_func ;
 
   if (InterpMethod != SAMPLE_NEAREST &&
       InterpMethod != SAMPLE_TRILINEAR &&
-      InterpMethod != SAMPLE_CUBIC_BSPLINE )
+      InterpMethod != SAMPLE_CUBIC_BSPLINE &&
+      InterpMethod != SAMPLE_SINC)
   {
     printf("ERROR: MRIlinearTransformInterp: unrecognized or unsupported interpolation "
            "method %d\n",InterpMethod);
@@ -12407,6 +12704,10 @@ MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
   if (!mAinv)
     ErrorReturn(NULL, (ERROR_BADPARM,
                        "MRIlinearTransform: xform is singular")) ;
+  for (r = 0 ; r < 3 ; r++)
+    for (c = 0 ; c < 4 ; c++)
+      A[r][c] = *MATRIX_RELT(mAinv, r+1, c+1) ;
+  MatrixFree(&mAinv) ;
 
   if (!mri_dst)
     mri_dst = MRIclone(mri_src, NULL) ;
@@ -12421,90 +12722,45 @@ MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
     
   MRI_BSPLINE * bspline = NULL;
   if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
+    // recommended to externally call this and keep mri_coeff
+    // if image is resampled often (e.g. in registration algo)
     bspline = MRItoBSpline(mri_src,NULL,3);
+  row_func = mriResampleRowFunc(mri_src->type, InterpMethod) ;
 
   width  = mri_dst->width ;
   height = mri_dst->height ;
   depth  = mri_dst->depth ;
-  v_X = VectorAlloc(4, MATRIX_REAL) ;  /* input (src) coordinates */
-  v_Y = VectorAlloc(4, MATRIX_REAL) ;  /* transformed (dst) coordinates */
+  nframes = MIN(mri_src->nframes, mri_dst->nframes) ;
 
-  v_Y->rptr[4][1] = 1.0f ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for shared(A, bspline, row_func, mri_src, mri_dst) schedule(dynamic,1)
+#endif
   for (y3 = 0 ; y3 < depth ; y3++)
   {
-    V3_Z(v_Y) = y3 ;
+    int    y2 ;
+    double p0[3], dp[3], *vals ;
+
+    vals = (double *)calloc(width*nframes, sizeof(double)) ;
+    if (vals == NULL)
+      ErrorExit(ERROR_NOMEMORY, "MRIlinearTransformInterp: could not allocate row buffer") ;
+    dp[0] = A[0][0] ; dp[1] = A[1][0] ; dp[2] = A[2][0] ;
     for (y2 = 0 ; y2 < height ; y2++)
     {
-      V3_Y(v_Y) = y2 ;
-      for (y1 = 0 ; y1 < width ; y1++)
-      {
-        V3_X(v_Y) = y1 ;
-        MatrixMultiply(mAinv, v_Y, v_X) ;
-
-        x1 = V3_X(v_X) ;
-        x2 = V3_Y(v_X) ;
-        x3 = V3_Z(v_X) ;
-
-        if (nint(y1) == Gx && nint(y2) == Gy && nint(y3) == Gz)
-          DiagBreak() ;
-        if (nint(x1) == Gx && nint(x2) == Gy && nint(x3) == Gz)
-        {
-#if 0
-          fprintf
-          (stderr,
-           "(%2.1f, %2.1f, %2.1f) --> (%2.1f, %2.1f, %2.1f)\n",
-           (float)x1, (float)x2, (float)x3,
-           (float)y1, (float)y2, (float)y3) ;
-#endif
-          DiagBreak() ;
-        }
-
-        //MRIsampleVolume(mri_src, x1, x2, x3, &val);
-        for (frame = 0 ; frame < mri_src->nframes ; frame++)
-        {
-          if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
-            // recommended to externally call this and keep mri_coeff
-            // if image is resampled often (e.g. in registration algo)
-            MRIsampleBSpline(bspline, x1, x2, x3, frame, &val);
-          else
-            MRIsampleVolumeFrameType(mri_src, x1, x2, x3, 
-                                     frame, InterpMethod, &val);
-
-          // will clip the val according to mri_dst type:
-          MRIsetVoxVal(mri_dst, y1, y2, y3, frame, val) ;
+      // source coords of the first voxel in the row, then step by the first column of A
+      p0[0] = A[0][1]*y2 + A[0][2]*y3 + A[0][3] ;
+      p0[1] = A[1][1]*y2 + A[1][2]*y3 + A[1][3] ;
+      p0[2] = A[2][1]*y2 + A[2][2]*y3 + A[2][3] ;
+      if (row_func)
+        row_func(mri_src, p0, dp, width, nframes, vals) ;
+      else
+        mriResampleRowGeneric(mri_src, bspline, InterpMethod, p0, dp, width, nframes, vals) ;
 
-#if 0
-          // if this gets ever enabled, don't forget to clip val to type...
-          switch (mri_dst->type)
-          {
-          case MRI_UCHAR:
-            MRIvox(mri_dst,y1,y2,y3) = (BUFTYPE)nint(val) ;
-          break ;
-          case MRI_SHORT:
-            MRISvox(mri_dst,y1,y2,y3) = (short)nint(val) ;
-            break ;
-          case MRI_FLOAT:
-            MRIFvox(mri_dst,y1,y2,y3) = (float)(val) ;
-            break ;
-          case MRI_INT:
-            MRIIvox(mri_dst,y1,y2,y3) = nint(val) ;
-            break ;
-          default:
-            ErrorReturn(NULL,
-                        (ERROR_UNSUPPORTED,
-                         "MRIlinearTransform: unsupported dst type %d",
-                         mri_dst->type)) ;
-            break ;
-          }
-#endif
-        }
-      }
+      // will clip the val according to mri_dst type:
+      mriResampleStoreRow(mri_dst, y2, y3, width, nframes, vals) ;
     }
+    free(vals) ;
   }
   if (bspline) MRIfreeBSpline(&bspline);
-  MatrixFree(&v_X) ;
-  MatrixFree(&mAinv) ;
-  MatrixFree(&v_Y) ;
 
   mri_dst->ras_good_flag = 1;
 
@@ -17175,9 +17431,311 @@ char *MRIsliceDirectionName(MRI *mri)
   return(rtstr);
 }
 
+/*
+  Exact Euclidean distance transform (Felzenszwalb & Huttenlocher,
+  "Distance Transforms of Sampled Functions"). The squared distance is
+  separable, so it is computed with three passes of a 1-D lower
+  envelope of parabolas, one per axis, each weighted by the voxel size
+  along that axis. Every pass is linear in the number of voxels and the
+  lines within a pass are independent.
+*/
+#define EDT_INF 1e20f
+
+static int dtrans_engine = -1 ;
+
+int
+MRIsetDistanceTransformEngine(int engine)
+{
+  int old_engine = MRIgetDistanceTransformEngine() ;
+
+  if (engine != DTRANS_ENGINE_FASTMARCHING && engine != DTRANS_ENGINE_EDT)
+    ErrorReturn(old_engine,
+                (ERROR_BADPARM,
+                 "MRIsetDistanceTransformEngine: unknown engine %d", engine)) ;
+  dtrans_engine = engine ;
+  return(old_engine) ;
+}
+
+int
+MRIgetDistanceTransformEngine(void)
+{
+  char *cp ;
+
+  if (dtrans_engine < 0)
+  {
+    dtrans_engine = DTRANS_ENGINE_FASTMARCHING ;
+    cp = getenv("FS_DTRANS_ENGINE") ;
+    if (cp != NULL && (!stricmp(cp, "edt") || !strcmp(cp, "1")))
+      dtrans_engine = DTRANS_ENGINE_EDT ;
+  }
+  return(dtrans_engine) ;
+}
+
+/*
+  squared distance transform of the sampled function f[0..n-1] with
+  sample spacing h. Entries >= EDT_INF are not sites. v, z and d are
+  scratch arrays of n, n+1 and n elements.
+*/
+static void
+mriEDT1D(float *f, int n, double h, int *v, double *z, float *d)
+{
+  int    q, k, p ;
+  double s ;
+
+  k = -1 ;
+  for (q = 0 ; q < n ; q++)
+  {
+    if (f[q] >= EDT_INF)
+      continue ;
+    if (k < 0)
+    {
+      k = 0 ;
+      v[0] = q ;
+      z[0] = -EDT_INF ;
+      z[1] = EDT_INF ;
+      continue ;
+    }
+    for (;;)
+    {
+      p = v[k] ;
+      s = ((f[q] + SQR(q*h)) - (f[p] + SQR(p*h))) / (2.0*h*(q-p)) ;
+      if (s <= z[k])
+        k-- ;   /* z[0] is -inf so this terminates with k >= 0 */
+      else
+        break ;
+    }
+    k++ ;
+    v[k] = q ;
+    z[k] = s ;
+    z[k+1] = EDT_INF ;
+  }
+  if (k < 0)    /* no sites on this line */
+    return ;
+
+  for (k = 0, q = 0 ; q < n ; q++)
+  {
+    while (z[k+1] < q*h)
+      k++ ;
+    d[q] = SQR((q-v[k])*h) + f[v[k]] ;
+  }
+  memmove(f, d, n*sizeof(float)) ;
+}
+
+/*
+  squared distance (mm^2) from every voxel to the nearest voxel with
+  (label == label) == site_is_label. d2 must hold width*height*depth
+  floats, x fastest.
+*/
+static void
+mriEDTsquared(MRI *mri_src, int label, int site_is_label, float *d2)
+{
+  int    width, height, depth, nmax, slice, row ;
+  long   wh ;
+
+  width = mri_src->width ;
+  height = mri_src->height ;
+  depth = mri_src->depth ;
+  wh = (long)width*height ;
+  nmax = MAX(MAX(width, height), depth) ;
+
+  /* x pass, initializing the sites from the label volume */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (slice = 0 ; slice < depth ; slice++)
+  {
+    int    x, y, *v ;
+    double *zb ;
+    float  *d, *f ;
+
+    v = (int *)calloc(nmax, sizeof(int)) ;
+    zb = (double *)calloc(nmax+1, sizeof(double)) ;
+    d = (float *)calloc(nmax, sizeof(float)) ;
+    for (y = 0 ; y < height ; y++)
+    {
+      f = d2 + slice*wh + (long)y*width ;
+      for (x = 0 ; x < width ; x++)
+        f[x] = ((nint(MRIgetVoxVal(mri_src, x, y, slice, 0)) == label) ==
+                site_is_label) ? 0 : EDT_INF ;
+      mriEDT1D(f, width, mri_src->xsize, v, zb, d) ;
+    }
+    free(v) ; free(zb) ; free(d) ;
+  }
+
+  /* y pass */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (slice = 0 ; slice < depth ; slice++)
+  {
+    int    x, y, *v ;
+    double *zb ;
+    float  *d, *f ;
+
+    v = (int *)calloc(nmax, sizeof(int)) ;
+    zb = (double *)calloc(nmax+1, sizeof(double)) ;
+    d = (float *)calloc(nmax, sizeof(float)) ;
+    f = (float *)calloc(nmax, sizeof(float)) ;
+    for (x = 0 ; x < width ; x++)
+    {
+      for (y = 0 ; y < height ; y++)
+        f[y] = d2[slice*wh + (long)y*width + x] ;
+      mriEDT1D(f, height, mri_src->ysize, v, zb, d) ;
+      for (y = 0 ; y < height ; y++)
+        d2[slice*wh + (long)y*width + x] = f[y] ;
+    }
+    free(v) ; free(zb) ; free(d) ; free(f) ;
+  }
+
+  /* z pass */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (row = 0 ; row < height ; row++)
+  {
+    int    x, z, *v ;
+    double *zb ;
+    float  *d, *f ;
+
+    v = (int *)calloc(nmax, sizeof(int)) ;
+    zb = (double *)calloc(nmax+1, sizeof(double)) ;
+    d = (float *)calloc(nmax, sizeof(float)) ;
+    f = (float *)calloc(nmax, sizeof(float)) ;
+    for (x = 0 ; x < width ; x++)
+    {
+      for (z = 0 ; z < depth ; z++)
+        f[z] = d2[z*wh + (long)row*width + x] ;
+      mriEDT1D(f, depth, mri_src->zsize, v, zb, d) ;
+      for (z = 0 ; z < depth ; z++)
+        d2[z*wh + (long)row*width + x] = f[z] ;
+    }
+    free(v) ; free(zb) ; free(d) ; free(f) ;
+  }
+}
+
+/*
+  convert the squared distances of the voxels whose label membership
+  matches in_label to signed distances from the boundary (half a voxel
+  inside the nearest center of the other class), truncated at limit.
+*/
+static void
+mriEDTstore(MRI *mri_src, MRI *mri_dist, int label, int in_label,
+            float *d2, float sign, float limit)
+{
+  int  z, width, height, depth ;
+  long wh ;
+
+  width = mri_src->width ;
+  height = mri_src->height ;
+  depth = mri_src->depth ;
+  wh = (long)width*height ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < depth ; z++)
+  {
+    int   x, y ;
+    float dist ;
+
+    for (y = 0 ; y < height ; y++)
+      for (x = 0 ; x < width ; x++)
+      {
+        if ((nint(MRIgetVoxVal(mri_src, x, y, z, 0)) == label) != in_label)
+          continue ;
+        dist = sqrt(d2[z*wh + (long)y*width + x]) - 0.5*mri_src->xsize ;
+        MRIFvox(mri_dist, x, y, z) = sign * MIN(dist, limit) ;
+      }
+  }
+}
+
+/*
+  Exact replacement for the fast marching engine of
+  MRIdistanceTransform, with the same output conventions: distances are
+  in mm, measured from the voxel centers to the label boundary (half a
+  voxel closer than the nearest center of the other class), label
+  voxels are 0 in DTRANS_MODE_OUTSIDE, negative in DTRANS_MODE_SIGNED
+  and DTRANS_MODE_INSIDE, and everything is truncated at max_dist
+  voxels. Voxels with mri_mask == 0 are set to the limit; unlike fast
+  marching the mask does not act as a barrier, so distances are
+  straight-line rather than geodesic within the mask.
+*/
+MRI *
+MRIdistanceTransformEDT(MRI *mri_src,
+                        MRI *mri_dist,
+                        int label,
+                        float max_dist,
+                        int mode,
+                        MRI *mri_mask)
+{
+  int   width, height, depth, do_out, do_in, x, y, z ;
+  long  wh ;
+  float *d2, limit ;
+
+  width = mri_src->width ;
+  height = mri_src->height ;
+  depth = mri_src->depth ;
+  wh = (long)width*height ;
+
+  if (mri_dist == NULL)
+  {
+    mri_dist = MRIalloc(width, height, depth, MRI_FLOAT) ;
+    MRIcopyHeader(mri_src, mri_dist) ;
+  }
+  else
+  {
+    if (mri_dist->type != MRI_FLOAT || mri_dist->width != width ||
+        mri_dist->height != height || mri_dist->depth != depth)
+      ErrorReturn(NULL, (ERROR_BADPARM,
+                         "MRIdistanceTransformEDT: mri_dist must be a float "
+                         "volume the size of mri_src")) ;
+    MRIclear(mri_dist) ;
+  }
+
+  if (max_dist <= 0)
+    max_dist = 2*MAX(MAX(width, height), depth) ;
+  limit = max_dist * mri_src->xsize ;
+
+  d2 = (float *)calloc(wh*depth, sizeof(float)) ;
+  if (d2 == NULL)
+    ErrorExit(ERROR_NOMEMORY,
+              "MRIdistanceTransformEDT: could not allocate %dx%dx%d buffer",
+              width, height, depth) ;
+
+  do_out = (mode != DTRANS_MODE_INSIDE) ;
+  do_in = (mode != DTRANS_MODE_OUTSIDE) ;
+
+  if (do_out)   /* non-label voxels: distance to the label */
+  {
+    mriEDTsquared(mri_src, label, 1, d2) ;
+    mriEDTstore(mri_src, mri_dist, label, 0, d2, 1.0, limit) ;
+  }
+  if (do_in)    /* label voxels: distance to the non-label voxels */
+  {
+    mriEDTsquared(mri_src, label, 0, d2) ;
+    mriEDTstore(mri_src, mri_dist, label, 1, d2,
+                mode == DTRANS_MODE_UNSIGNED ? 1.0 : -1.0, limit) ;
+  }
+  free(d2) ;
+
+  if (mri_mask)
+  {
+    for (z = 0 ; z < depth ; z++)
+      for (y = 0 ; y < height ; y++)
+        for (x = 0 ; x < width ; x++)
+          if ((int)MRIgetVoxVal(mri_mask, x, y, z, 0) == 0)
+            MRIFvox(mri_dist, x, y, z) =
+              (mode == DTRANS_MODE_INSIDE) ? -limit : limit ;
+  }
+
+  mri_dist->outside_val = max_dist ;
+  return(mri_dist) ;
+}
+
 /** 
  * This is deprecated.  Please use MRIextractDistanceMap in fastmarching.h 
- * instead 
+ * instead. Set the engine with MRIsetDistanceTransformEngine or
+ * FS_DTRANS_ENGINE=edt to use the exact transform above.
  **/
 MRI *
 MRIdistanceTransform(MRI *mri_src,
@@ -17192,6 +17750,10 @@ MRIdistanceTransform(MRI *mri_src,
   const int height = mri_src->height;
   const int depth = mri_src->depth;
 
+  if (MRIgetDistanceTransformEngine() == DTRANS_ENGINE_EDT)
+    return(MRIdistanceTransformEDT(mri_src, mri_dist, label, max_dist,
+                                   mode, mri_mask)) ;
+
   if (mri_dist == NULL)
   {
     mri_dist = MRIalloc(width, height, depth, MRI_FLOAT) ;
@@ -17202,8 +17764,7 @@ MRIdistanceTransform(MRI *mri_src,
     
   // these are the modes in fastmarching...
   const int outside = 1;
-  // this one isn't used in this function
-  // const int inside = 2;
+  const int inside = 2;
   const int both_signed = 3;
   const int both_unsigned = 4;
   
@@ -17217,6 +17778,9 @@ MRIdistanceTransform(MRI *mri_src,
   } else if( mode == DTRANS_MODE_OUTSIDE ) {
     // DTRANS_MODE_OUTSIDE is zero inside and positive outside
     mode = outside;
+  } else if( mode == DTRANS_MODE_INSIDE ) {
+    // DTRANS_MODE_INSIDE is negative inside and zero outside
+    mode = inside;
   }
 
   // Not to get an error within MRIextractDistanceMap
@@ -28,6 +28,7 @@ char *MRIFLOOD_VERSION = "$Revision: 1.41 $";
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include "diag.h"
 #include "mri.h"
 #include "mrisurf.h"
@@ -1683,15 +1684,51 @@ MRI *MRISfillInteriorOld(MRI_SURFACE *mris, double resolution, MRI *mri_interior
 
 /*!
 \fn MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
-\brief Fills in the interior of a surface by creating a "watertight"
-shell and filling everything outside of the shell. This is much faster
-but slightly less accurate than a ray-tracing algorithm.  See also
+\brief Fills in the interior of a closed surface (1 where the voxel
+center is inside). Uses MRISfillInteriorScanline(), which gives the
+same answer as ray tracing. See also MRISfillInteriorShell(),
 MRISfillInteriorOld() and MRISfillInteriorRibbonTest().
 \param mris - input surface
 \param resolution - only used if mri_dst is NULL
 \param mri_dst - output
 */
 MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
+{
+  int width, height, depth ;
+  MATRIX *m_vox2ras ;
+
+  MRIScomputeMetricProperties(mris) ;
+
+  if(!mri_dst){
+    width  = ceil((mris->xhi - mris->xlo)/resolution) ;
+    height = ceil((mris->yhi - mris->ylo)/resolution) ;
+    depth  = ceil((mris->zhi - mris->zlo)/resolution) ;
+    mri_dst = MRIalloc(width, height, depth, MRI_FLOAT) ;
+    MRIsetResolution(mri_dst, resolution, resolution, resolution) ;
+    m_vox2ras = MatrixIdentity(4, NULL) ;
+    *MATRIX_RELT(m_vox2ras, 1, 1) = resolution ;
+    *MATRIX_RELT(m_vox2ras, 2, 2) = resolution ;
+    *MATRIX_RELT(m_vox2ras, 3, 3) = resolution ;
+    *MATRIX_RELT(m_vox2ras, 1, 4) = mris->xlo+mris->vg.c_r ;
+    *MATRIX_RELT(m_vox2ras, 2, 4) = mris->ylo+mris->vg.c_a ;
+    *MATRIX_RELT(m_vox2ras, 3, 4) = mris->zlo+mris->vg.c_s ;
+    MRIsetVoxelToRasXform(mri_dst, m_vox2ras) ;
+    MatrixFree(&m_vox2ras) ;
+  }
+  return(MRISfillInteriorScanline(mris, NULL, 0, mri_dst)) ;
+}
+
+/*!
+\fn MRI *MRISfillInteriorShell(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
+\brief Fills in the interior of a surface by creating a "watertight"
+shell and filling everything outside of the shell. This is much faster
+but slightly less accurate than a ray-tracing algorithm. This was
+MRISfillInterior() before MRISfillInteriorScanline().
+\param mris - input surface
+\param resolution - only used if mri_dst is NULL
+\param mri_dst - output
+*/
+MRI *MRISfillInteriorShell(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
 {
   int col,row,slc,fno,numu,numv,u,v,nhits,width,height,depth ;
   double x0,y0,z0,x1,y1,z1,x2,y2,z2,d0,d1,d2,dmax;
@@ -1913,13 +1950,245 @@ MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
   return(mri_dst);
 }
 
+/* Canonical 2D edge function of the (y,z) projection: the sign of
+   (b-a)x(p-a) is evaluated with the lower vertex index first so that
+   the two faces sharing an edge get exactly opposite values. */
+static double scanlineEdge(const double *vy, const double *vz, int a, int b,
+                           double py, double pz)
+{
+  if (a < b)
+    return((vy[b]-vy[a])*(pz-vz[a]) - (vz[b]-vz[a])*(py-vy[a])) ;
+  return(-((vy[a]-vy[b])*(pz-vz[b]) - (vz[a]-vz[b])*(py-vy[b]))) ;
+}
+
+/* Tie-breaking for sample lines that pass exactly through an edge or
+   vertex: of the two directions of an edge exactly one owns it. */
+static int scanlineOwnsEdge(const double *vy, const double *vz, int a, int b)
+{
+  double dy = vy[b]-vy[a], dz = vz[b]-vz[a] ;
+  return(dz < 0 || (dz == 0 && dy > 0)) ;
+}
+
+/* Range of sample lines (jy,jz) covered by the projection of a face */
+static void scanlineFaceLines(const double *vy, const double *vz, FACE *f,
+                              double off, int ns, int nly, int nlz,
+                              int *jy0, int *jy1, int *jz0, int *jz1)
+{
+  double ymin, ymax, zmin, zmax ;
+  ymin = MIN(vy[f->v[0]], MIN(vy[f->v[1]], vy[f->v[2]])) ;
+  ymax = MAX(vy[f->v[0]], MAX(vy[f->v[1]], vy[f->v[2]])) ;
+  zmin = MIN(vz[f->v[0]], MIN(vz[f->v[1]], vz[f->v[2]])) ;
+  zmax = MAX(vz[f->v[0]], MAX(vz[f->v[1]], vz[f->v[2]])) ;
+  *jy0 = MAX((int)ceil((ymin-off)*ns), 0) ;
+  *jy1 = MIN((int)floor((ymax-off)*ns), nly-1) ;
+  *jz0 = MAX((int)ceil((zmin-off)*ns), 0) ;
+  *jz1 = MIN((int)floor((zmax-off)*ns), nlz-1) ;
+}
+
+/*!
+\fn MRI *MRISfillInteriorScanline(MRI_SURFACE *mris, MATRIX *sras2vox, int nsub, MRI *mri_dst)
+\brief Fills the interior of a closed surface by intersecting lines
+along the column axis with the mesh and filling by crossing parity.
+Faces are binned by the lines their (row,slice) projection covers,
+so each line is only tested against the faces it can hit, and lines
+that pass exactly through an edge or vertex are resolved with a
+consistent ownership rule so that each crossing is counted once.
+Voxel rows are processed in parallel.
+\param mris - closed surface
+\param sras2vox - maps vertex xyz to mri_dst col,row,slice. If NULL,
+MRISsurfaceRASToVoxelCached() is used.
+\param nsub - 0 for a binary mask (1 where the voxel center is
+inside); otherwise the fraction of each voxel inside the surface is
+computed from nsub x nsub lines per voxel row with exact coverage
+along the line (mri_dst should then be MRI_FLOAT).
+\param mri_dst - output, must be allocated
+*/
+MRI *MRISfillInteriorScanline(MRI_SURFACE *mris, MATRIX *sras2vox, int nsub, MRI *mri_dst)
+{
+  int    vno, fno, ns, nly, nlz, nlines, jy, jz, jy0, jy1, jz0, jz1, maxbin, nodd=0 ;
+  int    *binstart, *binfill, *bin ;
+  double *vx, *vy, *vz, off, c, r, s ;
+  VERTEX *v ;
+  struct timeb start ;
+
+  if (mri_dst == NULL)
+  {
+    printf("ERROR: MRISfillInteriorScanline(): output volume must be allocated\n");
+    return(NULL) ;
+  }
+  TimerStart(&start) ;
+  MRIclear(mri_dst) ;
+
+  // vertex coordinates in output voxel space
+  vx = (double *)calloc(mris->nvertices, sizeof(double)) ;
+  vy = (double *)calloc(mris->nvertices, sizeof(double)) ;
+  vz = (double *)calloc(mris->nvertices, sizeof(double)) ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    if (sras2vox)
+    {
+      vx[vno] = sras2vox->rptr[1][1]*v->x + sras2vox->rptr[1][2]*v->y +
+        sras2vox->rptr[1][3]*v->z + sras2vox->rptr[1][4] ;
+      vy[vno] = sras2vox->rptr[2][1]*v->x + sras2vox->rptr[2][2]*v->y +
+        sras2vox->rptr[2][3]*v->z + sras2vox->rptr[2][4] ;
+      vz[vno] = sras2vox->rptr[3][1]*v->x + sras2vox->rptr[3][2]*v->y +
+        sras2vox->rptr[3][3]*v->z + sras2vox->rptr[3][4] ;
+    }
+    else
+    {
+      MRISsurfaceRASToVoxelCached(mris, mri_dst, v->x, v->y, v->z, &c, &r, &s) ;
+      vx[vno] = c ; vy[vno] = r ; vz[vno] = s ;
+    }
+  }
+
+  // Sample lines: line (jy,jz) is at row jy/ns+off, slice jz/ns+off
+  ns = (nsub > 0) ? nsub : 1 ;
+  off = (nsub > 0) ? 0.5/ns - 0.5 : 0.0 ;
+  nly = mri_dst->height*ns ;
+  nlz = mri_dst->depth*ns ;
+  nlines = nly*nlz ;
+
+  // Bin the faces by line (count, then fill)
+  binstart = (int *)calloc(nlines+1, sizeof(int)) ;
+  for (fno = 0 ; fno < mris->nfaces ; fno++)
+  {
+    scanlineFaceLines(vy, vz, &mris->faces[fno], off, ns, nly, nlz, &jy0, &jy1, &jz0, &jz1) ;
+    for (jz = jz0 ; jz <= jz1 ; jz++)
+      for (jy = jy0 ; jy <= jy1 ; jy++)
+        binstart[jz*nly+jy+1]++ ;
+  }
+  for (jy = 0 ; jy < nlines ; jy++)
+    binstart[jy+1] += binstart[jy] ;
+  binfill = (int *)calloc(nlines+1, sizeof(int)) ;
+  memcpy(binfill, binstart, nlines*sizeof(int)) ;
+  bin = (int *)calloc(binstart[nlines]+1, sizeof(int)) ;
+  for (fno = 0 ; fno < mris->nfaces ; fno++)
+  {
+    scanlineFaceLines(vy, vz, &mris->faces[fno], off, ns, nly, nlz, &jy0, &jy1, &jz0, &jz1) ;
+    for (jz = jz0 ; jz <= jz1 ; jz++)
+      for (jy = jy0 ; jy <= jy1 ; jy++)
+        bin[binfill[jz*nly+jy]++] = fno ;
+  }
+  free(binfill) ;
+  maxbin = 0 ;
+  for (jy = 0 ; jy < nlines ; jy++)
+    maxbin = MAX(maxbin, binstart[jy+1]-binstart[jy]) ;
+
+  // Intersect the lines of each voxel row and fill by parity
+#ifdef HAVE_OPENMP
+  #pragma omp parallel reduction(+:nodd)
+#endif
+  {
+    double *xs = (double *)calloc(maxbin+1, sizeof(double)) ;
+    double *frac = (double *)calloc(mri_dst->width, sizeof(double)) ;
+    int    rs ;
+
+#ifdef HAVE_OPENMP
+    #pragma omp for schedule(dynamic, 8)
+#endif
+    for (rs = 0 ; rs < mri_dst->height*mri_dst->depth ; rs++)
+    {
+      int    row = rs % mri_dst->height, slc = rs / mri_dst->height ;
+      int    iy, iz, k, n, nx, col, c0, c1, *vf, hit = 0 ;
+      double py, pz, e0, e1, e2, sum, x, x0, x1 ;
+
+      if (nsub > 0)
+        memset(frac, 0, mri_dst->width*sizeof(double)) ;
+      for (iz = 0 ; iz < ns ; iz++)
+        for (iy = 0 ; iy < ns ; iy++)
+        {
+          jy = row*ns + iy ;
+          jz = slc*ns + iz ;
+          py = (double)jy/ns + off ;
+          pz = (double)jz/ns + off ;
+          nx = 0 ;
+          for (n = binstart[jz*nly+jy] ; n < binstart[jz*nly+jy+1] ; n++)
+          {
+            vf = mris->faces[bin[n]].v ;
+            e0 = scanlineEdge(vy, vz, vf[1], vf[2], py, pz) ;
+            e1 = scanlineEdge(vy, vz, vf[2], vf[0], py, pz) ;
+            e2 = scanlineEdge(vy, vz, vf[0], vf[1], py, pz) ;
+            sum = e0+e1+e2 ;
+            if (sum == 0)
+              continue ;   // edge-on
+            if (sum > 0)
+            {
+              if (e0 < 0 || (e0 == 0 && !scanlineOwnsEdge(vy, vz, vf[1], vf[2])) ||
+                  e1 < 0 || (e1 == 0 && !scanlineOwnsEdge(vy, vz, vf[2], vf[0])) ||
+                  e2 < 0 || (e2 == 0 && !scanlineOwnsEdge(vy, vz, vf[0], vf[1])))
+                continue ;
+            }
+            else
+            {
+              if (e0 > 0 || (e0 == 0 && !scanlineOwnsEdge(vy, vz, vf[2], vf[1])) ||
+                  e1 > 0 || (e1 == 0 && !scanlineOwnsEdge(vy, vz, vf[0], vf[2])) ||
+                  e2 > 0 || (e2 == 0 && !scanlineOwnsEdge(vy, vz, vf[1], vf[0])))
+                continue ;
+            }
+            x = (e0*vx[vf[0]] + e1*vx[vf[1]] + e2*vx[vf[2]])/sum ;
+            // insertion sort, nx is small
+            for (k = nx ; k > 0 && xs[k-1] > x ; k--)
+              xs[k] = xs[k-1] ;
+            xs[k] = x ;
+            nx++ ;
+          }
+          if (nx % 2)
+          {
+            nodd++ ;   // surface is not closed, drop the last crossing
+            nx-- ;
+          }
+          for (k = 0 ; k < nx ; k += 2)
+          {
+            x0 = xs[k] ;
+            x1 = xs[k+1] ;
+            if (nsub == 0)
+            {
+              // voxel centers with x0 < col <= x1
+              c0 = MAX((int)floor(x0)+1, 0) ;
+              c1 = MIN((int)floor(x1), mri_dst->width-1) ;
+              for (col = c0 ; col <= c1 ; col++)
+                MRIsetVoxVal(mri_dst, col, row, slc, 0, 1) ;
+            }
+            else
+            {
+              // length of [x0,x1] within [col-.5,col+.5]
+              c0 = MAX((int)floor(x0+0.5), 0) ;
+              c1 = MIN((int)floor(x1+0.5), mri_dst->width-1) ;
+              for (col = c0 ; col <= c1 ; col++)
+                frac[col] += MIN(x1, col+0.5) - MAX(x0, col-0.5) ;
+              hit = 1 ;
+            }
+          }
+        }
+      if (hit)
+        for (col = 0 ; col < mri_dst->width ; col++)
+          if (frac[col] > 0)
+            MRIsetVoxVal(mri_dst, col, row, slc, 0, frac[col]/(ns*ns)) ;
+    }
+    free(xs) ;
+    free(frac) ;
+  }
+
+  if (nodd > 0)
+    printf("WARNING: MRISfillInteriorScanline(): %d lines had an odd number "
+           "of crossings, surface may not be closed\n", nodd) ;
+  if (Gdiag_no > 0)
+    printf("  MRISfillInteriorScanline t = %g\n",TimerStop(&start)/1000.0) ;
+
+  free(vx) ; free(vy) ; free(vz) ;
+  free(binstart) ; free(bin) ;
+  return(mri_dst) ;
+}
+
 /*!
 \fn int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 \brief Runs a test on MRISfillInterior() by comparing its results to
 the ribbon.mgz file.  The ribbon.mgz file is the gold standard
-generated using a ray tracing algorithm. Typical results are that the
-new MRISfillInterior() will overlap ribbon.mgz to better than 99.5%
-but is on the order of 20 times faster.
+generated using a ray tracing algorithm. Typical results are that
+MRISfillInteriorShell() will overlap ribbon.mgz to better than 99.5%
+but is on the order of 20 times faster. UseNew=1 tests MRISfillInterior(),
+UseNew=2 tests MRISfillInteriorShell(), UseNew=0 MRISfillInteriorOld().
 */
 int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 {
@@ -1962,7 +2231,8 @@ int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 	return(1);
       }
       MRIclear(mri);
-      if(UseNew)  MRISfillInterior(surf,1,mri); // resolution = 1
+      if(UseNew == 1) MRISfillInterior(surf,1,mri); // resolution = 1
+      if(UseNew == 2) MRISfillInteriorShell(surf,1,mri);
       if(!UseNew) MRISfillInteriorOld(surf,1,mri); // resolution = 1
 
       nfp = 0; // false positive - not in ribbon but in interior
@@ -167,7 +167,8 @@ static MRI *ximgRead(const char *fname, int read_volume);
 
 static MRI *nifti1Read(const char *fname, int read_volume);
 static int nifti1Write(MRI *mri,const  char *fname);
-static MRI *niiRead(const char *fname, int read_volume);
+static MRI *niiRead(const char *fname, int read_volume,
+                    const MRI_REGION *box, const int *frames, int nframes);
 static int niiWrite(MRI *mri,const  char *fname);
 static int itkMorphWrite(MRI *mri,const  char *fname);
 static int niftiQformToMri(MRI *mri, struct nifti_1_header *hdr);
@@ -198,7 +199,8 @@ static void local_buffer_to_image
 (BUFTYPE *buf, MRI *mri, int slice, int frame) ;
 
 static MRI *sdtRead(const char *fname, int read_volume);
-static MRI *mghRead(const char *fname, int read_volume, int frame) ;
+static MRI *mghRead(const char *fname, int read_volume,
+                    const MRI_REGION *box, const int *frames, int nframes) ;
 static int mghWrite(MRI *mri,const  char *fname, int frame) ;
 static int mghAppend(MRI *mri,const  char *fname, int frame) ;
 
@@ -786,9 +788,27 @@ MRI *mri_read( const char *fname,
   {
     mri = sdtRead(fname_copy, volume_flag);
   }
-  else if (type == MRI_MGH_FILE)
+  else if (type == MRI_MGH_FILE || type == NII_FILE)
   {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    // read only the frames asked for rather than copying them out below
+    int *frames = NULL, nframes = 0 ;
+    if (volume_flag && start_frame >= 0)
+    {
+      nframes = end_frame - start_frame + 1 ;
+      frames = (int *)calloc(nframes, sizeof(int)) ;
+      for (t = 0 ; t < nframes ; t++)
+        frames[t] = start_frame + t ;
+    }
+    if (type == MRI_MGH_FILE)
+      mri = mghRead(fname_copy, volume_flag, NULL, frames, nframes);
+    else
+      mri = niiRead(fname_copy, volume_flag, NULL, frames, nframes);
+    if (frames)
+    {
+      free(frames) ;
+      start_frame = 0 ;
+      end_frame = nframes - 1 ;
+    }
   }
   else if (type == MGH_MORPH)
   {
@@ -850,10 +870,6 @@ MRI *mri_read( const char *fname,
   {
     mri = nifti1Read(fname_copy, volume_flag);
   }
-  else if (type == NII_FILE)
-  {
-    mri = niiRead(fname_copy, volume_flag);
-  }
   else if (type == NRRD_FILE)
   {
     mri = mriNrrdRead(fname_copy, volume_flag);
@@ -1198,6 +1214,427 @@ MRI *MRIreadHeader(const char *fname, int type)
 
 } /* end MRIreadInfo() */
 
+/*---------------------------------------------------------------
+  mriSelectRegion() - checks box and frames against a width x height
+  x depth volume with nframes frames. A NULL box stands for the whole
+  volume and nselect <= 0 for all frames. Fills pbox and *pframes
+  (to be freed by the caller) and returns the number of frames
+  selected, or -1 if the selection does not fit.
+  ---------------------------------------------------------------*/
+static int mriSelectRegion(const char *fname, int width, int height,
+                           int depth, int nframes, const MRI_REGION *box,
+                           const int *frames, int nselect,
+                           MRI_REGION *pbox, int **pframes)
+{
+  int  f ;
+
+  if (box == NULL)
+  {
+    pbox->x = pbox->y = pbox->z = 0 ;
+    pbox->dx = width ;
+    pbox->dy = height ;
+    pbox->dz = depth ;
+  }
+  else
+    *pbox = *box ;
+
+  if (pbox->dx < 1 || pbox->dy < 1 || pbox->dz < 1 ||
+      pbox->x < 0 || pbox->y < 0 || pbox->z < 0 ||
+      pbox->x+pbox->dx > width || pbox->y+pbox->dy > height ||
+      pbox->z+pbox->dz > depth)
+  {
+    errno = 0;
+    ErrorReturn(-1, (ERROR_BADPARM,
+                     "mriSelectRegion(%s): box (%d, %d, %d) + (%d, %d, %d) "
+                     "is not within the volume (%d, %d, %d)",
+                     fname, pbox->x, pbox->y, pbox->z, pbox->dx, pbox->dy,
+                     pbox->dz, width, height, depth)) ;
+  }
+
+  if (frames == NULL || nselect <= 0)
+  {
+    frames = NULL ;
+    nselect = nframes ;
+  }
+  *pframes = (int *)calloc(nselect, sizeof(int)) ;
+  if (*pframes == NULL)
+    ErrorExit(ERROR_NOMEMORY, "mriSelectRegion: could not allocate %d frames",
+              nselect) ;
+  for (f = 0 ; f < nselect ; f++)
+  {
+    (*pframes)[f] = frames ? frames[f] : f ;
+    if ((*pframes)[f] < 0 || (*pframes)[f] >= nframes)
+    {
+      free(*pframes) ;
+      *pframes = NULL ;
+      errno = 0;
+      ErrorReturn(-1, (ERROR_BADPARM,
+                       "mriSelectRegion(%s): frame %d is out of range "
+                       "(%d frames in volume)", fname, frames[f], nframes)) ;
+    }
+  }
+  return(nselect) ;
+}
+
+/*---------------------------------------------------------------
+  mriAllocRegion() - allocates a volume for box and nframes frames of
+  the volume described by mri_hdr, with its header and c_ras moved
+  so that the voxels of the box keep their RAS coordinates.
+  ---------------------------------------------------------------*/
+static MRI *mriAllocRegion(MRI *mri_hdr, const MRI_REGION *box, int nframes)
+{
+  MRI     *mri ;
+  double  dx, dy, dz ;
+
+  mri = MRIallocSequence(box->dx, box->dy, box->dz, mri_hdr->type, nframes) ;
+  if (mri == NULL)
+    return(NULL) ;
+  MRIcopyHeader(mri_hdr, mri) ;
+  MRIcopyPulseParameters(mri_hdr, mri) ;
+
+  // offset of the center of the box from that of the volume, in mm
+  dx = (box->x + box->dx/2.0 - mri_hdr->width/2.0) * mri_hdr->xsize ;
+  dy = (box->y + box->dy/2.0 - mri_hdr->height/2.0) * mri_hdr->ysize ;
+  dz = (box->z + box->dz/2.0 - mri_hdr->depth/2.0) * mri_hdr->zsize ;
+  mri->c_r = mri_hdr->c_r + mri_hdr->x_r*dx + mri_hdr->y_r*dy + mri_hdr->z_r*dz ;
+  mri->c_a = mri_hdr->c_a + mri_hdr->x_a*dx + mri_hdr->y_a*dy + mri_hdr->z_a*dz ;
+  mri->c_s = mri_hdr->c_s + mri_hdr->x_s*dx + mri_hdr->y_s*dy + mri_hdr->z_s*dz ;
+
+  mri->xstart = mri_hdr->xstart + box->x*mri->xsize ;
+  mri->xend = mri->xstart + box->dx*mri->xsize ;
+  mri->ystart = mri_hdr->ystart + box->y*mri->ysize ;
+  mri->yend = mri->ystart + box->dy*mri->ysize ;
+  mri->zstart = mri_hdr->zstart + box->z*mri->zsize ;
+  mri->zend = mri->zstart + box->dz*mri->zsize ;
+  mri->imnr0 = mri_hdr->imnr0 + box->z ;
+  mri->imnr1 = mri->imnr0 + box->dz - 1 ;
+  MRIreInitCache(mri) ;
+  return(mri) ;
+}
+
+static void mriCopyFrameInfo(const MRI_FRAME *src, MRI_FRAME *dst)
+{
+  MATRIX *m_ras2vox = dst->m_ras2vox ;
+
+  *dst = *src ;
+  if (src->m_ras2vox)
+    dst->m_ras2vox = MatrixCopy(src->m_ras2vox, m_ras2vox) ;
+  else
+  {
+    if (m_ras2vox)
+      MatrixFree(&m_ras2vox) ;
+    dst->m_ras2vox = NULL ;
+  }
+}
+
+/* skips forward by reading, which also works for compressed streams */
+static int znzskip(znzFile fp, long long nbytes)
+{
+  char  buf[16384] ;
+  long long n ;
+
+  for ( ; nbytes > 0 ; nbytes -= n)
+  {
+    n = nbytes < (long long)sizeof(buf) ? nbytes : (long long)sizeof(buf) ;
+    if ((long long)znzread(buf, 1, n, fp) != n)
+      return(ERROR_BADFILE) ;
+  }
+  return(NO_ERROR) ;
+}
+
+/* how the voxels of an MGH or NIfTI file are stored */
+typedef struct
+{
+  int    datatype ;   // NIfTI DT_* code of the voxels on disk
+  int    bpv ;        // bytes per voxel on disk
+  int    swap ;       // byte order on disk differs from the machine's
+  float  scl_slope ;  // if nonzero, values are scaled into MRI_FLOAT
+  float  scl_inter ;
+}
+MRI_RAW_FORMAT ;
+
+/* converts (in place) one row of mri->width voxels read from disk */
+static void mriRawToImage(unsigned char *buf, const MRI_RAW_FORMAT *fmt,
+                          MRI *mri, int y, int z, int frame)
+{
+  int    x, width ;
+  float  *dst ;
+
+  width = mri->width ;
+  if (fmt->swap)
+  {
+    if (fmt->bpv == 2)
+      byteswapbufshort(buf, (long)width*fmt->bpv) ;
+    else if (fmt->bpv == 4)
+      byteswapbuffloat(buf, (long)width*fmt->bpv) ;
+    else if (fmt->bpv == 8)
+      byteswapbufdouble(buf, (long)width*fmt->bpv) ;
+  }
+
+  if (fmt->scl_slope == 0)
+  {
+    if (fmt->datatype == DT_DOUBLE)
+    {
+      dst = &MRIFseq_vox(mri, 0, y, z, frame) ;
+      for (x = 0 ; x < width ; x++)
+        dst[x] = (float)((double *)buf)[x] ;
+    }
+    else
+      memmove(&MRIseq_vox(mri, 0, y, z, frame), buf, (size_t)width*fmt->bpv) ;
+    return ;
+  }
+
+  dst = &MRIFseq_vox(mri, 0, y, z, frame) ;
+  switch (fmt->datatype)
+  {
+  case DT_UNSIGNED_CHAR:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(buf[x]) + fmt->scl_inter ;
+    break ;
+  case DT_INT8:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((signed char *)buf)[x]) +
+               fmt->scl_inter ;
+    break ;
+  case DT_SIGNED_SHORT:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((short *)buf)[x]) + fmt->scl_inter ;
+    break ;
+  case DT_UINT16:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((unsigned short *)buf)[x]) +
+               fmt->scl_inter ;
+    break ;
+  case DT_SIGNED_INT:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((int *)buf)[x]) + fmt->scl_inter ;
+    break ;
+  case DT_UINT32:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((unsigned int *)buf)[x]) +
+               fmt->scl_inter ;
+    break ;
+  case DT_FLOAT:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * ((float *)buf)[x] + fmt->scl_inter ;
+    break ;
+  case DT_DOUBLE:
+    for (x = 0 ; x < width ; x++)
+      dst[x] = fmt->scl_slope * (float)(((double *)buf)[x]) + fmt->scl_inter ;
+    break ;
+  }
+}
+
+/*---------------------------------------------------------------
+  mriReadRawRegion() - fills mri with box of the given frames
+  (frames[0..mri->nframes-1]) of a width x height x depth x nframes
+  array starting at byte offset of fname, x fastest.
+
+  An uncompressed file is read with one pread() per slice of the box,
+  covering its rows and the gaps between them, and the slices are
+  read and converted in parallel. fp is not used and left where it
+  is. A compressed stream can only be inflated in order, so the
+  frames are visited in file order and fp is skipped forward to each
+  slice; it is left after the last one read.
+  ---------------------------------------------------------------*/
+static int mriReadRawRegion(znzFile fp, const char *fname, int gzipped,
+                            long long offset, int width, int height,
+                            int depth, const MRI_RAW_FORMAT *fmt,
+                            const MRI_REGION *box, const int *frames,
+                            MRI *mri)
+{
+  long long span, row ;
+  int  nslices, nbad, s, f, n, bytes, *order ;
+  unsigned char *buf ;
+
+  row = (long long)width * fmt->bpv ;
+  span = (box->dy-1) * row + (long long)box->dx * fmt->bpv ;
+  nslices = mri->nframes * box->dz ;
+
+  if (!gzipped)
+  {
+    int fd = open(fname, O_RDONLY) ;
+    if (fd < 0)
+    {
+      errno = 0;
+      ErrorReturn(ERROR_BADFILE,
+                  (ERROR_BADFILE, "mriReadRawRegion(%s): could not open file",
+                   fname)) ;
+    }
+    nbad = 0 ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nbad)
+#endif
+    for (s = 0 ; s < nslices ; s++)
+    {
+      int  y, z, frame ;
+      long long pos, got, nread ;
+      unsigned char *sbuf ;
+
+      frame = s / box->dz ;
+      z = s % box->dz ;
+      pos = offset + (((long long)frames[frame]*depth + box->z + z)*height
+                      + box->y) * row + (long long)box->x * fmt->bpv ;
+      sbuf = (unsigned char *)malloc(span) ;
+      if (sbuf == NULL)
+      {
+        nbad++ ;
+        continue ;
+      }
+      for (got = 0 ; got < span ; got += nread)
+      {
+        nread = pread(fd, sbuf+got, span-got, pos+got) ;
+        if (nread <= 0)
+          break ;
+      }
+      if (got < span)
+        nbad++ ;
+      else
+        for (y = 0 ; y < box->dy ; y++)
+          mriRawToImage(sbuf + y*row, fmt, mri, y, z, frame) ;
+      free(sbuf) ;
+#ifdef HAVE_OPENMP
+      if (omp_get_thread_num() == 0)
+#endif
+        exec_progress_callback(z, box->dz, frame, mri->nframes) ;
+    }
+    close(fd) ;
+    if (nbad > 0)
+    {
+      errno = 0;
+      ErrorReturn(ERROR_BADFILE,
+                  (ERROR_BADFILE, "mriReadRawRegion(%s): could not read "
+                   "%d of %d slices", fname, nbad, nslices)) ;
+    }
+    return(NO_ERROR) ;
+  }
+
+  // frames in file order, repeated ones copied from their first read
+  bytes = box->dx * (fmt->scl_slope == 0 && fmt->datatype != DT_DOUBLE ?
+                     fmt->bpv : (int)sizeof(float)) ;
+  order = (int *)calloc(mri->nframes, sizeof(int)) ;
+  buf = (unsigned char *)malloc(span) ;
+  if (order == NULL || buf == NULL)
+    ErrorExit(ERROR_NOMEMORY, "mriReadRawRegion: could not allocate buffers") ;
+  for (f = 0 ; f < mri->nframes ; f++)
+  {
+    for (n = f ; n > 0 && frames[order[n-1]] > frames[f] ; n--)
+      order[n] = order[n-1] ;
+    order[n] = f ;
+  }
+  for (n = 0 ; n < mri->nframes ; n++)
+  {
+    int  y, z, frame = order[n] ;
+
+    if (n > 0 && frames[order[n-1]] == frames[frame])
+    {
+      for (z = 0 ; z < box->dz ; z++)
+        for (y = 0 ; y < box->dy ; y++)
+          memmove(&MRIseq_vox(mri, 0, y, z, frame),
+                  &MRIseq_vox(mri, 0, y, z, order[n-1]), bytes) ;
+      continue ;
+    }
+    for (z = 0 ; z < box->dz ; z++)
+    {
+      long long pos = offset + (((long long)frames[frame]*depth + box->z + z)
+                                * height + box->y) * row
+                      + (long long)box->x * fmt->bpv ;
+      if (znzskip(fp, pos - znztell(fp)) != NO_ERROR ||
+          (long long)znzread(buf, 1, span, fp) != span)
+      {
+        free(buf) ;
+        free(order) ;
+        errno = 0;
+        ErrorReturn(ERROR_BADFILE,
+                    (ERROR_BADFILE, "mriReadRawRegion(%s): could not read "
+                     "slice %d of frame %d", fname, box->z + z,
+                     frames[frame])) ;
+      }
+      for (y = 0 ; y < box->dy ; y++)
+        mriRawToImage(buf + y*row, fmt, mri, y, z, frame) ;
+      exec_progress_callback(z, box->dz, n, mri->nframes) ;
+    }
+  }
+  free(buf) ;
+  free(order) ;
+  return(NO_ERROR) ;
+}
+
+/*---------------------------------------------------------------
+  MRIreadRegion() - reads the voxels of box (NULL for the whole
+  volume) in the given frames (NULL or nframes <= 0 for all of them)
+  of the given file. The result is box->dx x box->dy x box->dz with
+  nframes frames, in the order listed, and a vox2ras that keeps every
+  voxel at its RAS position in the whole volume. MRIreadHeader() can
+  be used first to find the dimensions to choose the box from.
+
+  Uncompressed MGH and NIfTI files are read with pread() of only the
+  slices needed, in parallel, and compressed ones are inflated no
+  further than the last voxel needed. Other formats are read in full
+  and the region is copied out.
+  ---------------------------------------------------------------*/
+MRI *MRIreadRegion(const char *fname, const MRI_REGION *box,
+                   const int *frames, int nframes)
+{
+  char  buf[STRLEN] ;
+  MRI   *mri, *mri_src ;
+  MRI_REGION region ;
+  int   *select, type, f, y, z, bytes ;
+
+  chklc() ;
+
+  FileNameFromWildcard(fname, buf) ;
+  fname = buf ;
+  if (frames == NULL)
+    nframes = 0 ;
+
+  // the type and frame suffixes are left to mri_read()
+  type = MRI_VOLUME_TYPE_UNKNOWN ;
+  if (strchr(fname, '@') == NULL &&
+      (!MRIIO_Strip_Pound || strchr(fname, '#') == NULL))
+    type = mri_identify(fname) ;
+
+  if (type == MRI_MGH_FILE)
+    mri = mghRead(fname, TRUE, box, frames, nframes) ;
+  else if (type == NII_FILE)
+    mri = niiRead(fname, TRUE, box, frames, nframes) ;
+  else
+  {
+    mri_src = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1) ;
+    if (mri_src == NULL)
+      return(NULL) ;
+    nframes = mriSelectRegion(fname, mri_src->width, mri_src->height,
+                              mri_src->depth, mri_src->nframes,
+                              box, frames, nframes, &region, &select) ;
+    if (nframes < 0)
+    {
+      MRIfree(&mri_src) ;
+      return(NULL) ;
+    }
+    mri = mriAllocRegion(mri_src, &region, nframes) ;
+    bytes = region.dx * MRIsizeof(mri->type) ;
+    for (f = 0 ; f < nframes ; f++)
+    {
+      for (z = 0 ; z < region.dz ; z++)
+        for (y = 0 ; y < region.dy ; y++)
+          memmove(&MRIseq_vox(mri, 0, y, z, f),
+                  &MRIseq_vox(mri_src, 0, region.y+y, region.z+z, select[f])
+                  + region.x * MRIsizeof(mri->type), bytes) ;
+      mriCopyFrameInfo(&mri_src->frames[select[f]], &mri->frames[f]) ;
+    }
+    free(select) ;
+    MRIfree(&mri_src) ;
+  }
+  if (mri == NULL)
+    return(NULL) ;
+
+  strcpy(mri->fname, fname) ;
+  MRIreInitCache(mri) ;
+  MRIremoveNaNs(mri, mri) ;
+  return(mri) ;
+
+} /* end MRIreadRegion() */
+
 int MRIwriteType(MRI *mri, const char *fname, int type)
 {
   struct stat stat_buf;
@@ -10500,19 +10937,23 @@ static int nifti1Write(MRI *mri0, const char *fname)
 /*------------------------------------------------------------------
   niiRead() - note: there is also an nifti1Read(). Make sure to
   edit both. Automatically detects whether an input is Ico7
-  and reshapes.
+  and reshapes. Only box (NULL for all) of the given frames (NULL or
+  nframes <= 0 for all) is read, see MRIreadRegion().
   -----------------------------------------------------------------*/
-static MRI *niiRead(const char *fname, int read_volume)
+static MRI *niiRead(const char *fname, int read_volume,
+                    const MRI_REGION *box, const int *frames, int nframes)
 {
 
   znzFile fp;
   MRI *mri,*mritmp;
+  MRI_REGION region;
+  MRI_RAW_FORMAT fmt;
   struct nifti_1_header hdr;
   int nslices;
   int fs_type;
   float time_units_factor, space_units_factor;
   int swapped_flag;
-  int n_read, i, j, k, t;
+  int *select, err;
   int bytes_per_voxel,time_units,space_units ;
   int use_compression, fnamelen;
   int ncols, IsIco7=0;
@@ -10700,7 +11141,14 @@ static MRI *niiRead(const char *fname, int read_volume)
         hdr.datatype, fname));
     }
     fs_type = MRI_FLOAT;
-    bytes_per_voxel = 0; /* set below -- avoid the compiler warning */
+    if (hdr.datatype == DT_UNSIGNED_CHAR || hdr.datatype == DT_INT8)
+      bytes_per_voxel = 1;
+    else if (hdr.datatype == DT_SIGNED_SHORT || hdr.datatype == DT_UINT16)
+      bytes_per_voxel = 2;
+    else if (hdr.datatype == DT_DOUBLE)
+      bytes_per_voxel = 8;
+    else
+      bytes_per_voxel = 4;
   }
 
   // Check whether dim[1] is less than 0. This can happen when FreeSurfer
@@ -10711,8 +11159,9 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if(ncols*hdr.dim[2]*hdr.dim[3] == 163842) IsIco7 = 1;
 
+  // the voxels are allocated once the region to read is known
   if (read_volume)
-    mri = MRIallocSequence(ncols,hdr.dim[2],hdr.dim[3],fs_type,nslices);
+    mri = MRIallocHeader(ncols,hdr.dim[2],hdr.dim[3],fs_type,nslices);
   else{
     if(! IsIco7)
       mri = MRIallocHeader(ncols, hdr.dim[2], hdr.dim[3], fs_type, nslices);
@@ -10798,350 +11247,75 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if (!read_volume) return(mri);
 
-  fp = znzopen(fname, "r", use_compression);
-  if (fp == NULL)
+  // an ico7 overlay is reshaped after reading, so the box is cut out then
+  nframes = mriSelectRegion(fname, mri->width, mri->height, mri->depth,
+                            mri->nframes, IsIco7 ? NULL : box,
+                            frames, nframes, &region, &select);
+  if (nframes < 0)
   {
     MRIfree(&mri);
-    errno = 0;
-    ErrorReturn(NULL, (ERROR_BADFILE,
-                       "niiRead(): error opening file %s", fname));
+    return(NULL);
+  }
+  mritmp = mriAllocRegion(mri, &region, nframes);
+  MRIfree(&mri);
+  mri = mritmp;
+  if (mri == NULL)
+  {
+    free(select);
+    return(NULL);
   }
 
-  if (znzseek(fp, (long)(hdr.vox_offset), SEEK_SET) == -1)
+  fmt.datatype = hdr.datatype;
+  fmt.bpv = bytes_per_voxel;
+  fmt.swap = swapped_flag;
+  fmt.scl_slope = hdr.scl_slope;
+  fmt.scl_inter = hdr.scl_inter;
+
+  fp = NULL;
+  if (use_compression)
+  {
+    fp = znzopen(fname, "r", use_compression);
+    if (fp == NULL)
+    {
+      free(select);
+      MRIfree(&mri);
+      errno = 0;
+      ErrorReturn(NULL, (ERROR_BADFILE,
+                         "niiRead(): error opening file %s", fname));
+    }
+  }
+  err = mriReadRawRegion(fp, fname, use_compression, (long long)hdr.vox_offset,
+                         ncols, hdr.dim[2], hdr.dim[3], &fmt, &region,
+                         select, mri);
+  if (fp != NULL) znzclose(fp);
+  free(select);
+  if (err != NO_ERROR)
   {
-    znzclose(fp);
     MRIfree(&mri);
     errno = 0;
     ErrorReturn(NULL, (ERROR_BADFILE,
-                       "niiRead(): error finding voxel data in %s", fname));
+                       "niiRead(): error reading from %s", fname));
   }
 
-  if (hdr.scl_slope == 0)
-  {
-    // no voxel value scaling needed
-    void *buf;
-    float *fbuf;
-    double *dbuf;
-    int nn;
-    fbuf = (float *)  calloc(mri->width, sizeof(float));
-    dbuf = (double *) calloc(mri->width, sizeof(double));
-
-    for (t = 0; t < mri->nframes; t++)    {
-      for (k = 0; k < mri->depth; k++)      {
-        for (j = 0; j < mri->height; j++)        {
-          buf = &MRIseq_vox(mri, 0, j, k, t);
-
-	  if (hdr.datatype != DT_DOUBLE)
-	    n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-	  else
-	    n_read = znzread(dbuf, bytes_per_voxel, mri->width, fp);
-          if(n_read != mri->width) {
-	    printf("ERROR: Read %d, expected %d\n",n_read,mri->width);
-            znzclose(fp);
-            MRIfree(&mri);
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_BADFILE,
-                               "niiRead(): error reading from %s", fname));
-          }
-
-          if (swapped_flag) {
-            if (bytes_per_voxel == 2)
-              byteswapbufshort(buf, bytes_per_voxel * mri->width);
-            if (bytes_per_voxel == 4)
-              byteswapbuffloat(buf, bytes_per_voxel * mri->width);
-            if (bytes_per_voxel == 8)
-              byteswapbuffloat(dbuf, bytes_per_voxel * mri->width);
-          }
-	  if(hdr.datatype == DT_DOUBLE){
-	    for(nn=0; nn < mri->width; nn++) fbuf[nn] = (float) dbuf[nn];
-	    memcpy(buf,fbuf, 4*mri->width);
-	  }
-
-        }
-        exec_progress_callback(k, mri->depth, t, mri->nframes);
+  // Check for ico7 surface
+  if(IsIco7){
+ //   printf("niiRead: reshaping\n");
+    mritmp = mri_reshape(mri,163842,1,1,mri->nframes);
+    MRIfree(&mri);
+    mri = mritmp;
+    if (box != NULL)
+    {
+      if (mriSelectRegion(fname, mri->width, mri->height, mri->depth,
+                          mri->nframes, box, NULL, 0, &region, &select) < 0)
+      {
+        MRIfree(&mri);
+        return(NULL);
       }
+      free(select);
+      mritmp = MRIextractRegion(mri, NULL, &region);
+      MRIfree(&mri);
+      mri = mritmp;
     }
-    free(fbuf);
-    free(dbuf);
-  }
-  else
-  {
-    // voxel value scaling needed
-    if (hdr.datatype == DT_UNSIGNED_CHAR)
-    {
-      unsigned char *buf;
-      bytes_per_voxel = 1;
-      buf = (unsigned char *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_SIGNED_SHORT)
-    {
-      short *buf;
-      bytes_per_voxel = 2;
-      buf = (short *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-              byteswapbufshort(buf, bytes_per_voxel * mri->width);
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_SIGNED_INT)
-    {
-      int *buf;
-      bytes_per_voxel = 4;
-      buf = (int *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-              byteswapbuffloat(buf, bytes_per_voxel * mri->width);
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_FLOAT)
-    {
-      float *buf;
-      bytes_per_voxel = 4;
-      buf = (float *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-              byteswapbuffloat(buf, bytes_per_voxel * mri->width);
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_DOUBLE)
-    {
-      double *buf;
-      unsigned char *cbuf, ccbuf[8];
-      bytes_per_voxel = 8;
-      buf = (double *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-            {
-              for (i = 0;i < mri->width;i++)
-              {
-                cbuf = (unsigned char *)&buf[i];
-                memmove(ccbuf, cbuf, 8);
-                cbuf[0] = ccbuf[7];
-                cbuf[1] = ccbuf[6];
-                cbuf[2] = ccbuf[5];
-                cbuf[3] = ccbuf[4];
-                cbuf[4] = ccbuf[3];
-                cbuf[5] = ccbuf[2];
-                cbuf[6] = ccbuf[1];
-                cbuf[7] = ccbuf[0];
-              }
-            }
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_INT8)
-    {
-      char *buf;
-      bytes_per_voxel = 1;
-      buf = (char *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_UINT16)
-    {
-      unsigned short *buf;
-      bytes_per_voxel = 2;
-      buf = (unsigned short *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-              byteswapbufshort(buf, bytes_per_voxel * mri->width);
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-
-    if (hdr.datatype == DT_UINT32)
-    {
-      unsigned int *buf;
-      bytes_per_voxel = 4;
-      buf = (unsigned int *)malloc(mri->width * bytes_per_voxel);
-      for (t = 0;t < mri->nframes;t++)
-        for (k = 0;k < mri->depth;k++)
-        {
-          for (j = 0;j < mri->height;j++)
-          {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-            if (n_read != mri->width)
-            {
-              free(buf);
-              znzclose(fp);
-              MRIfree(&mri);
-              errno = 0;
-              ErrorReturn(NULL,
-                          (ERROR_BADFILE,
-                           "niiRead(): error reading from %s", fname));
-            }
-            if (swapped_flag)
-              byteswapbuffloat(buf, bytes_per_voxel * mri->width);
-            for (i = 0;i < mri->width;i++)
-              MRIFseq_vox(mri, i, j, k, t) =
-                hdr.scl_slope * (float)(buf[i]) + hdr.scl_inter;
-          }
-          exec_progress_callback(k, mri->depth, t, mri->nframes);
-        }
-      free(buf);
-    }
-  }
-  znzclose(fp);
-
-  // Check for ico7 surface
-  if(IsIco7){
- //   printf("niiRead: reshaping\n");
-    mritmp = mri_reshape(mri,163842,1,1,mri->nframes);
-    MRIfree(&mri);
-    mri = mritmp;
   }
 
   return(mri);
@@ -12663,18 +12837,24 @@ znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 //static int (*myclose)(FILE *stream);
 
+/*
+  Only box (NULL for all) of the given frames (NULL or nframes <= 0 for
+  all) is read, see MRIreadRegion().
+*/
 static MRI *
-mghRead(const char *fname, int read_volume, int frame)
+mghRead(const char *fname, int read_volume,
+        const MRI_REGION *box, const int *frames, int nframes)
 {
-  MRI  *mri ;
+  MRI  *mri, *mri_hdr ;
+  MRI_REGION region ;
+  MRI_RAW_FORMAT fmt ;
   znzFile fp;
-  int   start_frame, end_frame, width, height, depth, nframes, type, x, y, z,
-  bpv, dof, bytes, version, ival, unused_space_size, good_ras_flag, i ;
-  BUFTYPE *buf ;
+  int   width, height, depth, file_frames, type, *select, i,
+  bpv, dof, version, unused_space_size, good_ras_flag ;
   char   unused_buf[UNUSED_SPACE_SIZE+1] ;
   float  fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s,
   z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov ;
-  short  sval ;
+  long long data_start, data_bytes ;
   //  int tag_data_size;
   char *ext;
   int gzipped=0;
@@ -12707,16 +12887,16 @@ mghRead(const char *fname, int read_volume, int frame)
       ErrorReturn
           (NULL,
            (ERROR_BADPARM,
-            "mghRead(%s, %d): could not open file",
-            fname, frame)) ;
+            "mghRead(%s): could not open file",
+            fname)) ;
     }
   }
   else
   {
     ErrorReturn(NULL,(ERROR_BADPARM,
-                      "mghRead(%s, %d): could not open file.\n"
+                      "mghRead(%s): could not open file.\n"
                       "Filename extension must be .mgh, .mgh.gz or .mgz",
-                      fname, frame));
+                      fname));
   }
 
   /* keep the compiler quiet */
@@ -12728,13 +12908,13 @@ mghRead(const char *fname, int read_volume, int frame)
 
   nread = znzreadIntEx(&version, fp) ;
   if (!nread)
-    ErrorReturn(NULL, (ERROR_BADPARM,"mghRead(%s, %d): read error",
-                       fname, frame)) ;
+    ErrorReturn(NULL, (ERROR_BADPARM,"mghRead(%s): read error",
+                       fname)) ;
 
   width = znzreadInt(fp) ;
   height = znzreadInt(fp) ;
   depth =  znzreadInt(fp) ;
-  nframes = znzreadInt(fp) ;
+  file_frames = znzreadInt(fp) ;
   type = znzreadInt(fp) ;
   dof = znzreadInt(fp) ;
 
@@ -12782,123 +12962,15 @@ mghRead(const char *fname, int read_volume, int frame)
     break ;
   case MRI_TENSOR:
     bpv = sizeof(float) ;
-    nframes = 9 ;
+    file_frames = 9 ;
     break ;
   }
-  bytes = width * height * bpv ;  /* bytes per slice */
-  if (!read_volume)
-  {
-    mri = MRIallocHeader(width, height, depth, type, nframes) ;
-    mri->dof = dof ;
-    mri->nframes = nframes ;
-    if (gzipped)
-    { // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN] ;
-
-      total_bytes = (long)mri->nframes*width*height*depth*bpv ;
-      for (count=0; count < total_bytes-STRLEN; count += STRLEN)
-        znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes-count, 1, fp) ;
-    }
-    else
-      znzseek(fp, (long)mri->nframes*width*height*depth*bpv, SEEK_CUR) ;
-  }
-  else
-  {
-    if (frame >= 0)
-    {
-      start_frame = end_frame = frame ;
-      if (gzipped)
-      { // pipe cannot seek
-        long count;
-        for (count=0; count < (long)frame*width*height*depth*bpv; count++)
-          znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame*width*height*depth*bpv, SEEK_CUR) ;
-      nframes = 1 ;
-    }
-    else
-    {  /* hack - # of frames < -1 means to only read in that
-          many frames. Otherwise I would have had to change the whole
-          MRIread interface and that was too much of a pain. Sorry.
-       */
-      if (frame < -1)
-        nframes = frame*-1 ;
-
-      start_frame = 0 ;
-      end_frame = nframes-1 ;
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-        fprintf(stderr, "read %d frames\n", nframes);
-    }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE)) ;
-    mri = MRIallocSequence(width, height, depth, type, nframes) ;
-    mri->dof = dof ;
-    for (frame = start_frame ; frame <= end_frame ; frame++)
-    {
-      for (z = 0 ; z < depth ; z++)
-      {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes)
-        {
-          // fclose(fp) ;
-          znzclose(fp);
-          free(buf) ;
-          ErrorReturn
-          (NULL,
-           (ERROR_BADFILE,
-            "mghRead(%s): could not read %d bytes at slice %d",
-            fname, bytes, z)) ;
-        }
-        switch (type)
-        {
-        case MRI_INT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              ival = orderIntBytes(((int *)buf)[i]) ;
-              MRIIseq_vox(mri,x,y,z,frame-start_frame) = ival ;
-            }
-          }
-          break ;
-        case MRI_SHORT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              sval = orderShortBytes(((short *)buf)[i]) ;
-              MRISseq_vox(mri,x,y,z,frame-start_frame) = sval ;
-            }
-          }
-          break ;
-        case MRI_TENSOR:
-        case MRI_FLOAT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              fval = orderFloatBytes(((float *)buf)[i]) ;
-              MRIFseq_vox(mri,x,y,z,frame-start_frame) = fval ;
-            }
-          }
-          break ;
-        case MRI_UCHAR:
-          local_buffer_to_image(buf, mri, z, frame-start_frame) ;
-          break ;
-        default:
-          errno = 0;
-          ErrorReturn(NULL,
-                      (ERROR_UNSUPPORTED, "mghRead: unsupported type %d",
-                       mri->type)) ;
-          break ;
-        }
-        exec_progress_callback(z, depth, frame-start_frame, end_frame-start_frame+1);
-      }
-    }
-    if (buf) free(buf) ;
-  }
+  data_start = znztell(fp) ;
+  data_bytes = (long long)file_frames*width*height*depth*bpv ;
 
+  mri = MRIallocHeader(width, height, depth, type, file_frames) ;
+  mri->dof = dof ;
+  mri->nframes = file_frames ;
   if (good_ras_flag > 0)
   {
     mri->xsize =     xsize ;
@@ -12940,6 +13012,48 @@ mghRead(const char *fname, int read_volume, int frame)
       );
     setDirectionCosine(mri, MRI_CORONAL);
   }
+
+  select = NULL ;
+  if (read_volume)
+  {
+    nframes = mriSelectRegion(fname, width, height, depth, file_frames,
+                              box, frames, nframes, &region, &select) ;
+    if (nframes < 0)
+    {
+      znzclose(fp);
+      MRIfree(&mri) ;
+      return(NULL) ;
+    }
+    mri_hdr = mri ;
+    mri = mriAllocRegion(mri_hdr, &region, nframes) ;
+    MRIfree(&mri_hdr) ;
+
+    fmt.datatype = type == MRI_UCHAR ? DT_UNSIGNED_CHAR :
+                   type == MRI_SHORT ? DT_SIGNED_SHORT :
+                   type == MRI_INT ? DT_SIGNED_INT : DT_FLOAT ;
+    fmt.bpv = bpv ;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    fmt.swap = 1 ;   // mgh files are big-endian
+#else
+    fmt.swap = 0 ;
+#endif
+    fmt.scl_slope = fmt.scl_inter = 0 ;
+    if (mriReadRawRegion(fp, fname, gzipped, data_start, width, height, depth,
+                         &fmt, &region, select, mri) != NO_ERROR)
+    {
+      znzclose(fp);
+      free(select) ;
+      MRIfree(&mri) ;
+      return(NULL) ;
+    }
+  }
+
+  // the tags follow the voxels
+  if (gzipped)
+    znzskip(fp, data_start + data_bytes - znztell(fp)) ;
+  else
+    znzseek(fp, data_start + data_bytes, SEEK_SET) ;
+
   // read TR, Flip, TE, TI, FOV
   if (znzreadFloatEx(&(mri->tr), fp))
   {
@@ -12968,8 +13082,22 @@ mghRead(const char *fname, int read_volume, int frame)
       switch (tag)      {
 
       case TAG_MRI_FRAME:
-        if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
-          fprintf(stderr, "couldn't read frame structure from file\n") ;
+        if (select == NULL)
+        {
+          if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
+            fprintf(stderr, "couldn't read frame structure from file\n") ;
+        }
+        else
+        {
+          // the file has them for all of its frames
+          mri_hdr = MRIallocHeader(1, 1, 1, MRI_UCHAR, file_frames) ;
+          if (znzTAGreadMRIframes(fp, mri_hdr, len) != NO_ERROR)
+            fprintf(stderr, "couldn't read frame structure from file\n") ;
+          else
+            for (i = 0 ; i < mri->nframes ; i++)
+              mriCopyFrameInfo(&mri_hdr->frames[select[i]], &mri->frames[i]) ;
+          MRIfree(&mri_hdr) ;
+        }
         break ;
 
       case TAG_OLD_COLORTABLE:
@@ -13055,6 +13183,8 @@ mghRead(const char *fname, int read_volume, int frame)
 
   // fclose(fp) ;
   znzclose(fp);
+  if (select)
+    free(select) ;
 
   // xstart, xend, ystart, yend, zstart, zend are not stored
   mri->xstart = - mri->width/2.*mri->xsize;
@@ -2881,6 +2881,10 @@ MRIsoapBubble(MRI *mri_src,
   MRI     *mri_tmp ;
 
 
+  if (MRIgetSoapBubbleEngine() == SOAP_ENGINE_MULTIGRID)
+  {
+    return(MRIsoapBubbleMultigrid(mri_src, mri_ctrl, mri_dst, niter, min_change)) ;
+  }
   if (mri_src->type == MRI_FLOAT)
   {
     return(mriSoapBubbleFloat(mri_src, mri_ctrl, mri_dst, niter, min_change)) ;
@@ -3049,6 +3053,570 @@ MRIaverageFixedPoints(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst,int niter)
 }
 
 
+/*-----------------------------------------------------
+  Multigrid soap bubble.
+
+  The iteration in MRIsoapBubble replaces every voxel that is not a
+  control point by the mean of its 3x3x3 neighborhood (with the
+  borders replicated). Its fixed point is the solution of
+
+    (27-nself) u(p) - sum of the other neighbors of p = 0
+
+  with the control points as Dirichlet constraints, where nself is the
+  number of neighborhood offsets that map back onto p at the border.
+  Jacobi needs O(N^2) sweeps to get there on an N^3 grid. Instead solve
+  the same (symmetric positive definite) system with conjugate gradients
+  preconditioned by a geometric multigrid V-cycle: Gauss-Seidel
+  smoothing (8 colors so that the 27-point stencil of a voxel only
+  touches other colors, each color parallel over slices), trilinear
+  prolongation and its transpose as restriction. A coarse voxel is
+  constrained if any of its children is. That coarse operator is crude
+  for scattered control points, which is why the V-cycle is used as a
+  preconditioner instead of being iterated on its own.
+  ------------------------------------------------------*/
+#define SOAP_MG_MAX_LEVELS   12
+#define SOAP_MG_COARSE_ITERS 25
+
+typedef struct
+{
+  int           width, height, depth ;
+  float         *u ;      /* solution (correction on coarse levels) */
+  float         *f ;      /* right-hand side */
+  float         *r ;      /* residual */
+  unsigned char *fixed ;
+} SOAP_LEVEL ;
+
+#define SOAP_INDEX(l,x,y,z) ((size_t)(x) + (size_t)(l)->width*((size_t)(y) + (size_t)(l)->height*(size_t)(z)))
+
+static int soap_engine = -1 ;
+
+int
+MRIsetSoapBubbleEngine(int engine)
+{
+  int old_engine = MRIgetSoapBubbleEngine() ;
+
+  if (engine != SOAP_ENGINE_JACOBI && engine != SOAP_ENGINE_MULTIGRID)
+    ErrorReturn(old_engine,
+                (ERROR_BADPARM,
+                 "MRIsetSoapBubbleEngine: unknown engine %d", engine)) ;
+  soap_engine = engine ;
+  return(old_engine) ;
+}
+
+int
+MRIgetSoapBubbleEngine(void)
+{
+  char *cp ;
+
+  if (soap_engine < 0)
+  {
+    soap_engine = SOAP_ENGINE_JACOBI ;
+    cp = getenv("FS_SOAP_ENGINE") ;
+    if (cp != NULL && (!stricmp(cp, "multigrid") || !stricmp(cp, "mg") || !strcmp(cp, "1")))
+      soap_engine = SOAP_ENGINE_MULTIGRID ;
+  }
+  return(soap_engine) ;
+}
+
+/*
+  sum of u over the 3x3x3 neighbors of (x,y,z) other than itself, with
+  the border replicated. *pnself is set to the number of offsets that
+  map back onto (x,y,z).
+*/
+static float
+soapNeighborSum(SOAP_LEVEL *l, float *u, int x, int y, int z, int *pnself)
+{
+  int    xk, yk, zk, xi, yi, zi, nself ;
+  float  sum ;
+  size_t index ;
+
+  if (x > 0 && y > 0 && z > 0 &&
+      x < l->width-1 && y < l->height-1 && z < l->depth-1)
+  {
+    size_t dy = l->width, dz = (size_t)l->width*l->height ;
+
+    index = SOAP_INDEX(l, x, y, z) ;
+    *pnself = 1 ;
+    sum = 0 ;
+    for (zk = -1 ; zk <= 1 ; zk++)
+      for (yk = -1 ; yk <= 1 ; yk++)
+      {
+        float *p = u + index + zk*dz + yk*dy ;
+        sum += p[-1] + p[0] + p[1] ;
+      }
+    return(sum - u[index]) ;
+  }
+
+  for (sum = 0, nself = 0, zk = -1 ; zk <= 1 ; zk++)
+  {
+    zi = MIN(MAX(z+zk, 0), l->depth-1) ;
+    for (yk = -1 ; yk <= 1 ; yk++)
+    {
+      yi = MIN(MAX(y+yk, 0), l->height-1) ;
+      for (xk = -1 ; xk <= 1 ; xk++)
+      {
+        xi = MIN(MAX(x+xk, 0), l->width-1) ;
+        if (xi == x && yi == y && zi == z)
+          nself++ ;
+        else
+          sum += u[SOAP_INDEX(l, xi, yi, zi)] ;
+      }
+    }
+  }
+  *pnself = nself ;
+  return(sum) ;
+}
+
+/* r = f - A u, fixed voxels are 0. Returns max |r|/diagonal */
+static float
+soapResidual(SOAP_LEVEL *l, float *u, float *f, float *r)
+{
+  int   z ;
+  float max_change, *slice_max_change ;
+
+  slice_max_change = (float *)calloc(l->depth, sizeof(float)) ;
+  if (slice_max_change == NULL)
+    ErrorExit(ERROR_NOMEMORY, "soapResidual: could not allocate %d slices", l->depth) ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < l->depth ; z++)
+  {
+    int    x, y, nself ;
+    float  res, max_change = 0 ;
+    size_t index ;
+
+    for (y = 0 ; y < l->height ; y++)
+      for (x = 0 ; x < l->width ; x++)
+      {
+        index = SOAP_INDEX(l, x, y, z) ;
+        if (l->fixed[index])
+        {
+          r[index] = 0 ;
+          continue ;
+        }
+        res = soapNeighborSum(l, u, x, y, z, &nself) - (27-nself)*u[index] ;
+        if (f)
+          res += f[index] ;
+        r[index] = res ;
+        if (fabs(res)/(27-nself) > max_change)
+          max_change = fabs(res)/(27-nself) ;
+      }
+    slice_max_change[z] = max_change ;
+  }
+  for (max_change = 0, z = 0 ; z < l->depth ; z++)
+    max_change = MAX(max_change, slice_max_change[z]) ;
+  free(slice_max_change) ;
+  return(max_change) ;
+}
+
+/*
+  Gauss-Seidel sweeps over the 8 colors (parities of x, y and z) in
+  order or, if reverse, in reverse order - so that a forward sweep
+  followed by a reverse one is symmetric.
+*/
+static void
+soapSmooth(SOAP_LEVEL *l, int niter, int reverse)
+{
+  int i, c, color, z ;
+
+  for (i = 0 ; i < niter ; i++)
+  {
+    for (c = 0 ; c < 8 ; c++)
+    {
+      color = reverse ? 7-c : c ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+      for (z = (color >> 2) & 1 ; z < l->depth ; z += 2)
+      {
+        int    x, y, nself ;
+        float  sum ;
+        size_t index ;
+
+        for (y = (color >> 1) & 1 ; y < l->height ; y += 2)
+          for (x = color & 1 ; x < l->width ; x += 2)
+          {
+            index = SOAP_INDEX(l, x, y, z) ;
+            if (l->fixed[index])
+              continue ;
+            sum = soapNeighborSum(l, l->u, x, y, z, &nself) + l->f[index] ;
+            l->u[index] = sum / (27-nself) ;
+          }
+      }
+    }
+  }
+}
+
+/*
+  trilinear interpolation of cell-centered coarse values: fine voxel x
+  gets (1-*pdx) of coarse voxel *px0 and *pdx of *px1
+*/
+static void
+soapProlongationWeights(int x, int ncoarse, int *px0, int *px1, float *pdx)
+{
+  float xc ;
+
+  xc = MAX(0, MIN((x-0.5f)/2, ncoarse-1)) ;
+  *px0 = (int)xc ;
+  *px1 = MIN(*px0+1, ncoarse-1) ;
+  *pdx = xc - *px0 ;
+}
+
+/* add the interpolated coarse correction to the fine level */
+static void
+soapProlongate(SOAP_LEVEL *coarse, SOAP_LEVEL *fine)
+{
+  int z ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < fine->depth ; z++)
+  {
+    int    x, y, x0, y0, z0, x1, y1, z1 ;
+    float  dx, dy, dz, *u = coarse->u ;
+    size_t index ;
+
+    soapProlongationWeights(z, coarse->depth, &z0, &z1, &dz) ;
+    for (y = 0 ; y < fine->height ; y++)
+    {
+      soapProlongationWeights(y, coarse->height, &y0, &y1, &dy) ;
+      for (x = 0 ; x < fine->width ; x++)
+      {
+        index = SOAP_INDEX(fine, x, y, z) ;
+        if (fine->fixed[index])
+          continue ;
+        soapProlongationWeights(x, coarse->width, &x0, &x1, &dx) ;
+        fine->u[index] +=
+          (1-dz)*((1-dy)*((1-dx)*u[SOAP_INDEX(coarse,x0,y0,z0)] + dx*u[SOAP_INDEX(coarse,x1,y0,z0)]) +
+                  dy    *((1-dx)*u[SOAP_INDEX(coarse,x0,y1,z0)] + dx*u[SOAP_INDEX(coarse,x1,y1,z0)])) +
+          dz    *((1-dy)*((1-dx)*u[SOAP_INDEX(coarse,x0,y0,z1)] + dx*u[SOAP_INDEX(coarse,x1,y0,z1)]) +
+                  dy    *((1-dx)*u[SOAP_INDEX(coarse,x0,y1,z1)] + dx*u[SOAP_INDEX(coarse,x1,y1,z1)])) ;
+      }
+    }
+  }
+}
+
+/*
+  the fine voxels along one axis that coarse voxel X gets a weight from
+  in soapProlongate (at most 6 of them)
+*/
+typedef struct
+{
+  int   n ;
+  int   x[6] ;
+  float w[6] ;
+} SOAP_STENCIL ;
+
+static SOAP_STENCIL *
+soapRestrictionStencil(int nfine, int ncoarse)
+{
+  SOAP_STENCIL *stencil ;
+  int          x, x0, x1 ;
+  float        dx ;
+
+  stencil = (SOAP_STENCIL *)calloc(ncoarse, sizeof(SOAP_STENCIL)) ;
+  if (stencil == NULL)
+    ErrorExit(ERROR_NOMEMORY, "soapRestrictionStencil: could not allocate %d", ncoarse) ;
+  for (x = 0 ; x < nfine ; x++)
+  {
+    soapProlongationWeights(x, ncoarse, &x0, &x1, &dx) ;
+    if (x1 == x0)
+    {
+      stencil[x0].x[stencil[x0].n] = x ;
+      stencil[x0].w[stencil[x0].n++] = 1 ;
+      continue ;
+    }
+    if (1-dx > 0)
+    {
+      stencil[x0].x[stencil[x0].n] = x ;
+      stencil[x0].w[stencil[x0].n++] = 1-dx ;
+    }
+    if (dx > 0)
+    {
+      stencil[x1].x[stencil[x1].n] = x ;
+      stencil[x1].w[stencil[x1].n++] = dx ;
+    }
+  }
+  return(stencil) ;
+}
+
+/*
+  restrict the fine residual to the coarse right-hand side with the
+  transpose of the prolongation. That sums 8 fine voxels per coarse one
+  where the rediscretized coarse operator is 4 times the fine one, so
+  the result is halved.
+*/
+static void
+soapRestrict(SOAP_LEVEL *fine, SOAP_LEVEL *coarse)
+{
+  SOAP_STENCIL *sx, *sy, *sz ;
+  int          z ;
+
+  sx = soapRestrictionStencil(fine->width, coarse->width) ;
+  sy = soapRestrictionStencil(fine->height, coarse->height) ;
+  sz = soapRestrictionStencil(fine->depth, coarse->depth) ;
+  memset(coarse->u, 0, (size_t)coarse->width*coarse->height*coarse->depth*sizeof(float)) ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < coarse->depth ; z++)
+  {
+    int    x, y, i, j, k ;
+    float  sum ;
+    size_t index ;
+
+    for (y = 0 ; y < coarse->height ; y++)
+      for (x = 0 ; x < coarse->width ; x++)
+      {
+        index = SOAP_INDEX(coarse, x, y, z) ;
+        if (coarse->fixed[index])
+        {
+          coarse->f[index] = 0 ;
+          continue ;
+        }
+        for (sum = 0, k = 0 ; k < sz[z].n ; k++)
+          for (j = 0 ; j < sy[y].n ; j++)
+            for (i = 0 ; i < sx[x].n ; i++)
+              sum += sz[z].w[k]*sy[y].w[j]*sx[x].w[i] *
+                fine->r[SOAP_INDEX(fine, sx[x].x[i], sy[y].x[j], sz[z].x[k])] ;
+        coarse->f[index] = sum/2 ;
+      }
+  }
+  free(sx) ;
+  free(sy) ;
+  free(sz) ;
+}
+
+/* a coarse voxel is fixed if any of its children is */
+static void
+soapBuildCoarseLevel(SOAP_LEVEL *fine, SOAP_LEVEL *coarse)
+{
+  int    x, y, z ;
+  size_t index ;
+
+  for (z = 0 ; z < fine->depth ; z++)
+    for (y = 0 ; y < fine->height ; y++)
+      for (x = 0 ; x < fine->width ; x++)
+      {
+        index = SOAP_INDEX(fine, x, y, z) ;
+        if (fine->fixed[index])
+          coarse->fixed[SOAP_INDEX(coarse, x/2, y/2, z/2)] = 1 ;
+      }
+}
+
+/* symmetric V-cycle on l->u starting from 0 */
+static void
+soapVcycle(SOAP_LEVEL *levels, int nlevels, int l)
+{
+  int i ;
+
+  memset(levels[l].u, 0, (size_t)levels[l].width*levels[l].height*levels[l].depth*sizeof(float)) ;
+  if (l == nlevels-1)
+  {
+    for (i = 0 ; i < SOAP_MG_COARSE_ITERS ; i++)
+    {
+      soapSmooth(&levels[l], 1, 0) ;
+      soapSmooth(&levels[l], 1, 1) ;
+    }
+    return ;
+  }
+  soapSmooth(&levels[l], 1, 0) ;
+  soapResidual(&levels[l], levels[l].u, levels[l].f, levels[l].r) ;
+  soapRestrict(&levels[l], &levels[l+1]) ;
+  soapVcycle(levels, nlevels, l+1) ;
+  soapProlongate(&levels[l+1], &levels[l]) ;
+  soapSmooth(&levels[l], 1, 1) ;
+}
+
+static double
+soapDot(SOAP_LEVEL *l, float *a, float *b)
+{
+  int    z ;
+  double dot, *slice_dot ;
+
+  slice_dot = (double *)calloc(l->depth, sizeof(double)) ;
+  if (slice_dot == NULL)
+    ErrorExit(ERROR_NOMEMORY, "soapDot: could not allocate %d slices", l->depth) ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < l->depth ; z++)
+  {
+    size_t index, end ;
+    double dot = 0 ;
+
+    end = SOAP_INDEX(l, 0, 0, z+1) ;
+    for (index = SOAP_INDEX(l, 0, 0, z) ; index < end ; index++)
+      dot += (double)a[index]*b[index] ;
+    slice_dot[z] = dot ;
+  }
+  for (dot = 0, z = 0 ; z < l->depth ; z++)
+    dot += slice_dot[z] ;
+  free(slice_dot) ;
+  return(dot) ;
+}
+
+/* a += s*b (or a = b + s*a if scale_a) */
+static void
+soapAxpy(SOAP_LEVEL *l, float *a, float *b, double s, int scale_a)
+{
+  int z ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < l->depth ; z++)
+  {
+    size_t index, end ;
+
+    end = SOAP_INDEX(l, 0, 0, z+1) ;
+    for (index = SOAP_INDEX(l, 0, 0, z) ; index < end ; index++)
+      if (scale_a)
+        a[index] = b[index] + s*a[index] ;
+      else
+        a[index] += s*b[index] ;
+  }
+}
+
+/*-----------------------------------------------------
+  Parameters:
+    mri_ctrl   - voxels that are CONTROL_MARKED are kept fixed
+    max_iter   - max # of (preconditioned conjugate gradient) iterations
+    min_change - stop when a Jacobi iteration would change no
+                 voxel by more than this. If <= 0 a small fraction of
+                 the range of the control values is used.
+
+  Description
+    Same result as MRIsoapBubble run to convergence (see above).
+  ------------------------------------------------------*/
+MRI *
+MRIsoapBubbleMultigrid(MRI *mri_src, MRI *mri_ctrl, MRI *mri_dst,
+                       int max_iter, float min_change)
+{
+  SOAP_LEVEL levels[SOAP_MG_MAX_LEVELS], *l ;
+  int        nlevels, width, height, depth, x, y, z, f, i, nfixed ;
+  float      max_change, best_change, tol, min_val, max_val, val, *u, *p ;
+  double     rz, rz_old, alpha ;
+  size_t     index, nvox ;
+
+  width = mri_src->width ;
+  height = mri_src->height ;
+  depth = mri_src->depth ;
+  if (!mri_dst)
+    mri_dst = MRIcopy(mri_src, NULL) ;
+
+  /*
+    build the hierarchy of grids. On the finest level u and f are the
+    preconditioned residual and the residual of the conjugate gradients
+  */
+  memset(levels, 0, sizeof(levels)) ;
+  for (nlevels = 0 ; nlevels < SOAP_MG_MAX_LEVELS ; )
+  {
+    l = &levels[nlevels] ;
+    l->width = nlevels ? (levels[nlevels-1].width+1)/2 : width ;
+    l->height = nlevels ? (levels[nlevels-1].height+1)/2 : height ;
+    l->depth = nlevels ? (levels[nlevels-1].depth+1)/2 : depth ;
+    nvox = (size_t)l->width*l->height*l->depth ;
+    l->u = (float *)calloc(nvox, sizeof(float)) ;
+    l->f = (float *)calloc(nvox, sizeof(float)) ;
+    l->r = (float *)calloc(nvox, sizeof(float)) ;
+    l->fixed = (unsigned char *)calloc(nvox, sizeof(unsigned char)) ;
+    if (!l->u || !l->f || !l->r || !l->fixed)
+      ErrorExit(ERROR_NOMEMORY, "MRIsoapBubbleMultigrid: could not allocate level %d",
+                nlevels) ;
+    nlevels++ ;
+    if (l->width <= 4 && l->height <= 4 && l->depth <= 4)
+      break ;
+  }
+  l = &levels[0] ;
+  nvox = (size_t)width*height*depth ;
+  u = (float *)calloc(nvox, sizeof(float)) ;
+  p = (float *)calloc(nvox, sizeof(float)) ;
+  if (!u || !p)
+    ErrorExit(ERROR_NOMEMORY, "MRIsoapBubbleMultigrid: could not allocate %dx%dx%d",
+              width, height, depth) ;
+
+  for (nfixed = 0, z = 0 ; z < depth ; z++)
+    for (y = 0 ; y < height ; y++)
+      for (x = 0 ; x < width ; x++)
+        if (MRIgetVoxVal(mri_ctrl, x, y, z, 0) == CONTROL_MARKED)
+        {
+          l->fixed[SOAP_INDEX(l, x, y, z)] = 1 ;
+          nfixed++ ;
+        }
+  for (i = 1 ; i < nlevels ; i++)
+    soapBuildCoarseLevel(&levels[i-1], &levels[i]) ;
+
+  for (f = 0 ; nfixed > 0 && f < mri_dst->nframes ; f++)
+  {
+    min_val = 1e10 ;
+    max_val = -1e10 ;
+    for (z = 0 ; z < depth ; z++)
+      for (y = 0 ; y < height ; y++)
+        for (x = 0 ; x < width ; x++)
+        {
+          index = SOAP_INDEX(l, x, y, z) ;
+          val = MRIgetVoxVal(mri_dst, x, y, z, f) ;
+          u[index] = val ;
+          if (l->fixed[index])
+          {
+            min_val = MIN(min_val, val) ;
+            max_val = MAX(max_val, val) ;
+          }
+        }
+    tol = min_change > 0 ? min_change : 1e-4*(max_val-min_val) ;
+    // can't get much below the float precision of the values
+    tol = MAX(tol, 1e-5*MAX(fabs(min_val), fabs(max_val))) ;
+    tol = MAX(tol, 1e-6) ;
+
+    /* preconditioned conjugate gradients for the correction to u */
+    max_change = soapResidual(l, u, NULL, l->f) ;
+    soapVcycle(levels, nlevels, 0) ;
+    memcpy(p, l->u, nvox*sizeof(float)) ;
+    rz = soapDot(l, l->f, l->u) ;
+    best_change = max_change ;
+    for (i = 0 ; i < max_iter && max_change >= tol && rz > 0 && max_change < 2*best_change ; i++)
+    {
+      /* l->u = A p */
+      soapResidual(l, p, NULL, l->u) ;
+      alpha = rz / -soapDot(l, p, l->u) ;
+      soapAxpy(l, u, p, alpha, 0) ;
+      max_change = soapResidual(l, u, NULL, l->f) ;
+      best_change = MIN(best_change, max_change) ;
+      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+        printf("soap bubble multigrid iteration %d: max change %f\n", i, max_change) ;
+      soapVcycle(levels, nlevels, 0) ;
+      rz_old = rz ;
+      rz = soapDot(l, l->f, l->u) ;
+      soapAxpy(l, p, l->u, rz/rz_old, 1) ;
+    }
+
+    for (z = 0 ; z < depth ; z++)
+      for (y = 0 ; y < height ; y++)
+        for (x = 0 ; x < width ; x++)
+        {
+          index = SOAP_INDEX(l, x, y, z) ;
+          if (l->fixed[index] == 0)
+            MRIsetVoxVal(mri_dst, x, y, z, f,
+                         mri_dst->type == MRI_FLOAT ? u[index] : nint(u[index])) ;
+        }
+  }
+
+  for (i = 0 ; i < nlevels ; i++)
+  {
+    free(levels[i].u) ;
+    free(levels[i].f) ;
+    free(levels[i].r) ;
+    free(levels[i].fixed) ;
+  }
+  free(u) ;
+  free(p) ;
+  return(mri_dst) ;
+}
+
+
 /*-----------------------------------------------------
   Parameters:
 
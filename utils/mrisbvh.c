@@ -0,0 +1,444 @@
+/**
+ * @file  mrisbvh.c
+ * @brief bounding volume hierarchy over surface triangles
+ *
+ * The tree is a binary hierarchy of axis-aligned boxes built by median
+ * splits along the longest axis of the triangle centroids, so its depth
+ * is logarithmic in the # of faces. Nodes are stored depth first with
+ * the left child directly after its parent. Queries descend into the
+ * nearer child first and prune boxes that are farther away than the best
+ * triangle found so far. The closest point on a triangle is computed
+ * exactly (Ericson, Real-Time Collision Detection, 5.1.5).
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "error.h"
+#include "diag.h"
+#include "macros.h"
+#include "mrisurf.h"
+#include "mrisbvh.h"
+
+#define BVH_LEAF_SIZE   4
+#define BVH_MAX_DEPTH   64
+
+static int    bvhBuild(MRIS_BVH *bvh, int *order, float *cent, float *box,
+                       int start, int end, int depth) ;
+static void   bvhSelect(int *order, float *cent, int axis,
+                        int start, int end, int k) ;
+static double bvhBoxDist2(MRIS_BVH_NODE *node, double x, double y, double z) ;
+static double bvhClosestPointOnTriangle(float *t, double x, double y, double z,
+                                        double *bary, double *c) ;
+
+MRIS_BVH *
+MRISbvhAlloc(MRI_SURFACE *mris, int which)
+{
+  MRIS_BVH  *bvh ;
+  int       fno, n, i, j, *order, *fnos ;
+  float     *cent, *box, *tri, *t, x, y, z ;
+  FACE      *f ;
+
+  bvh = (MRIS_BVH *)calloc(1, sizeof(MRIS_BVH)) ;
+  if (bvh == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISbvhAlloc: could not allocate tree") ;
+  bvh->which = which ;
+
+  for (n = fno = 0 ; fno < mris->nfaces ; fno++)
+    if (mris->faces[fno].ripflag == 0)
+      n++ ;
+  bvh->nfaces = n ;
+  if (n == 0)
+    return(bvh) ;
+
+  // triangles, their bounding boxes and centroids in face order
+  fnos = (int *)calloc(n, sizeof(int)) ;
+  order = (int *)calloc(n, sizeof(int)) ;
+  tri = (float *)calloc(9*n, sizeof(float)) ;
+  box = (float *)calloc(6*n, sizeof(float)) ;
+  cent = (float *)calloc(3*n, sizeof(float)) ;
+  bvh->nodes = (MRIS_BVH_NODE *)calloc(2*n, sizeof(MRIS_BVH_NODE)) ;
+  if (!fnos || !order || !tri || !box || !cent || !bvh->nodes)
+    ErrorExit(ERROR_NOMEMORY, "MRISbvhAlloc: could not allocate %d faces", n) ;
+
+  for (i = fno = 0 ; fno < mris->nfaces ; fno++)
+  {
+    f = &mris->faces[fno] ;
+    if (f->ripflag)
+      continue ;
+    fnos[i] = fno ;
+    order[i] = i ;
+    t = tri + 9*i ;
+    for (j = 0 ; j < VERTICES_PER_FACE ; j++)
+    {
+      MRISvertexCoord2XYZ_float(&mris->vertices[f->v[j]], which, &x, &y, &z) ;
+      t[3*j] = x ; t[3*j+1] = y ; t[3*j+2] = z ;
+    }
+    for (j = 0 ; j < 3 ; j++)
+    {
+      box[6*i+j] = MIN(t[j], MIN(t[3+j], t[6+j])) ;
+      box[6*i+3+j] = MAX(t[j], MAX(t[3+j], t[6+j])) ;
+      cent[3*i+j] = (t[j] + t[3+j] + t[6+j]) / 3 ;
+    }
+    i++ ;
+  }
+
+  bvhBuild(bvh, order, cent, box, 0, n, 0) ;
+
+  // store the triangles in leaf order so that a leaf is contiguous
+  bvh->tri = (float *)calloc(9*n, sizeof(float)) ;
+  bvh->fno = (int *)calloc(n, sizeof(int)) ;
+  if (!bvh->tri || !bvh->fno)
+    ErrorExit(ERROR_NOMEMORY, "MRISbvhAlloc: could not allocate %d faces", n) ;
+  for (i = 0 ; i < n ; i++)
+  {
+    memcpy(bvh->tri + 9*i, tri + 9*order[i], 9*sizeof(float)) ;
+    bvh->fno[i] = fnos[order[i]] ;
+  }
+
+  free(fnos) ;
+  free(order) ;
+  free(tri) ;
+  free(box) ;
+  free(cent) ;
+  return(bvh) ;
+}
+
+int
+MRISbvhFree(MRIS_BVH **pbvh)
+{
+  MRIS_BVH *bvh ;
+
+  bvh = *pbvh ;
+  *pbvh = NULL ;
+  if (bvh == NULL)
+    return(NO_ERROR) ;
+  if (bvh->nodes)
+    free(bvh->nodes) ;
+  if (bvh->tri)
+    free(bvh->tri) ;
+  if (bvh->fno)
+    free(bvh->fno) ;
+  free(bvh) ;
+  return(NO_ERROR) ;
+}
+
+/*
+  build the subtree over order[start..end) and return the index of its
+  root. Interior nodes split at the median centroid of their longest axis.
+*/
+static int
+bvhBuild(MRIS_BVH *bvh, int *order, float *cent, float *box,
+         int start, int end, int depth)
+{
+  MRIS_BVH_NODE  *node ;
+  int            nno, i, j, axis, mid, right ;
+  float          cmin[3], cmax[3], *b, *c ;
+
+  nno = bvh->nnodes++ ;
+  node = &bvh->nodes[nno] ;
+  for (j = 0 ; j < 3 ; j++)
+  {
+    node->bmin[j] = cmin[j] = 1e10 ;
+    node->bmax[j] = cmax[j] = -1e10 ;
+  }
+  for (i = start ; i < end ; i++)
+  {
+    b = box + 6*order[i] ;
+    c = cent + 3*order[i] ;
+    for (j = 0 ; j < 3 ; j++)
+    {
+      node->bmin[j] = MIN(node->bmin[j], b[j]) ;
+      node->bmax[j] = MAX(node->bmax[j], b[3+j]) ;
+      cmin[j] = MIN(cmin[j], c[j]) ;
+      cmax[j] = MAX(cmax[j], c[j]) ;
+    }
+  }
+
+  axis = 0 ;
+  for (j = 1 ; j < 3 ; j++)
+    if (cmax[j]-cmin[j] > cmax[axis]-cmin[axis])
+      axis = j ;
+
+  // small enough, or all centroids coincide and can't be split
+  if (end-start <= BVH_LEAF_SIZE || cmax[axis] <= cmin[axis] ||
+      depth >= BVH_MAX_DEPTH-2)
+  {
+    node->first = start ;
+    node->nfaces = end-start ;
+    return(nno) ;
+  }
+
+  mid = (start+end)/2 ;
+  bvhSelect(order, cent, axis, start, end, mid) ;
+  bvhBuild(bvh, order, cent, box, start, mid, depth+1) ;
+  right = bvhBuild(bvh, order, cent, box, mid, end, depth+1) ;
+  node = &bvh->nodes[nno] ;
+  node->first = right ;
+  node->nfaces = 0 ;
+  return(nno) ;
+}
+
+/*
+  partially sort order[start..end) by centroid coordinate so that element
+  k is in its sorted position, with smaller ones before and larger after.
+*/
+static void
+bvhSelect(int *order, float *cent, int axis, int start, int end, int k)
+{
+  int    lo, hi, i, j, tmp ;
+  float  pivot ;
+
+  lo = start ;
+  hi = end-1 ;
+  while (lo < hi)
+  {
+    pivot = cent[3*order[(lo+hi)/2]+axis] ;
+    i = lo ;
+    j = hi ;
+    while (i <= j)
+    {
+      while (cent[3*order[i]+axis] < pivot)
+        i++ ;
+      while (cent[3*order[j]+axis] > pivot)
+        j-- ;
+      if (i <= j)
+      {
+        tmp = order[i] ; order[i] = order[j] ; order[j] = tmp ;
+        i++ ;
+        j-- ;
+      }
+    }
+    if (k <= j)
+      hi = j ;
+    else if (k >= i)
+      lo = i ;
+    else
+      break ;
+  }
+}
+
+static double
+bvhBoxDist2(MRIS_BVH_NODE *node, double x, double y, double z)
+{
+  double d, dist ;
+
+  dist = 0 ;
+  d = node->bmin[0]-x ; if (d > 0) dist += d*d ;
+  d = x-node->bmax[0] ; if (d > 0) dist += d*d ;
+  d = node->bmin[1]-y ; if (d > 0) dist += d*d ;
+  d = y-node->bmax[1] ; if (d > 0) dist += d*d ;
+  d = node->bmin[2]-z ; if (d > 0) dist += d*d ;
+  d = z-node->bmax[2] ; if (d > 0) dist += d*d ;
+  return(dist) ;
+}
+
+/*
+  closest point c on triangle t (a,b,c packed in 9 floats) to (x,y,z) and
+  its barycentric weights. Returns the squared distance.
+*/
+static double
+bvhClosestPointOnTriangle(float *t, double x, double y, double z,
+                          double *bary, double *c)
+{
+  double ab[3], ac[3], ap[3], bp[3], cp[3], d1, d2, d3, d4, d5, d6,
+         va, vb, vc, v, w, denom ;
+  int    j ;
+
+  for (j = 0 ; j < 3 ; j++)
+  {
+    ab[j] = t[3+j] - t[j] ;
+    ac[j] = t[6+j] - t[j] ;
+  }
+  ap[0] = x-t[0] ; ap[1] = y-t[1] ; ap[2] = z-t[2] ;
+  d1 = ab[0]*ap[0] + ab[1]*ap[1] + ab[2]*ap[2] ;
+  d2 = ac[0]*ap[0] + ac[1]*ap[1] + ac[2]*ap[2] ;
+  if (d1 <= 0 && d2 <= 0)    // vertex region a
+  {
+    bary[0] = 1 ; bary[1] = bary[2] = 0 ;
+  }
+  else
+  {
+    bp[0] = x-t[3] ; bp[1] = y-t[4] ; bp[2] = z-t[5] ;
+    d3 = ab[0]*bp[0] + ab[1]*bp[1] + ab[2]*bp[2] ;
+    d4 = ac[0]*bp[0] + ac[1]*bp[1] + ac[2]*bp[2] ;
+    cp[0] = x-t[6] ; cp[1] = y-t[7] ; cp[2] = z-t[8] ;
+    d5 = ab[0]*cp[0] + ab[1]*cp[1] + ab[2]*cp[2] ;
+    d6 = ac[0]*cp[0] + ac[1]*cp[1] + ac[2]*cp[2] ;
+    vc = d1*d4 - d3*d2 ;
+    vb = d5*d2 - d1*d6 ;
+    va = d3*d6 - d5*d4 ;
+    if (d3 >= 0 && d4 <= d3)   // vertex region b
+    {
+      bary[1] = 1 ; bary[0] = bary[2] = 0 ;
+    }
+    else if (d6 >= 0 && d5 <= d6)  // vertex region c
+    {
+      bary[2] = 1 ; bary[0] = bary[1] = 0 ;
+    }
+    else if (vc <= 0 && d1 >= 0 && d3 <= 0)  // edge ab
+    {
+      v = d1 / (d1-d3) ;
+      bary[0] = 1-v ; bary[1] = v ; bary[2] = 0 ;
+    }
+    else if (vb <= 0 && d2 >= 0 && d6 <= 0)  // edge ac
+    {
+      w = d2 / (d2-d6) ;
+      bary[0] = 1-w ; bary[1] = 0 ; bary[2] = w ;
+    }
+    else if (va <= 0 && (d4-d3) >= 0 && (d5-d6) >= 0)  // edge bc
+    {
+      w = (d4-d3) / ((d4-d3) + (d5-d6)) ;
+      bary[0] = 0 ; bary[1] = 1-w ; bary[2] = w ;
+    }
+    else   // interior
+    {
+      denom = va+vb+vc ;
+      if (FZERO(denom))   // degenerate triangle
+      {
+        bary[0] = 1 ; bary[1] = bary[2] = 0 ;
+      }
+      else
+      {
+        bary[1] = vb / denom ;
+        bary[2] = vc / denom ;
+        bary[0] = 1 - bary[1] - bary[2] ;
+      }
+    }
+  }
+  for (j = 0 ; j < 3 ; j++)
+    c[j] = bary[0]*t[j] + bary[1]*t[3+j] + bary[2]*t[6+j] ;
+  return(SQR(c[0]-x) + SQR(c[1]-y) + SQR(c[2]-z)) ;
+}
+
+int
+MRISbvhClosestPoint(MRIS_BVH *bvh, float x, float y, float z,
+                    float max_dist, MRIS_CLOSEST_POINT *cp)
+{
+  MRIS_BVH_NODE  *node ;
+  int            stack[BVH_MAX_DEPTH], sp, nno, child_near, child_far, i,
+                 best_i ;
+  double         stack_dist[BVH_MAX_DEPTH], best, dist, dnear, dfar,
+                 bary[3], c[3], best_bary[3], best_c[3] ;
+
+  best = max_dist > 0 ? max_dist*max_dist : 1e30 ;
+  best_i = -1 ;
+  best_bary[0] = best_bary[1] = best_bary[2] = 0 ;
+  best_c[0] = best_c[1] = best_c[2] = 0 ;
+
+  sp = 0 ;
+  if (bvh->nfaces > 0 && bvhBoxDist2(&bvh->nodes[0], x, y, z) < best)
+  {
+    stack[sp] = 0 ;
+    stack_dist[sp++] = 0 ;
+  }
+  while (sp > 0)
+  {
+    sp-- ;
+    if (stack_dist[sp] >= best)  // something closer was found since the push
+      continue ;
+    nno = stack[sp] ;
+    for (;;)
+    {
+      node = &bvh->nodes[nno] ;
+      if (node->nfaces > 0)
+      {
+        for (i = node->first ; i < node->first+node->nfaces ; i++)
+        {
+          dist = bvhClosestPointOnTriangle(bvh->tri+9*i, x, y, z, bary, c) ;
+          if (dist < best)
+          {
+            best = dist ;
+            best_i = i ;
+            memcpy(best_bary, bary, sizeof(bary)) ;
+            memcpy(best_c, c, sizeof(c)) ;
+          }
+        }
+        break ;
+      }
+      child_near = nno+1 ;
+      child_far = node->first ;
+      dnear = bvhBoxDist2(&bvh->nodes[child_near], x, y, z) ;
+      dfar = bvhBoxDist2(&bvh->nodes[child_far], x, y, z) ;
+      if (dfar < dnear)
+      {
+        child_near = child_far ; child_far = nno+1 ;
+        dist = dnear ; dnear = dfar ; dfar = dist ;
+      }
+      if (dnear >= best)
+        break ;
+      if (dfar < best)
+      {
+        stack[sp] = child_far ;
+        stack_dist[sp++] = dfar ;
+      }
+      nno = child_near ;
+    }
+  }
+
+  if (best_i < 0)
+  {
+    cp->fno = -1 ;
+    cp->bary[0] = cp->bary[1] = cp->bary[2] = 0 ;
+    cp->x = x ; cp->y = y ; cp->z = z ;
+    cp->dist = max_dist ;
+    return(-1) ;
+  }
+  cp->fno = bvh->fno[best_i] ;
+  cp->bary[0] = best_bary[0] ;
+  cp->bary[1] = best_bary[1] ;
+  cp->bary[2] = best_bary[2] ;
+  cp->x = best_c[0] ;
+  cp->y = best_c[1] ;
+  cp->z = best_c[2] ;
+  cp->dist = sqrt(best) ;
+  return(cp->fno) ;
+}
+
+int
+MRISbvhClosestVertexPoints(MRIS_BVH *bvh, MRI_SURFACE *mris, int which,
+                           float max_dist, MRIS_CLOSEST_POINT *cps)
+{
+  int vno, nmissed ;
+
+  nmissed = 0 ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 256) reduction(+:nmissed)
+#endif
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    VERTEX *v ;
+    float  x, y, z ;
+
+    v = &mris->vertices[vno] ;
+    if (v->ripflag)
+    {
+      memset(&cps[vno], 0, sizeof(MRIS_CLOSEST_POINT)) ;
+      cps[vno].fno = -1 ;
+      continue ;
+    }
+    MRISvertexCoord2XYZ_float(v, which, &x, &y, &z) ;
+    if (MRISbvhClosestPoint(bvh, x, y, z, max_dist, &cps[vno]) < 0)
+      nmissed++ ;
+  }
+  return(nmissed) ;
+}
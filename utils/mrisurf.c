@@ -46,6 +46,7 @@
 #include "timer.h"
 #include "const.h"
 #include "mrishash.h"
+#include "mrisbvh.h"
 #include "icosahedron.h"
 #include "tritri.h"
 #include "timer.h"
@@ -32993,6 +32994,306 @@ MRISfindClosestVertex(MRI_SURFACE *mris,
   }
   return(min_v) ;
 }
+/*-----------------------------------------------------
+  MRISnearestVertexField() - for every voxel of mri_template within
+  band mm of mris, find the closest non-ripped vertex, i.e. what
+  MRISfindClosestVertex() or MHTfindClosestVertexNo() would return,
+  for the whole volume at once. vox2surf maps voxel CRS to surface
+  coordinates (e.g. MRIxfmCRS2XYZtkreg()). Returns an MRI_INT volume
+  of vertex numbers (-1 beyond band) and, if pmri_dist != NULL, an
+  MRI_FLOAT volume of distances in mm.
+
+  The vertex numbers are propagated from the voxels containing the
+  vertices with forward/backward sweeps along each axis (a vector
+  distance transform), then improved by walking to closer neighboring
+  vertices. Voxels found to be within exact_band mm of the surface are
+  finally checked against all vertices that could be closer, so they
+  are exact; farther out the answer may rarely be a vertex that is a
+  fraction of a mm farther than the closest one.
+  ------------------------------------------------------*/
+#define NVF_INF 1e30
+
+typedef struct
+{
+  int    x0, y0, z0, nx, ny, nz ;
+  double o[3], cx[3], cy[3], cz[3] ;   /* voxel to surface coords */
+  int    *vno ;                         /* closest vertex so far */
+  double *d2 ;                          /* its squared distance */
+  int    *cell_start, *cell_vno ;       /* vertices binned by voxel */
+} NVF ;
+
+#define NVF_INDEX(nvf,x,y,z) ((x) + (long)(nvf)->nx*((y) + (long)(nvf)->ny*(z)))
+
+static double
+nvfDist2(MRI_SURFACE *mris, NVF *nvf, int x, int y, int z, int vno)
+{
+  VERTEX *v = &mris->vertices[vno] ;
+  double dx, dy, dz ;
+
+  x += nvf->x0 ; y += nvf->y0 ; z += nvf->z0 ;
+  dx = nvf->o[0] + x*nvf->cx[0] + y*nvf->cy[0] + z*nvf->cz[0] - v->x ;
+  dy = nvf->o[1] + x*nvf->cx[1] + y*nvf->cy[1] + z*nvf->cz[1] - v->y ;
+  dz = nvf->o[2] + x*nvf->cx[2] + y*nvf->cy[2] + z*nvf->cz[2] - v->z ;
+  return(dx*dx + dy*dy + dz*dz) ;
+}
+
+/* offer candidate vertex vno to voxel (x,y,z) */
+static void
+nvfTry(MRI_SURFACE *mris, NVF *nvf, int x, int y, int z, int vno)
+{
+  long   ind = NVF_INDEX(nvf, x, y, z) ;
+  double d2 ;
+
+  if (vno < 0 || vno == nvf->vno[ind])
+    return ;
+  d2 = nvfDist2(mris, nvf, x, y, z, vno) ;
+  if (d2 < nvf->d2[ind] || (d2 == nvf->d2[ind] && vno < nvf->vno[ind]))
+  {
+    nvf->d2[ind] = d2 ;
+    nvf->vno[ind] = vno ;
+  }
+}
+
+/* forward and backward sweep of all lines along axis (0=x, 1=y, 2=z) */
+static void
+nvfSweep(MRI_SURFACE *mris, NVF *nvf, int axis)
+{
+  int  n, nlines, nouter, outer ;
+
+  n = axis == 0 ? nvf->nx : axis == 1 ? nvf->ny : nvf->nz ;
+  nouter = axis == 2 ? nvf->ny : nvf->nz ;
+  nlines = axis == 0 ? nvf->ny : nvf->nx ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (outer = 0 ; outer < nouter ; outer++)
+  {
+    int line, i, x, y, z, xp, yp, zp ;
+
+    for (line = 0 ; line < nlines ; line++)
+    {
+      for (i = 1 ; i < n ; i++)
+      {
+        x = axis == 0 ? i : line ;
+        y = axis == 1 ? i : axis == 0 ? line : outer ;
+        z = axis == 2 ? i : outer ;
+        xp = x - (axis == 0) ; yp = y - (axis == 1) ; zp = z - (axis == 2) ;
+        nvfTry(mris, nvf, x, y, z, nvf->vno[NVF_INDEX(nvf, xp, yp, zp)]) ;
+      }
+      for (i = n-2 ; i >= 0 ; i--)
+      {
+        x = axis == 0 ? i : line ;
+        y = axis == 1 ? i : axis == 0 ? line : outer ;
+        z = axis == 2 ? i : outer ;
+        xp = x + (axis == 0) ; yp = y + (axis == 1) ; zp = z + (axis == 2) ;
+        nvfTry(mris, nvf, x, y, z, nvf->vno[NVF_INDEX(nvf, xp, yp, zp)]) ;
+      }
+    }
+  }
+}
+
+MRI *
+MRISnearestVertexField(MRI_SURFACE *mris, MRI *mri_template,
+                       MATRIX *vox2surf, double band, double exact_band,
+                       MRI **pmri_dist)
+{
+  MATRIX *surf2vox ;
+  MRI    *mri_vno, *mri_dist = NULL ;
+  NVF    nvf ;
+  int    vno, x, y, z, x1, y1, z1, pad, ncells, nvertices, *cell_of ;
+  double hmin, h ;
+  long   ind ;
+  VERTEX *v ;
+
+  mri_vno = MRIcloneDifferentType(mri_template, MRI_INT) ;
+  MRIsetValues(mri_vno, -1) ;
+  if (pmri_dist)
+  {
+    mri_dist = MRIcloneDifferentType(mri_template, MRI_FLOAT) ;
+    MRIsetValues(mri_dist, -1) ;
+    *pmri_dist = mri_dist ;
+  }
+
+  for (x = 0 ; x < 3 ; x++)
+  {
+    nvf.o[x] = *MATRIX_RELT(vox2surf, x+1, 4) ;
+    nvf.cx[x] = *MATRIX_RELT(vox2surf, x+1, 1) ;
+    nvf.cy[x] = *MATRIX_RELT(vox2surf, x+1, 2) ;
+    nvf.cz[x] = *MATRIX_RELT(vox2surf, x+1, 3) ;
+  }
+  hmin = sqrt(SQR(nvf.cx[0])+SQR(nvf.cx[1])+SQR(nvf.cx[2])) ;
+  h = sqrt(SQR(nvf.cy[0])+SQR(nvf.cy[1])+SQR(nvf.cy[2])) ;
+  hmin = MIN(hmin, h) ;
+  h = sqrt(SQR(nvf.cz[0])+SQR(nvf.cz[1])+SQR(nvf.cz[2])) ;
+  hmin = MIN(hmin, h) ;
+  surf2vox = MatrixInverse(vox2surf, NULL) ;
+  if (surf2vox == NULL)
+    ErrorReturn(mri_vno, (ERROR_BADPARM,
+                          "MRISnearestVertexField: singular vox2surf")) ;
+
+  /* voxel (rounded and clamped to the volume) of every vertex, and the
+     box around them that is within reach of the band */
+  cell_of = (int *)calloc(3*mris->nvertices, sizeof(int)) ;
+  nvf.x0 = mri_template->width ; nvf.y0 = mri_template->height ;
+  nvf.z0 = mri_template->depth ;
+  x1 = y1 = z1 = -1 ;
+  nvertices = 0 ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    int c[3], k ;
+
+    v = &mris->vertices[vno] ;
+    if (v->ripflag)
+      continue ;
+    for (k = 0 ; k < 3 ; k++)
+    {
+      c[k] = nint(*MATRIX_RELT(surf2vox, k+1, 1) * v->x +
+                  *MATRIX_RELT(surf2vox, k+1, 2) * v->y +
+                  *MATRIX_RELT(surf2vox, k+1, 3) * v->z +
+                  *MATRIX_RELT(surf2vox, k+1, 4)) ;
+    }
+    c[0] = MAX(0, MIN(mri_template->width-1, c[0])) ;
+    c[1] = MAX(0, MIN(mri_template->height-1, c[1])) ;
+    c[2] = MAX(0, MIN(mri_template->depth-1, c[2])) ;
+    memmove(cell_of+3*vno, c, sizeof(c)) ;
+    nvf.x0 = MIN(nvf.x0, c[0]) ; x1 = MAX(x1, c[0]) ;
+    nvf.y0 = MIN(nvf.y0, c[1]) ; y1 = MAX(y1, c[1]) ;
+    nvf.z0 = MIN(nvf.z0, c[2]) ; z1 = MAX(z1, c[2]) ;
+    nvertices++ ;
+  }
+  MatrixFree(&surf2vox) ;
+  if (nvertices == 0)
+  {
+    free(cell_of) ;
+    return(mri_vno) ;
+  }
+  pad = (int)ceil(band/hmin) + 1 ;
+  nvf.x0 = MAX(0, nvf.x0-pad) ; x1 = MIN(mri_template->width-1, x1+pad) ;
+  nvf.y0 = MAX(0, nvf.y0-pad) ; y1 = MIN(mri_template->height-1, y1+pad) ;
+  nvf.z0 = MAX(0, nvf.z0-pad) ; z1 = MIN(mri_template->depth-1, z1+pad) ;
+  nvf.nx = x1 - nvf.x0 + 1 ;
+  nvf.ny = y1 - nvf.y0 + 1 ;
+  nvf.nz = z1 - nvf.z0 + 1 ;
+  ncells = nvf.nx * nvf.ny * nvf.nz ;
+
+  /* bin the vertices by voxel (compressed rows: cell_start[ind] ..
+     cell_start[ind+1]-1 index cell_vno) */
+  nvf.cell_start = (int *)calloc(ncells+1, sizeof(int)) ;
+  nvf.cell_vno = (int *)calloc(nvertices, sizeof(int)) ;
+  nvf.vno = (int *)calloc(ncells, sizeof(int)) ;
+  nvf.d2 = (double *)calloc(ncells, sizeof(double)) ;
+  if (!nvf.cell_start || !nvf.cell_vno || !nvf.vno || !nvf.d2)
+    ErrorExit(ERROR_NOMEMORY,
+              "MRISnearestVertexField: could not allocate %dx%dx%d field",
+              nvf.nx, nvf.ny, nvf.nz) ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    if (mris->vertices[vno].ripflag)
+      continue ;
+    ind = NVF_INDEX(&nvf, cell_of[3*vno]-nvf.x0, cell_of[3*vno+1]-nvf.y0,
+                    cell_of[3*vno+2]-nvf.z0) ;
+    nvf.cell_start[ind+1]++ ;
+  }
+  for (ind = 0 ; ind < ncells ; ind++)
+    nvf.cell_start[ind+1] += nvf.cell_start[ind] ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    if (mris->vertices[vno].ripflag)
+      continue ;
+    ind = NVF_INDEX(&nvf, cell_of[3*vno]-nvf.x0, cell_of[3*vno+1]-nvf.y0,
+                    cell_of[3*vno+2]-nvf.z0) ;
+    nvf.cell_vno[nvf.cell_start[ind] + nvf.vno[ind]++] = vno ;
+  }
+  free(cell_of) ;
+
+  /* seed every voxel with the closest of its own vertices */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < nvf.nz ; z++)
+  {
+    int  xk, yk, k ;
+    long i ;
+
+    for (yk = 0 ; yk < nvf.ny ; yk++)
+      for (xk = 0 ; xk < nvf.nx ; xk++)
+      {
+        i = NVF_INDEX(&nvf, xk, yk, z) ;
+        nvf.vno[i] = -1 ;
+        nvf.d2[i] = NVF_INF ;
+        for (k = nvf.cell_start[i] ; k < nvf.cell_start[i+1] ; k++)
+          nvfTry(mris, &nvf, xk, yk, z, nvf.cell_vno[k]) ;
+      }
+  }
+
+  /* propagate: three rounds of sweeps along x, y and z */
+  for (x = 0 ; x < 3 ; x++)
+  {
+    nvfSweep(mris, &nvf, 0) ;
+    nvfSweep(mris, &nvf, 1) ;
+    nvfSweep(mris, &nvf, 2) ;
+  }
+
+  /* improve by walking over the surface, and search exhaustively near it */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (z = 0 ; z < nvf.nz ; z++)
+  {
+    int    xk, yk, n, R, cx, cy, cz, k, improved, vcur ;
+    long   i, ci ;
+    VERTEX *vc ;
+
+    for (yk = 0 ; yk < nvf.ny ; yk++)
+      for (xk = 0 ; xk < nvf.nx ; xk++)
+      {
+        i = NVF_INDEX(&nvf, xk, yk, z) ;
+        if (nvf.vno[i] < 0)
+          continue ;
+        do
+        {
+          improved = 0 ;
+          vcur = nvf.vno[i] ;
+          vc = &mris->vertices[vcur] ;
+          for (n = 0 ; n < vc->vnum ; n++)
+            if (!mris->vertices[vc->v[n]].ripflag)
+              nvfTry(mris, &nvf, xk, yk, z, vc->v[n]) ;
+          improved = (nvf.vno[i] != vcur) ;
+        } while (improved) ;
+
+        if (nvf.d2[i] > SQR(exact_band))
+          continue ;
+        /* a vertex binned k voxels away (in the max norm) is at least
+           (k-0.5)*hmin mm away */
+        R = (int)ceil(sqrt(nvf.d2[i])/hmin + 0.5) ;
+        for (cz = MAX(0, z-R) ; cz <= MIN(nvf.nz-1, z+R) ; cz++)
+          for (cy = MAX(0, yk-R) ; cy <= MIN(nvf.ny-1, yk+R) ; cy++)
+            for (cx = MAX(0, xk-R) ; cx <= MIN(nvf.nx-1, xk+R) ; cx++)
+            {
+              ci = NVF_INDEX(&nvf, cx, cy, cz) ;
+              for (k = nvf.cell_start[ci] ; k < nvf.cell_start[ci+1] ; k++)
+                nvfTry(mris, &nvf, xk, yk, z, nvf.cell_vno[k]) ;
+            }
+      }
+  }
+
+  for (z = 0 ; z < nvf.nz ; z++)
+    for (y = 0 ; y < nvf.ny ; y++)
+      for (x = 0 ; x < nvf.nx ; x++)
+      {
+        ind = NVF_INDEX(&nvf, x, y, z) ;
+        if (nvf.vno[ind] < 0 || nvf.d2[ind] > SQR(band))
+          continue ;
+        MRIsetVoxVal(mri_vno, x+nvf.x0, y+nvf.y0, z+nvf.z0, 0, nvf.vno[ind]) ;
+        if (mri_dist)
+          MRIsetVoxVal(mri_dist, x+nvf.x0, y+nvf.y0, z+nvf.z0, 0,
+                       sqrt(nvf.d2[ind])) ;
+      }
+
+  free(nvf.cell_start) ; free(nvf.cell_vno) ;
+  free(nvf.vno) ; free(nvf.d2) ;
+  return(mri_vno) ;
+}
 /*-----------------------------------------------------
   Parameters:
 
@@ -35628,17 +35929,36 @@ MRISfindClosestOrigVertices(MRI_SURFACE *mris, int nbhd_size)
 /*
   find the closest pial vertex and use it's spherical coords to initialize
   the thickness minimization. Put the v->c[xyz] coords of the nearest pial vertex into v->[xyz] of each vertex.
+
+  The exact closest point on the pial surface is used when it passes the
+  same tests as the vertex search: it is outwards from the white surface
+  and its face has a vertex within nbhd_size of vno. The canonical coords
+  are then interpolated within that face and projected back onto the
+  sphere, and v->curv is set to the face vertex nearest to that point.
+  Otherwise the closest pial vertex is used as before.
 */
 int
 MRISfindClosestPialVerticesCanonicalCoords(MRI_SURFACE *mris, int nbhd_size)
 {
   int     vno, n, vlist[100000], vtotal, ns, i,
-          vnum, nbr_count[100], min_n, min_vno ;
+          vnum, nbr_count[100], min_n, min_vno, nexact ;
   VERTEX  *v, *vn, *vn2 ;
-  float   dx, dy, dz, dist, min_dist, nx, ny, nz, dot ;
+  FACE    *f ;
+  float   dx, dy, dz, dist, min_dist, nx, ny, nz, dot,
+          x, y, z, radius, len ;
+  MRIS_BVH            *bvh ;
+  MRIS_CLOSEST_POINT  *cps, *cp ;
 
   memset(nbr_count, 0, 100*sizeof(int)) ;
 
+  cps = (MRIS_CLOSEST_POINT *)calloc(mris->nvertices, sizeof(MRIS_CLOSEST_POINT)) ;
+  if (cps == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISfindClosestPialVerticesCanonicalCoords: could not allocate %d points", mris->nvertices) ;
+  bvh = MRISbvhAlloc(mris, PIAL_VERTICES) ;
+  MRISbvhClosestVertexPoints(bvh, mris, WHITE_VERTICES, 0, cps) ;
+  MRISbvhFree(&bvh) ;
+
+  nexact = 0 ;
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     v = &mris->vertices[vno] ;
@@ -35714,6 +36034,46 @@ MRISfindClosestPialVerticesCanonicalCoords(MRI_SURFACE *mris, int nbhd_size)
     }
 
     nbr_count[min_n]++ ;
+
+    /* use the exact closest point if its face is in the neighborhood
+       searched above and it passes the same outward tests */
+    cp = &cps[vno] ;
+    f = NULL ;
+    if (cp->fno >= 0)
+    {
+      f = &mris->faces[cp->fno] ;
+      for (n = 0 ; n < VERTICES_PER_FACE ; n++)
+        if (mris->vertices[f->v[n]].marked)
+        {
+          break ;
+        }
+      if (n == VERTICES_PER_FACE)
+      {
+        f = NULL ;
+      }
+    }
+    if (f)
+    {
+      dot = (cp->x-v->whitex)*nx + (cp->y-v->whitey)*ny + (cp->z-v->whitez)*nz ;
+      if (dot < 0) /* must be outwards from surface */
+      {
+        f = NULL ;
+      }
+    }
+    if (f)
+    {
+      dot = 0 ;
+      for (n = 0 ; n < VERTICES_PER_FACE ; n++)
+      {
+        vn = &mris->vertices[f->v[n]] ;
+        dot += cp->bary[n]*(vn->wnx*nx + vn->wny*ny + vn->wnz*nz) ;
+      }
+      if (dot < 0) /* must be outwards from surface */
+      {
+        f = NULL ;
+      }
+    }
+
     for (n = 0 ; n < vtotal ; n++)
     {
       vn = &mris->vertices[vlist[n]] ;
@@ -35723,10 +36083,42 @@ MRISfindClosestPialVerticesCanonicalCoords(MRI_SURFACE *mris, int nbhd_size)
       }
       vn->marked = 0 ;
     }
-    v->curv = min_vno ;
-    v->x = mris->vertices[min_vno].cx ;
-    v->y = mris->vertices[min_vno].cy ;
-    v->z = mris->vertices[min_vno].cz ;
+
+    if (f == NULL)
+    {
+      v->curv = min_vno ;
+      v->x = mris->vertices[min_vno].cx ;
+      v->y = mris->vertices[min_vno].cy ;
+      v->z = mris->vertices[min_vno].cz ;
+      continue ;
+    }
+
+    nexact++ ;
+    x = y = z = radius = 0 ;
+    min_n = 0 ;
+    for (n = 0 ; n < VERTICES_PER_FACE ; n++)
+    {
+      vn = &mris->vertices[f->v[n]] ;
+      x += cp->bary[n]*vn->cx ;
+      y += cp->bary[n]*vn->cy ;
+      z += cp->bary[n]*vn->cz ;
+      radius += cp->bary[n]*sqrt(SQR(vn->cx)+SQR(vn->cy)+SQR(vn->cz)) ;
+      if (cp->bary[n] > cp->bary[min_n])
+      {
+        min_n = n ;
+      }
+    }
+    len = sqrt(x*x + y*y + z*z) ;
+    if (!FZERO(len))
+    {
+      x *= radius/len ;
+      y *= radius/len ;
+      z *= radius/len ;
+    }
+    v->curv = f->v[min_n] ;
+    v->x = x ;
+    v->y = y ;
+    v->z = z ;
   }
 
 
@@ -35734,6 +36126,8 @@ MRISfindClosestPialVerticesCanonicalCoords(MRI_SURFACE *mris, int nbhd_size)
   {
     fprintf(stdout, "%d vertices at %d distance\n", nbr_count[n], n) ;
   }
+  fprintf(stdout, "%d vertices used the closest pial point\n", nexact) ;
+  free(cps) ;
   return(NO_ERROR) ;
 }
 int
@@ -35969,6 +36363,58 @@ MRISmeasureCorticalThickness(MRI_SURFACE *mris, int nbhd_size, float max_thick)
   }
   return(NO_ERROR) ;
 }
+/*
+  Same measure as MRISmeasureCorticalThickness (the average of the
+  white->pial and pial->white distances), but each distance is to the
+  exact closest point on the other surface rather than to the closest
+  vertex within nbhd_size rings, so it doesn't depend on mesh density.
+  Distances are truncated at max_thick. The white matter surface is
+  expected in ORIGINAL_VERTICES and the pial surface in the current ones.
+*/
+int
+MRISmeasureCorticalThicknessExact(MRI_SURFACE *mris, float max_thick)
+{
+  int                 vno, nwg_bad, ngw_bad ;
+  VERTEX              *v ;
+  MRIS_BVH            *bvh ;
+  MRIS_CLOSEST_POINT  *cps ;
+
+  cps = (MRIS_CLOSEST_POINT *)calloc(mris->nvertices, sizeof(MRIS_CLOSEST_POINT)) ;
+  if (cps == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISmeasureCorticalThicknessExact: could not allocate %d points", mris->nvertices) ;
+
+  /* white->gray */
+  bvh = MRISbvhAlloc(mris, CURRENT_VERTICES) ;
+  nwg_bad = MRISbvhClosestVertexPoints(bvh, mris, ORIGINAL_VERTICES, max_thick, cps) ;
+  MRISbvhFree(&bvh) ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    v->curv = v->ripflag ? 0 : cps[vno].dist ;
+  }
+
+  /* gray->white */
+  bvh = MRISbvhAlloc(mris, ORIGINAL_VERTICES) ;
+  ngw_bad = MRISbvhClosestVertexPoints(bvh, mris, CURRENT_VERTICES, max_thick, cps) ;
+  MRISbvhFree(&bvh) ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    if (v->ripflag)
+    {
+      continue ;
+    }
+    if (vno == Gdiag_no)
+      fprintf(stdout, "v %d, white->gray=%2.2f, gray->white=%2.2f (face %d)\n",
+              vno, v->curv, cps[vno].dist, cps[vno].fno) ;
+    v->curv = (v->curv+cps[vno].dist)/2 ;
+  }
+
+  fprintf(stdout, "thickness calculation complete, %d:%d truncations.\n",
+          nwg_bad, ngw_bad) ;
+  free(cps) ;
+  return(NO_ERROR) ;
+}
 #else
 #define MAX_THICKNESS 6.0f
 int
@@ -37813,417 +38259,720 @@ MRIScomputeWhiteSurfaceValues
 #endif
 #endif
 
-#define MAX_SAMPLES 1000
-int
-MRIScomputeBorderValues(MRI_SURFACE *mris,MRI *mri_brain,
-                        MRI *mri_smooth, double inside_hi, double border_hi,
-                        double border_low, double outside_low, double outside_hi,
-                        double sigma,
-                        float max_thickness,
-                        FILE *log_fp,
-                        int which,
-                        MRI *mri_mask,
-                        double thresh,
-			int flags,
-			MRI *mri_aseg)
+/*
+  MRIScomputeBorderValues first finds the search bounds and samples the
+  intensity profile along the normal of a block of vertices in parallel,
+  then runs the border search on those profiles. The Gaussian weights of
+  MRIsampleVolumeDerivativeScale are computed once per sigma instead of
+  at every sample, in the same order so that the derivatives are bitwise
+  identical. The search of a vertex can depend on the next_val left over
+  from the previous one; those few are searched again serially.
+*/
+#define BV_BLOCK_SIZE      4096
+#define BV_MAX_KERNEL      64
+#define BV_MAX_SIGMAS      8
+
+typedef struct
 {
-  double    val, x, y, z, max_mag_val, xw, yw, zw,mag,max_mag, max_mag_dist=0.0f,
-                                                               previous_val, next_val, min_val,inward_dist,outward_dist,xw1,yw1,zw1,
-                                                               min_val_dist, orig_dist, dx, dy, dz, previous_mag, next_mag ;
-  int  total_vertices, vno, nmissing = 0, nout = 0, nin = 0, nfound = 0,
-                            nalways_missing = 0, local_max_found,
-                            ngrad_max, ngrad, nmin, num_changed=0, i ;
-  float   mean_border, mean_in, mean_out, dist, nx, ny, nz, mean_dist, step_size,
-    dists[MAX_SAMPLES], mri[MAX_SAMPLES], dm[MAX_SAMPLES], dm2[MAX_SAMPLES] ;
-  double  current_sigma ;
-  VERTEX  *v ;
-  FILE    *fp = NULL ;
-  MRI     *mri_tmp ;
+  int    n ;                  /* -1 if too many samples - use MRIsampleVolumeDerivativeScale */
+  double dist[BV_MAX_KERNEL] ;
+  double k[BV_MAX_KERNEL] ;
+  double ktotal ;
+  double len ;                /* already normalized by ktotal */
+} BV_DERIV_KERNEL ;
 
-  step_size = mri_brain->xsize/2 ;
-  if (mri_brain->type == MRI_UCHAR)
+typedef struct
+{
+  double val ;                /* I(dist) */
+  double previous_val ;       /* I(dist-STEP_SIZE) */
+  double mag ;                /* derivative at dist (only if previous_val in range) */
+  double previous_mag ;       /* derivative at dist-STEP_SIZE */
+  double next_mag ;           /* derivative at dist+STEP_SIZE */
+  double next_val ;           /* I(dist+STEP_SIZE), GRAY_CSF only */
+  double next_val1 ;          /* I(dist+1) (only if val is a border candidate) */
+  float  dist ;
+  int    label ;              /* aseg label at dist, -1 if none */
+} BV_SAMPLE ;
+
+typedef struct
+{
+  float  nx, ny, nz ;         /* normal in voxel coords */
+  double inward_dist ;
+  double outward_dist ;
+  double current_sigma ;
+  int    refined ;            /* hires refinement of inward_dist ran */
+  double refined_next_val ;
+  int    first ;              /* index of first sample */
+  int    nsamples ;           /* # of steps from inward_dist to outward_dist */
+  int    nsampled ;           /* # of them sampled so far */
+  float  next_dist ;
+
+  /* results of the border search */
+  int    searched ;
+  int    len ;
+  int    local_max_found ;
+  double max_mag_val, max_mag, max_mag_dist, min_val, min_val_dist ;
+  int    max_mag_dist_set ;
+  int    next_val_set ;
+  double next_val ;
+} BV_PROFILE ;
+
+typedef struct
+{
+  MRI_SURFACE     *mris ;
+  MRI             *mri_brain ;
+  MRI             *mri_tmp ;
+  MRI             *mri_mask ;
+  MRI             *mri_aseg ;
+  double          inside_hi, border_hi, border_low, outside_low, outside_hi ;
+  double          sigma, thresh ;
+  float           max_thickness ;
+  int             which ;
+  int             flags ;
+  int             nkernels ;
+  BV_DERIV_KERNEL kernels[BV_MAX_SIGMAS] ;
+  BV_PROFILE      *profiles ;    /* BV_BLOCK_SIZE of them */
+  BV_SAMPLE       *samples ;
+  int             max_samples ;
+} BV_PROFILES ;
+
+static void
+mrisBVinitDerivKernel(BV_DERIV_KERNEL *kernel, double sigma)
+{
+  double dist, k, ktotal, len, step_size ;
+  int    n ;
+
+  step_size = MAX(.25,sigma/5.0) ;
+  for (ktotal = 0.0, n = 0, len = 0.0, dist = step_size ;
+       dist <= MAX(2*sigma,step_size);
+       dist += step_size, n++)
   {
-    mri_tmp = MRIreplaceValues(mri_brain, NULL, 255, 0) ;
+    if (FZERO(sigma))
+      k = 1.0 ;
+    else
+      k = exp(-dist*dist/(2*sigma*sigma)) ;
+    ktotal += k ;
+    len += dist ;
+    if (n < BV_MAX_KERNEL)
+    {
+      kernel->dist[n] = dist ;
+      kernel->k[n] = k ;
+    }
   }
-  else
+  kernel->n = n <= BV_MAX_KERNEL ? n : -1 ;
+  kernel->ktotal = ktotal ;
+  kernel->len = len / ktotal ;
+}
+
+/* same as MRIsampleVolumeDerivativeScale(mri_tmp, ..., sigma*2^ks) */
+static void
+mrisBVsampleDerivative(BV_PROFILES *bv, int ks, double current_sigma,
+                       double x, double y, double z,
+                       double dx, double dy, double dz, double *pmag)
+{
+  BV_DERIV_KERNEL *kernel ;
+  MRI             *mri = bv->mri_tmp ;
+  double          vp1, vm1, val, dist, k ;
+  int             n ;
+
+  if (ks >= bv->nkernels || bv->kernels[ks].n < 0)
   {
-    mri_tmp = MRIcopy(mri_brain, NULL) ;
+    MRIsampleVolumeDerivativeScale(mri, x, y, z, dx, dy, dz, pmag, current_sigma) ;
+    return ;
   }
+  kernel = &bv->kernels[ks] ;
 
-  /* first compute intensity of local gray/white boundary */
-  mean_dist = mean_in = mean_out = mean_border = 0.0f ;
-  ngrad_max = ngrad = nmin = 0 ;
-  MRISclearMarks(mris) ;  /* for soap bubble smoothing later */
-  for (total_vertices = vno = 0 ; vno < mris->nvertices ; vno++)
+  if (x >= mri->width)
+    x = mri->width - 1.0 ;
+  if (y >= mri->height)
+    y = mri->height - 1.0 ;
+  if (z >= mri->depth)
+    z = mri->depth - 1.0 ;
+  if (x < 0.0)
+    x = 0.0 ;
+  if (y < 0.0)
+    y = 0.0 ;
+  if (z < 0.0)
+    z = 0.0 ;
+
+  for (vp1 = vm1 = 0.0, n = 0 ; n < kernel->n ; n++)
   {
-    v = &mris->vertices[vno] ;
-    if (v->ripflag)
-    {
-      continue ;
-    }
-    if (vno == Gdiag_no)
-    {
-      DiagBreak() ;
-    }
+    dist = kernel->dist[n] ;
+    k = kernel->k[n] ;
+    MRIsampleVolume(mri, x + dist*dx, y + dist*dy, z + dist*dz, &val) ;
+    vp1 += k*val ;
+    MRIsampleVolume(mri, x - dist*dx, y - dist*dy, z - dist*dz, &val) ;
+    vm1 += k*val ;
+  }
+  vm1 /= kernel->ktotal ;
+  vp1 /= kernel->ktotal ;
+  *pmag = (vp1-vm1) / (2.0*kernel->len) ;
+}
 
-    x = v->x ;
-    y = v->y ;
-    z = v->z ;
-    MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-    x = v->x + v->nx ;
-    y = v->y + v->ny ;
-    z = v->z + v->nz ;
-    MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw1, &yw1, &zw1) ;
-    nx = xw1 - xw ;
-    ny = yw1 - yw ;
-    nz = zw1 - zw ;
-    dist = sqrt(SQR(nx)+SQR(ny)+SQR(nz)) ;
-    if (FZERO(dist))
-    {
-      dist = 1 ;
-    }
-    nx /= dist ;
-    ny /= dist ;
-    nz /= dist ;
+/*
+  find the distance in the directions parallel and anti-parallel to
+  the surface normal in which the gradient is pointing 'inwards'.
+  The border will then be constrained to be within that region.
+*/
+static void
+mrisBVfindSearchBounds(BV_PROFILES *bv, int vno, BV_PROFILE *prof)
+{
+  MRI_SURFACE *mris = bv->mris ;
+  MRI         *mri_brain = bv->mri_brain ;
+  VERTEX      *v = &mris->vertices[vno] ;
+  double      xw, yw, zw, xw1, yw1, zw1, x, y, z, val, next_val, mag = 0,
+              dx, dy, dz, orig_dist, inward_dist, outward_dist, current_sigma ;
+  float       dist, nx, ny, nz, step_size, max_thickness = bv->max_thickness ;
+  int         ks ;
 
-    /*
-      find the distance in the directions parallel and anti-parallel to
-      the surface normal in which the gradient is pointing 'inwards'.
-      The border will then be constrained to be within that region.
-    */
-    inward_dist = 1.0 ;
-    outward_dist = -1.0 ;
-    for (current_sigma = sigma;
-         current_sigma <= 10*sigma;
-         current_sigma *= 2)
+  step_size = mri_brain->xsize/2 ;
+  MRISsurfaceRASToVoxelCached(mris, mri_brain, v->x, v->y, v->z, &xw, &yw, &zw) ;
+  x = v->x + v->nx ;
+  y = v->y + v->ny ;
+  z = v->z + v->nz ;
+  MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw1, &yw1, &zw1) ;
+  nx = xw1 - xw ;
+  ny = yw1 - yw ;
+  nz = zw1 - zw ;
+  dist = sqrt(SQR(nx)+SQR(ny)+SQR(nz)) ;
+  if (FZERO(dist))
+  {
+    dist = 1 ;
+  }
+  nx /= dist ;
+  ny /= dist ;
+  nz /= dist ;
+  prof->nx = nx ;
+  prof->ny = ny ;
+  prof->nz = nz ;
+  prof->refined = 0 ;
+
+  inward_dist = 1.0 ;
+  outward_dist = -1.0 ;
+  for (ks = 0, current_sigma = bv->sigma;
+       current_sigma <= 10*bv->sigma;
+       current_sigma *= 2, ks++)
+  {
+    for (dist = 0 ; dist > -max_thickness ; dist -= step_size)
     {
-      for (dist = 0 ; dist > -max_thickness ; dist -= step_size)
+      dx = v->x-v->origx ;
+      dy = v->y-v->origy ;
+      dz = v->z-v->origz ;
+      orig_dist = fabs(dx*v->nx + dy*v->ny + dz*v->nz) ;
+      if (fabs(dist)+orig_dist > max_thickness)
       {
-        dx = v->x-v->origx ;
-        dy = v->y-v->origy ;
-        dz = v->z-v->origz ;
-        orig_dist = fabs(dx*v->nx + dy*v->ny + dz*v->nz) ;
-        if (fabs(dist)+orig_dist > max_thickness)
-        {
-          break ;
-        }
-        x = v->x + v->nx*dist ;
-        y = v->y + v->ny*dist ;
-        z = v->z + v->nz*dist ;
-        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolumeDerivativeScale(mri_tmp, xw, yw, zw,
-                                       nx, ny,nz,&mag,
-                                       current_sigma);
-        if (mag >= 0.0)
-        {
-          break ;
-        }
-        MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
-        if (val > border_hi)
-        {
-          break ;
-        }
-        if (mri_mask)
-        {
-          MRIsampleVolume(mri_mask, xw, yw, zw, &val) ;
-          if (val > thresh)
-          {
-            break ;
-          }
-        }
+        break ;
       }
-      inward_dist = dist+step_size/2 ;
-
-      if (DIAG_VERBOSE_ON && mri_brain->xsize < .95 && mag >= 0.0)  // refine inward_dist for hires volumes
+      x = v->x + v->nx*dist ;
+      y = v->y + v->ny*dist ;
+      z = v->z + v->nz*dist ;
+      MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+      mrisBVsampleDerivative(bv, ks, current_sigma, xw, yw, zw, nx, ny, nz, &mag) ;
+      if (mag >= 0.0)
       {
-        for (dist = inward_dist ; dist > -max_thickness ; dist -= step_size/2)
-        {
-          x = v->x + v->nx*dist ;
-          y = v->y + v->ny*dist ;
-          z = v->z + v->nz*dist ;
-          MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-          MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
-
-          x = v->x + v->nx*(dist+step_size/2) ;
-          y = v->y + v->ny*(dist+step_size/2) ;
-          z = v->z + v->nz*(dist+step_size/2) ;
-          MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-          MRIsampleVolume(mri_brain, xw, yw, zw, &next_val) ;
-          if (next_val < val)  // found max inwards intensity
-          {
-            break ;
-          }
-        }
-        inward_dist = dist ;
+        break ;
       }
-
-      for (dist = 0 ; dist < max_thickness ; dist += step_size)
+      MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
+      if (val > bv->border_hi)
+      {
+        break ;
+      }
+      if (bv->mri_mask)
       {
-        dx = v->x-v->origx ;
-        dy = v->y-v->origy ;
-        dz = v->z-v->origz ;
-        orig_dist = fabs(dx*v->nx + dy*v->ny + dz*v->nz) ;
-        if (fabs(dist)+orig_dist > max_thickness)
+        MRIsampleVolume(bv->mri_mask, xw, yw, zw, &val) ;
+        if (val > bv->thresh)
         {
           break ;
         }
+      }
+    }
+    inward_dist = dist+step_size/2 ;
+
+    if (DIAG_VERBOSE_ON && mri_brain->xsize < .95 && mag >= 0.0)  // refine inward_dist for hires volumes
+    {
+      for (dist = inward_dist ; dist > -max_thickness ; dist -= step_size/2)
+      {
         x = v->x + v->nx*dist ;
         y = v->y + v->ny*dist ;
         z = v->z + v->nz*dist ;
         MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolumeDerivativeScale
-        (mri_tmp, xw, yw, zw, nx, ny,nz, &mag,
-         current_sigma);
-        if (mag >= 0.0)
-        {
-          break ;
-        }
         MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
-        if (val < border_low)
+
+        x = v->x + v->nx*(dist+step_size/2) ;
+        y = v->y + v->ny*(dist+step_size/2) ;
+        z = v->z + v->nz*(dist+step_size/2) ;
+        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+        MRIsampleVolume(mri_brain, xw, yw, zw, &next_val) ;
+        prof->refined = 1 ;
+        prof->refined_next_val = next_val ;
+        if (next_val < val)  // found max inwards intensity
         {
           break ;
         }
-        if (mri_mask)
-        {
-          MRIsampleVolume(mri_mask, xw, yw, zw, &val) ;
-          if (val > thresh)
-          {
-            break ;
-          }
-        }
       }
-      outward_dist = dist-step_size/2 ;
-      if (!isfinite(outward_dist))
+      inward_dist = dist ;
+    }
+
+    for (dist = 0 ; dist < max_thickness ; dist += step_size)
+    {
+      dx = v->x-v->origx ;
+      dy = v->y-v->origy ;
+      dz = v->z-v->origz ;
+      orig_dist = fabs(dx*v->nx + dy*v->ny + dz*v->nz) ;
+      if (fabs(dist)+orig_dist > max_thickness)
       {
-        DiagBreak() ;
+        break ;
       }
-      if (inward_dist <= 0 || outward_dist >= 0)
+      x = v->x + v->nx*dist ;
+      y = v->y + v->ny*dist ;
+      z = v->z + v->nz*dist ;
+      MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+      mrisBVsampleDerivative(bv, ks, current_sigma, xw, yw, zw, nx, ny, nz, &mag) ;
+      if (mag >= 0.0)
       {
         break ;
       }
+      MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
+      if (val < bv->border_low)
+      {
+        break ;
+      }
+      if (bv->mri_mask)
+      {
+        MRIsampleVolume(bv->mri_mask, xw, yw, zw, &val) ;
+        if (val > bv->thresh)
+        {
+          break ;
+        }
+      }
     }
-
-    if (inward_dist > 0 && outward_dist < 0)
+    outward_dist = dist-step_size/2 ;
+    if (!isfinite(outward_dist))
     {
-      current_sigma = sigma ;  /* couldn't find anything */
+      DiagBreak() ;
     }
-
-    if (vno == Gdiag_no)
+    if (inward_dist <= 0 || outward_dist >= 0)
     {
-      char fname[STRLEN] ;
-      sprintf(fname, "v%d.%2.0f.log", Gdiag_no, sigma*100) ;
-      fp = fopen(fname, "w") ;
-      fprintf(stdout,
-              "v %d: inward dist %2.2f, outward dist %2.2f, sigma %2.1f\n",
-              vno, inward_dist, outward_dist, current_sigma) ;
+      break ;
     }
+  }
 
-    v->val2 = current_sigma ;
-    /*
-      search outwards and inwards and find the local gradient maximum
-      at a location with a reasonable MR intensity value. This will
-      be the location of the edge.
-    */
+  if (inward_dist > 0 && outward_dist < 0)
+  {
+    current_sigma = bv->sigma ;  /* couldn't find anything */
+  }
+  prof->inward_dist = inward_dist ;
+  prof->outward_dist = outward_dist ;
+  prof->current_sigma = current_sigma ;
 
-    /* search in the normal direction to find the min value */
-    max_mag_val = -10.0f ;
-    mag = 5.0f ;
-    max_mag = 0.0f ;
-    min_val = 10000.0 ;
-    min_val_dist = 0.0f ;
-    local_max_found = 0 ;
-    for (i = 0, dist = inward_dist ; dist <= outward_dist ; dist += STEP_SIZE)
-    {
-      x = v->x + v->nx*dist ;
-      y = v->y + v->ny*dist ;
-      z = v->z + v->nz*dist ;
-      MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-      MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
-      dists[i] = dist;
-      mri[i] = val ;
-      i++ ;
+  for (prof->nsamples = 0, dist = inward_dist ; dist <= outward_dist ; dist += STEP_SIZE)
+    prof->nsamples++ ;
+  prof->nsampled = 0 ;
+  prof->next_dist = inward_dist ;
+}
 
-#if 1
-      x = v->x + v->nx*(dist-STEP_SIZE) ;
-      y = v->y + v->ny*(dist-STEP_SIZE) ;
-      z = v->z + v->nz*(dist-STEP_SIZE) ;
-      MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-      MRIsampleVolume(mri_brain, xw, yw, zw, &previous_val) ;
-#else
-      /* find max val within 1 mm in inwards direction */
-      {
-        float  d ;
-        double   tmp_val ;
+/*
+  return sample i of the profile, sampling it if it hasn't been yet
+  (they are always requested in order). Everything the border search
+  may look at is sampled, except what is only used if the previous
+  point is inside the surface.
+*/
+static BV_SAMPLE *
+mrisBVgetSample(BV_PROFILES *bv, int vno, BV_PROFILE *prof, int i)
+{
+  MRI_SURFACE *mris = bv->mris ;
+  MRI         *mri_brain = bv->mri_brain ;
+  VERTEX      *v = &mris->vertices[vno] ;
+  BV_SAMPLE   *s ;
+  double      x, y, z, xw, yw, zw ;
+  float       dist ;
+
+  if (i < prof->nsampled)
+    return(&bv->samples[prof->first+i]) ;
+  if (i >= prof->nsamples)
+    return(NULL) ;
 
-        previous_val = 0 ;
-        for (d = 0.25 ; d <= 1.5 ; d += 0.25)
-        {
-          x = v->x + v->nx*(d-1) ;
-          y = v->y + v->ny*(d-1) ;
-          z = v->z + v->nz*(d-1) ;
-          MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-          MRIsampleVolume(mri_brain, xw, yw, zw, &tmp_val) ;
-          if (tmp_val > previous_val)
-          {
-            previous_val = tmp_val ;
-          }
-        }
-      }
-#endif
+  s = &bv->samples[prof->first+prof->nsampled++] ;
+  s->dist = dist = prof->next_dist ;
+  prof->next_dist += STEP_SIZE ;
+  s->label = -1 ;
 
-      /* the previous point was inside the surface */
-      if (previous_val < inside_hi && previous_val >= border_low)
-      {
-        /* see if we are at a local maximum in the gradient magnitude */
-        x = v->x + v->nx*dist ;
-        y = v->y + v->ny*dist ;
-        z = v->z + v->nz*dist ;
-        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolume(mri_brain, xw, yw, zw, &val) ;
+  x = v->x + v->nx*(dist-STEP_SIZE) ;
+  y = v->y + v->ny*(dist-STEP_SIZE) ;
+  z = v->z + v->nz*(dist-STEP_SIZE) ;
+  MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+  MRIsampleVolume(mri_brain, xw, yw, zw, &s->previous_val) ;
+  if (s->previous_val < bv->inside_hi && s->previous_val >= bv->border_low)
+  {
+    mrisBVsampleDerivative(bv, 0, bv->sigma, xw, yw, zw, prof->nx, prof->ny, prof->nz,
+                           &s->previous_mag) ;
 
-        x = v->x + v->nx*(dist+STEP_SIZE) ;
-        y = v->y + v->ny*(dist+STEP_SIZE) ;
-        z = v->z + v->nz*(dist+STEP_SIZE) ;
-        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolumeDerivativeScale(mri_tmp, xw, yw, zw, nx, ny, nz,
-                                       &next_mag, sigma);
+    x = v->x + v->nx*(dist+STEP_SIZE) ;
+    y = v->y + v->ny*(dist+STEP_SIZE) ;
+    z = v->z + v->nz*(dist+STEP_SIZE) ;
+    MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+    mrisBVsampleDerivative(bv, 0, bv->sigma, xw, yw, zw, prof->nx, prof->ny, prof->nz,
+                           &s->next_mag) ;
+    if (bv->which == GRAY_CSF)
+      MRIsampleVolume(mri_brain, xw, yw, zw, &s->next_val) ;
+  }
 
-        x = v->x + v->nx*(dist-STEP_SIZE) ;
-        y = v->y + v->ny*(dist-STEP_SIZE) ;
-        z = v->z + v->nz*(dist-STEP_SIZE) ;
-        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolumeDerivativeScale(mri_tmp, xw, yw, zw, nx, ny, nz,
-                                       &previous_mag, sigma);
+  x = v->x + v->nx*dist ;
+  y = v->y + v->ny*dist ;
+  z = v->z + v->nz*dist ;
+  MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+  MRIsampleVolume(mri_brain, xw, yw, zw, &s->val) ;
+  if (s->previous_val >= bv->inside_hi || s->previous_val < bv->border_low)
+    return(s) ;
 
-        if (val < min_val)
+  mrisBVsampleDerivative(bv, 0, bv->sigma, xw, yw, zw, prof->nx, prof->ny, prof->nz, &s->mag) ;
+  if ((bv->mri_aseg != NULL) && (MRIindexNotInVolume(bv->mri_aseg, xw,yw,zw)==0))
+    s->label = MRIgetVoxVal(bv->mri_aseg, nint(xw), nint(yw), nint(zw), 0) ;
+
+  if (s->val <= bv->border_hi && s->val >= bv->border_low)
+  {
+    x = v->x + v->nx*(dist+1) ;
+    y = v->y + v->ny*(dist+1) ;
+    z = v->z + v->nz*(dist+1) ;
+    MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
+    MRIsampleVolume(mri_brain, xw, yw, zw, &s->next_val1) ;
+  }
+  return(s) ;
+}
+
+/*
+  search outwards and inwards and find the local gradient maximum
+  at a location with a reasonable MR intensity value. This will
+  be the location of the edge. next_val is the value left over from
+  the previous vertex - if it isn't known and the search needs it
+  give up and return 0.
+*/
+static int
+mrisBVsearch(BV_PROFILES *bv, int vno, BV_PROFILE *prof,
+             int next_val_known, double next_val, FILE *fp)
+{
+  MRI_SURFACE *mris = bv->mris ;
+  BV_SAMPLE   *s ;
+  double      val, previous_val, mag, previous_mag, next_mag, max_mag_val, max_mag,
+              max_mag_dist = 0, min_val, min_val_dist ;
+  float       dist ;
+  int         i, local_max_found, max_mag_dist_set = 0, next_val_set = 0 ;
+
+  /* search in the normal direction to find the min value */
+  max_mag_val = -10.0f ;
+  max_mag = 0.0f ;
+  min_val = 10000.0 ;
+  min_val_dist = 0.0f ;
+  local_max_found = 0 ;
+  for (i = 0 ; (s = mrisBVgetSample(bv, vno, prof, i)) != NULL ; )
+  {
+    dist = s->dist ;
+    val = s->val ;
+    i++ ;
+
+    previous_val = s->previous_val ;
+
+    /* the previous point was inside the surface */
+    if (previous_val < bv->inside_hi && previous_val >= bv->border_low)
+    {
+      /* see if we are at a local maximum in the gradient magnitude */
+      next_mag = s->next_mag ;
+      previous_mag = s->previous_mag ;
+
+      if (val < min_val)
+      {
+        min_val = val ;  /* used if no gradient max is found */
+        min_val_dist = dist ;
+      }
+
+      /* if gradient is big and val is in right range */
+      mag = s->mag ;
+      // only for hires volumes - if intensities are increasing don't keep going - in gm
+      if (bv->which == GRAY_WHITE &&
+          (bv->mri_brain->xsize < .95 || bv->flags & IPFLAG_FIND_FIRST_WM_PEAK) &&
+          val > previous_val)
+      {
+        if (!next_val_known)
+          return(0) ;
+        if (next_val > val)
+          break ;
+      }
+      if (s->label >= 0)
+      {
+        if (vno == Gdiag_no)
         {
-          min_val = val ;  /* used if no gradient max is found */
-          min_val_dist = dist ;
-        }
+          double xw, yw, zw ;
 
-        /* if gradient is big and val is in right range */
-        x = v->x + v->nx*dist;
-        y = v->y + v->ny*dist;
-        z = v->z + v->nz*dist;
-        MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-        MRIsampleVolumeDerivativeScale(mri_tmp, xw, yw, zw, nx, ny, nz,&mag,sigma);
-        // only for hires volumes - if intensities are increasing don't keep going - in gm
-        if (which == GRAY_WHITE && 
-	    (mri_brain->xsize < .95 || flags & IPFLAG_FIND_FIRST_WM_PEAK) &&
-            val > previous_val && next_val > val)
+          MRISsurfaceRASToVoxelCached(mris, bv->mri_brain,
+                                      mris->vertices[vno].x + mris->vertices[vno].nx*dist,
+                                      mris->vertices[vno].y + mris->vertices[vno].ny*dist,
+                                      mris->vertices[vno].z + mris->vertices[vno].nz*dist,
+                                      &xw, &yw, &zw) ;
+          printf("v %d: label distance %2.2f = %s @ (%d %d %d)\n",
+                 vno, dist, cma_label_to_name(s->label),nint(xw),nint(yw),nint(zw)) ;
+        }
+        if ((mris->hemisphere == LEFT_HEMISPHERE && IS_RH_CLASS(s->label)) ||
+            (mris->hemisphere == RIGHT_HEMISPHERE && IS_LH_CLASS(s->label)))
         {
+          if (vno == Gdiag_no)
+            printf("v %d: terminating search at distance %2.2f due to presence of contra tissue (%s)\n",
+                   vno, dist, cma_label_to_name(s->label)) ;
           break ;
         }
-	if ((mri_aseg != NULL) && (MRIindexNotInVolume(mri_aseg, xw,yw,zw)==0))
-	{
-	  int label ;
-	  label = MRIgetVoxVal(mri_aseg, nint(xw), nint(yw), nint(zw), 0) ;
-	  if (vno == Gdiag_no)
-	    printf("v %d: label distance %2.2f = %s @ (%d %d %d)\n",
-		   vno, dist, cma_label_to_name(label),nint(xw),nint(yw),nint(zw)) ;
-	  if ((mris->hemisphere == LEFT_HEMISPHERE && IS_RH_CLASS(label)) ||
-	      (mris->hemisphere == RIGHT_HEMISPHERE && IS_LH_CLASS(label)))
-	  {
-	    if (vno == Gdiag_no)
-	      printf("v %d: terminating search at distance %2.2f due to presence of contra tissue (%s)\n",
-		     vno, dist, cma_label_to_name(label)) ;
-	    break ;
-	  }
-	}
-        if (which == GRAY_CSF)
+      }
+      if (bv->which == GRAY_CSF)
+      {
+        /*
+          sample the next val we would process.
+          If it is too low, then we
+          have definitely reached the border,
+          and the current gradient
+          should be considered a local max.
+
+          Don't want to do this for gray/white,
+          as the gray/white gradient
+          often continues seemlessly into the gray/csf.
+        */
+        next_val = s->next_val ;
+        next_val_known = next_val_set = 1 ;
+        if (next_val < bv->border_low)
         {
-          /*
-            sample the next val we would process.
-            If it is too low, then we
-            have definitely reached the border,
-            and the current gradient
-            should be considered a local max.
-
-            Don't want to do this for gray/white,
-            as the gray/white gradient
-            often continues seemlessly into the gray/csf.
-          */
-          x = v->x + v->nx*(dist+STEP_SIZE) ;
-          y = v->y + v->ny*(dist+STEP_SIZE) ;
-          z = v->z + v->nz*(dist+STEP_SIZE) ;
-          MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-          MRIsampleVolume(mri_brain, xw, yw, zw, &next_val) ;
-          if (next_val < border_low)
-          {
-            next_mag = 0 ;
-          }
+          next_mag = 0 ;
         }
+      }
 
-        if (vno == Gdiag_no)
-          fprintf(fp, "%2.3f  %2.3f  %2.3f  %2.3f  %2.3f\n",
-                  dist, val, mag, previous_mag, next_mag) ;
+      if (fp)
+        fprintf(fp, "%2.3f  %2.3f  %2.3f  %2.3f  %2.3f\n",
+                dist, val, mag, previous_mag, next_mag) ;
 
+      /*
+        if no local max has been found, or this one
+        has a greater magnitude,
+        and it is in the right intensity range....
+      */
+      if ((fabs(mag) > fabs(previous_mag)) &&
+          (fabs(mag) > fabs(next_mag)) &&
+          (val <= bv->border_hi) && (val >= bv->border_low))
+      {
+        next_val = s->next_val1 ;   /* I(dist+1) */
+        next_val_known = next_val_set = 1 ;
         /*
-          if no local max has been found, or this one
-          has a greater magnitude,
-          and it is in the right intensity range....
+          if next val is in the right range, and the intensity at
+          this local max is less than the one at the previous local
+          max, assume it is the correct one.
         */
-        if (
-          /* (!local_max_found || (fabs(mag) > max_mag)) && */
-          (fabs(mag) > fabs(previous_mag)) &&
-          (fabs(mag) > fabs(next_mag)) &&
-          (val <= border_hi) && (val >= border_low)
-        )
+        if ((next_val >= bv->outside_low) &&
+            (next_val <= bv->border_hi) &&
+            (next_val <= bv->outside_hi) &&
+            (!local_max_found || (max_mag < fabs(mag))))
         {
-          x = v->x + v->nx*(dist+1) ;
-          y = v->y + v->ny*(dist+1) ;
-          z = v->z + v->nz*(dist+1) ;
-          MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-          MRIsampleVolume(mri_brain, xw, yw, zw, &next_val) ;
-          /*
-            if next val is in the right range, and the intensity at
-            this local max is less than the one at the previous local
-            max, assume it is the correct one.
-          */
-          if ((next_val >= outside_low) &&
-              (next_val <= border_hi) &&
-              (next_val <= outside_hi) &&
-#if 0
-              (!local_max_found || (val < max_mag_val)))
-#else
-              (!local_max_found || (max_mag < fabs(mag))))
-#endif
+          local_max_found = 1 ;
+          max_mag_dist = dist ;
+          max_mag = fabs(mag) ;
+          max_mag_val = val ;
+          max_mag_dist_set = 1 ;
+        }
+      }
+      else
+      {
+        /*
+          if no local max found yet, just used largest gradient
+          if the intensity is in the right range.
+        */
+        if ((local_max_found == 0) &&
+            (fabs(mag) > max_mag) &&
+            (val <= bv->border_hi) &&
+            (val >= bv->border_low))
+        {
+          next_val = s->next_val1 ;   /* I(dist+1) */
+          next_val_known = next_val_set = 1 ;
+          if (next_val >= bv->outside_low && next_val <= bv->border_hi &&
+              next_val < bv->outside_hi)
           {
-            local_max_found = 1 ;
             max_mag_dist = dist ;
             max_mag = fabs(mag) ;
             max_mag_val = val ;
+            max_mag_dist_set = 1 ;
           }
         }
-        else
-        {
-          /*
-            if no local max found yet, just used largest gradient
-            if the intensity is in the right range.
-          */
-          if ((local_max_found == 0) &&
-              (fabs(mag) > max_mag) &&
-              (val <= border_hi) &&
-              (val >= border_low)
-             )
-          {
-            x = v->x + v->nx*(dist+1) ;
-            y = v->y + v->ny*(dist+1) ;
-            z = v->z + v->nz*(dist+1) ;
-            MRISsurfaceRASToVoxelCached(mris, mri_brain, x, y, z, &xw, &yw, &zw) ;
-            MRIsampleVolume(mri_brain, xw, yw, zw, &next_val) ;
-            if (next_val >= outside_low && next_val <= border_hi &&
-                next_val < outside_hi)
-            {
-              max_mag_dist = dist ;
-              max_mag = fabs(mag) ;
-              max_mag_val = val ;
-            }
-          }
-        }
-
       }
     }
+  }
+
+  prof->len = i ;
+  prof->local_max_found = local_max_found ;
+  prof->max_mag_val = max_mag_val ;
+  prof->max_mag = max_mag ;
+  prof->max_mag_dist = max_mag_dist ;
+  prof->max_mag_dist_set = max_mag_dist_set ;
+  prof->min_val = min_val ;
+  prof->min_val_dist = min_val_dist ;
+  prof->next_val_set = next_val_set ;
+  prof->next_val = next_val ;
+  return(1) ;
+}
+
+/* find the search bounds of vertices [vno0, vno1) and search their profiles */
+static int
+mrisBVsearchBlock(BV_PROFILES *bv, int vno0, int vno1)
+{
+  MRI_SURFACE *mris = bv->mris ;
+  int         vno, nsamples ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+  for (vno = vno0 ; vno < vno1 ; vno++)
+  {
+    if (mris->vertices[vno].ripflag == 0)
+      mrisBVfindSearchBounds(bv, vno, &bv->profiles[vno-vno0]) ;
+  }
+
+  for (nsamples = 0, vno = vno0 ; vno < vno1 ; vno++)
+  {
+    BV_PROFILE *prof = &bv->profiles[vno-vno0] ;
+
+    prof->first = nsamples ;
+    if (mris->vertices[vno].ripflag == 0)
+      nsamples += prof->nsamples ;
+  }
+  if (nsamples > bv->max_samples)
+  {
+    free(bv->samples) ;
+    bv->max_samples = nsamples ;
+    bv->samples = (BV_SAMPLE *)calloc(nsamples, sizeof(BV_SAMPLE)) ;
+    if (bv->samples == NULL)
+      ErrorExit(ERROR_NOMEMORY, "mrisBVsearchBlock: could not allocate %d samples",
+                nsamples) ;
+  }
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+  for (vno = vno0 ; vno < vno1 ; vno++)
+  {
+    BV_PROFILE *prof = &bv->profiles[vno-vno0] ;
+
+    prof->searched = 0 ;
+    if (mris->vertices[vno].ripflag || vno == Gdiag_no)
+      continue ;
+    prof->searched =
+      mrisBVsearch(bv, vno, prof, prof->refined, prof->refined_next_val, NULL) ;
+  }
+  return(NO_ERROR) ;
+}
+
+#define MAX_SAMPLES 1000
+int
+MRIScomputeBorderValues(MRI_SURFACE *mris,MRI *mri_brain,
+                        MRI *mri_smooth, double inside_hi, double border_hi,
+                        double border_low, double outside_low, double outside_hi,
+                        double sigma,
+                        float max_thickness,
+                        FILE *log_fp,
+                        int which,
+                        MRI *mri_mask,
+                        double thresh,
+			int flags,
+			MRI *mri_aseg)
+{
+  double    val, x, y, z, max_mag_val, xw, yw, zw,max_mag, max_mag_dist=0.0f,
+                                                               previous_val, next_val = 0, min_val,
+                                                               min_val_dist ;
+  int  total_vertices, vno, nmissing = 0, nout = 0, nin = 0, nfound = 0,
+                            nalways_missing = 0, local_max_found,
+                            ngrad_max, ngrad, nmin, num_changed=0, i ;
+  float   mean_border, mean_in, mean_out, mean_dist,
+    dists[MAX_SAMPLES], mri[MAX_SAMPLES], dm[MAX_SAMPLES], dm2[MAX_SAMPLES] ;
+  VERTEX  *v ;
+  FILE    *fp = NULL ;
+  MRI     *mri_tmp ;
+  BV_PROFILES bv ;
+  BV_PROFILE  *prof ;
+
+  if (mri_brain->type == MRI_UCHAR)
+  {
+    mri_tmp = MRIreplaceValues(mri_brain, NULL, 255, 0) ;
+  }
+  else
+  {
+    mri_tmp = MRIcopy(mri_brain, NULL) ;
+  }
+
+  /* first compute intensity of local gray/white boundary */
+  mean_dist = mean_in = mean_out = mean_border = 0.0f ;
+  ngrad_max = ngrad = nmin = 0 ;
+  MRISclearMarks(mris) ;  /* for soap bubble smoothing later */
+
+  memset(&bv, 0, sizeof(bv)) ;
+  bv.mris = mris ;
+  bv.mri_brain = mri_brain ;
+  bv.mri_tmp = mri_tmp ;
+  bv.mri_mask = mri_mask ;
+  bv.mri_aseg = mri_aseg ;
+  bv.inside_hi = inside_hi ;
+  bv.border_hi = border_hi ;
+  bv.border_low = border_low ;
+  bv.outside_low = outside_low ;
+  bv.outside_hi = outside_hi ;
+  bv.sigma = sigma ;
+  bv.thresh = thresh ;
+  bv.max_thickness = max_thickness ;
+  bv.which = which ;
+  bv.flags = flags ;
+  for (val = sigma ; val <= 10*sigma && bv.nkernels < BV_MAX_SIGMAS ; val *= 2)
+    mrisBVinitDerivKernel(&bv.kernels[bv.nkernels++], val) ;
+  bv.profiles = (BV_PROFILE *)calloc(BV_BLOCK_SIZE, sizeof(BV_PROFILE)) ;
+  if (bv.profiles == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRIScomputeBorderValues: could not allocate profiles") ;
+  // compute the surface RAS->voxel transform before it is used by multiple threads
+  MRISsurfaceRASToVoxelCached(mris, mri_brain, 0, 0, 0, &xw, &yw, &zw) ;
+
+  for (total_vertices = vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    if (vno % BV_BLOCK_SIZE == 0)
+      mrisBVsearchBlock(&bv, vno, MIN(vno+BV_BLOCK_SIZE, mris->nvertices)) ;
+    v = &mris->vertices[vno] ;
+    if (v->ripflag)
+    {
+      continue ;
+    }
+    if (vno == Gdiag_no)
+    {
+      DiagBreak() ;
+    }
+    prof = &bv.profiles[vno % BV_BLOCK_SIZE] ;
+    if (prof->refined)
+      next_val = prof->refined_next_val ;
+
+    if (vno == Gdiag_no)
+    {
+      char fname[STRLEN] ;
+      sprintf(fname, "v%d.%2.0f.log", Gdiag_no, sigma*100) ;
+      fp = fopen(fname, "w") ;
+      fprintf(stdout,
+              "v %d: inward dist %2.2f, outward dist %2.2f, sigma %2.1f\n",
+              vno, prof->inward_dist, prof->outward_dist, prof->current_sigma) ;
+    }
+
+    v->val2 = prof->current_sigma ;
+    // needs the next_val left over from the previous vertex - search serially
+    if (prof->searched == 0)
+      mrisBVsearch(&bv, vno, prof, 1, next_val, fp) ;
+    if (prof->next_val_set)
+      next_val = prof->next_val ;
+    if (prof->max_mag_dist_set)
+      max_mag_dist = prof->max_mag_dist ;
+    max_mag_val = prof->max_mag_val ;
+    max_mag = prof->max_mag ;
+    min_val = prof->min_val ;
+    min_val_dist = prof->min_val_dist ;
+    local_max_found = prof->local_max_found ;
+    for (i = 0 ; i < prof->len && i < MAX_SAMPLES ; i++)
+    {
+      dists[i] = bv.samples[prof->first+i].dist ;
+      mri[i] = bv.samples[prof->first+i].val ;
+    }
 
     if (vno == Gdiag_no)
       fclose(fp) ;
@@ -38542,6 +39291,9 @@ MRIScomputeBorderValues(MRI_SURFACE *mris,MRI *mri_brain,
             100.0f*(float)ngrad/(float)mris->nvertices,
             100.0f*(float)nmin/(float)mris->nvertices, num_changed) ;
   }
+  free(bv.samples) ;
+  free(bv.profiles) ;
+  MRIfree(&mri_tmp) ;
   return(NO_ERROR) ;
 }
 #if 1
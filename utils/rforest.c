@@ -41,6 +41,9 @@
 #define MAX_CLASSES 50
 static double entropy(int *class_counts, int nclasses, int *Nc) ;
 static double rfFeatureInfoGain(RANDOM_FOREST *rf, TREE *tree, NODE *parent, NODE *left, NODE *right, int fno, int *ptotal_count) ;
+static int rfClassifyCompiled(RF_COMPILED *cf, double *feature, double *class_counts) ;
+static int rfWriteCompiled(RANDOM_FOREST *rf, FILE *fp) ;
+static int rfReadCompiled(RANDOM_FOREST *rf, FILE *fp, char *header) ;
 
 RANDOM_FOREST *
 RFalloc(int ntrees, int nfeatures, int nclasses, int max_depth, char **class_names, int nsteps) 
@@ -421,6 +424,8 @@ RFtrain(RANDOM_FOREST *rf, double feature_fraction, double training_fraction, in
     index, start_no, end_no, ntraining_per_tree = 0, total_to_remove = 0 ;
   TREE   *tree = NULL ;
 
+  RFfreeCompiled(rf) ;  // trees are about to change
+
   if (rf->max_class_ratio > 0)
   {
     int class_counts[MAX_CLASSES], max_class, max_class_count, min_class, min_class_count ;
@@ -627,6 +632,7 @@ RFtrainTree(RANDOM_FOREST *rf, int tno, int *training_classes, double **training
     }
   }
 
+  RFfreeCompiled(rf) ;
   tree = &rf->trees[tno] ;
 
   tree->feature_list = (int *)calloc(rf->nfeatures, sizeof(tree->feature_list[0]));
@@ -837,6 +843,8 @@ RFwriteInto(RANDOM_FOREST *rf, FILE *fp)
 
   for (n = 0 ; n < rf->ntrees ; n++)
     rfWriteTree(rf, &rf->trees[n], fp) ;
+  if (rf->compiled)
+    rfWriteCompiled(rf, fp) ;
 
   return(NO_ERROR) ;
 }
@@ -999,7 +1007,9 @@ RFclassify(RANDOM_FOREST *rf, double *feature, double *p_pval, int true_class)
   TREE   *tree ;
 
   memset(class_counts, 0, sizeof(class_counts)) ;
-  for (n = 0 ; n < rf->ntrees ; n++)
+  if (rf->compiled && rf->compiled->nclasses == rf->nclasses && !DIAG_VERBOSE_ON)
+    rfClassifyCompiled(rf->compiled, feature, class_counts) ;
+  else for (n = 0 ; n < rf->ntrees ; n++)
   {
     tree = &rf->trees[n] ;
 
@@ -1092,6 +1102,7 @@ RFreadFrom(FILE *fp)
   int    nfeatures, nclasses, ntrees, max_depth, ntraining, nsteps, c, n, f ;
   char   line[MAX_LINE_LEN], *cp, *class_names[MAX_CLASSES] ;
   double feature_fraction ;
+  long   pos ;
 
   cp = fgetl(line, MAX_LINE_LEN, fp) ;
   sscanf(cp, "%d %d %d %d %d %d %lf", 
@@ -1134,6 +1145,15 @@ RFreadFrom(FILE *fp)
 
   for (n = 0 ; n < rf->ntrees ; n++)
     rfReadTree(rf, &rf->trees[n], fp) ;
+
+  // optional flattened forest - rewind if it isn't there
+  pos = ftell(fp) ;
+  cp = fgetl(line, MAX_LINE_LEN, fp) ;
+  if (cp && !strncmp(cp, "COMPILED", strlen("COMPILED")))
+    rfReadCompiled(rf, fp, cp) ;
+  else if (pos >= 0)
+    fseek(fp, pos, SEEK_SET) ;
+
   for (c = 0 ; c < nclasses ; c++)
     free(class_names[c]) ;
   return(rf) ;
@@ -1147,6 +1167,7 @@ RFsetNumberOfClasses(RANDOM_FOREST *rf, int nclasses)
   int   *old_class_counts ;
   TREE  *tree ;
 
+  RFfreeCompiled(rf) ;
   if (nclasses > rf->nclasses)
   {
     old_class_names = rf->class_names ;
@@ -1264,6 +1285,7 @@ RFfree(RANDOM_FOREST **prf)
 
   *prf = NULL ;
   
+  RFfreeCompiled(rf) ;
   for (t = 0 ; t < rf->ntrees ; t++)
   {
     tree = &rf->trees[t] ;
@@ -1308,6 +1330,7 @@ RFpruneTree(RANDOM_FOREST *rf, int min_training_samples)
   int           t ;
   TREE          *tree ;
   
+  RFfreeCompiled(rf) ;
   for (t = 0 ; t < rf->ntrees ; t++)
   {
     tree = &rf->trees[t] ;
@@ -1317,3 +1340,286 @@ RFpruneTree(RANDOM_FOREST *rf, int min_training_samples)
   return(NO_ERROR) ;
 }
 
+
+/*
+  flattened forest for inference. The linked trees are copied into
+  contiguous node arrays so that classification is a tight loop over
+  indices instead of a pointer chase, and the leaf class counts of all
+  trees live in one table.
+*/
+static int
+rfCountNodes(NODE *node, int *pnleaves)
+{
+  if (node->left == NULL)
+  {
+    (*pnleaves)++ ;
+    return(1) ;
+  }
+  return(1 + rfCountNodes(node->left, pnleaves) + rfCountNodes(node->right, pnleaves)) ;
+}
+
+static RF_COMPILED *
+rfAllocCompiled(int nnodes, int nleaves, int nclasses, int ntrees)
+{
+  RF_COMPILED *cf ;
+
+  cf = (RF_COMPILED *)calloc(1, sizeof(RF_COMPILED)) ;
+  if (cf == NULL)
+    ErrorExit(ERROR_NOMEMORY, "rfAllocCompiled: could not allocate compiled forest") ;
+  cf->nnodes = nnodes ; cf->nleaves = nleaves ; 
+  cf->nclasses = nclasses ; cf->ntrees = ntrees ;
+  cf->roots = (int *)calloc(ntrees, sizeof(cf->roots[0])) ;
+  cf->active = (int *)calloc(ntrees, sizeof(cf->active[0])) ;
+  cf->feature = (int *)calloc(nnodes, sizeof(cf->feature[0])) ;
+  cf->thresh = (double *)calloc(nnodes, sizeof(cf->thresh[0])) ;
+  cf->child = (int *)calloc(nnodes, sizeof(cf->child[0])) ;
+  cf->leaf_counts = (double *)calloc(nleaves*nclasses, sizeof(cf->leaf_counts[0])) ;
+  if (!cf->roots || !cf->active || !cf->feature || !cf->thresh || !cf->child || !cf->leaf_counts)
+    ErrorExit(ERROR_NOMEMORY, "rfAllocCompiled: could not allocate %d nodes and %d leaves",
+	      nnodes, nleaves) ;
+  return(cf) ;
+}
+
+// children of a node are placed next to each other: left at child[n], right at child[n]+1
+static int
+rfCompileNode(RF_COMPILED *cf, NODE *node, int n, int *pnext_node, int *pnext_leaf)
+{
+  int c, leaf, left ;
+
+  cf->feature[n] = node->feature ;
+  cf->thresh[n] = node->thresh ;
+  if (node->left == NULL)
+  {
+    leaf = (*pnext_leaf)++ ;
+    cf->child[n] = -(leaf+1) ;
+    for (c = 0 ; c < cf->nclasses ; c++)
+      cf->leaf_counts[leaf*cf->nclasses+c] = node->class_counts[c] ;
+    return(NO_ERROR) ;
+  }
+  left = *pnext_node ;
+  *pnext_node += 2 ;
+  cf->child[n] = left ;
+  rfCompileNode(cf, node->left, left, pnext_node, pnext_leaf) ;
+  rfCompileNode(cf, node->right, left+1, pnext_node, pnext_leaf) ;
+  return(NO_ERROR) ;
+}
+
+int
+RFcompile(RANDOM_FOREST *rf)
+{
+  int         n, c, nnodes, nleaves, next_node, next_leaf ;
+  TREE        *tree ;
+  RF_COMPILED *cf ;
+
+  RFfreeCompiled(rf) ;
+  for (nnodes = nleaves = n = 0 ; n < rf->ntrees ; n++)
+    nnodes += rfCountNodes(&rf->trees[n].root, &nleaves) ;
+
+  cf = rfAllocCompiled(nnodes, nleaves, rf->nclasses, rf->ntrees) ;
+  for (next_node = next_leaf = n = 0 ; n < rf->ntrees ; n++)
+  {
+    tree = &rf->trees[n] ;
+
+    // same test as RFclassify - trees with only one training class are not used
+    for (c = 0 ; c < rf->nclasses ; c++)
+      if (tree->root.class_counts[c] == tree->root.total_counts)
+	break ;
+    cf->active[n] = (c >= rf->nclasses) ;
+    cf->roots[n] = next_node++ ;
+    rfCompileNode(cf, &tree->root, cf->roots[n], &next_node, &next_leaf) ;
+  }
+  rf->compiled = cf ;
+  return(NO_ERROR) ;
+}
+
+int
+RFfreeCompiled(RANDOM_FOREST *rf)
+{
+  RF_COMPILED *cf = rf->compiled ;
+
+  if (cf == NULL)
+    return(NO_ERROR) ;
+  rf->compiled = NULL ;
+  free(cf->roots) ; free(cf->active) ; free(cf->feature) ;
+  free(cf->thresh) ; free(cf->child) ; free(cf->leaf_counts) ;
+  free(cf) ;
+  return(NO_ERROR) ;
+}
+
+static int
+rfClassifyCompiled(RF_COMPILED *cf, double *feature, double *class_counts)
+{
+  int    t, n, child, c ;
+  double *counts ;
+
+  for (t = 0 ; t < cf->ntrees ; t++)
+  {
+    if (cf->active[t] == 0)
+      continue ;
+    n = cf->roots[t] ;
+    while ((child = cf->child[n]) >= 0)   // same comparison as rfFindLeaf (NaNs go right)
+      n = (feature[cf->feature[n]] < cf->thresh[n]) ? child : child+1 ;
+    counts = &cf->leaf_counts[(-child-1)*cf->nclasses] ;
+    for (c = 0 ; c < cf->nclasses ; c++)
+      class_counts[c] += counts[c] ;
+  }
+  return(NO_ERROR) ;
+}
+
+/*
+  classify nsamples feature vectors stored contiguously (nsamples x
+  rf->nfeatures). classes[i] gets the same label RFclassify would return
+  and pvals[i] (if pvals is not NULL) the probability of that label, or 0
+  if no tree voted. Compiles the forest if that hasn't been done, so it
+  must not be called concurrently on the same uncompiled forest. Unlike
+  RFclassify it doesn't touch rf->pvals.
+*/
+int
+RFclassifyBatch(RANDOM_FOREST *rf, double *features, int nsamples, int *classes, double *pvals)
+{
+  int         i ;
+  RF_COMPILED *cf ;
+
+  if (rf->nclasses > MAX_CLASSES)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "RFclassifyBatch: too many classes %d (max %d)",
+				rf->nclasses, MAX_CLASSES)) ;
+  if (rf->compiled == NULL || rf->compiled->nclasses != rf->nclasses)
+    RFcompile(rf) ;
+  cf = rf->compiled ;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for shared(cf, features, classes, pvals) schedule(static)
+#endif
+  for (i = 0 ; i < nsamples ; i++)
+  {
+    int    c, max_class = 0 ;
+    double class_counts[MAX_CLASSES], max_count, total_count ;
+
+    memset(class_counts, 0, sizeof(class_counts)) ;
+    rfClassifyCompiled(cf, features + (size_t)i*rf->nfeatures, class_counts) ;
+    for (total_count = max_count = 0.0, c = 0 ; c < cf->nclasses ; c++)
+    {
+      total_count += class_counts[c] ;
+      if (class_counts[c] > max_count)
+      {
+	max_count = class_counts[c] ;
+	max_class = c ;
+      }
+    }
+    classes[i] = max_class ;
+    if (pvals)
+      pvals[i] = FZERO(total_count) ? 0.0 : max_count/total_count ;
+  }
+  return(NO_ERROR) ;
+}
+
+/*
+  the trees themselves are written with %lf, which rounds the thresholds,
+  so the flattened form carries the exact values and replaces the rounded
+  ones when it is read back in.
+*/
+static int
+rfWriteCompiled(RANDOM_FOREST *rf, FILE *fp)
+{
+  RF_COMPILED *cf = rf->compiled ;
+  int         n, c ;
+
+  fprintf(fp, "COMPILED %d %d %d %d\n", cf->nnodes, cf->nleaves, cf->nclasses, cf->ntrees) ;
+  for (n = 0 ; n < cf->ntrees ; n++)
+    fprintf(fp, "%d %d\n", cf->roots[n], cf->active[n]) ;
+  for (n = 0 ; n < cf->nnodes ; n++)
+    fprintf(fp, "%d %d %.17g\n", cf->feature[n], cf->child[n], cf->thresh[n]) ;
+  for (n = 0 ; n < cf->nleaves ; n++)
+  {
+    for (c = 0 ; c < cf->nclasses ; c++)
+      fprintf(fp, "%.0f ", cf->leaf_counts[n*cf->nclasses+c]) ;
+    fprintf(fp, "\n") ;
+  }
+  fprintf(fp, "COMPILED: END\n") ;
+  return(NO_ERROR) ;
+}
+
+// check the flattened node n against the tree node and take its exact threshold
+static int
+rfMatchCompiledNode(RF_COMPILED *cf, NODE *node, int n)
+{
+  int child ;
+
+  if (n < 0 || n >= cf->nnodes || cf->feature[n] != node->feature ||
+      fabs(cf->thresh[n] - node->thresh) > 1e-5*MAX(1.0, fabs(node->thresh)))
+    return(0) ;
+  child = cf->child[n] ;
+  if (node->left == NULL)
+    return(child < 0 && -child-1 < cf->nleaves) ;
+  if (child < 0 || !rfMatchCompiledNode(cf, node->left, child) ||
+      !rfMatchCompiledNode(cf, node->right, child+1))
+    return(0) ;
+  return(1) ;
+}
+static int
+rfCopyCompiledThresholds(RF_COMPILED *cf, NODE *node, int n)
+{
+  node->thresh = cf->thresh[n] ;
+  if (node->left)
+  {
+    rfCopyCompiledThresholds(cf, node->left, cf->child[n]) ;
+    rfCopyCompiledThresholds(cf, node->right, cf->child[n]+1) ;
+  }
+  return(NO_ERROR) ;
+}
+
+static int
+rfReadCompiled(RANDOM_FOREST *rf, FILE *fp, char *header)
+{
+  RF_COMPILED *cf ;
+  int         nnodes, nleaves, nclasses, ntrees, n, c ;
+  char        line[MAX_LINE_LEN], *cp ;
+
+  if (sscanf(header, "COMPILED %d %d %d %d", &nnodes, &nleaves, &nclasses, &ntrees) != 4 ||
+      nnodes <= 0 || nleaves <= 0 || nclasses != rf->nclasses || ntrees != rf->ntrees)
+    ErrorExit(ERROR_BADFILE, "rfReadCompiled: bad header '%s'", header) ;
+
+  cf = rfAllocCompiled(nnodes, nleaves, nclasses, ntrees) ;
+  for (n = 0 ; n < ntrees ; n++)
+  {
+    cp = fgetl(line, MAX_LINE_LEN, fp) ;
+    if (cp == NULL || sscanf(cp, "%d %d", &cf->roots[n], &cf->active[n]) != 2)
+      ErrorExit(ERROR_BADFILE, "rfReadCompiled: could not read root of tree %d", n) ;
+  }
+  for (n = 0 ; n < nnodes ; n++)
+  {
+    cp = fgetl(line, MAX_LINE_LEN, fp) ;
+    if (cp == NULL || sscanf(cp, "%d %d %lf", &cf->feature[n], &cf->child[n], &cf->thresh[n]) != 3)
+      ErrorExit(ERROR_BADFILE, "rfReadCompiled: could not read node %d", n) ;
+  }
+  for (n = 0 ; n < nleaves ; n++)
+  {
+    cp = fgetl(line, MAX_LINE_LEN, fp) ;
+    if (cp == NULL)
+      ErrorExit(ERROR_BADFILE, "rfReadCompiled: could not read leaf %d", n) ;
+    cp = strtok(line, " ") ;
+    for (c = 0 ; c < nclasses ; c++)
+    {
+      if (cp == NULL)
+	ErrorExit(ERROR_BADFILE, "rfReadCompiled: could not read class counts of leaf %d", n) ;
+      sscanf(cp, "%lf", &cf->leaf_counts[n*nclasses+c]) ;
+      cp = strtok(NULL, " ") ;
+    }
+  }
+  cp = fgetl(line, MAX_LINE_LEN, fp) ;  // COMPILED: END line
+
+  // only trust it if it describes the trees that were just read
+  for (n = 0 ; n < ntrees ; n++)
+    if (!rfMatchCompiledNode(cf, &rf->trees[n].root, cf->roots[n]))
+      break ;
+  rf->compiled = cf ;
+  if (n < ntrees)
+  {
+    printf("warning: rfReadCompiled: compiled forest does not match tree %d - recompiling\n", n) ;
+    RFcompile(rf) ;
+    return(ERROR_BADFILE) ;
+  }
+  for (n = 0 ; n < ntrees ; n++)
+    rfCopyCompiledThresholds(cf, &rf->trees[n].root, cf->roots[n]) ;
+  return(NO_ERROR) ;
+}
@@ -68,41 +68,75 @@ SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax,
                            MATRIX *XFM)
 {
   SCS *scs, *scs_sorted;
-  int vtx, vtx_inrange, vtx_clustno, CurrentClusterNo;
+  int vtx, vtx_clustno, CurrentClusterNo;
+  int nbr, nbr_vtx, root, nUF, *newno;
   float vtx_val,ClusterArea;
   int nVtxsInCluster;
+  CLUSTER_UF *uf;
 
-  /* initialized all cluster numbers to 0 */
+  /* Label the connected components of the vertices that meet the
+     threshold criteria with union-find (no recursion, so large
+     clusters cannot overflow the stack) */
+  uf = clustUFalloc(Surf->nvertices,0);
+  if (uf == NULL)
+  {
+    *nClusters = 0;
+    return(NULL);
+  }
   for (vtx = 0; vtx < Surf->nvertices; vtx++)
+  {
     Surf->vertices[vtx].undefval = 0; /* overloads this elem of struct */
+    vtx_val = Surf->vertices[vtx].val;
+    if (!clustValueInRange(vtx_val,thmin,thmax,thsign)) continue;
+    clustUFadd(uf,vtx,0,0);
+    for (nbr=0; nbr < Surf->vertices[vtx].vnum; nbr++)
+    {
+      nbr_vtx = Surf->vertices[vtx].v[nbr];
+      if (nbr_vtx < vtx && uf->parent[nbr_vtx] >= 0)
+        clustUFunion(uf,vtx,nbr_vtx);
+    }
+  }
 
-  /* Go through each vertex looking for one that meets the threshold
-     criteria and has not been previously assigned to a cluster.
-     When found, grow it out. */
-  CurrentClusterNo = 1;
+  /* Number the clusters in the order of their lowest vertex (the seed
+     order when growing). The root keeps its number in nmembers
+     (negated). */
+  nUF = 0;
   for (vtx = 0; vtx < Surf->nvertices; vtx++)
   {
+    if (uf->parent[vtx] < 0) continue;
+    root = clustUFfind(uf,vtx);
+    if (uf->nmembers[root] > 0)
+    {
+      nUF++;
+      uf->nmembers[root] = -nUF;
+    }
+    Surf->vertices[vtx].undefval = -uf->nmembers[root];
+  }
+  clustUFfree(&uf);
 
-    vtx_val     = Surf->vertices[vtx].val;
-    vtx_clustno = Surf->vertices[vtx].undefval;
-    vtx_inrange = clustValueInRange(vtx_val,thmin,thmax,thsign);
-
-    if (vtx_clustno == 0 && vtx_inrange)
+  /* If a cluster does not meet the area criteria, delete it and
+     renumber the ones that remain */
+  CurrentClusterNo = nUF+1;
+  if (minarea > 0 && nUF > 0)
+  {
+    newno = (int *) calloc(nUF+1,sizeof(int));
+    if (newno == NULL)
     {
-      sclustGrowSurfCluster(CurrentClusterNo,vtx,Surf,thmin,thmax,thsign);
-      if (minarea > 0)
-      {
-        /* If the cluster does not meet the area criteria, delete it */
-        ClusterArea = sclustSurfaceArea(CurrentClusterNo, Surf,
-                                        &nVtxsInCluster) ;
-        if (ClusterArea < minarea)
-        {
-          sclustZeroSurfaceClusterNo(CurrentClusterNo, Surf);
-          continue;
-        }
-      }
+      printf("ERROR: sclustMapSurfClusters: could not alloc %d\n",nUF+1);
+      *nClusters = 0;
+      return(NULL);
+    }
+    CurrentClusterNo = 1;
+    for (vtx_clustno = 1; vtx_clustno <= nUF; vtx_clustno++)
+    {
+      ClusterArea = sclustSurfaceArea(vtx_clustno, Surf, &nVtxsInCluster) ;
+      if (ClusterArea < minarea) continue;
+      newno[vtx_clustno] = CurrentClusterNo;
       CurrentClusterNo++;
     }
+    for (vtx = 0; vtx < Surf->nvertices; vtx++)
+      Surf->vertices[vtx].undefval = newno[Surf->vertices[vtx].undefval];
+    free(newno);
   }
 
   *nClusters = CurrentClusterNo-1;
@@ -141,7 +175,7 @@ SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax,
 int sclustGrowSurfCluster(int ClusterNo, int SeedVtx, MRI_SURFACE *Surf,
                           float thmin, float thmax, int thsign)
 {
-  int nbr, nbr_vtx, nbr_inrange, nbr_clustno;
+  int nbr, nbr_vtx, nbr_inrange, nbr_clustno, vtx, nstack, *stack;
   float nbr_val;
 
   if (ClusterNo == 0)
@@ -150,21 +184,29 @@ int sclustGrowSurfCluster(int ClusterNo, int SeedVtx, MRI_SURFACE *Surf,
     return(1);
   }
 
+  /* Use an explicit stack instead of recursion. A vertex is labeled
+     when it is pushed, so it can be on the stack at most once. */
+  stack = (int *) calloc(Surf->nvertices, sizeof(int));
   Surf->vertices[SeedVtx].undefval = ClusterNo;
-
-  for (nbr=0; nbr < Surf->vertices[SeedVtx].vnum; nbr++)
+  stack[0] = SeedVtx;
+  nstack = 1;
+  while (nstack > 0)
   {
-
-    nbr_vtx     = Surf->vertices[SeedVtx].v[nbr];
-    nbr_clustno = Surf->vertices[nbr_vtx].undefval;
-    if (nbr_clustno != 0) continue;
-    nbr_val     = Surf->vertices[nbr_vtx].val;
-    if (fabs(nbr_val) < thmin) continue;
-    nbr_inrange = clustValueInRange(nbr_val,thmin,thmax,thsign);
-    if (!nbr_inrange) continue;
-    sclustGrowSurfCluster(ClusterNo, nbr_vtx, Surf, thmin,thmax,thsign);
-
+    vtx = stack[--nstack];
+    for (nbr=0; nbr < Surf->vertices[vtx].vnum; nbr++)
+    {
+      nbr_vtx     = Surf->vertices[vtx].v[nbr];
+      nbr_clustno = Surf->vertices[nbr_vtx].undefval;
+      if (nbr_clustno != 0) continue;
+      nbr_val     = Surf->vertices[nbr_vtx].val;
+      if (fabs(nbr_val) < thmin) continue;
+      nbr_inrange = clustValueInRange(nbr_val,thmin,thmax,thsign);
+      if (!nbr_inrange) continue;
+      Surf->vertices[nbr_vtx].undefval = ClusterNo;
+      stack[nstack++] = nbr_vtx;
+    }
   }
+  free(stack);
   return(0);
 }
 /*----------------------------------------------------------------
@@ -908,3 +950,148 @@ int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh,
   
   return(nhits);
 }
+
+/*---------------------------------------------------------------
+  sclustThresholdSweep() - computes the number of clusters, the area
+  of the largest cluster, the number of vertices in the cluster with
+  the most vertices, and the weightvtx of the heaviest cluster at each
+  of the nthresh thresholds in a single pass (thmax is taken as -1).
+  The value is taken from the val field. The vertices are sorted by
+  value (taking thsign into account) and added from the highest down
+  with union-find, so each threshold is read off as the sweep passes
+  it. This gives the same results as calling sclustMapSurfClusters()
+  followed by sclustMaxClusterArea(), sclustMaxClusterCount() and
+  sclustMaxClusterWeightVtx() at each threshold, but without
+  re-clustering. Any of the outputs can be NULL.
+  ---------------------------------------------------------------*/
+typedef struct
+{
+  float key;
+  int vtxno;
+} SCLUST_SWEEP_ITEM;
+
+static int sclustCompareSweepItem(const void *a, const void *b)
+{
+  const SCLUST_SWEEP_ITEM *ia = (const SCLUST_SWEEP_ITEM *) a;
+  const SCLUST_SWEEP_ITEM *ib = (const SCLUST_SWEEP_ITEM *) b;
+  if (ia->key > ib->key) return(-1);
+  if (ia->key < ib->key) return(+1);
+  return(ia->vtxno - ib->vtxno);
+}
+
+int sclustThresholdSweep(MRI_SURFACE *Surf, int thsign, int nthresh,
+                         const double *thresh, int *nClusters,
+                         double *MaxArea, int *MaxCount, double *MaxWeightVtx)
+{
+  CLUSTER_UF *uf;
+  SCLUST_SWEEP_ITEM *items;
+  int *order, n, m, k, tmp, pos, nc, ncomp, maxcount, vtx, nbr_vtx, root;
+  double t, maxarea, maxw, w, vtxarea, areascale;
+  float val;
+
+  areascale = 1.0;
+  if (Surf->group_avg_surface_area > 0 && ! Surf->group_avg_vtxarea_loaded)
+    areascale = Surf->group_avg_surface_area/Surf->total_area;
+
+  items = (SCLUST_SWEEP_ITEM *) calloc(Surf->nvertices, sizeof(SCLUST_SWEEP_ITEM));
+  if (items == NULL)
+  {
+    printf("ERROR: sclustThresholdSweep: could not alloc %d items\n",Surf->nvertices);
+    return(1);
+  }
+  for (vtx = 0; vtx < Surf->nvertices; vtx++)
+  {
+    val = Surf->vertices[vtx].val;
+    if (thsign ==  0) val = fabs(val);
+    if (thsign == -1) val = -val;
+    items[vtx].key = val;
+    items[vtx].vtxno = vtx;
+  }
+  qsort(items, Surf->nvertices, sizeof(SCLUST_SWEEP_ITEM), sclustCompareSweepItem);
+
+  // Visit the thresholds from highest to lowest
+  order = (int *) calloc(nthresh, sizeof(int));
+  if (order == NULL)
+  {
+    printf("ERROR: sclustThresholdSweep: could not alloc %d thresholds\n",nthresh);
+    free(items);
+    return(1);
+  }
+  for (n=0; n < nthresh; n++) order[n] = n;
+  for (n=0; n < nthresh; n++)
+  {
+    for (m=n+1; m < nthresh; m++)
+    {
+      if (thresh[order[m]] > thresh[order[n]])
+      {
+        tmp = order[n];
+        order[n] = order[m];
+        order[m] = tmp;
+      }
+    }
+  }
+
+  uf = clustUFalloc(Surf->nvertices,1);
+  if (uf == NULL)
+  {
+    free(items);
+    free(order);
+    return(1);
+  }
+  pos = 0;
+  ncomp = 0;
+  maxcount = 0;
+  maxarea = 0;
+  for (n=0; n < nthresh; n++)
+  {
+    t = (float) thresh[order[n]]; // same precision as clustValueInRange()
+    while (pos < Surf->nvertices && items[pos].key >= t)
+    {
+      vtx = items[pos].vtxno;
+      if (! Surf->group_avg_vtxarea_loaded) vtxarea = Surf->vertices[vtx].area;
+      else                                 vtxarea = Surf->vertices[vtx].group_avg_area;
+      clustUFadd(uf,vtx,vtxarea,Surf->vertices[vtx].val);
+      ncomp++;
+      for (k=0; k < Surf->vertices[vtx].vnum; k++)
+      {
+        nbr_vtx = Surf->vertices[vtx].v[k];
+        if (uf->parent[nbr_vtx] < 0) continue;
+        ncomp -= clustUFunion(uf,vtx,nbr_vtx);
+      }
+      // Area and count can only grow as clusters merge
+      root = clustUFfind(uf,vtx);
+      if (maxcount < uf->nmembers[root]) maxcount = uf->nmembers[root];
+      if (maxarea  < uf->size[root])     maxarea  = uf->size[root];
+      pos++;
+    }
+
+    // The weight of a merged cluster can be smaller in magnitude than
+    // one of its parts (abs), so check the current clusters
+    if (MaxWeightVtx != NULL)
+    {
+      if (thsign == 0) maxw = 0;
+      else             maxw = -thsign*10e10;
+      nc = 0;
+      for (k=0; k < pos; k++)
+      {
+        vtx = items[k].vtxno;
+        if (uf->parent[vtx] != vtx) continue;
+        w = uf->weight[vtx];
+        if (thsign ==  0 && fabs(maxw) < fabs(w)) maxw = w;
+        if (thsign == +1 && maxw < w)             maxw = w;
+        if (thsign == -1 && maxw > w)             maxw = w;
+        nc++;
+      }
+      if (nc == 0) maxw = 0;
+      MaxWeightVtx[order[n]] = maxw;
+    }
+    if (nClusters != NULL) nClusters[order[n]] = ncomp;
+    if (MaxCount  != NULL) MaxCount[order[n]]  = maxcount;
+    if (MaxArea   != NULL) MaxArea[order[n]]   = maxarea*areascale;
+  }
+
+  clustUFfree(&uf);
+  free(items);
+  free(order);
+  return(0);
+}
@@ -0,0 +1,271 @@
+/*--------------------------------------------
+  test_GCAMread.c
+
+  1. A morph written by GCAMwrite in the legacy, chunked and chunked
+     delta m3z layouts reads back through GCAMread with every node
+     field, the labels, the geometry, the affine and the header
+     bit-identical to what was written, and with the same invalid
+     flags from all three layouts.
+  2. GCAMreadPartial of a chunked file with a box and a subset of the
+     fields reads those fields of the nodes inside the box, and marks
+     the nodes outside of it invalid.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "matrix.h"
+#include "gcamorph.h"
+
+char *Progname ;
+
+/* more than two chunks of x slices, the last one partial */
+#define WIDTH   19
+#define HEIGHT  6
+#define DEPTH   5
+
+static int
+same_float(float a, float b)
+{
+  return(memcmp(&a, &b, sizeof(float)) == 0) ;
+}
+
+static void
+set_geom(VOL_GEOM *vg, int i)
+{
+  vg->valid = 1 ;
+  vg->width = 256 + i ;
+  vg->height = 255 ;
+  vg->depth = 170 - i ;
+  vg->xsize = 1.0 ;
+  vg->ysize = 0.9375 + i ;
+  vg->zsize = 1.2 ;
+  vg->x_r = -1 ; vg->x_a = 0 ;  vg->x_s = 0 ;
+  vg->y_r = 0 ;  vg->y_a = 0 ;  vg->y_s = -1 ;
+  vg->z_r = 0 ;  vg->z_a = 1 ;  vg->z_s = 0 ;
+  vg->c_r = 1.5 + i ; vg->c_a = -17.25 ; vg->c_s = 3.125 ;
+  sprintf(vg->fname, "/some/subject/mri/vol%d.mgz", i) ;
+}
+
+static int
+differ_geom(VOL_GEOM *vg1, VOL_GEOM *vg2)
+{
+  return(vg1->valid != vg2->valid || vg1->width != vg2->width ||
+         vg1->height != vg2->height || vg1->depth != vg2->depth ||
+         !same_float(vg1->xsize, vg2->xsize) ||
+         !same_float(vg1->ysize, vg2->ysize) ||
+         !same_float(vg1->zsize, vg2->zsize) ||
+         !same_float(vg1->x_r, vg2->x_r) || !same_float(vg1->x_a, vg2->x_a) ||
+         !same_float(vg1->x_s, vg2->x_s) || !same_float(vg1->y_r, vg2->y_r) ||
+         !same_float(vg1->y_a, vg2->y_a) || !same_float(vg1->y_s, vg2->y_s) ||
+         !same_float(vg1->z_r, vg2->z_r) || !same_float(vg1->z_a, vg2->z_a) ||
+         !same_float(vg1->z_s, vg2->z_s) || !same_float(vg1->c_r, vg2->c_r) ||
+         !same_float(vg1->c_a, vg2->c_a) || !same_float(vg1->c_s, vg2->c_s) ||
+         strcmp(vg1->fname, vg2->fname)) ;
+}
+
+/* a smooth warp with full precision noise, some negative values and a
+   few all-zero (invalid) nodes */
+static GCA_MORPH *
+make_gcam(void)
+{
+  GCA_MORPH      *gcam ;
+  GCA_MORPH_NODE *gcamn ;
+  int            x, y, z, r, c ;
+
+  gcam = GCAMalloc(WIDTH, HEIGHT, DEPTH) ;
+  gcam->spacing = 2 ;
+  gcam->exp_k = 20.5 ;
+  gcam->type = GCAM_VOX ;
+  set_geom(&gcam->image, 0) ;
+  set_geom(&gcam->atlas, 1) ;
+  gcam->m_affine = MatrixAlloc(4, 4, MATRIX_REAL) ;
+  for (r = 1 ; r <= 4 ; r++)
+    for (c = 1 ; c <= 4 ; c++)
+      *MATRIX_RELT(gcam->m_affine, r, c) = (r == c) + 0.01*r - 0.003*c ;
+  *MATRIX_RELT(gcam->m_affine, 4, 1) = 0 ;
+  *MATRIX_RELT(gcam->m_affine, 4, 2) = 0 ;
+  *MATRIX_RELT(gcam->m_affine, 4, 3) = 0 ;
+  *MATRIX_RELT(gcam->m_affine, 4, 4) = 1 ;
+
+  srand48(17) ;
+  for (x = 0 ; x < WIDTH ; x++)
+    for (y = 0 ; y < HEIGHT ; y++)
+      for (z = 0 ; z < DEPTH ; z++)
+      {
+        gcamn = &gcam->nodes[x][y][z] ;
+        gcamn->origx = 2*x - 3.0 + drand48()*1e-3 ;
+        gcamn->origy = 2*y + drand48()*1e-3 ;
+        gcamn->origz = 2*z - 5.0 + drand48()*1e-3 ;
+        gcamn->x = gcamn->origx + 1.5*sin(0.3*x + 0.2*z) + drand48()*1e-5 ;
+        gcamn->y = gcamn->origy - 0.7*cos(0.25*y) + drand48()*1e-5 ;
+        gcamn->z = gcamn->origz + 0.1*x*y - drand48()*1e-5 ;
+        gcamn->xn = x/2 - 1 ;
+        gcamn->yn = y/2 ;
+        gcamn->zn = lrand48() % 1000 - 500 ;
+        gcamn->label = (x*3 + y + z) % 7 ? (x + 2*y + 4*z) % 60 : 0 ;
+        if ((x*HEIGHT + y)*DEPTH + z == 40 || (x == 10 && y == 3 && z == 0))
+        {
+          gcamn->origx = gcamn->origy = gcamn->origz = 0 ;
+          gcamn->x = gcamn->y = gcamn->z = 0 ;
+        }
+      }
+  return(gcam) ;
+}
+
+/* number of differences between the fields (GCAM_FIELD_*) of two nodes */
+static int
+compare_node(GCA_MORPH_NODE *gcamn1, GCA_MORPH_NODE *gcamn2, int fields)
+{
+  int nbad = 0 ;
+
+  if (fields & GCAM_FIELD_ORIG)
+    nbad += !same_float(gcamn1->origx, gcamn2->origx) ||
+            !same_float(gcamn1->origy, gcamn2->origy) ||
+            !same_float(gcamn1->origz, gcamn2->origz) ;
+  if (fields & GCAM_FIELD_POSITION)
+    nbad += !same_float(gcamn1->x, gcamn2->x) ||
+            !same_float(gcamn1->y, gcamn2->y) ||
+            !same_float(gcamn1->z, gcamn2->z) ;
+  if (fields & GCAM_FIELD_NODE)
+    nbad += (gcamn1->xn != gcamn2->xn || gcamn1->yn != gcamn2->yn ||
+             gcamn1->zn != gcamn2->zn) ;
+  if (fields & GCAM_FIELD_LABEL)
+    nbad += (gcamn1->label != gcamn2->label) ;
+  return(nbad) ;
+}
+
+/* number of differences between a morph and the one read back */
+static int
+compare_gcams(GCA_MORPH *gcam, GCA_MORPH *gcam_read)
+{
+  int x, y, z, r, c, nbad = 0 ;
+
+  if (gcam_read->width != gcam->width || gcam_read->height != gcam->height ||
+      gcam_read->depth != gcam->depth)
+    return(1) ;
+  nbad += (gcam_read->spacing != gcam->spacing) ;
+  nbad += !same_float(gcam_read->exp_k, gcam->exp_k) ;
+  nbad += (gcam_read->type != gcam->type) ;
+  nbad += !(gcam_read->status & GCAM_LABELED) ;
+  nbad += differ_geom(&gcam_read->image, &gcam->image) ;
+  nbad += differ_geom(&gcam_read->atlas, &gcam->atlas) ;
+  if (gcam_read->m_affine == NULL)
+    nbad++ ;
+  else
+    for (r = 1 ; r <= 4 ; r++)
+      for (c = 1 ; c <= 4 ; c++)
+        nbad += !same_float(*MATRIX_RELT(gcam_read->m_affine, r, c),
+                            *MATRIX_RELT(gcam->m_affine, r, c)) ;
+
+  for (x = 0 ; x < gcam->width ; x++)
+    for (y = 0 ; y < gcam->height ; y++)
+      for (z = 0 ; z < gcam->depth ; z++)
+        nbad += compare_node(&gcam->nodes[x][y][z],
+                             &gcam_read->nodes[x][y][z], GCAM_FIELD_ALL) ;
+  return(nbad) ;
+}
+
+/* number of nodes whose invalid flags differ */
+static int
+compare_invalid(GCA_MORPH *gcam1, GCA_MORPH *gcam2)
+{
+  int x, y, z, nbad = 0 ;
+
+  for (x = 0 ; x < gcam1->width ; x++)
+    for (y = 0 ; y < gcam1->height ; y++)
+      for (z = 0 ; z < gcam1->depth ; z++)
+        nbad += (gcam1->nodes[x][y][z].invalid !=
+                 gcam2->nodes[x][y][z].invalid) ;
+  return(nbad) ;
+}
+
+/* number of nodes in box that do not have the fields of gcam, and of
+   nodes outside of it that are not marked invalid */
+static int
+check_partial(GCA_MORPH *gcam, GCA_MORPH *gcam_read, int fields,
+              MRI_REGION *box)
+{
+  GCA_MORPH_NODE *gcamn ;
+  int            x, y, z, nbad = 0 ;
+
+  if (gcam_read->width != gcam->width || gcam_read->height != gcam->height ||
+      gcam_read->depth != gcam->depth)
+    return(1) ;
+  for (x = 0 ; x < gcam->width ; x++)
+    for (y = 0 ; y < gcam->height ; y++)
+      for (z = 0 ; z < gcam->depth ; z++)
+      {
+        gcamn = &gcam_read->nodes[x][y][z] ;
+        if (x >= box->x && x < box->x+box->dx &&
+            y >= box->y && y < box->y+box->dy &&
+            z >= box->z && z < box->z+box->dz)
+          nbad += compare_node(&gcam->nodes[x][y][z], gcamn, fields) ;
+        else
+          nbad += (gcamn->invalid != GCAM_POSITION_INVALID) ;
+      }
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int        formats[3] = { GCAM_M3Z_LEGACY, GCAM_M3Z_CHUNKED,
+                            GCAM_M3Z_CHUNKED_DELTA } ;
+  char       *names[3] = { "legacy", "chunked", "delta" } ;
+  GCA_MORPH  *gcam, *gcam_read, *gcam_legacy = NULL ;
+  MRI_REGION box ;
+  char       fname[STRLEN] ;
+  int        i, nbad, fields, failed = 0 ;
+
+  Progname = argv[0] ;
+
+  gcam = make_gcam() ;
+  sprintf(fname, "test_GCAMread_%d.m3z", getpid()) ;
+  for (i = 0 ; i < 3 ; i++)
+  {
+    GCAMsetM3zFormat(formats[i]) ;
+    if (GCAMwrite(gcam, fname) != NO_ERROR)
+      ErrorExit(ERROR_BADFILE, "%s: could not write %s", Progname, fname) ;
+    gcam_read = GCAMread(fname) ;
+    if (gcam_read == NULL)
+      ErrorExit(ERROR_BADFILE, "%s: could not read %s", Progname, fname) ;
+    nbad = compare_gcams(gcam, gcam_read) ;
+    if (gcam_legacy == NULL)
+      gcam_legacy = gcam_read ;
+    else
+    {
+      nbad += compare_invalid(gcam_legacy, gcam_read) ;
+      GCAMfree(&gcam_read) ;
+    }
+    printf("%s: %d errors\n", names[i], nbad) ;
+    failed |= (nbad != 0) ;
+  }
+
+  /* the file now holds the delta layout; box straddles two chunks */
+  box.x = 6 ; box.dx = 8 ;
+  box.y = 1 ; box.dy = 4 ;
+  box.z = 2 ; box.dz = 2 ;
+  fields = GCAM_FIELD_POSITION | GCAM_FIELD_LABEL ;
+  gcam_read = GCAMreadPartial(fname, fields, &box) ;
+  unlink(fname) ;
+  if (gcam_read == NULL)
+    ErrorExit(ERROR_BADFILE, "%s: could not read %s", Progname, fname) ;
+  nbad = check_partial(gcam, gcam_read, fields, &box) ;
+  printf("partial: %d errors\n", nbad) ;
+  failed |= (nbad != 0) ;
+  GCAMfree(&gcam_read) ;
+
+  GCAMfree(&gcam_legacy) ;
+  GCAMfree(&gcam) ;
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
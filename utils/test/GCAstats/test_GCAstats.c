@@ -0,0 +1,300 @@
+/*--------------------------------------------
+  test_GCAstats.c
+
+  Regression check of the mergeable training statistics (gcastats.c)
+  against the classic two-pass training of mri_ca_train:
+
+    GCAtrain for every subject, GCAcompleteMeanTraining,
+    GCAtrainCovariances for every subject with intensities,
+    GCAcompleteCovarianceTraining
+
+  on the same synthetic subjects (two inputs, one -noint subject, labels
+  that move from subject to subject so that prior holes get filled).
+  The GCA from a single GCAstatsTrain pass, and the one from shards
+  that are written, read back and merged in order, must have the same
+  priors, labels, sample counts and neighbor label priors, and means
+  and covariances equal up to float rounding.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+#include "gca.h"
+#include "gcastats.h"
+#include "transform.h"
+
+char *Progname ;
+
+#define WIDTH      24
+#define NINPUTS    2
+#define NSUBJECTS  4
+#define NOINT_SUBJECT  2
+#define TOL        1e-4
+
+static void
+make_subject(int subject, MRI **pmri_inputs, MRI **pmri_labels)
+{
+  MRI *mri_inputs, *mri_labels ;
+  int x, y, z, r, label ;
+
+  mri_inputs = MRIallocSequence(WIDTH, WIDTH, WIDTH, MRI_UCHAR, NINPUTS) ;
+  mri_labels = MRIalloc(WIDTH, WIDTH, WIDTH, MRI_SHORT) ;
+  for (z = 0 ; z < WIDTH ; z++)
+    for (y = 0 ; y < WIDTH ; y++)
+      for (x = 0 ; x < WIDTH ; x++)
+      {
+        if (x < 2 || y < 2 || z < 2 || x >= WIDTH-2 || y >= WIDTH-2 ||
+            z >= WIDTH-2)
+          label = 0 ;
+        else
+          label = 1 + ((x+subject)/5 + 2*(y/6) + (z+2*subject)/7) % 6 ;
+        MRISvox(mri_labels, x, y, z) = label ;
+        for (r = 0 ; r < NINPUTS ; r++)
+          MRIseq_vox(mri_inputs, x, y, z, r) =
+            20*label + 30*r + (x*7 + y*13 + z*17 + subject*29 + r*3) % 11 ;
+      }
+  *pmri_inputs = mri_inputs ;
+  *pmri_labels = mri_labels ;
+}
+
+static GCA *
+alloc_gca(void)
+{
+  return(GCAalloc(NINPUTS, 2, 4, WIDTH, WIDTH, WIDTH, 0)) ;
+}
+
+static GCA *
+train_classic(void)
+{
+  GCA       *gca ;
+  MRI       *mri_inputs, *mri_labels ;
+  TRANSFORM *transform ;
+  int       i ;
+
+  gca = alloc_gca() ;
+  for (i = 0 ; i < NSUBJECTS ; i++)
+  {
+    make_subject(i, &mri_inputs, &mri_labels) ;
+    GCAreinit(mri_inputs, gca) ;
+    transform = TransformAlloc(LINEAR_VOXEL_TO_VOXEL, NULL) ;
+    GCAtrain(gca, mri_inputs, mri_labels, transform, NULL,
+             i == NOINT_SUBJECT) ;
+    gca = GCAcompactify(gca) ;
+    MRIfree(&mri_inputs) ; MRIfree(&mri_labels) ;
+    TransformFree(&transform) ;
+  }
+  GCAcompleteMeanTraining(gca) ;
+  for (i = 0 ; i < NSUBJECTS ; i++)
+  {
+    if (i == NOINT_SUBJECT)
+      continue ;
+    make_subject(i, &mri_inputs, &mri_labels) ;
+    GCAreinit(mri_inputs, gca) ;
+    transform = TransformAlloc(LINEAR_VOXEL_TO_VOXEL, NULL) ;
+    GCAtrainCovariances(gca, mri_inputs, mri_labels, transform) ;
+    gca = GCAcompactify(gca) ;
+    MRIfree(&mri_inputs) ; MRIfree(&mri_labels) ;
+    TransformFree(&transform) ;
+  }
+  GCAcompleteCovarianceTraining(gca) ;
+  return(gca) ;
+}
+
+/* statistics of subjects first..last */
+static GCA_STATS *
+train_stats(int first, int last)
+{
+  GCA_STATS *gs ;
+  MRI       *mri_inputs, *mri_labels ;
+  TRANSFORM *transform ;
+  int       i ;
+
+  gs = GCAstatsAlloc(alloc_gca()) ;
+  for (i = first ; i <= last ; i++)
+  {
+    make_subject(i, &mri_inputs, &mri_labels) ;
+    GCAreinit(mri_inputs, gs->gca) ;
+    transform = TransformAlloc(LINEAR_VOXEL_TO_VOXEL, NULL) ;
+    GCAstatsTrain(gs, mri_inputs, mri_labels, transform,
+                  i == NOINT_SUBJECT) ;
+    MRIfree(&mri_inputs) ; MRIfree(&mri_labels) ;
+    TransformFree(&transform) ;
+  }
+  return(gs) ;
+}
+
+/* shards {0,1}, {2}, {3} written, read back and merged in order */
+static GCA *
+train_merged(void)
+{
+  GCA       *gca ;
+  GCA_STATS *gs, *gs_shard ;
+  int       shards[3][2] = { { 0, 1 }, { 2, 2 }, { 3, 3 } } ;
+  int       i ;
+  char      fname[STRLEN] ;
+
+  gs = NULL ;
+  sprintf(fname, "test_GCAstats_%d.stats", getpid()) ;
+  for (i = 0 ; i < 3 ; i++)
+  {
+    gs_shard = train_stats(shards[i][0], shards[i][1]) ;
+    if (GCAstatsWrite(gs_shard, fname) != NO_ERROR)
+      ErrorExit(ERROR_BADFILE, "%s: could not write %s", Progname, fname) ;
+    GCAstatsFree(&gs_shard) ;
+    gs_shard = GCAstatsRead(fname) ;
+    unlink(fname) ;
+    if (!gs_shard)
+      ErrorExit(ERROR_BADFILE, "%s: could not read %s", Progname, fname) ;
+    if (gs == NULL)
+    {
+      gs = gs_shard ;
+      continue ;
+    }
+    if (GCAstatsMerge(gs, gs_shard) != NO_ERROR)
+      ErrorExit(ERROR_BADPARM, "%s: could not merge shard %d", Progname, i) ;
+    GCAstatsFree(&gs_shard) ;
+  }
+  gca = GCAstatsCompleteTraining(gs) ;
+  GCAstatsFree(&gs) ;
+  return(gca) ;
+}
+
+static int
+differ(double a, double b)
+{
+  return(fabs(a-b) > TOL*MAX(1.0, fabs(a))) ;
+}
+
+static int
+find_label(unsigned short *labels, int nlabels, int label)
+{
+  int n ;
+
+  for (n = 0 ; n < nlabels ; n++)
+    if (labels[n] == label)
+      return(n) ;
+  return(-1) ;
+}
+
+/* number of differences between two trained GCAs */
+static int
+compare_gcas(GCA *gca1, GCA *gca2)
+{
+  GCA_NODE  *gcan1, *gcan2 ;
+  GCA_PRIOR *gcap1, *gcap2 ;
+  GC1D      *gc1, *gc2 ;
+  int       x, y, z, n, m, i, j, k, r, nbad = 0 ;
+
+  if (gca1->node_width != gca2->node_width ||
+      gca1->prior_width != gca2->prior_width ||
+      gca1->total_training != gca2->total_training)
+    return(1) ;
+
+  for (x = 0 ; x < gca1->prior_width ; x++)
+    for (y = 0 ; y < gca1->prior_height ; y++)
+      for (z = 0 ; z < gca1->prior_depth ; z++)
+      {
+        gcap1 = &gca1->priors[x][y][z] ;
+        gcap2 = &gca2->priors[x][y][z] ;
+        if (gcap1->nlabels != gcap2->nlabels ||
+            gcap1->total_training != gcap2->total_training)
+        {
+          nbad++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcap1->nlabels ; n++)
+        {
+          m = find_label(gcap2->labels, gcap2->nlabels, gcap1->labels[n]) ;
+          nbad += (m < 0 || differ(gcap1->priors[n], gcap2->priors[m])) ;
+        }
+      }
+
+  for (x = 0 ; x < gca1->node_width ; x++)
+    for (y = 0 ; y < gca1->node_height ; y++)
+      for (z = 0 ; z < gca1->node_depth ; z++)
+      {
+        gcan1 = &gca1->nodes[x][y][z] ;
+        gcan2 = &gca2->nodes[x][y][z] ;
+        if (gcan1->nlabels != gcan2->nlabels ||
+            gcan1->total_training != gcan2->total_training)
+        {
+          nbad++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcan1->nlabels ; n++)
+        {
+          m = find_label(gcan2->labels, gcan2->nlabels, gcan1->labels[n]) ;
+          if (m < 0)
+          {
+            nbad++ ;
+            continue ;
+          }
+          gc1 = &gcan1->gcs[n] ;
+          gc2 = &gcan2->gcs[m] ;
+          if (gc1->ntraining != gc2->ntraining ||
+              gc1->n_just_priors != gc2->n_just_priors)
+          {
+            nbad++ ;
+            continue ;
+          }
+          for (r = 0 ; r < gca1->ninputs ; r++)
+            nbad += differ(gc1->means[r], gc2->means[r]) ;
+          for (r = 0 ; r < gca1->ninputs*(gca1->ninputs+1)/2 ; r++)
+            nbad += differ(gc1->covars[r], gc2->covars[r]) ;
+          for (i = 0 ; i < GIBBS_NEIGHBORHOOD ; i++)
+          {
+            if (gc1->nlabels[i] != gc2->nlabels[i])
+            {
+              nbad++ ;
+              continue ;
+            }
+            for (j = 0 ; j < gc1->nlabels[i] ; j++)
+            {
+              k = find_label(gc2->labels[i], gc2->nlabels[i],
+                             gc1->labels[i][j]) ;
+              nbad += (k < 0 || differ(gc1->label_priors[i][j],
+                                       gc2->label_priors[i][k])) ;
+            }
+          }
+        }
+      }
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  GCA       *gca_classic, *gca ;
+  GCA_STATS *gs ;
+  int       nbad, failed = 0 ;
+
+  Progname = argv[0] ;
+
+  gca_classic = train_classic() ;
+
+  gs = train_stats(0, NSUBJECTS-1) ;
+  gca = GCAstatsCompleteTraining(gs) ;
+  GCAstatsFree(&gs) ;
+  nbad = compare_gcas(gca_classic, gca) ;
+  printf("one pass vs two pass training: %d differences\n", nbad) ;
+  failed |= (nbad != 0) ;
+  GCAfree(&gca) ;
+
+  gca = train_merged() ;
+  nbad = compare_gcas(gca_classic, gca) ;
+  printf("merged shards vs two pass training: %d differences\n", nbad) ;
+  failed |= (nbad != 0) ;
+  GCAfree(&gca) ;
+
+  GCAfree(&gca_classic) ;
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
@@ -0,0 +1,217 @@
+/*--------------------------------------------
+  test_MRISbvh.c
+
+  1. MRISbvhClosestPoint must find the same distance as a brute force
+     search over every face, for points inside, outside and on a
+     deformed icosahedral surface with some ripped faces.
+  2. The returned barycentric coordinates must reproduce the returned
+     point, and a max_dist smaller than the true distance must give no
+     face.
+  3. The batched MRISbvhClosestVertexPoints must agree with single
+     queries.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mrisurf.h"
+#include "mrisbvh.h"
+#include "icosahedron.h"
+
+char *Progname ;
+
+#define NPOINTS   300
+#define DIST_TOL  1e-4
+
+/* distance from p to triangle (a,b,c) by dense sampling of its barycentric
+   coordinates followed by a local refinement, independent of mrisbvh.c */
+static double
+sampled_distance(float *a, float *b, float *c, double *p)
+{
+  int    i, j, n, iter ;
+  double u, v, w, x, y, z, d, best, bu, bv, step, u0, v0 ;
+
+  n = 20 ;
+  best = 1e30 ;
+  bu = bv = 0 ;
+  for (i = 0 ; i <= n ; i++)
+    for (j = 0 ; i+j <= n ; j++)
+    {
+      u = (double)i/n ; v = (double)j/n ; w = 1-u-v ;
+      x = w*a[0] + u*b[0] + v*c[0] - p[0] ;
+      y = w*a[1] + u*b[1] + v*c[1] - p[1] ;
+      z = w*a[2] + u*b[2] + v*c[2] - p[2] ;
+      d = x*x + y*y + z*z ;
+      if (d < best)
+      {
+        best = d ; bu = u ; bv = v ;
+      }
+    }
+  for (step = 1.0/n, iter = 0 ; iter < 30 ; iter++, step /= 2)
+  {
+    u0 = bu ; v0 = bv ;
+    for (i = -2 ; i <= 2 ; i++)
+      for (j = -2 ; j <= 2 ; j++)
+      {
+        u = u0 + i*step/2 ; v = v0 + j*step/2 ;
+        if (u < 0 || v < 0 || u+v > 1)
+          continue ;
+        w = 1-u-v ;
+        x = w*a[0] + u*b[0] + v*c[0] - p[0] ;
+        y = w*a[1] + u*b[1] + v*c[1] - p[1] ;
+        z = w*a[2] + u*b[2] + v*c[2] - p[2] ;
+        d = x*x + y*y + z*z ;
+        if (d < best)
+        {
+          best = d ; bu = u ; bv = v ;
+        }
+      }
+  }
+  return(sqrt(best)) ;
+}
+
+static double
+brute_force_distance(MRI_SURFACE *mris, double *p)
+{
+  int    fno, n ;
+  float  t[3][3] ;
+  double d, best ;
+  VERTEX *v ;
+
+  best = 1e30 ;
+  for (fno = 0 ; fno < mris->nfaces ; fno++)
+  {
+    if (mris->faces[fno].ripflag)
+      continue ;
+    for (n = 0 ; n < VERTICES_PER_FACE ; n++)
+    {
+      v = &mris->vertices[mris->faces[fno].v[n]] ;
+      t[n][0] = v->x ; t[n][1] = v->y ; t[n][2] = v->z ;
+    }
+    d = sampled_distance(t[0], t[1], t[2], p) ;
+    if (d < best)
+      best = d ;
+  }
+  return(best) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  MRI_SURFACE         *mris ;
+  MRIS_BVH            *bvh ;
+  MRIS_CLOSEST_POINT  cp, *cps ;
+  VERTEX              *v ;
+  FACE                *f ;
+  int                 vno, fno, n, i, nbad ;
+  double              p[3], r, d, x, y, z ;
+
+  Progname = argv[0] ;
+  srand48(42) ;
+
+  mris = ic642_make_surface(642, 1280) ;
+  if (!mris)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not make surface", Progname) ;
+
+  // a bumpy sphere of radius ~50 with a few holes in it
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    r = sqrt(SQR(v->x) + SQR(v->y) + SQR(v->z)) ;
+    x = v->x/r ; y = v->y/r ; z = v->z/r ;
+    r = 50 + 4*sin(3*x)*cos(5*y) + 2*z*z ;
+    v->x = r*x ; v->y = r*y ; v->z = r*z ;
+  }
+  for (fno = 0 ; fno < mris->nfaces ; fno += 17)
+    mris->faces[fno].ripflag = 1 ;
+
+  bvh = MRISbvhAlloc(mris, CURRENT_VERTICES) ;
+
+  nbad = 0 ;
+  for (i = 0 ; i < NPOINTS ; i++)
+  {
+    if (i < NPOINTS/3)   // on the surface
+    {
+      v = &mris->vertices[i] ;
+      p[0] = v->x ; p[1] = v->y ; p[2] = v->z ;
+    }
+    else
+    {
+      p[0] = 140*(drand48()-0.5) ;
+      p[1] = 140*(drand48()-0.5) ;
+      p[2] = 140*(drand48()-0.5) ;
+    }
+    d = brute_force_distance(mris, p) ;
+    fno = MRISbvhClosestPoint(bvh, p[0], p[1], p[2], 0, &cp) ;
+    if (fno < 0 || mris->faces[fno].ripflag || fabs(cp.dist - d) > DIST_TOL)
+    {
+      printf("point %d: tree distance %f (face %d), brute force %f\n",
+             i, cp.dist, fno, d) ;
+      nbad++ ;
+      continue ;
+    }
+
+    f = &mris->faces[fno] ;
+    x = y = z = 0 ;
+    for (n = 0 ; n < VERTICES_PER_FACE ; n++)
+    {
+      v = &mris->vertices[f->v[n]] ;
+      x += cp.bary[n]*v->x ; y += cp.bary[n]*v->y ; z += cp.bary[n]*v->z ;
+      if (cp.bary[n] < -DIST_TOL)
+        nbad++ ;
+    }
+    if (fabs(x-cp.x) > DIST_TOL*100 || fabs(y-cp.y) > DIST_TOL*100 || fabs(z-cp.z) > DIST_TOL*100 ||
+        fabs(sqrt(SQR(cp.x-p[0])+SQR(cp.y-p[1])+SQR(cp.z-p[2])) - cp.dist) > DIST_TOL*100)
+    {
+      printf("point %d: barycentric coords don't reproduce closest point\n", i) ;
+      nbad++ ;
+    }
+
+    if (d > 0.1 &&
+        MRISbvhClosestPoint(bvh, p[0], p[1], p[2], d*0.9, &cp) >= 0)
+    {
+      printf("point %d: found face beyond max_dist %f\n", i, d*0.9) ;
+      nbad++ ;
+    }
+  }
+
+  // batched queries of the vertices of a shrunken copy of the surface
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    v->origx = 0.9*v->x ; v->origy = 0.9*v->y ; v->origz = 0.9*v->z ;
+  }
+  mris->vertices[7].ripflag = 1 ;
+  cps = (MRIS_CLOSEST_POINT *)calloc(mris->nvertices, sizeof(MRIS_CLOSEST_POINT)) ;
+  MRISbvhClosestVertexPoints(bvh, mris, ORIGINAL_VERTICES, 0, cps) ;
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    v = &mris->vertices[vno] ;
+    if (v->ripflag)
+    {
+      if (cps[vno].fno != -1)
+        nbad++ ;
+      continue ;
+    }
+    MRISbvhClosestPoint(bvh, v->origx, v->origy, v->origz, 0, &cp) ;
+    if (cp.fno != cps[vno].fno || cp.dist != cps[vno].dist)
+    {
+      printf("vertex %d: batched query differs\n", vno) ;
+      nbad++ ;
+    }
+  }
+
+  free(cps) ;
+  MRISbvhFree(&bvh) ;
+  MRISfree(&mris) ;
+
+  printf("%d errors\n", nbad) ;
+  printf("%s\n", nbad ? "FAILED" : "passed") ;
+  exit(nbad ? 1 : 0) ;
+}
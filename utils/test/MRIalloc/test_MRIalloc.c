@@ -0,0 +1,108 @@
+/*--------------------------------------------
+  test_MRIalloc.c
+
+  1. The voxels of a volume are one block: rows follow each other
+     without gaps, slice after slice and frame after frame, for every
+     voxel type.
+  2. A volume that reuses the block of a freed one of the same size
+     starts out zeroed, and MRIchunk()ed volumes read back the same
+     values through MRIgetVoxVal() as the macros wrote.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+
+char *Progname ;
+
+#define NTYPES 5
+
+/* number of rows that are not where one block puts them, and of
+   nonzero bytes in a freshly allocated volume */
+static int
+check_type(int type)
+{
+  MRI     *mri ;
+  int     r, s, nbad ;
+  size_t  i ;
+  BUFTYPE *p ;
+
+  mri = MRIallocSequence(13, 11, 7, type, 3) ;
+  nbad = 0 ;
+  p = (BUFTYPE *)mri->chunk ;
+  for (s = 0 ; s < mri->depth*mri->nframes ; s++)
+    for (r = 0 ; r < mri->height ; r++)
+    {
+      nbad += (mri->slices[s][r] != p) ;
+      p += mri->bytes_per_row ;
+    }
+  nbad += (p != (BUFTYPE *)mri->chunk + mri->bytes_total) ;
+
+  /* dirty the block, free it and get it back */
+  memset(mri->chunk, 0xff, mri->bytes_total) ;
+  MRIfree(&mri) ;
+  mri = MRIallocSequence(13, 11, 7, type, 3) ;
+  for (i = 0 ; i < mri->bytes_total ; i++)
+    nbad += (((BUFTYPE *)mri->chunk)[i] != 0) ;
+
+  MRIfree(&mri) ;
+  return(nbad) ;
+}
+
+/* number of voxels MRIgetVoxVal() reads differently once chunked */
+static int
+check_chunk(void)
+{
+  MRI *mri ;
+  int x, y, z, f, nbad = 0 ;
+
+  mri = MRIallocSequence(9, 8, 7, MRI_FLOAT, 2) ;
+  for (f = 0 ; f < mri->nframes ; f++)
+    for (z = 0 ; z < mri->depth ; z++)
+      for (y = 0 ; y < mri->height ; y++)
+        for (x = 0 ; x < mri->width ; x++)
+          MRIFseq_vox(mri, x, y, z, f) = x + 10*y + 100*z + 1000*f ;
+  MRIchunk(&mri) ;
+  for (f = 0 ; f < mri->nframes ; f++)
+    for (z = 0 ; z < mri->depth ; z++)
+      for (y = 0 ; y < mri->height ; y++)
+        for (x = 0 ; x < mri->width ; x++)
+          nbad += (MRIgetVoxVal(mri, x, y, z, f) !=
+                   x + 10*y + 100*z + 1000*f) ;
+  nbad += !mri->ischunked ;
+  MRIfreeFrames(mri, 1) ;
+  nbad += (mri->nframes != 1) ;
+  MRIfree(&mri) ;
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int            types[NTYPES] = { MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_LONG,
+                                   MRI_FLOAT } ;
+  int            t, nbad, failed = 0 ;
+
+  Progname = argv[0] ;
+  setenv("FS_MRI_POOL_MB", "64", 1) ;   // the pool is off by default
+
+  for (t = 0 ; t < NTYPES ; t++)
+  {
+    nbad = check_type(types[t]) ;
+    printf("type %d: %d errors\n", types[t], nbad) ;
+    failed |= (nbad != 0) ;
+  }
+  nbad = check_chunk() ;
+  printf("chunked: %d errors\n", nbad) ;
+  failed |= (nbad != 0) ;
+
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
@@ -0,0 +1,91 @@
+/*--------------------------------------------
+  bench_MRIdistanceTransform.c
+
+  Timing program, not run by make check:
+
+    bench_MRIdistanceTransform [dim]
+
+  times a signed MRIdistanceTransform (max_dist 10) of a ball in a
+  dim^3 (default 128) volume with the fast marching and the exact (EDT)
+  engines, and reports how far fast marching is from the exact result.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+#include "timer.h"
+
+char *Progname ;
+
+#define LABEL 1
+
+static MRI *
+make_ball(int dim, float radius)
+{
+  MRI   *mri ;
+  int   x, y, z ;
+  float c ;
+
+  mri = MRIalloc(dim, dim, dim, MRI_UCHAR) ;
+  c = (dim-1)/2.0 ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+        if (SQR(x-c)+SQR(y-c)+SQR(z-c) < SQR(radius))
+          MRIvox(mri, x, y, z) = LABEL ;
+  return(mri) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  MRI          *mri, *mri_edt, *mri_fm ;
+  int          x, y, z, dim, msec_edt, msec_fm ;
+  double       err, max_diff, mean_diff ;
+  struct timeb then ;
+
+  Progname = argv[0] ;
+
+  dim = argc > 1 ? atoi(argv[1]) : 128 ;
+  if (dim < 1)
+    ErrorExit(ERROR_BADPARM, "usage: %s [dim]", Progname) ;
+  mri = make_ball(dim, dim/3.0) ;
+
+  MRIsetDistanceTransformEngine(DTRANS_ENGINE_FASTMARCHING) ;
+  TimerStart(&then) ;
+  mri_fm = MRIdistanceTransform(mri, NULL, LABEL, 10, DTRANS_MODE_SIGNED,
+                                NULL) ;
+  msec_fm = TimerStop(&then) ;
+
+  MRIsetDistanceTransformEngine(DTRANS_ENGINE_EDT) ;
+  TimerStart(&then) ;
+  mri_edt = MRIdistanceTransform(mri, NULL, LABEL, 10, DTRANS_MODE_SIGNED,
+                                 NULL) ;
+  msec_edt = TimerStop(&then) ;
+
+  max_diff = mean_diff = 0 ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+      {
+        err = fabs(MRIFvox(mri_fm, x, y, z) - MRIFvox(mri_edt, x, y, z)) ;
+        mean_diff += err ;
+        if (err > max_diff)
+          max_diff = err ;
+      }
+  mean_diff /= (double)dim*dim*dim ;
+  printf("%d^3 signed, max_dist 10: fast marching %d msec, EDT %d msec\n",
+         dim, msec_fm, msec_edt) ;
+  printf("fast marching vs EDT: mean |diff| %2.3f, max |diff| %2.3f mm\n",
+         mean_diff, max_diff) ;
+
+  MRIfree(&mri) ; MRIfree(&mri_fm) ; MRIfree(&mri_edt) ;
+  exit(0) ;
+}
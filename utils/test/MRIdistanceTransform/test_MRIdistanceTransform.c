@@ -0,0 +1,147 @@
+/*--------------------------------------------
+  test_MRIdistanceTransform.c
+
+  Compares the two MRIdistanceTransform engines on a synthetic ball:
+
+  1. The exact (EDT) engine must match a brute-force distance to the
+     nearest voxel center of the other class, in all modes and with
+     anisotropic voxels.
+  2. Fast marching must stay within a voxel of the exact transform.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+
+char *Progname ;
+
+#define LABEL 1
+
+static MRI *
+make_ball(int dim, float xsize, float ysize, float zsize, float radius)
+{
+  MRI   *mri ;
+  int   x, y, z ;
+  float c ;
+
+  mri = MRIalloc(dim, dim, dim, MRI_UCHAR) ;
+  mri->xsize = xsize ; mri->ysize = ysize ; mri->zsize = zsize ;
+  c = (dim-1)/2.0 ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+        if (SQR((x-c)*xsize)+SQR((y-c)*ysize)+SQR((z-c)*zsize) <
+            SQR(radius))
+          MRIvox(mri, x, y, z) = LABEL ;
+  return(mri) ;
+}
+
+/* largest error of mri_dist against a brute-force search (mm) */
+static double
+check_exact(MRI *mri, MRI *mri_dist, int mode)
+{
+  int    x, y, z, x1, y1, z1, in, in1 ;
+  double d, best, expected, err, max_err = 0 ;
+
+  for (z = 0 ; z < mri->depth ; z++)
+    for (y = 0 ; y < mri->height ; y++)
+      for (x = 0 ; x < mri->width ; x++)
+      {
+        in = (MRIvox(mri, x, y, z) == LABEL) ;
+        best = 1e10 ;
+        for (z1 = 0 ; z1 < mri->depth ; z1++)
+          for (y1 = 0 ; y1 < mri->height ; y1++)
+            for (x1 = 0 ; x1 < mri->width ; x1++)
+            {
+              in1 = (MRIvox(mri, x1, y1, z1) == LABEL) ;
+              if (in1 == in)
+                continue ;
+              d = SQR((x1-x)*mri->xsize) + SQR((y1-y)*mri->ysize) +
+                  SQR((z1-z)*mri->zsize) ;
+              if (d < best)
+                best = d ;
+            }
+        expected = sqrt(best) - 0.5*mri->xsize ;
+        if (in)
+        {
+          if (mode == DTRANS_MODE_OUTSIDE)
+            expected = 0 ;
+          else if (mode != DTRANS_MODE_UNSIGNED)
+            expected = -expected ;
+        }
+        else if (mode == DTRANS_MODE_INSIDE)
+          expected = 0 ;
+        err = fabs(expected - MRIFvox(mri_dist, x, y, z)) ;
+        if (err > max_err)
+          max_err = err ;
+      }
+  return(max_err) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  MRI           *mri, *mri_edt, *mri_fm ;
+  int           modes[4] = { DTRANS_MODE_SIGNED, DTRANS_MODE_UNSIGNED,
+                             DTRANS_MODE_OUTSIDE, DTRANS_MODE_INSIDE } ;
+  int           m, x, y, z, dim, failed = 0 ;
+  double        err, max_diff, mean_diff ;
+
+  Progname = argv[0] ;
+
+  /* exactness, isotropic and anisotropic */
+  for (m = 0 ; m < 4 ; m++)
+  {
+    mri = make_ball(24, 1, 1, 1, 7.3) ;
+    mri_edt = MRIdistanceTransformEDT(mri, NULL, LABEL, -1, modes[m], NULL) ;
+    err = check_exact(mri, mri_edt, modes[m]) ;
+    printf("mode %d isotropic:   max error %2.2e\n", modes[m], err) ;
+    failed |= (err > 1e-3) ;
+    MRIfree(&mri) ; MRIfree(&mri_edt) ;
+
+    mri = make_ball(24, 1, 0.7, 1.5, 8.1) ;
+    mri_edt = MRIdistanceTransformEDT(mri, NULL, LABEL, -1, modes[m], NULL) ;
+    err = check_exact(mri, mri_edt, modes[m]) ;
+    printf("mode %d anisotropic: max error %2.2e\n", modes[m], err) ;
+    failed |= (err > 1e-3) ;
+    MRIfree(&mri) ; MRIfree(&mri_edt) ;
+  }
+
+  /* agreement with fast marching */
+  dim = 48 ;
+  mri = make_ball(dim, 1, 1, 1, dim/3.0) ;
+
+  MRIsetDistanceTransformEngine(DTRANS_ENGINE_FASTMARCHING) ;
+  mri_fm = MRIdistanceTransform(mri, NULL, LABEL, 10, DTRANS_MODE_SIGNED,
+                                NULL) ;
+  MRIsetDistanceTransformEngine(DTRANS_ENGINE_EDT) ;
+  mri_edt = MRIdistanceTransform(mri, NULL, LABEL, 10, DTRANS_MODE_SIGNED,
+                                 NULL) ;
+
+  max_diff = mean_diff = 0 ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+      {
+        err = fabs(MRIFvox(mri_fm, x, y, z) - MRIFvox(mri_edt, x, y, z)) ;
+        mean_diff += err ;
+        if (err > max_diff)
+          max_diff = err ;
+      }
+  mean_diff /= (double)dim*dim*dim ;
+  printf("fast marching vs EDT: mean |diff| %2.3f, max |diff| %2.3f mm\n",
+         mean_diff, max_diff) ;
+  /* fast marching is first order, but should stay within a voxel */
+  failed |= (max_diff > 1.0) ;
+
+  MRIfree(&mri) ; MRIfree(&mri_fm) ; MRIfree(&mri_edt) ;
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
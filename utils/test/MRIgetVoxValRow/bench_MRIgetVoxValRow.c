@@ -0,0 +1,105 @@
+/*--------------------------------------------
+  bench_MRIgetVoxValRow.c
+
+  Micro-benchmark, not run by make check:
+
+    bench_MRIgetVoxValRow [dim]
+
+  times a binarize-style threshold of a dim^3 (default 256) float
+  volume done the way most tools do it (column/row/slice loops around
+  MRIgetVoxVal/MRIsetVoxVal) against the same threshold done a row at
+  a time with MRIgetVoxValRow/MRIsetVoxValRow, and checks that the two
+  give the same result.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+#include "timer.h"
+
+char *Progname ;
+
+static int
+binarize_vox(MRI *mri_src, MRI *mri_dst, float thresh)
+{
+  int   c, r, s, nhits = 0 ;
+  float val ;
+
+  for (c = 0 ; c < mri_src->width ; c++)
+    for (r = 0 ; r < mri_src->height ; r++)
+      for (s = 0 ; s < mri_src->depth ; s++)
+      {
+        val = MRIgetVoxVal(mri_src, c, r, s, 0) ;
+        MRIsetVoxVal(mri_dst, c, r, s, 0, val > thresh) ;
+        nhits += (val > thresh) ;
+      }
+  return(nhits) ;
+}
+
+static int
+binarize_row(MRI *mri_src, MRI *mri_dst, float thresh)
+{
+  int   c, r, s, nhits = 0 ;
+  float *row ;
+
+  row = (float *)calloc(mri_src->width, sizeof(float)) ;
+  for (s = 0 ; s < mri_src->depth ; s++)
+    for (r = 0 ; r < mri_src->height ; r++)
+    {
+      MRIgetVoxValRow(mri_src, r, s, 0, row) ;
+      for (c = 0 ; c < mri_src->width ; c++)
+      {
+        nhits += (row[c] > thresh) ;
+        row[c] = (row[c] > thresh) ;
+      }
+      MRIsetVoxValRow(mri_dst, r, s, 0, row) ;
+    }
+  free(row) ;
+  return(nhits) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int          dim, n_vox, n_row, x, y, z, msec_vox, msec_row, nbad ;
+  MRI          *mri, *mri_vox, *mri_row ;
+  struct timeb then ;
+
+  Progname = argv[0] ;
+
+  dim = argc > 1 ? atoi(argv[1]) : 256 ;
+  if (dim < 1)
+    ErrorExit(ERROR_BADPARM, "usage: %s [dim]", Progname) ;
+  mri = MRIalloc(dim, dim, dim, MRI_FLOAT) ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+        MRIFvox(mri, x, y, z) = (float)((x*7919 + y*104729 + z*1299709)
+                                        % 200003 - 100000) ;
+  mri_vox = MRIalloc(dim, dim, dim, MRI_UCHAR) ;
+  mri_row = MRIalloc(dim, dim, dim, MRI_UCHAR) ;
+
+  TimerStart(&then) ;
+  n_vox = binarize_vox(mri, mri_vox, 0) ;
+  msec_vox = TimerStop(&then) ;
+  TimerStart(&then) ;
+  n_row = binarize_row(mri, mri_row, 0) ;
+  msec_row = TimerStop(&then) ;
+
+  nbad = (n_vox != n_row) ;
+  for (z = 0 ; z < dim ; z++)
+    for (y = 0 ; y < dim ; y++)
+      for (x = 0 ; x < dim ; x++)
+        nbad += (MRIvox(mri_vox, x, y, z) != MRIvox(mri_row, x, y, z)) ;
+  printf("%d^3 binarize: MRIgetVoxVal %d msec, MRIgetVoxValRow %d msec, "
+         "%d mismatches\n", dim, msec_vox, msec_row, nbad) ;
+
+  MRIfree(&mri) ; MRIfree(&mri_vox) ; MRIfree(&mri_row) ;
+  exit(nbad ? 1 : 0) ;
+}
@@ -0,0 +1,102 @@
+/*--------------------------------------------
+  test_MRIgetVoxValRow.c
+
+  MRIgetVoxValRow/MRIsetVoxValRow must give exactly what
+  MRIgetVoxVal/MRIsetVoxVal give, for every voxel type, for normal
+  and chunked volumes, including values that have to be clipped.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+
+char *Progname ;
+
+#define NTYPES 5
+
+/* values that span and exceed the range of every type */
+static float
+test_value(int c, int r, int s, int f)
+{
+  return (float)((c*7919 + r*104729 + s*1299709 + f*15485863) % 200003 - 100000)
+         * 0.37f ;
+}
+
+/* number of voxels where the row accessors disagree with the voxel ones */
+static int
+check_type(int type, int chunked)
+{
+  MRI   *mri_vox, *mri_row ;
+  int   c, r, s, f, nbad ;
+  float *row ;
+
+  if (chunked)
+  {
+    mri_vox = MRIallocChunk(13, 11, 7, type, 2) ;
+    mri_row = MRIallocChunk(13, 11, 7, type, 2) ;
+  }
+  else
+  {
+    mri_vox = MRIallocSequence(13, 11, 7, type, 2) ;
+    mri_row = MRIallocSequence(13, 11, 7, type, 2) ;
+  }
+  row = (float *)calloc(mri_vox->width, sizeof(float)) ;
+
+  for (f = 0 ; f < mri_vox->nframes ; f++)
+    for (s = 0 ; s < mri_vox->depth ; s++)
+      for (r = 0 ; r < mri_vox->height ; r++)
+      {
+        for (c = 0 ; c < mri_vox->width ; c++)
+        {
+          row[c] = test_value(c, r, s, f) ;
+          MRIsetVoxVal(mri_vox, c, r, s, f, row[c]) ;
+        }
+        MRIsetVoxValRow(mri_row, r, s, f, row) ;
+      }
+
+  nbad = 0 ;
+  for (f = 0 ; f < mri_vox->nframes ; f++)
+    for (s = 0 ; s < mri_vox->depth ; s++)
+      for (r = 0 ; r < mri_vox->height ; r++)
+      {
+        MRIgetVoxValRow(mri_row, r, s, f, row) ;
+        for (c = 0 ; c < mri_vox->width ; c++)
+          if (row[c] != MRIgetVoxVal(mri_vox, c, r, s, f) ||
+              row[c] != MRIgetVoxVal(mri_row, c, r, s, f))
+            nbad++ ;
+      }
+
+  free(row) ;
+  MRIfree(&mri_vox) ;
+  MRIfree(&mri_row) ;
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int            types[NTYPES] = { MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_LONG,
+                                   MRI_FLOAT } ;
+  int            t, chunked, nbad, failed = 0 ;
+
+  Progname = argv[0] ;
+
+  for (t = 0 ; t < NTYPES ; t++)
+    for (chunked = 0 ; chunked <= 1 ; chunked++)
+    {
+      nbad = check_type(types[t], chunked) ;
+      printf("type %d%s: %d mismatches\n", types[t],
+             chunked ? " (chunked)" : "", nbad) ;
+      failed |= (nbad != 0) ;
+    }
+
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
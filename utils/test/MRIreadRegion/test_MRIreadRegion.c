@@ -0,0 +1,298 @@
+/*--------------------------------------------
+  test_MRIreadRegion.c
+
+  MRIreadRegion() must give the same volume as MRIread() followed by
+  MRIextractRegion() and MRIcopyFrame():
+
+  1. for .mgh, .mgz, .nii and .nii.gz files written by MRIwrite() with
+     uchar, short, int and float voxels,
+  2. for .nii and .nii.gz files with and without scl_slope/scl_inter,
+     written here so the expected voxel values are known,
+  3. for the whole volume, a box, a single corner voxel, and frame
+     lists that repeat frames and are out of order, including the
+     "#start:end" frame syntax of MRIread().
+
+  Boxes outside of the volume and bad frame numbers must fail.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+#include "matrix.h"
+#include "znzlib.h"
+#include "nifti1.h"
+
+char *Progname ;
+
+#define WIDTH   13
+#define HEIGHT  11
+#define DEPTH    9
+#define NFRAMES  5
+#define NTYPES   4
+
+static float
+test_value(int c, int r, int s, int f, int type)
+{
+  float val ;
+
+  val = (c*7 + r*13 + s*17 + f*101) % 250 ;
+  switch (type)
+  {
+  case MRI_SHORT: val = val*100 - 300 ; break ;
+  case MRI_INT:   val = val*100000 - 7 ; break ;
+  case MRI_FLOAT: val = val/3.0 - 20 ; break ;
+  }
+  return(val) ;
+}
+
+static MRI *
+make_volume(int type)
+{
+  MRI *mri ;
+  int c, r, s, f ;
+
+  mri = MRIallocSequence(WIDTH, HEIGHT, DEPTH, type, NFRAMES) ;
+  for (f = 0 ; f < NFRAMES ; f++)
+    for (s = 0 ; s < DEPTH ; s++)
+      for (r = 0 ; r < HEIGHT ; r++)
+        for (c = 0 ; c < WIDTH ; c++)
+          MRIsetVoxVal(mri, c, r, s, f, test_value(c, r, s, f, type)) ;
+  mri->xsize = 1.1 ; mri->ysize = 0.9 ; mri->zsize = 2.3 ;
+  mri->x_r = cos(0.3) ; mri->x_a = sin(0.3) ; mri->x_s = 0 ;
+  mri->y_r = -sin(0.3) ; mri->y_a = cos(0.3) ; mri->y_s = 0 ;
+  mri->z_r = 0 ; mri->z_a = 0 ; mri->z_s = 1 ;
+  mri->c_r = 12.5 ; mri->c_a = -30.25 ; mri->c_s = 7.75 ;
+  mri->ras_good_flag = 1 ;
+  mri->tr = 2000 ;
+  MRIreInitCache(mri) ;
+  return(mri) ;
+}
+
+/* a NIfTI file of 16 bit voxels, scaled if slope is nonzero. The
+   voxel values MRIread() should give are returned in mri_expected. */
+static int
+write_nifti(const char *fname, int gz, float slope, float inter,
+            MRI *mri_expected)
+{
+  struct nifti_1_header hdr ;
+  znzFile  fp ;
+  char     pad[4] = { 0, 0, 0, 0 } ;
+  short    *buf ;
+  int      c, r, s, f, n ;
+
+  memset(&hdr, 0, sizeof(hdr)) ;
+  hdr.sizeof_hdr = sizeof(hdr) ;
+  hdr.dim[0] = 4 ;
+  hdr.dim[1] = WIDTH ; hdr.dim[2] = HEIGHT ; hdr.dim[3] = DEPTH ;
+  hdr.dim[4] = NFRAMES ;
+  hdr.datatype = DT_SIGNED_SHORT ;
+  hdr.bitpix = 16 ;
+  hdr.pixdim[0] = 1 ;
+  hdr.pixdim[1] = 1.5 ; hdr.pixdim[2] = 1.25 ; hdr.pixdim[3] = 2 ;
+  hdr.pixdim[4] = 2 ;
+  hdr.vox_offset = 352 ;
+  hdr.scl_slope = slope ;
+  hdr.scl_inter = inter ;
+  hdr.xyzt_units = NIFTI_UNITS_MM | NIFTI_UNITS_SEC ;
+  hdr.sform_code = NIFTI_XFORM_SCANNER_ANAT ;
+  hdr.srow_x[0] = 1.5 ;  hdr.srow_x[3] = -9 ;
+  hdr.srow_y[1] = 1.25 ; hdr.srow_y[3] = -6 ;
+  hdr.srow_z[2] = 2 ;    hdr.srow_z[3] = 4 ;
+  strcpy(hdr.magic, "n+1") ;
+
+  fp = znzopen(fname, "wb", gz) ;
+  if (znz_isnull(fp))
+    return(1) ;
+  znzwrite(&hdr, sizeof(hdr), 1, fp) ;
+  znzwrite(pad, 1, 4, fp) ;
+  buf = (short *)calloc(WIDTH, sizeof(short)) ;
+  for (f = 0 ; f < NFRAMES ; f++)
+    for (s = 0 ; s < DEPTH ; s++)
+      for (r = 0 ; r < HEIGHT ; r++)
+      {
+        for (c = 0 ; c < WIDTH ; c++)
+        {
+          n = (c*7 + r*13 + s*17 + f*101) % 250 ;
+          buf[c] = n*100 - 12000 ;
+          MRIsetVoxVal(mri_expected, c, r, s, f,
+                       slope == 0 ? buf[c] : slope*buf[c] + inter) ;
+        }
+        znzwrite(buf, sizeof(short), WIDTH, fp) ;
+      }
+  free(buf) ;
+  znzclose(fp) ;
+  return(0) ;
+}
+
+/* number of differences between mri and what MRIread() followed by
+   MRIextractRegion() and MRIcopyFrame() give */
+static int
+compare(MRI *mri, MRI *mri_full, MRI_REGION *box, int *frames, int nframes)
+{
+  MRI    *mri_box, *mri_ref ;
+  MATRIX *m_ref, *m ;
+  int    c, r, s, f, i, j, nbad = 0 ;
+
+  if (mri == NULL)
+    return(1) ;
+  mri_box = MRIextractRegion(mri_full, NULL, box) ;
+  mri_ref = MRIallocSequence(mri_box->width, mri_box->height, mri_box->depth,
+                             mri_box->type, nframes) ;
+  MRIcopyHeader(mri_box, mri_ref) ;
+  for (f = 0 ; f < nframes ; f++)
+    MRIcopyFrame(mri_box, mri_ref, frames[f], f) ;
+
+  if (mri->width != mri_ref->width || mri->height != mri_ref->height ||
+      mri->depth != mri_ref->depth || mri->nframes != mri_ref->nframes ||
+      mri->type != mri_ref->type)
+  {
+    nbad++ ;
+  }
+  else
+  {
+    for (f = 0 ; f < nframes ; f++)
+      for (s = 0 ; s < mri->depth ; s++)
+        for (r = 0 ; r < mri->height ; r++)
+          for (c = 0 ; c < mri->width ; c++)
+            nbad += (MRIgetVoxVal(mri, c, r, s, f) !=
+                     MRIgetVoxVal(mri_ref, c, r, s, f)) ;
+    m_ref = MRIgetVoxelToRasXform(mri_ref) ;
+    m = MRIgetVoxelToRasXform(mri) ;
+    for (i = 1 ; i <= 3 ; i++)
+      for (j = 1 ; j <= 4 ; j++)
+        nbad += (fabs(*MATRIX_RELT(m, i, j) - *MATRIX_RELT(m_ref, i, j)) >
+                 1e-4) ;
+    MatrixFree(&m_ref) ;
+    MatrixFree(&m) ;
+  }
+
+  MRIfree(&mri_box) ;
+  MRIfree(&mri_ref) ;
+  return(nbad) ;
+}
+
+/* region and frame subset reads of fname against MRIread() */
+static int
+check_file(const char *fname)
+{
+  MRI        *mri_full, *mri ;
+  MRI_REGION whole = { 0, 0, 0, WIDTH, HEIGHT, DEPTH } ;
+  MRI_REGION box = { 3, 5, 2, 7, 4, 6 } ;
+  MRI_REGION corner = { WIDTH-1, HEIGHT-1, DEPTH-1, 1, 1, 1 } ;
+  MRI_REGION outside = { WIDTH-3, 0, 0, 4, 1, 1 } ;
+  int        all[NFRAMES] = { 0, 1, 2, 3, 4 } ;
+  int        mixed[4] = { 4, 1, 1, 3 } ;
+  int        last = NFRAMES-1, bad = NFRAMES ;
+  int        range[3] = { 1, 2, 3 } ;
+  char       fname_frames[STRLEN] ;
+  int        nbad = 0 ;
+
+  mri_full = MRIread(fname) ;
+  if (mri_full == NULL)
+    return(1) ;
+
+  mri = MRIreadRegion(fname, NULL, NULL, 0) ;
+  nbad += compare(mri, mri_full, &whole, all, NFRAMES) ;
+  if (mri) MRIfree(&mri) ;
+
+  mri = MRIreadRegion(fname, &box, NULL, 0) ;
+  nbad += compare(mri, mri_full, &box, all, NFRAMES) ;
+  if (mri) MRIfree(&mri) ;
+
+  mri = MRIreadRegion(fname, NULL, mixed, 4) ;
+  nbad += compare(mri, mri_full, &whole, mixed, 4) ;
+  if (mri) MRIfree(&mri) ;
+
+  mri = MRIreadRegion(fname, &box, mixed, 4) ;
+  nbad += compare(mri, mri_full, &box, mixed, 4) ;
+  if (mri) MRIfree(&mri) ;
+
+  mri = MRIreadRegion(fname, &corner, &last, 1) ;
+  nbad += compare(mri, mri_full, &corner, &last, 1) ;
+  if (mri) MRIfree(&mri) ;
+
+  sprintf(fname_frames, "%s#1:3", fname) ;
+  mri = MRIread(fname_frames) ;
+  nbad += compare(mri, mri_full, &whole, range, 3) ;
+  if (mri) MRIfree(&mri) ;
+
+  mri = MRIreadRegion(fname, &outside, NULL, 0) ;
+  nbad += (mri != NULL) ;
+  if (mri) MRIfree(&mri) ;
+  mri = MRIreadRegion(fname, NULL, &bad, 1) ;
+  nbad += (mri != NULL) ;
+  if (mri) MRIfree(&mri) ;
+
+  MRIfree(&mri_full) ;
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char  *exts[4] = { "mgh", "mgz", "nii", "nii.gz" } ;
+  int   types[NTYPES] = { MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT } ;
+  float slopes[2] = { 0, 0.5 }, inters[2] = { 0, -3.25 } ;
+  int   e, t, n, c, r, s, f, nbad, failed = 0 ;
+  char  fname[STRLEN] ;
+  MRI   *mri, *mri_read ;
+
+  Progname = argv[0] ;
+
+  /* volumes written by MRIwrite() */
+  for (e = 0 ; e < 4 ; e++)
+    for (t = 0 ; t < NTYPES ; t++)
+    {
+      sprintf(fname, "test_MRIreadRegion_%d.%s", getpid(), exts[e]) ;
+      mri = make_volume(types[t]) ;
+      nbad = MRIwrite(mri, fname) ;
+      if (nbad == 0)
+        nbad = check_file(fname) ;
+      unlink(fname) ;
+      MRIfree(&mri) ;
+      printf("%-6s type %d: %d errors\n", exts[e], types[t], nbad) ;
+      failed |= (nbad != 0) ;
+    }
+
+  /* scaled and unscaled NIfTI, checked against the known values too */
+  for (e = 2 ; e < 4 ; e++)
+    for (n = 0 ; n < 2 ; n++)
+    {
+      sprintf(fname, "test_MRIreadRegion_%d.%s", getpid(), exts[e]) ;
+      mri = MRIallocSequence(WIDTH, HEIGHT, DEPTH,
+                             slopes[n] == 0 ? MRI_SHORT : MRI_FLOAT,
+                             NFRAMES) ;
+      nbad = write_nifti(fname, e == 3, slopes[n], inters[n], mri) ;
+      mri_read = nbad ? NULL : MRIread(fname) ;
+      if (mri_read == NULL || mri_read->type != mri->type)
+        nbad++ ;
+      else
+      {
+        for (f = 0 ; f < NFRAMES ; f++)
+          for (s = 0 ; s < DEPTH ; s++)
+            for (r = 0 ; r < HEIGHT ; r++)
+              for (c = 0 ; c < WIDTH ; c++)
+                nbad += (MRIgetVoxVal(mri_read, c, r, s, f) !=
+                         MRIgetVoxVal(mri, c, r, s, f)) ;
+        nbad += check_file(fname) ;
+      }
+      unlink(fname) ;
+      if (mri_read) MRIfree(&mri_read) ;
+      MRIfree(&mri) ;
+      printf("%-6s %s: %d errors\n", exts[e],
+             slopes[n] == 0 ? "unscaled" : "scaled", nbad) ;
+      failed |= (nbad != 0) ;
+    }
+
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
@@ -0,0 +1,138 @@
+/*--------------------------------------------
+  test_clustThresholdSweep.c
+
+  clustThresholdSweep() must give, at every threshold, the number of
+  clusters, the voxel count of the largest cluster and the weight of
+  the heaviest cluster that clustGetClusters() gives at that threshold
+  (threshmax -1, no minimum size, 6-connected), for positive, negative
+  and absolute thresholding, with and without a mask. The values are
+  multiples of 0.1 so that some voxels sit exactly on a threshold, and
+  the thresholds are not sorted.
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mri.h"
+#include "volcluster.h"
+
+char *Progname ;
+
+#define NTHRESH 6
+
+/* a smooth signed field with some speckle, in steps of 0.1 */
+static MRI *
+make_volume(void)
+{
+  MRI    *mri ;
+  int    x, y, z ;
+  double val ;
+
+  mri = MRIalloc(21, 18, 15, MRI_FLOAT) ;
+  srand48(31) ;
+  for (z = 0 ; z < mri->depth ; z++)
+    for (y = 0 ; y < mri->height ; y++)
+      for (x = 0 ; x < mri->width ; x++)
+      {
+        val = 2.5*sin(0.45*x)*cos(0.35*y) + 1.5*sin(0.6*z + 0.2*x) +
+              1.2*(drand48() - 0.5) ;
+        MRIsetVoxVal(mri, x, y, z, 0, nint(10*val) / 10.0) ;
+      }
+  return(mri) ;
+}
+
+static MRI *
+make_mask(MRI *mri)
+{
+  MRI *mri_mask ;
+  int x, y, z ;
+
+  mri_mask = MRIalloc(mri->width, mri->height, mri->depth, MRI_UCHAR) ;
+  for (z = 0 ; z < mri->depth ; z++)
+    for (y = 0 ; y < mri->height ; y++)
+      for (x = 0 ; x < mri->width ; x++)
+        MRIsetVoxVal(mri_mask, x, y, z, 0, (x + 2*y + 3*z) % 7 != 0) ;
+  return(mri_mask) ;
+}
+
+/* sum of the values of the members of a cluster */
+static double
+cluster_weight(VOLCLUSTER *vc, MRI *mri)
+{
+  double w = 0 ;
+  int    n ;
+
+  for (n = 0 ; n < vc->nmembers ; n++)
+    w += MRIgetVoxVal(mri, vc->col[n], vc->row[n], vc->slc[n], 0) ;
+  return(w) ;
+}
+
+/* number of thresholds at which the sweep and clustGetClusters differ */
+static int
+check(MRI *mri, MRI *mri_mask, int thsign)
+{
+  double     thresh[NTHRESH] = { 1.3, 0.1, 3.0, 2.0, 0.5, 4.0 } ;
+  int        nClusters[NTHRESH], MaxCount[NTHRESH] ;
+  double     MaxWeight[NTHRESH], maxw, w ;
+  VOLCLUSTER **ClusterList ;
+  int        t, n, nc, maxcount, nbad = 0 ;
+
+  if (clustThresholdSweep(mri, 0, thsign, mri_mask, 0, NTHRESH, thresh,
+                          nClusters, MaxCount, MaxWeight))
+    return(NTHRESH) ;
+
+  for (t = 0 ; t < NTHRESH ; t++)
+  {
+    ClusterList = clustGetClusters(mri, 0, thresh[t], -1, thsign, 0,
+                                   mri_mask, &nc, NULL) ;
+    maxcount = clustMaxClusterCount(ClusterList, nc) ;
+    maxw = thsign == 0 ? 0 : -thsign*10e10 ;
+    for (n = 0 ; n < nc ; n++)
+    {
+      w = cluster_weight(ClusterList[n], mri) ;
+      if (thsign ==  0 && fabs(maxw) < fabs(w)) maxw = w ;
+      if (thsign == +1 && maxw < w)             maxw = w ;
+      if (thsign == -1 && maxw > w)             maxw = w ;
+    }
+    if (nc == 0)
+      maxw = 0 ;
+    if (nc != nClusters[t] || maxcount != MaxCount[t] ||
+        fabs(maxw - MaxWeight[t]) > 1e-6*MAX(1.0, fabs(maxw)))
+    {
+      printf("  thsign %d thresh %g: %d clusters, max %d, weight %g "
+             "instead of %d, %d, %g\n", thsign, thresh[t],
+             nClusters[t], MaxCount[t], MaxWeight[t], nc, maxcount, maxw) ;
+      nbad++ ;
+    }
+    clustFreeClusterList(&ClusterList, nc) ;
+  }
+  return(nbad) ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  MRI *mri, *mri_mask ;
+  int thsign, nbad, failed = 0 ;
+
+  Progname = argv[0] ;
+
+  mri = make_volume() ;
+  mri_mask = make_mask(mri) ;
+  for (thsign = -1 ; thsign <= 1 ; thsign++)
+  {
+    nbad = check(mri, NULL, thsign) + check(mri, mri_mask, thsign) ;
+    printf("thsign %d: %d errors\n", thsign, nbad) ;
+    failed |= (nbad != 0) ;
+  }
+  MRIfree(&mri_mask) ;
+  MRIfree(&mri) ;
+  printf("%s\n", failed ? "FAILED" : "passed") ;
+  exit(failed ? 1 : 0) ;
+}
@@ -40,6 +40,9 @@
 #define VOLCLUSTER_SRC
 #include "volcluster.h"
 #include "surfcluster.h"
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 /*---------------------------------------------------------------
   vculstSrcVersion(void) - returns CVS version of this file.
@@ -478,6 +481,435 @@ VOLCLUSTER *clustGrow(int col0, int row0, int slc0, MRI *HitMap, int AllowDiag)
 }
 
 
+/*------------------------------------------------------------------------
+  clustUFalloc() - allocates a union-find structure over n elements,
+  none of which have been added yet. If KeepStats, the member count,
+  size and weight of each component are tracked as elements are added
+  and merged (needed by the threshold sweep).
+  ------------------------------------------------------------------------*/
+CLUSTER_UF *clustUFalloc(int n, int KeepStats)
+{
+  CLUSTER_UF *uf;
+  int k;
+
+  uf = (CLUSTER_UF *) calloc(1, sizeof(CLUSTER_UF));
+  if (uf == NULL)
+  {
+    printf("ERROR: clustUFalloc: could not alloc %d\n",n);
+    return(NULL);
+  }
+  uf->n = n;
+  uf->parent   = (int *) calloc(n, sizeof(int));
+  uf->nmembers = (int *) calloc(n, sizeof(int));
+  if (uf->parent == NULL || uf->nmembers == NULL)
+  {
+    printf("ERROR: clustUFalloc: could not alloc %d\n",n);
+    clustUFfree(&uf);
+    return(NULL);
+  }
+  if (KeepStats)
+  {
+    uf->size   = (double *) calloc(n, sizeof(double));
+    uf->weight = (double *) calloc(n, sizeof(double));
+    if (uf->size == NULL || uf->weight == NULL)
+    {
+      printf("ERROR: clustUFalloc: could not alloc %d stats\n",n);
+      clustUFfree(&uf);
+      return(NULL);
+    }
+  }
+  for (k=0; k < n; k++) uf->parent[k] = -1;
+  return(uf);
+}
+
+
+/*------------------------------------------------------------------------*/
+int clustUFfree(CLUSTER_UF **puf)
+{
+  CLUSTER_UF *uf = *puf;
+  if (uf == NULL) return(0);
+  if (uf->parent)   free(uf->parent);
+  if (uf->nmembers) free(uf->nmembers);
+  if (uf->size)     free(uf->size);
+  if (uf->weight)   free(uf->weight);
+  free(uf);
+  *puf = NULL;
+  return(0);
+}
+
+
+/*------------------------------------------------------------------------
+  clustUFadd() - adds element a as a component of its own.
+  ------------------------------------------------------------------------*/
+int clustUFadd(CLUSTER_UF *uf, int a, double size, double weight)
+{
+  uf->parent[a] = a;
+  uf->nmembers[a] = 1;
+  if (uf->size)   uf->size[a] = size;
+  if (uf->weight) uf->weight[a] = weight;
+  return(0);
+}
+
+
+/*------------------------------------------------------------------------
+  clustUFfind() - returns the root of the component that a belongs
+  to. Uses path halving so that no recursion is needed.
+  ------------------------------------------------------------------------*/
+int clustUFfind(CLUSTER_UF *uf, int a)
+{
+  int *parent = uf->parent;
+  while (parent[a] != a)
+  {
+    parent[a] = parent[parent[a]];
+    a = parent[a];
+  }
+  return(a);
+}
+
+
+/*------------------------------------------------------------------------
+  clustUFunion() - merges the components of a and b (both must have
+  been added). The smaller component is attached to the larger. Returns
+  1 if two components were merged, 0 if they were already the same.
+  ------------------------------------------------------------------------*/
+int clustUFunion(CLUSTER_UF *uf, int a, int b)
+{
+  int tmp;
+
+  a = clustUFfind(uf,a);
+  b = clustUFfind(uf,b);
+  if (a == b) return(0);
+  if (uf->nmembers[a] < uf->nmembers[b])
+  {
+    tmp = a;
+    a = b;
+    b = tmp;
+  }
+  uf->parent[b] = a;
+  uf->nmembers[a] += uf->nmembers[b];
+  if (uf->size)   uf->size[a]   += uf->size[b];
+  if (uf->weight) uf->weight[a] += uf->weight[b];
+  return(1);
+}
+
+
+/*------------------------------------------------------------------------
+  clustNeighborOffsets() - fills dc, dr, ds with the neighborhood
+  (6-connected, or 26-connected if AllowDiag). If HalfOnly, then only
+  the neighbors that come earlier in slc,row,col scan order are
+  included (enough for a single labeling pass). Returns the number.
+  ------------------------------------------------------------------------*/
+static int clustNeighborOffsets(int AllowDiag, int HalfOnly,
+                                int *dc, int *dr, int *ds)
+{
+  int c, r, s, n;
+
+  n = 0;
+  for (s = -1; s <= 1; s++)
+  {
+    for (r = -1; r <= 1; r++)
+    {
+      for (c = -1; c <= 1; c++)
+      {
+        if (c == 0 && r == 0 && s == 0) continue;
+        if (!AllowDiag && abs(c)+abs(r)+abs(s) != 1) continue;
+        if (HalfOnly && (s > 0 || (s == 0 && r > 0) ||
+                         (s == 0 && r == 0 && c > 0))) continue;
+        dc[n] = c;
+        dr[n] = r;
+        ds[n] = s;
+        n++;
+      }
+    }
+  }
+  return(n);
+}
+
+
+/*------------------------------------------------------------------------
+  clustLabelComponents() - labels the connected components of the
+  voxels of vol whose values are in the threshold range (and are in the
+  binmask, if given). label must have width*height*depth elements and is
+  indexed by col + row*width + slc*width*height. Components are numbered
+  1..N in the order they are first encountered when scanning col, row,
+  slc (the same order as clustInitHitMap()); voxels not in a cluster get
+  0. Slabs of slices are labeled in parallel with union-find, then the
+  slabs are joined. Returns the number of clusters, -1 on error.
+  ------------------------------------------------------------------------*/
+int clustLabelComponents(MRI *vol, int frame, float thmin, float thmax,
+                         int thsign, MRI *binmask, int AllowDiag, int *label)
+{
+  CLUSTER_UF *uf;
+  int nvox, nslab, slab, nthslab, nnbrs, dc[13], dr[13], ds[13];
+  int col, row, slc, v, root, nclusters;
+  int width, height, depth, wh;
+
+  width  = vol->width;
+  height = vol->height;
+  depth  = vol->depth;
+  wh = width*height;
+  nvox = wh*depth;
+  uf = clustUFalloc(nvox,0);
+  if (uf == NULL) return(-1);
+  nnbrs = clustNeighborOffsets(AllowDiag,1,dc,dr,ds);
+
+  nslab = 1;
+#ifdef HAVE_OPENMP
+  nslab = omp_get_max_threads();
+#endif
+  if (nslab > depth) nslab = depth;
+  slab = (depth + nslab - 1)/nslab;
+
+  // Label each slab of slices independently. Unions never cross into
+  // another slab here, so the threads touch disjoint parts of uf.
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for private(col,row,slc,v)
+#endif
+  for (nthslab = 0; nthslab < nslab; nthslab++)
+  {
+    int s0, s1, n, c2, r2, s2;
+    float val;
+    s0 = nthslab*slab;
+    s1 = MIN(s0+slab,depth);
+    for (slc = s0; slc < s1; slc++)
+    {
+      for (row = 0; row < height; row++)
+      {
+        for (col = 0; col < width; col++)
+        {
+          if (binmask != NULL &&
+              MRIgetVoxVal(binmask,col,row,slc,0) == 0) continue;
+          val = MRIgetVoxVal(vol,col,row,slc,frame);
+          if (!clustValueInRange(val,thmin,thmax,thsign)) continue;
+          v = col + row*width + slc*wh;
+          clustUFadd(uf,v,0,0);
+          for (n=0; n < nnbrs; n++)
+          {
+            c2 = col + dc[n];
+            r2 = row + dr[n];
+            s2 = slc + ds[n];
+            if (c2 < 0 || c2 >= width || r2 < 0 || r2 >= height) continue;
+            if (s2 < s0) continue;
+            if (uf->parent[c2 + r2*width + s2*wh] < 0) continue;
+            clustUFunion(uf,v,c2 + r2*width + s2*wh);
+          }
+        }
+      }
+    }
+  }
+
+  // Join the slabs across their first slice
+  for (nthslab = 1; nthslab < nslab; nthslab++)
+  {
+    int n, c2, r2;
+    slc = nthslab*slab;
+    if (slc >= depth) break;
+    for (row = 0; row < height; row++)
+    {
+      for (col = 0; col < width; col++)
+      {
+        v = col + row*width + slc*wh;
+        if (uf->parent[v] < 0) continue;
+        for (n=0; n < nnbrs; n++)
+        {
+          if (ds[n] != -1) continue;
+          c2 = col + dc[n];
+          r2 = row + dr[n];
+          if (c2 < 0 || c2 >= width || r2 < 0 || r2 >= height) continue;
+          if (uf->parent[c2 + r2*width + (slc-1)*wh] < 0) continue;
+          clustUFunion(uf,v,c2 + r2*width + (slc-1)*wh);
+        }
+      }
+    }
+  }
+
+  // Number the components in col,row,slc order. The root's label is
+  // kept in nmembers (negated so it cannot be confused with a count).
+  for (v=0; v < nvox; v++) label[v] = 0;
+  nclusters = 0;
+  for (col = 0; col < width; col++)
+  {
+    for (row = 0; row < height; row++)
+    {
+      for (slc = 0; slc < depth; slc++)
+      {
+        v = col + row*width + slc*wh;
+        if (uf->parent[v] < 0) continue;
+        root = clustUFfind(uf,v);
+        if (uf->nmembers[root] > 0)
+        {
+          nclusters++;
+          uf->nmembers[root] = -nclusters;
+        }
+        label[v] = -uf->nmembers[root];
+      }
+    }
+  }
+
+  clustUFfree(&uf);
+  return(nclusters);
+}
+
+
+/*------------------------------------------------------------------------
+  clustThresholdSweep() - computes the number of clusters, the size
+  (number of voxels) of the largest cluster and the weight (sum of
+  values) of the heaviest cluster at each of the nthresh thresholds in
+  one pass. The voxels are sorted by value (taking thsign into account)
+  and added from the highest down, merging with neighbors already
+  added, so each threshold is read off as the sweep passes it.  The
+  results are the same as running clustGetClusters() with threshmax=-1
+  at each threshold. Any of the outputs can be NULL.
+  ------------------------------------------------------------------------*/
+typedef struct
+{
+  float key;
+  int index;
+} CLUST_SWEEP_ITEM;
+
+static int clustCompareSweepItem(const void *a, const void *b)
+{
+  const CLUST_SWEEP_ITEM *ia = (const CLUST_SWEEP_ITEM *) a;
+  const CLUST_SWEEP_ITEM *ib = (const CLUST_SWEEP_ITEM *) b;
+  // Descending by key, ties by index so that the order is reproducible
+  if (ia->key > ib->key) return(-1);
+  if (ia->key < ib->key) return(+1);
+  return(ia->index - ib->index);
+}
+
+int clustThresholdSweep(MRI *vol, int frame, int thsign, MRI *binmask,
+                        int AllowDiag, int nthresh, const double *thresh,
+                        int *nClusters, int *MaxCount, double *MaxWeight)
+{
+  CLUSTER_UF *uf;
+  CLUST_SWEEP_ITEM *items;
+  int *order, nitems, n, m, k, tmp, pos, nc, ncomp, maxcount, root;
+  int col, row, slc, c2, r2, s2, v, nnbrs, dc[26], dr[26], ds[26];
+  int width, height, depth, wh;
+  double t, maxw, w;
+  float val;
+
+  width  = vol->width;
+  height = vol->height;
+  depth  = vol->depth;
+  wh = width*height;
+  nnbrs = clustNeighborOffsets(AllowDiag,0,dc,dr,ds);
+
+  items = (CLUST_SWEEP_ITEM *) calloc(wh*depth, sizeof(CLUST_SWEEP_ITEM));
+  if (items == NULL)
+  {
+    printf("ERROR: clustThresholdSweep: could not alloc %d items\n",wh*depth);
+    return(1);
+  }
+  nitems = 0;
+  for (slc = 0; slc < depth; slc++)
+  {
+    for (row = 0; row < height; row++)
+    {
+      for (col = 0; col < width; col++)
+      {
+        if (binmask != NULL &&
+            MRIgetVoxVal(binmask,col,row,slc,0) == 0) continue;
+        val = MRIgetVoxVal(vol,col,row,slc,frame);
+        if (thsign ==  0) val = fabs(val);
+        if (thsign == -1) val = -val;
+        items[nitems].key = val;
+        items[nitems].index = col + row*width + slc*wh;
+        nitems++;
+      }
+    }
+  }
+  qsort(items, nitems, sizeof(CLUST_SWEEP_ITEM), clustCompareSweepItem);
+
+  // Visit the thresholds from highest to lowest
+  order = (int *) calloc(nthresh, sizeof(int));
+  if (order == NULL)
+  {
+    printf("ERROR: clustThresholdSweep: could not alloc %d thresholds\n",nthresh);
+    free(items);
+    return(1);
+  }
+  for (n=0; n < nthresh; n++) order[n] = n;
+  for (n=0; n < nthresh; n++)
+  {
+    for (m=n+1; m < nthresh; m++)
+    {
+      if (thresh[order[m]] > thresh[order[n]])
+      {
+        tmp = order[n];
+        order[n] = order[m];
+        order[m] = tmp;
+      }
+    }
+  }
+
+  uf = clustUFalloc(wh*depth,1);
+  if (uf == NULL)
+  {
+    free(items);
+    free(order);
+    return(1);
+  }
+  pos = 0;
+  ncomp = 0;
+  maxcount = 0;
+  for (n=0; n < nthresh; n++)
+  {
+    t = (float) thresh[order[n]]; // same precision as clustValueInRange()
+    while (pos < nitems && items[pos].key >= t)
+    {
+      v = items[pos].index;
+      slc = v/wh;
+      row = (v - slc*wh)/width;
+      col = v - slc*wh - row*width;
+      clustUFadd(uf,v,1,MRIgetVoxVal(vol,col,row,slc,frame));
+      ncomp++;
+      for (k=0; k < nnbrs; k++)
+      {
+        c2 = col + dc[k];
+        r2 = row + dr[k];
+        s2 = slc + ds[k];
+        if (c2 < 0 || c2 >= width || r2 < 0 || r2 >= height ||
+            s2 < 0 || s2 >= depth) continue;
+        if (uf->parent[c2 + r2*width + s2*wh] < 0) continue;
+        ncomp -= clustUFunion(uf,v,c2 + r2*width + s2*wh);
+      }
+      root = clustUFfind(uf,v);
+      if (maxcount < uf->nmembers[root]) maxcount = uf->nmembers[root];
+      pos++;
+    }
+
+    // The weight of a merged cluster can be smaller in magnitude than
+    // one of its parts (abs), so check the current components
+    if (MaxWeight != NULL)
+    {
+      if (thsign == 0) maxw = 0;
+      else             maxw = -thsign*10e10;
+      nc = 0;
+      for (k=0; k < pos; k++)
+      {
+        v = items[k].index;
+        if (uf->parent[v] != v) continue;
+        w = uf->weight[v];
+        if (thsign ==  0 && fabs(maxw) < fabs(w)) maxw = w;
+        if (thsign == +1 && maxw < w)             maxw = w;
+        if (thsign == -1 && maxw > w)             maxw = w;
+        nc++;
+      }
+      if (nc == 0) maxw = 0;
+      MaxWeight[order[n]] = maxw;
+    }
+    if (nClusters != NULL) nClusters[order[n]] = ncomp;
+    if (MaxCount  != NULL) MaxCount[order[n]]  = maxcount;
+  }
+
+  clustUFfree(&uf);
+  free(items);
+  free(order);
+  return(0);
+}
+
+
 /*-------------------------------------------------------------------*/
 int clustMaxMember(VOLCLUSTER *vc, MRI *vol, int frame, int thsign)
 {
@@ -877,63 +1309,84 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
                               MRI *binmask, int *nClusters,
                               MATRIX *XFM)
 {
-  int nthhit,nclusters,nhits, *hitcol=NULL, *hitrow=NULL, *hitslc=NULL;
+  int n,nclusters,nvox,*label,*nmembers;
   int col,row,slc,allowdiag=0,nprunedclusters;
-  MRI *HitMap;
-  VOLCLUSTER **ClusterList, **ClusterList2;
+  VOLCLUSTER **ClusterList, **ClusterList2, *vc;
   float voxsizemm3, distthresh=0;
 
   voxsizemm3 = vol->xsize*vol->ysize*vol->zsize;
 
-  /* Initialize the hit map - this is a map of voxels that have been
-     accounted for as either outside of a the threshold range or
-     belonging to a cluster. The initialization is for thresholding */
-  HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign,
-                           &nhits, &hitcol, &hitrow, &hitslc, binmask,0);
-  if (HitMap == NULL)
+  /* Label the connected components of the voxels in the threshold
+     range. This replaces growing each cluster from a seed. */
+  nvox = vol->width*vol->height*vol->depth;
+  label = (int *) calloc(nvox, sizeof(int));
+  if (label == NULL)
   {
-    // Nothing survived the first thresholding
+    printf("ERROR: clustGetClusters: could not alloc label %d\n",nvox);
+    *nClusters = 0;
+    return(NULL);
+  }
+  nclusters = clustLabelComponents(vol, frame, threshmin, threshmax, threshsign,
+                                   binmask, allowdiag, label);
+  if (nclusters < 0)
+  {
+    free(label);
     *nClusters = 0;
     return(NULL);
   }
-  if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n",nhits);
 
-  /* Allocate an array of clusters equal to the number of hits -- this
-     is the maximum number of clusters possible */
-  ClusterList = clustAllocClusterList(nhits);
+  ClusterList = clustAllocClusterList(nclusters);
   if (ClusterList == NULL)
   {
-    printf("ERROR: could not alloc %d clusters\n",nhits);
+    printf("ERROR: could not alloc %d clusters\n",nclusters);
+    free(label);
     return(NULL);
   }
 
-  nclusters = 0;
-  for (nthhit = 0; nthhit < nhits; nthhit ++)
+  /* Count the members of each cluster so each can be allocated once */
+  nmembers = (int *) calloc(nclusters+1, sizeof(int));
+  if (nmembers == NULL)
   {
+    printf("ERROR: clustGetClusters: could not alloc %d counts\n",nclusters+1);
+    clustFreeClusterList(&ClusterList,nclusters);
+    free(label);
+    *nClusters = 0;
+    return(NULL);
+  }
+  for (n=0; n < nvox; n++) nmembers[label[n]]++;
+  for (n=0; n < nclusters; n++)
+  {
+    ClusterList[n] = clustAllocCluster(nmembers[n+1]);
+    ClusterList[n]->nmembers = 0;
+    ClusterList[n]->voxsize = voxsizemm3;
+  }
 
-    /* Determine whether this hit is still valid. It may
-       not be if it was assigned to the cluster of a
-       previous hit */
-    col = hitcol[nthhit];
-    row = hitrow[nthhit];
-    slc = hitslc[nthhit];
-    if (MRIgetVoxVal(HitMap,col,row,slc,0)) continue;
-
-    /* Grow cluster using this hit as a seed */
-    ClusterList[nclusters] = clustGrow(col,row,slc,HitMap,allowdiag);
-    ClusterList[nclusters]->voxsize = voxsizemm3;
+  /* Fill the members in hit order (col, row, slc) */
+  for (col = 0; col < vol->width; col++)
+  {
+    for (row = 0; row < vol->height; row++)
+    {
+      for (slc = 0; slc < vol->depth; slc++)
+      {
+        n = label[col + row*vol->width + slc*vol->width*vol->height];
+        if (n == 0) continue;
+        vc = ClusterList[n-1];
+        vc->col[vc->nmembers] = col;
+        vc->row[vc->nmembers] = row;
+        vc->slc[vc->nmembers] = slc;
+        vc->nmembers++;
+      }
+    }
+  }
+  free(nmembers);
+  free(label);
 
+  for (n=0; n < nclusters; n++)
+  {
     /* Determine the member with the maximum value */
-    clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
-
-    if (XFM) clustComputeTal(ClusterList[nclusters],XFM);
-
-    /* increment the number of clusters */
-    nclusters ++;
+    clustMaxMember(ClusterList[n], vol, frame, threshsign);
+    if (XFM) clustComputeTal(ClusterList[n],XFM);
   }
-  free(hitcol);
-  free(hitrow);
-  free(hitslc);
 
   if (Gdiag_no > 0)
     printf("INFO: Found %d clusters that meet threshold criteria\n",
@@ -966,8 +1419,6 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
   clustFreeClusterList(&ClusterList,nclusters);
   ClusterList = ClusterList2;
 
-  MRIfree(&HitMap);
-
   if (Gdiag_no > 0) printf("INFO: Found %d final clusters\n",nclusters);
   *nClusters = nclusters;
   return(ClusterList);